@@ -0,0 +1,28 @@
+﻿#pragma once
+
+#include "bytecode.h"
+
+// 1つの式を、変数の値を列として並べた大量の行に対して評価する。
+// 行をLANE_COUNTずつまとめて命令ごとに処理し、AVX2、SSE2が使える場合はベクトル化する。
+// 行が多い場合は複数のスレッドに分配する
+namespace BatchEval
+{
+
+// 1度に評価する行数
+constexpr u32 LANE_COUNT = 256;
+
+// これより行が少ない場合は呼び出したスレッドだけで評価する
+constexpr size_t PARALLEL_ROW_COUNT = 16384;
+
+// columnsにはProgram::variablesの順に、rowCount個の値を並べた列をcolumnCount個渡す。
+// rtResultsには結果を、rtErrorsには0除算が起きた行に1、それ以外の行に0を書き込む。0除算が起きた行の結果は0になる。
+// threadCountが0の場合はハードウェアのスレッド数を使用する。
+// 命令列が空の場合、columnCountがProgram::variablesの数より少ない場合はfalseを返す。
+// isOptimizingがtrueの場合は評価の前に1度だけOptimizer::Optimizeで最適化する。結果のビット列は変わらない
+bool Run
+(
+    const Program& program, const double* const* columns, size_t columnCount, size_t rowCount,
+    double* rtResults, u8* rtErrors, u32 threadCount = 0, bool isOptimizing = true
+);
+
+}
@@ -0,0 +1,41 @@
+﻿#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "big_int.h"
+
+// mantissa * 10^-scale で表す多倍長の10進数。加算、減算、乗算は誤差なく計算する
+class BigDecimal
+{
+private:
+    BigInt mantissa_;
+    u32 scale_ = 0; // 小数点以下の桁数
+
+public:
+    // 指数で指定できる桁数の上限
+    static constexpr s64 MAX_EXPONENT = 10000000;
+
+    BigDecimal() = default;
+    BigDecimal(BigInt mantissa, u32 scale) : mantissa_(std::move(mantissa)), scale_(scale) {}
+    ~BigDecimal() = default;
+
+    // 123、-0.5、1.5e3のような数値の文字列を読み込む。読み込めない場合はfalseを返す
+    static bool FromString(std::string_view text, BigDecimal& rtValue);
+
+    // 10進数の文字列に変換する。小数点以下の末尾の0は出力しない
+    std::string toString() const;
+
+    const BigInt& getMantissa() const { return mantissa_; }
+    u32 getScale() const { return scale_; }
+    bool isZero() const { return mantissa_.isZero(); }
+
+    void negate() { mantissa_.negate(); }
+
+    static BigDecimal Add(const BigDecimal& a, const BigDecimal& b);
+    static BigDecimal Subtract(const BigDecimal& a, const BigDecimal& b);
+    static BigDecimal Multiply(const BigDecimal& a, const BigDecimal& b);
+
+    // a / b を小数点以下scale桁に0方向へ切り捨てる。bが0の場合はfalseを返す
+    static bool Divide(const BigDecimal& a, const BigDecimal& b, u32 scale, BigDecimal& rtResult);
+};
@@ -0,0 +1,121 @@
+﻿#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+// 乗算の方法。automaticの場合は桁数によって選ぶ
+enum class MulAlgorithm : u8
+{
+    automatic = 0,
+    schoolbook,
+    karatsuba,
+    toom3,
+};
+
+// 除算の方法。automaticの場合は除数の桁数によって選ぶ
+enum class DivAlgorithm : u8
+{
+    automatic = 0,
+    schoolbook, // Knuthのアルゴリズム D
+    newton, // ニュートン法で求めた逆数を掛ける
+};
+
+// 64ビットのリムを下位から並べた、符号と絶対値で表す多倍長整数。
+// INLINE_LIMB_COUNT個以下のリムはインスタンスの中に置き、ヒープを確保しない
+class BigInt
+{
+private:
+    static constexpr u32 INLINE_LIMB_COUNT = 2;
+
+    u64 inline_[INLINE_LIMB_COUNT] = {};
+    std::unique_ptr<u64[]> heap_;
+    u32 size_ = 0; // 使用しているリムの数。0の場合は値が0
+    u32 capacity_ = INLINE_LIMB_COUNT;
+    bool negative_ = false;
+
+    u64* data() { return heap_ ? heap_.get() : inline_; }
+    void reserve(u32 capacity);
+    void resize(u32 size);
+    void trim();
+
+    // a + b。bNegativeはbの符号として使用する
+    static BigInt AddSigned(const BigInt& a, const BigInt& b, bool bNegative);
+
+public:
+    // この数以上のリムを持つ数の乗算にKaratsuba法を使用する
+    static constexpr u32 KARATSUBA_THRESHOLD = 32;
+
+    // この数以上のリムを持つ数の乗算にToom-3法を使用する
+    static constexpr u32 TOOM3_THRESHOLD = 160;
+
+    // この数以上のリムを持つ数による除算にニュートン法を使用する
+    static constexpr u32 NEWTON_THRESHOLD = 4096;
+
+    BigInt() = default;
+    BigInt(s64 value);
+    ~BigInt() = default;
+
+    BigInt(const BigInt& other);
+    BigInt(BigInt&& other) noexcept;
+    BigInt& operator=(const BigInt& other);
+    BigInt& operator=(BigInt&& other) noexcept;
+
+    // 下位からcount個のリムを絶対値とする正の数を作る
+    static BigInt FromLimbs(const u64* limbs, size_t count);
+
+    // 10進数の文字列を読み込む。先頭の-と+のみ受け付け、数字以外を含む場合はfalseを返す
+    static bool FromString(std::string_view text, BigInt& rtValue);
+
+    // 10^exponent
+    static BigInt Pow10(u64 exponent);
+
+    // 10進数の文字列に変換する
+    std::string toString() const;
+
+    bool isZero() const { return size_ == 0; }
+    bool isNegative() const { return negative_; }
+
+    // ヒープを確保せずにインスタンスの中に値を置いている場合はtrue
+    bool isInline() const { return heap_ == nullptr; }
+
+    u32 getLimbCount() const { return size_; }
+    const u64* getLimbs() const { return heap_ ? heap_.get() : inline_; }
+
+    // 絶対値のビット数
+    u64 getBitLength() const;
+
+    void negate() { if (size_ != 0) negative_ = !negative_; }
+
+    // 絶対値を比較する
+    static int CompareMagnitude(const BigInt& a, const BigInt& b);
+    static int Compare(const BigInt& a, const BigInt& b);
+
+    static BigInt Add(const BigInt& a, const BigInt& b);
+    static BigInt Subtract(const BigInt& a, const BigInt& b);
+    static BigInt Multiply(const BigInt& a, const BigInt& b, MulAlgorithm algorithm = MulAlgorithm::automatic);
+
+    // 0方向に切り捨てた商と、被除数と同じ符号の余りを求める。除数が0の場合はfalseを返す
+    static bool DivMod
+    (
+        const BigInt& a, const BigInt& b, BigInt& rtQuotient, BigInt& rtRemainder,
+        DivAlgorithm algorithm = DivAlgorithm::automatic
+    );
+
+    // 絶対値をbitsビット移動する。右への移動は絶対値を切り捨てる
+    BigInt shiftLeft(u64 bits) const;
+    BigInt shiftRight(u64 bits) const;
+
+    // 絶対値に小さい数を掛けて足す
+    void mulAddSmall(u64 multiplier, u64 addend);
+
+    // 絶対値を小さい数で割り、余りを返す
+    u64 divSmall(u64 divisor);
+};
+
+inline BigInt operator+(const BigInt& a, const BigInt& b) { return BigInt::Add(a, b); }
+inline BigInt operator-(const BigInt& a, const BigInt& b) { return BigInt::Subtract(a, b); }
+inline BigInt operator*(const BigInt& a, const BigInt& b) { return BigInt::Multiply(a, b); }
+inline bool operator==(const BigInt& a, const BigInt& b) { return BigInt::Compare(a, b) == 0; }
+inline bool operator!=(const BigInt& a, const BigInt& b) { return BigInt::Compare(a, b) != 0; }
+inline bool operator<(const BigInt& a, const BigInt& b) { return BigInt::Compare(a, b) < 0; }
@@ -0,0 +1,72 @@
+﻿#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+
+class Command;
+struct CmdToken;
+enum class CmdType : u8;
+
+enum class OpCode : u8
+{
+    push = 0,
+    load, // 変数の値を積む
+    add,
+    subtract,
+    multiply,
+    divide,
+    store, // 先頭の値を取り出さずに一時領域に書き込む
+    fetch, // 一時領域の値を積む
+};
+
+// 1つの命令。pushの場合は数値を命令に直接持ち、load、store、fetchの場合は変数または一時領域の番号を持つ
+struct Instruction
+{
+    OpCode op = OpCode::push;
+    u32 index = 0;
+    double num = 0.0;
+};
+
+// 逆ポーランド記法の順に命令を並べたもの
+struct Program
+{
+    std::vector<Instruction> code;
+    u32 stackSize = 0; // 評価に必要なスタックの深さ
+    u32 tempCount = 0; // 評価に必要な一時領域の数。共通の部分式を1度だけ計算するために使用する
+    std::vector<std::string> variables; // 変数の名前。式に初めて現れた順に番号を振る
+};
+
+// コマンド列を命令列に変換し、固定長のスタックで評価する。
+// 評価中はヒープを確保せず、仮想関数も呼ばない
+namespace Bytecode
+{
+
+constexpr u32 MAX_STACK_SIZE = 256;
+constexpr u32 MAX_TEMP_COUNT = 256;
+
+// 中置記法のコマンド列を命令列に変換する。rtProgramの領域は再利用する。
+// 式として正しくない場合、括弧が閉じられていない場合、スタックが足りない場合はfalseを返す
+bool Compile(const std::vector<std::unique_ptr<Command>>& cmds, Program& rtProgram);
+
+// CmdTokenの列を命令列に変換する。namesは変数の名前の表
+bool Compile(const std::vector<CmdToken>& tokens, const std::vector<std::string>& names, Program& rtProgram);
+
+// 演算子のコマンドの種類を命令に変換する
+OpCode ToOpCode(CmdType type);
+
+// 変数の番号を返す。式に含まれない場合は-1を返す
+s32 FindVariable(const Program& program, std::string_view name);
+
+// 命令列のハッシュ。数値はビット列で比較する
+u64 Hash(const Program& program);
+
+// 2つの命令列が同じ式か。数値はビット列で比較する
+bool IsSame(const Program& a, const Program& b);
+
+// 命令列を評価する。variablesには変数の値を番号の順に渡す。0除算の場合はfalseを返す
+std::pair<double, bool> Run(const Program& program, const double* variables = nullptr);
+
+}
@@ -4,9 +4,16 @@
 #include <vector>
 #include <string>
 #include <queue>
+#include <string_view>
+
+#include "bytecode.h"
+#include "cmd_token.h"
+#include "edit_history.h"
+#include "live_eval.h"
 
 class Command;
 class NumberCmd;
+class EvalCache;
 class Calculator;
 
 namespace RPN
@@ -26,41 +33,74 @@ std::unique_ptr<Command> CalcFromRPN
 
 }
 
+// 対話用の入力、履歴、表示を扱う。評価はEngineで行い、このクラスは状態を持つ表側だけを担う
 class Calculator
 {
 private:
-    std::vector<std::unique_ptr<Command>> history_;
-    std::vector<std::unique_ptr<Command>>::iterator historyIt_ = history_.end();
     double idleNum_ = 0.0;
+    EditHistory history_; // 全ての編集の木。cmds_は現在の位置の編集後のトークン列と同じ
 
-    std::vector<std::unique_ptr<Command>> cmds_;
+    std::vector<CmdToken> cmds_;
+    std::vector<std::string> names_; // 変数の名前の表。CmdToken::nameIndexで参照する
     std::string cmdsOutput_;
 
-    int inParenDepth = 0;
     bool error_ = false;
 
+    LiveEvaluator live_; // cmds_と同じトークンを持ち、途中までの式の値を求める
+    std::shared_ptr<EvalCache> cache_; // 設定されている場合は計算結果を共有する
+
+    u32 findName(std::string_view name);
+    CmdToken toToken(const Command& cmd);
+    AppendAction appendToCmds(const CmdToken& token);
+    void rebuildCmds(); // 現在の位置の履歴からcmds_とlive_を作り直す
+
 public:
-    Calculator();
+    // maxEditCountは残す編集の数。これより古い編集は取り消せなくなる
+    Calculator(u32 maxEditCount = EditHistory::DEFAULT_MAX_EDIT_COUNT);
     ~Calculator() = default;
 
+    // Commandをトークンに変換して追加する
     void appendCmd(std::unique_ptr<Command>& cmd);
 
+    // トークンを追加する。コマンドを複製せず、ヒープも確保しない
+    void appendToken(const CmdToken& token);
+
+    // 変数の名前を表に登録し、それを参照するトークンを返す
+    CmdToken toVariableToken(std::string_view name);
+
+    const std::vector<CmdToken>& getCmds() const { return cmds_; }
+    const std::vector<std::string>& getNames() const { return names_; }
+    const EditHistory& getHistory() const { return history_; }
+
+    // 計算結果を保持するキャッシュを設定する。複数のCalculatorで共有できる。nullptrの場合は毎回計算する
+    void setCache(std::shared_ptr<EvalCache> cache) { cache_ = std::move(cache); }
+
+    // 入力中の式を最後の数値まで計算した値。変数を含む場合はNaN、0除算の場合はfalseを返す
+    std::pair<double, bool> getPreview() const { return live_.preview(); }
+
     bool getError();
     void setError(const std::string& msg);
     void show();
 
     bool appendNumberCmd(std::vector<std::unique_ptr<Command>>& dst, std::unique_ptr<Command> src);
 
-    std::pair<double, bool> add(double leftNum, double rightNum);
-    std::pair<double, bool> subtract(double leftNum, double rightNum);
-    std::pair<double, bool> multiply(double leftNum, double rightNum);
-    std::pair<double, bool> divide(double leftNum, double rightNum);
+    // Engine::Applyで計算する。状態を変更しないため、1つのCalculatorを複数のスレッドで共有できる
+    std::pair<double, bool> add(double leftNum, double rightNum) const;
+    std::pair<double, bool> subtract(double leftNum, double rightNum) const;
+    std::pair<double, bool> multiply(double leftNum, double rightNum) const;
+    std::pair<double, bool> divide(double leftNum, double rightNum) const;
     bool appendOpeCmd(std::vector<std::unique_ptr<Command>>& dst, std::unique_ptr<Command> src);
 
     bool appendLeftParenCmd(std::vector<std::unique_ptr<Command>>& dst, std::unique_ptr<Command> src);
     bool appendRightParenCmd(std::vector<std::unique_ptr<Command>>& dst, std::unique_ptr<Command> src);
 
+    // 式を計算し、結果の数値に置き換える。置き換えも履歴に残るため、取り消すと式に戻る
     void execute();
+
+    // 取り消しとやり直しは定数時間で行う。計算の取り消しは式の長さに比例する時間がかかる
     void undo();
     void redo();
-};
\ No newline at end of file
+
+    // 履歴の任意の位置に戻る。取り消した後に別の編集をした場合も、元の枝の位置に戻れる
+    bool restore(u32 historyId);
+};
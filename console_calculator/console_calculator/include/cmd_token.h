@@ -0,0 +1,61 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+
+// コマンドの種類。dynamic_castを使わずにバイトコードへ変換するために使用する
+enum class CmdType : u8
+{
+    number = 0,
+    add,
+    subtract,
+    multiply,
+    divide,
+    leftParen,
+    rightParen,
+    variable,
+};
+
+// コマンドを値として連続した領域に並べるための16バイトのトークン。
+// 変数の名前は別の表に置き、その番号を持つ
+struct CmdToken
+{
+    CmdType type = CmdType::number;
+    u32 nameIndex = 0; // 変数の場合の名前の番号
+    double num = 0.0; // 数値の場合の値
+};
+
+static_assert(sizeof(CmdToken) == 16, "CmdToken must be 16 bytes");
+
+// トークンを追加した時の扱い
+enum class AppendAction : u8
+{
+    reject = 0, // 追加できない
+    append, // 末尾に追加する
+    replace, // 初期値の数値を置き換える
+};
+
+// 仮想関数を使わずに、種類ごとの表とswitchでトークンを扱う
+namespace CmdTokens
+{
+
+// Command::priority()と同じ値を返す。演算子以外は0を返す
+int GetPriority(CmdType type);
+
+// 数値または変数
+inline bool IsOperand(CmdType type)
+{
+    return type == CmdType::number || type == CmdType::variable;
+}
+
+// size個のトークンが並び、末尾がlastTypeの列にtypeを追加した時の扱い。
+// 初期値の数値だけの場合は、数値、変数、左括弧で置き換える
+AppendAction CheckAppend(size_t size, CmdType firstType, CmdType lastType, CmdType type);
+
+// CheckAppendに従ってdstに追加する。追加した場合はtrueを返す
+bool Append(std::vector<CmdToken>& dst, const CmdToken& token);
+
+// Command::toString()と同じ文字列を返す。namesは変数の名前の表
+std::string ToString(const CmdToken& token, const std::vector<std::string>& names);
+
+}
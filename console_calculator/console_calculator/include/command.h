@@ -3,6 +3,8 @@
 #include <memory>
 #include <utility>
 
+#include "cmd_token.h"
+
 class Calculator;
 
 class Command
@@ -13,6 +15,7 @@ public:
     virtual std::string toString() const = 0;
     virtual std::unique_ptr<Command> clone() = 0;
     virtual int priority() const { return 0; }
+    virtual CmdType type() const = 0;
     virtual bool append(Calculator* calculator, std::vector<std::unique_ptr<Command>>& dst) = 0;
 };
 
@@ -30,6 +33,7 @@ public:
     std::string toString() const override { return std::to_string(num_); }
     std::unique_ptr<Command> clone() override { return std::make_unique<NumberCmd>(*this); }
     int priority() const override { return 0; }
+    CmdType type() const override { return CmdType::number; }
 
     virtual bool append(Calculator* calculator, std::vector<std::unique_ptr<Command>>& dst) override;
 
@@ -37,6 +41,29 @@ public:
     double getNum() const { return num_; }
 };
 
+// 名前で値を参照する変数。値は評価する時に列として渡す
+class VariableCmd : public Command
+{
+private:
+    std::string name_;
+
+public:
+    VariableCmd() = default;
+    ~VariableCmd() override = default;
+
+    std::pair<double, bool> execute(Calculator* calculator, double leftNum, double rightNum) override;
+
+    std::string toString() const override { return name_; }
+    std::unique_ptr<Command> clone() override { return std::make_unique<VariableCmd>(*this); }
+    int priority() const override { return 0; }
+    CmdType type() const override { return CmdType::variable; }
+
+    virtual bool append(Calculator* calculator, std::vector<std::unique_ptr<Command>>& dst) override;
+
+    void setName(const std::string& name) { name_ = name; }
+    const std::string& getName() const { return name_; }
+};
+
 class AddCmd : public Command
 {
 public:
@@ -48,6 +75,7 @@ public:
     std::string toString() const override { return "+"; }
     std::unique_ptr<Command> clone() override { return std::make_unique<AddCmd>(*this); }
     int priority() const override { return 1; }
+    CmdType type() const override { return CmdType::add; }
 
     virtual bool append(Calculator* calculator, std::vector<std::unique_ptr<Command>>& dst) override;
 };
@@ -63,6 +91,7 @@ public:
     std::string toString() const override { return "-"; }
     std::unique_ptr<Command> clone() override { return std::make_unique<SubtractCmd>(*this); }
     int priority() const override { return 1; }
+    CmdType type() const override { return CmdType::subtract; }
 
     virtual bool append(Calculator* calculator, std::vector<std::unique_ptr<Command>>& dst) override;
 };
@@ -78,6 +107,7 @@ public:
     std::string toString() const override { return "*"; }
     std::unique_ptr<Command> clone() override { return std::make_unique<MultiplyCmd>(*this); }
     int priority() const override { return 2; }
+    CmdType type() const override { return CmdType::multiply; }
 
     virtual bool append(Calculator* calculator, std::vector<std::unique_ptr<Command>>& dst) override;
 };
@@ -93,6 +123,7 @@ public:
     std::string toString() const override { return "/"; }
     std::unique_ptr<Command> clone() override { return std::make_unique<DivideCmd>(*this); }
     int priority() const override { return 2; }
+    CmdType type() const override { return CmdType::divide; }
 
     virtual bool append(Calculator* calculator, std::vector<std::unique_ptr<Command>>& dst) override;
 };
@@ -108,6 +139,7 @@ public:
     std::string toString() const override { return "("; }
     std::unique_ptr<Command> clone() override { return std::make_unique<LeftParenCmd>(*this); }
     int priority() const override { return 0; }
+    CmdType type() const override { return CmdType::leftParen; }
 
     virtual bool append(Calculator* calculator, std::vector<std::unique_ptr<Command>>& dst) override;
 };
@@ -123,6 +155,7 @@ public:
     std::string toString() const override { return ")"; }
     std::unique_ptr<Command> clone() override { return std::make_unique<RightParenCmd>(*this); }
     int priority() const override { return 0; }
+    CmdType type() const override { return CmdType::rightParen; }
     
     virtual bool append(Calculator* calculator, std::vector<std::unique_ptr<Command>>& dst) override;
 };
\ No newline at end of file
@@ -0,0 +1,68 @@
+﻿#pragma once
+
+#include <vector>
+
+#include "cmd_token.h"
+
+// 編集の種類
+enum class EditType : u8
+{
+    initial = 0, // 履歴の最初の状態
+    append, // トークンを末尾に追加した
+    replace, // 末尾のトークンを置き換えた
+    execute, // 式を計算結果の数値に置き換えた
+};
+
+// 1回の編集。編集後のトークン列の末尾のトークンと、その1つ前のトークンを持つ編集を指すことで、
+// トークン列を複製せずに前の状態と共有する
+struct HistoryEdit
+{
+    CmdToken token;
+    u32 parent; // 取り消した時に戻る編集
+    u32 previous; // 編集後のトークン列で1つ前のトークンを持つ編集
+    u32 redo; // やり直した時に進む編集。最後に追加、または通った子を指す
+    EditType type;
+};
+
+// 追加だけを行う編集の木。取り消しとやり直しは親子の間を移動するだけで、
+// 取り消した後に別の編集をしても元の枝は残り、restoreで戻れる。
+// 編集の数がmaxEditCountの2倍を超えると、新しいmaxEditCount個の編集と、それらが参照するトークンだけを残す
+class EditHistory
+{
+private:
+    std::vector<HistoryEdit> edits_;
+    u32 current_ = 0;
+    u32 maxEditCount_;
+
+    void compact();
+
+public:
+    static constexpr u32 NO_EDIT = 0xffffffff;
+    static constexpr u32 DEFAULT_MAX_EDIT_COUNT = 1 << 16;
+
+    EditHistory(const CmdToken& initialToken, u32 maxEditCount = DEFAULT_MAX_EDIT_COUNT);
+    ~EditHistory() = default;
+
+    // 現在の状態に編集を追加し、追加した編集を現在の位置にする
+    void push(EditType type, const CmdToken& token);
+
+    // 親の編集に戻る。戻れない場合はfalseを返す
+    bool undo();
+
+    // 最後に通った子の編集に進む。進めない場合はfalseを返す
+    bool redo();
+
+    // 任意の編集に移動する。存在しない番号の場合はfalseを返す
+    bool restore(u32 id);
+
+    // idの編集の後のトークン列をrtTokensに設定する
+    void getTokens(u32 id, std::vector<CmdToken>& rtTokens) const;
+
+    // 現在の位置の番号。古い編集を削除すると番号は変わる
+    u32 getCurrentId() const { return current_; }
+    const HistoryEdit& getCurrent() const { return edits_[current_]; }
+    const HistoryEdit& get(u32 id) const { return edits_[id]; }
+
+    size_t size() const { return edits_.size(); }
+    u32 getMaxEditCount() const { return maxEditCount_; }
+};
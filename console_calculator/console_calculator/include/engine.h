@@ -0,0 +1,59 @@
+﻿#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "big_decimal.h"
+#include "bytecode.h"
+#include "cmd_token.h"
+
+class EvalCache;
+
+// 評価の結果
+enum class EvalStatus : u8
+{
+    success = 0,
+    syntaxError, // 式として正しくない
+    unmatchedParen, // 括弧が閉じられていない、または対応する左括弧がない
+    divisionByZero,
+    unboundVariable, // 変数の値が渡されていない
+};
+
+// 状態を持たない評価の処理。結果は引数に返し、成否は戻り値の状態で返す。
+// 作業用の命令列はスレッドごとに持つため、複数のスレッドから同時に呼び出せる
+namespace Engine
+{
+
+// 状態に対応するエラーメッセージ。successの場合は空の文字列を返す
+const char* ToMessage(EvalStatus status);
+
+// 1つの演算子を計算する
+EvalStatus Apply(CmdType type, double leftNum, double rightNum, double& rtResult);
+
+// 命令列を評価する。variablesには変数の値を番号の順に渡す。変数を含まない場合はnullptrでよい
+EvalStatus Run(const Program& program, const double* variables, double& rtResult);
+
+// CmdTokenの列を評価する。namesは変数の名前の表
+EvalStatus Evaluate
+(
+    const std::vector<CmdToken>& tokens, const std::vector<std::string>& names,
+    const double* variables, double& rtResult
+);
+
+// 式の文字列を評価する。構文エラーの場合はrtErrorPosに解析できなかった位置を設定する
+EvalStatus Evaluate(std::string_view text, const double* variables, double& rtResult, size_t& rtErrorPos);
+
+// 変数を含まない式を評価する。同じ命令列になる式の結果がcacheにある場合は計算せずにそれを返す。
+// 文字列の場合は、同じ文字列の結果があれば解析も省略する
+EvalStatus Evaluate
+(
+    const std::vector<CmdToken>& tokens, const std::vector<std::string>& names, EvalCache& cache, double& rtResult
+);
+EvalStatus Evaluate(std::string_view text, EvalCache& cache, double& rtResult, size_t& rtErrorPos);
+
+// 式の文字列を多倍長の10進数で誤差なく評価する。除算は小数点以下divisionScale桁に0方向へ切り捨てる。
+// 変数を含む場合はunboundVariableを返す
+EvalStatus EvaluateExact(std::string_view text, u32 divisionScale, BigDecimal& rtResult, size_t& rtErrorPos);
+
+}
@@ -0,0 +1,86 @@
+﻿#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "bytecode.h"
+#include "engine.h"
+
+// 変数を含まない式の評価結果を保持するLRUキャッシュ。
+// 式は逆ポーランド記法の命令列を正規形とし、数値はビット列で比較する。そのため括弧の付け方が違っても同じ式として扱う。
+// 同じ文字列の式は解析も省略できるよう、文字列をキーとした結果も別の表に保持する。
+// キーのハッシュで分けたSHARD_COUNT個の区画ごとにロックを持ち、複数のスレッドから同時に呼び出せる
+class EvalCache
+{
+private:
+    struct Entry
+    {
+        u64 hash;
+        std::string key; // 命令列を並べたバイト列、または式の文字列
+        EvalStatus status;
+        double result;
+    };
+
+    // 区画ごとのLRUリスト。先頭が最後に使用した結果
+    struct alignas(64) Shard
+    {
+        std::mutex mutex;
+        std::list<Entry> entries;
+        std::unordered_map<u64, std::list<Entry>::iterator> index;
+        u64 hitCount = 0;
+        u64 missCount = 0;
+    };
+
+    // キーの種類ごとの表
+    struct Table
+    {
+        std::unique_ptr<Shard[]> shards;
+
+        Shard& getShard(u64 hash) { return shards[hash >> (64 - SHARD_BITS)]; }
+        bool find(u64 hash, std::string_view key, EvalStatus& rtStatus, double& rtResult);
+        void insert(u64 hash, std::string_view key, EvalStatus status, double result, size_t capacity);
+        void clear();
+    };
+
+    Table programs_;
+    Table texts_;
+    size_t shardCapacity_;
+
+public:
+    static constexpr u32 SHARD_BITS = 4;
+    static constexpr u32 SHARD_COUNT = 1 << SHARD_BITS;
+    static constexpr size_t DEFAULT_CAPACITY = 1 << 16;
+
+    // capacityは表ごとに保持する結果の数の上限。区画ごとに均等に分ける
+    EvalCache(size_t capacity = DEFAULT_CAPACITY);
+    ~EvalCache() = default;
+
+    // 命令列の結果を探す。見つかった場合はtrueを返す
+    bool find(const Program& program, EvalStatus& rtStatus, double& rtResult);
+
+    // 命令列の結果を追加する。上限を超えた区画は最も長く使用していない結果を削除する
+    void insert(const Program& program, EvalStatus status, double result);
+
+    // 文字列の式の結果を探す、または追加する。結果は文字列を解析した命令列の結果と同じものを渡す
+    bool findText(std::string_view text, EvalStatus& rtStatus, double& rtResult);
+    void insertText(std::string_view text, EvalStatus status, double result);
+
+    // 保持している結果を返し、ない場合は評価して追加する。変数を含む命令列は保持しない
+    EvalStatus evaluate(const Program& program, double& rtResult);
+
+    // 文字列または命令列で結果が見つかった回数と、評価が必要だった回数
+    u64 getHitCount();
+    u64 getMissCount();
+
+    // 探した回数のうち評価せずに済んだ割合。探していない場合は0を返す
+    double getHitRate();
+
+    // 命令列の表に保持している結果の数
+    size_t size();
+    size_t getCapacity() const { return shardCapacity_ * SHARD_COUNT; }
+    void clear();
+};
@@ -0,0 +1,84 @@
+﻿#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "bytecode.h"
+
+// x86-64のLinuxでは命令列をSSE2の機械語に変換し、実行可能なページに置いて直接呼び出す。
+// スタックの各段と一時領域をxmm0からxmm14に割り当てるため、それより多く使用する式やその他の環境ではBytecode::Runで評価する
+class JitFunction
+{
+private:
+    using NativeFunc = int (*)(const double* variables, double* rtResult);
+
+    Program program_; // 評価できない場合の代わりと、キャッシュでの比較に使用する
+    void* code_ = nullptr;
+    size_t codeSize_ = 0;
+    NativeFunc func_ = nullptr;
+
+    void compile();
+
+public:
+    // 最も多く使用できるスタックの深さ。xmm15は0除算の判定に使用する
+    static constexpr u32 MAX_REGISTER_COUNT = 15;
+
+    JitFunction(const Program& program);
+    ~JitFunction();
+
+    JitFunction(const JitFunction&) = delete;
+    JitFunction& operator=(const JitFunction&) = delete;
+
+    // 機械語に変換できた場合はtrue
+    bool isNative() const { return func_ != nullptr; }
+
+    const Program& getProgram() const { return program_; }
+
+    // Bytecode::Runと同じ結果を返す。0除算の場合はfalseを返す
+    std::pair<double, bool> run(const double* variables = nullptr) const
+    {
+        if (func_ == nullptr) return Bytecode::Run(program_, variables);
+
+        double result = 0.0;
+        if (func_(variables, &result) == 0) return std::make_pair(0.0, false);
+        return std::make_pair(result, true);
+    }
+};
+
+// 変換した関数を命令列のハッシュで保持する。複数のスレッドから呼び出せる。
+// 関数ごとに実行可能なページを確保するため、上限を超えた場合は最も長く使用していない関数を削除する。
+// 削除した関数も、取得した側が保持している間は使用できる
+class JitCache
+{
+private:
+    struct Entry
+    {
+        u64 hash;
+        std::shared_ptr<const JitFunction> function;
+    };
+
+    std::mutex mutex_;
+    std::list<Entry> entries_; // 先頭が最後に使用した関数
+    std::unordered_map<u64, std::vector<std::list<Entry>::iterator>> index_;
+    size_t capacity_;
+
+    // 見つかった場合は先頭に移して返す
+    std::shared_ptr<const JitFunction> find(u64 hash, const Program& program);
+
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 4096;
+
+    // capacityは保持する関数の数の上限
+    JitCache(size_t capacity = DEFAULT_CAPACITY);
+    ~JitCache() = default;
+
+    // 同じ命令列を変換済みの場合はそれを返し、それ以外は変換して追加する
+    std::shared_ptr<const JitFunction> get(const Program& program);
+
+    size_t size();
+    size_t getCapacity() const { return capacity_; }
+    void clear();
+};
@@ -0,0 +1,63 @@
+﻿#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "cmd_token.h"
+
+// トークンを1つずつ追加しながら、途中までの式の値を求める操車場アルゴリズム。
+// 演算子は優先順位の高いものから追加するたびに計算するため、括弧の各段に残る演算子は2つまでになる。
+// そのため追加と取り消しは式の長さによらず定数時間で、途中の値は括弧の深さに比例する時間で求まる
+class LiveEvaluator
+{
+private:
+    // 計算途中の値。0除算を含む場合はvalidがfalse
+    struct Operand
+    {
+        double num = 0.0;
+        bool valid = true;
+    };
+
+    // トークンを追加する前の状態。追加中に取り出した要素を退避した位置と、スタックが最も低くなった位置を持つ
+    struct Checkpoint
+    {
+        u32 operandLow;
+        u32 opeLow;
+        u32 savedOperandBegin;
+        u32 savedOpeBegin;
+        bool expectOperand;
+    };
+
+    std::vector<Operand> operands_;
+    std::vector<CmdType> opes_; // 演算子と左括弧
+    bool expectOperand_ = true; // 次に数値、変数、左括弧が続く場合はtrue
+
+    std::vector<Checkpoint> checkpoints_;
+    std::vector<Operand> savedOperands_;
+    std::vector<CmdType> savedOpes_;
+
+    void popOperand(Operand& rtOperand);
+    CmdType popOpe();
+    void reduce();
+
+public:
+    LiveEvaluator() = default;
+    ~LiveEvaluator() = default;
+
+    // 全てのトークンを取り除く
+    void clear();
+
+    // トークンを追加する。CmdTokens::CheckAppendで追加できると判定されたトークンのみ渡す。
+    // 変数の値は分からないため、変数を含む式の途中の値はNaNになる
+    void push(const CmdToken& token);
+
+    // 最後に追加したトークンを取り除き、追加する前の状態に戻す
+    void pop();
+
+    // 追加したトークンの数
+    size_t size() const { return checkpoints_.size(); }
+
+    // 最後の数値、変数、右括弧までの式を、開いている括弧を閉じて計算した値を返す。
+    // トークンがない場合は0を返す。0除算の場合はfalseを返す
+    std::pair<double, bool> preview() const;
+};
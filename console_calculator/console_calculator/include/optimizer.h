@@ -0,0 +1,21 @@
+﻿#pragma once
+
+#include "bytecode.h"
+
+// 最適化の前後のノード数。前は命令の数、後は共通の部分式をまとめたDAGのノードの数
+struct OptimizeResult
+{
+    u32 nodeCountBefore = 0;
+    u32 nodeCountAfter = 0;
+};
+
+// 命令列を式のDAGに変換して最適化し、命令列に戻す。
+// 定数の畳み込み、IEEEの結果が変わらない恒等式の簡約、ハッシュコンシングによる共通の部分式の削除を行う。
+// 0除算は評価の時にエラーとして返すため、0による除算は畳み込まない
+namespace Optimizer
+{
+
+// rtProgramを最適化した命令列に置き換える。正しくない命令列の場合はfalseを返し、rtProgramを変更しない
+bool Optimize(Program& rtProgram, OptimizeResult& rtResult);
+
+}
@@ -0,0 +1,62 @@
+﻿#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "bytecode.h"
+
+enum class TreeOp : u8
+{
+    number = 0,
+    variable,
+    add,
+    subtract,
+    multiply,
+    divide,
+    negate, // 符号を反転する。連鎖を組み替えた時だけ現れる
+};
+
+// 木の1つのノード。sizeは自身を含む部分木のノード数
+struct TreeNode
+{
+    TreeOp op = TreeOp::number;
+    u32 index = 0;
+    double num = 0.0;
+    u32 size = 1;
+};
+
+// 式の木。ノードを命令列と同じ帰りがけ順に並べるため、部分木は連続した範囲になる。
+// ノードiの右の子はi - 1、左の子はi - 1 - nodes[i - 1].size
+struct ExprTree
+{
+    std::vector<TreeNode> nodes;
+    u32 stackSize = 0; // 評価に必要なスタックの深さ
+    u32 variableCount = 0;
+};
+
+// 数百万項の式を木に変換し、大きな部分木を複数のスレッドでfork-joinして評価する。
+// 各スレッドは自身の両端キューに分岐した部分木を積み、空いたスレッドは他のスレッドのキューの古い側から奪う。
+// 各ノードの計算は木の形だけで決まるため、スレッド数やスケジュールによらず同じ結果になる
+namespace ParallelEval
+{
+
+// これよりノードの少ない部分木は分岐せずに1つのスレッドで評価する
+constexpr u32 DEFAULT_GRAIN_SIZE = 1 << 14;
+
+// 組み替える時にたどる入れ子の深さの上限。超える場合は組み替えずに木を作る
+constexpr u32 MAX_REBALANCE_DEPTH = 4096;
+
+// 命令列から木を作る。storeとfetchを含む命令列、正しくない命令列の場合はfalseを返す。
+// isFastMathがtrueの場合は+、-の連鎖と*の連鎖を平衡な木に組み替える。加算、乗算の順序が変わるため丸め誤差が変わる。
+// falseの場合は命令列と同じ順に計算し、Bytecode::Runと同じ結果になる
+bool Build(const Program& program, bool isFastMath, ExprTree& rtTree);
+
+// 木を評価する。variablesには変数の値を番号の順に渡す。threadCountが0の場合はハードウェアのスレッド数を使用する。
+// 0除算の場合はfalseを返す
+std::pair<double, bool> Run
+(
+    const ExprTree& tree, const double* variables = nullptr,
+    u32 threadCount = 0, u32 grainSize = DEFAULT_GRAIN_SIZE
+);
+
+}
@@ -0,0 +1,58 @@
+﻿#pragma once
+
+#include <string_view>
+
+#include "bytecode.h"
+
+class Command;
+enum class CmdType : u8;
+
+// 式の文字列を先頭から1度だけ走査して切り出したトークン。ヒープを確保しない
+struct Token
+{
+    CmdType type;
+    double num = 0.0; // 数値の場合の値
+    std::string_view name = {}; // 変数の場合の名前と、数値の場合の書かれた通りの文字列。元の文字列を指す
+    size_t position = 0; // 元の文字列での位置
+};
+
+// 数値、変数、演算子、括弧を切り出す。
+// 先頭、演算子、左括弧の直後にある-の後に数字が続く場合は、負の数値として扱う
+class Tokenizer
+{
+private:
+    std::string_view text_;
+    bool isTextOnly_ = false;
+    size_t pos_ = 0;
+    bool afterOperand_ = false;
+    bool error_ = false;
+
+public:
+    // isTextOnlyがtrueの場合、doubleで表せない大きさの数値も書かれた通りの文字列として切り出す。
+    // その場合のToken::numは使用しない
+    Tokenizer(std::string_view text, bool isTextOnly = false) : text_(text), isTextOnly_(isTextOnly) {}
+    ~Tokenizer() = default;
+
+    // 次のトークンを読み込む。終端の場合と、解釈できない文字があった場合はfalseを返す
+    bool next(Token& rtToken);
+
+    // 解釈できない文字があった場合はtrue
+    bool isError() const { return error_; }
+
+    // 次に読み込む位置。エラーの場合は解釈できなかった文字の位置
+    size_t getPosition() const { return pos_; }
+};
+
+// 式の文字列を優先順位法（Pratt parser）で解析し、命令列を直接作る。
+// 演算子の優先順位はCommand::priority()を使用する
+namespace Parser
+{
+
+// Command::priority()と同じ値を返す。演算子以外は0を返す
+int GetPriority(CmdType type);
+
+// textを解析してrtProgramに命令列を作る。rtProgramの領域は再利用する。
+// 失敗した場合はfalseを返し、rtErrorPosに解析できなかった位置を設定する
+bool Parse(std::string_view text, Program& rtProgram, size_t& rtErrorPos);
+
+}
@@ -0,0 +1,35 @@
+﻿#pragma once
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+#include "bytecode.h"
+
+// 改行区切りの式を読み込み、画面を消さずに1行ずつ結果を書き出す。
+// 入力をBLOCK_SIZEずつ読み込み、ブロック内の行を複数のスレッドに分配しても入力と同じ順に書き出す
+namespace StreamEval
+{
+
+// 1度に読み込むバイト数
+constexpr size_t BLOCK_SIZE = 1 << 20;
+
+// 使用するスレッド数の上限。多く指定された場合はこの数に抑える
+constexpr u32 MAX_THREAD_COUNT = 256;
+
+// 多倍長で評価する場合の除算の小数点以下の桁数
+constexpr u32 EXACT_DIVISION_SCALE = 50;
+
+// 1行の式を評価し、結果またはエラーメッセージと改行をrtOutputの末尾に追加する。
+// 空の行は空の行を出力する。programは評価に使用する領域で、呼び出し側で再利用する。評価できなかった場合はfalseを返す
+bool EvaluateLine(std::string_view line, Program& program, std::string& rtOutput);
+
+// EvaluateLineと同じ形式で、多倍長の10進数で誤差なく評価した結果を追加する
+bool EvaluateLineExact(std::string_view line, std::string& rtOutput);
+
+// inputを終端まで読み込み、結果をoutputに書き出す。threadCountが0の場合はハードウェアのスレッド数を使用する。
+// threadCountはMAX_THREAD_COUNTまでに抑える。isExactがtrueの場合は多倍長の10進数で評価する。
+// rtErrorCountには評価できなかった行数を設定する。読み書きに失敗した場合はfalseを返す
+bool Run(FILE* input, FILE* output, u32 threadCount, size_t& rtErrorCount, bool isExact = false);
+
+}
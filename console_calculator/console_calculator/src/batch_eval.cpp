@@ -0,0 +1,219 @@
+﻿#include "pch.h"
+
+#include "batch_eval.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#include "optimizer.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define BATCH_EVAL_USE_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BATCH_EVAL_USE_SSE2
+#endif
+
+namespace
+{
+
+// スレッドが1度に取る行のまとまりの数
+constexpr u32 CHUNKS_PER_TASK = 16;
+
+double Calc(OpCode op, double left, double right)
+{
+    switch (op)
+    {
+    case OpCode::add: return left + right;
+    case OpCode::subtract: return left - right;
+    case OpCode::multiply: return left * right;
+    default: return left / right;
+    }
+}
+
+// dst = left op right を count行分計算する。0除算が起きた行はrtErrorsに1を書き込む
+template <OpCode OP>
+void ApplyOpe(double* dst, const double* left, const double* right, u32 count, u8* rtErrors)
+{
+    u32 i = 0;
+
+#if defined(BATCH_EVAL_USE_AVX2)
+    const __m256d zero = _mm256_setzero_pd();
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256d a = _mm256_loadu_pd(left + i);
+        __m256d b = _mm256_loadu_pd(right + i);
+
+        if constexpr (OP == OpCode::add) a = _mm256_add_pd(a, b);
+        else if constexpr (OP == OpCode::subtract) a = _mm256_sub_pd(a, b);
+        else if constexpr (OP == OpCode::multiply) a = _mm256_mul_pd(a, b);
+        else
+        {
+            int mask = _mm256_movemask_pd(_mm256_cmp_pd(b, zero, _CMP_EQ_OQ));
+            for (u32 lane = 0; mask != 0; ++lane, mask >>= 1) if (mask & 1) rtErrors[i + lane] = 1;
+            a = _mm256_div_pd(a, b);
+        }
+
+        _mm256_storeu_pd(dst + i, a);
+    }
+#elif defined(BATCH_EVAL_USE_SSE2)
+    const __m128d zero = _mm_setzero_pd();
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128d a = _mm_loadu_pd(left + i);
+        __m128d b = _mm_loadu_pd(right + i);
+
+        if constexpr (OP == OpCode::add) a = _mm_add_pd(a, b);
+        else if constexpr (OP == OpCode::subtract) a = _mm_sub_pd(a, b);
+        else if constexpr (OP == OpCode::multiply) a = _mm_mul_pd(a, b);
+        else
+        {
+            int mask = _mm_movemask_pd(_mm_cmpeq_pd(b, zero));
+            if (mask & 1) rtErrors[i] = 1;
+            if (mask & 2) rtErrors[i + 1] = 1;
+            a = _mm_div_pd(a, b);
+        }
+
+        _mm_storeu_pd(dst + i, a);
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        if constexpr (OP == OpCode::divide)
+        {
+            if (right[i] == 0.0) rtErrors[i] = 1;
+        }
+        dst[i] = Calc(OP, left[i], right[i]);
+    }
+}
+
+// rowStartからcount行を評価する。スタックの各段は、変数の場合は列を直接指し、それ以外はbufferの同じ段の領域を指す。
+// 演算の結果は左の被演算子の段に書き込み、次に積む値で上書きされないようにする
+void EvaluateChunk
+(
+    const Program& program, const double* const* columns, size_t rowStart, u32 count,
+    double* buffer, double* temps, const double** operands, double* rtResults, u8* rtErrors
+){
+    u8* errors = rtErrors + rowStart;
+    memset(errors, 0, count);
+
+    u32 top = 0;
+    for (const Instruction& inst : program.code)
+    {
+        double* slot = buffer + static_cast<size_t>(top) * BatchEval::LANE_COUNT;
+        switch (inst.op)
+        {
+        case OpCode::push:
+            std::fill(slot, slot + count, inst.num);
+            operands[top++] = slot;
+            break;
+
+        case OpCode::load:
+            operands[top++] = columns[inst.index] + rowStart;
+            break;
+
+        case OpCode::add:
+            top--;
+            slot = buffer + static_cast<size_t>(top - 1) * BatchEval::LANE_COUNT;
+            ApplyOpe<OpCode::add>(slot, operands[top - 1], operands[top], count, errors);
+            operands[top - 1] = slot;
+            break;
+
+        case OpCode::subtract:
+            top--;
+            slot = buffer + static_cast<size_t>(top - 1) * BatchEval::LANE_COUNT;
+            ApplyOpe<OpCode::subtract>(slot, operands[top - 1], operands[top], count, errors);
+            operands[top - 1] = slot;
+            break;
+
+        case OpCode::multiply:
+            top--;
+            slot = buffer + static_cast<size_t>(top - 1) * BatchEval::LANE_COUNT;
+            ApplyOpe<OpCode::multiply>(slot, operands[top - 1], operands[top], count, errors);
+            operands[top - 1] = slot;
+            break;
+
+        case OpCode::divide:
+            top--;
+            slot = buffer + static_cast<size_t>(top - 1) * BatchEval::LANE_COUNT;
+            ApplyOpe<OpCode::divide>(slot, operands[top - 1], operands[top], count, errors);
+            operands[top - 1] = slot;
+            break;
+
+        case OpCode::store:
+            std::copy(operands[top - 1], operands[top - 1] + count, temps + static_cast<size_t>(inst.index) * BatchEval::LANE_COUNT);
+            break;
+
+        case OpCode::fetch:
+            operands[top++] = temps + static_cast<size_t>(inst.index) * BatchEval::LANE_COUNT;
+            break;
+        }
+    }
+
+    const double* result = operands[0];
+    double* dst = rtResults + rowStart;
+    for (u32 i = 0; i < count; ++i) dst[i] = (errors[i] != 0) ? 0.0 : result[i];
+}
+
+}
+
+bool BatchEval::Run
+(
+    const Program& program, const double* const* columns, size_t columnCount, size_t rowCount,
+    double* rtResults, u8* rtErrors, u32 threadCount, bool isOptimizing
+){
+    if (program.code.empty()) return false;
+    if (!program.variables.empty() && (columns == nullptr || columnCount < program.variables.size())) return false;
+    if (rowCount == 0) return true;
+
+    // 全ての行で使い回すため、評価を始める前に1度だけ最適化する。最適化できない場合はそのまま評価する
+    Program optimized;
+    OptimizeResult optimizeResult;
+    bool isOptimized = false;
+    if (isOptimizing)
+    {
+        optimized = program;
+        isOptimized = Optimizer::Optimize(optimized, optimizeResult);
+    }
+    const Program& target = (isOptimized) ? optimized : program;
+
+    size_t chunkCount = (rowCount + LANE_COUNT - 1) / LANE_COUNT;
+    size_t taskCount = (chunkCount + CHUNKS_PER_TASK - 1) / CHUNKS_PER_TASK;
+    std::atomic<size_t> nextTask = 0;
+
+    auto worker = [&]()
+    {
+        std::vector<double> buffer(static_cast<size_t>(target.stackSize) * LANE_COUNT);
+        std::vector<double> temps(static_cast<size_t>(target.tempCount) * LANE_COUNT);
+        std::vector<const double*> operands(target.stackSize);
+
+        for (size_t task = nextTask++; task < taskCount; task = nextTask++)
+        {
+            size_t chunkEnd = std::min(chunkCount, (task + 1) * CHUNKS_PER_TASK);
+            for (size_t chunk = task * CHUNKS_PER_TASK; chunk < chunkEnd; ++chunk)
+            {
+                size_t rowStart = chunk * LANE_COUNT;
+                u32 count = static_cast<u32>(std::min<size_t>(LANE_COUNT, rowCount - rowStart));
+                EvaluateChunk
+                (
+                    target, columns, rowStart, count, buffer.data(), temps.data(), operands.data(), rtResults, rtErrors
+                );
+            }
+        }
+    };
+
+    if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+    size_t maxThreadCount = (rowCount + PARALLEL_ROW_COUNT - 1) / PARALLEL_ROW_COUNT;
+    threadCount = static_cast<u32>(std::min<size_t>({threadCount, maxThreadCount, taskCount}));
+
+    std::vector<std::thread> threads;
+    for (u32 i = 1; i < threadCount; ++i) threads.emplace_back(worker);
+    worker();
+    for (std::thread& thread : threads) thread.join();
+
+    return true;
+}
@@ -0,0 +1,124 @@
+﻿#include "pch.h"
+
+#include "big_decimal.h"
+
+#include <algorithm>
+
+namespace
+{
+
+// 小数点以下の桁数をscaleにそろえた仮数
+BigInt Rescale(const BigDecimal& value, u32 scale)
+{
+    if (value.getScale() == scale) return value.getMantissa();
+    return value.getMantissa() * BigInt::Pow10(scale - value.getScale());
+}
+
+}
+
+bool BigDecimal::FromString(std::string_view text, BigDecimal& rtValue)
+{
+    size_t pos = 0;
+    bool negative = false;
+    if (pos < text.size() && (text[pos] == '-' || text[pos] == '+')) negative = text[pos++] == '-';
+
+    // 小数点を除いた数字の列と、小数点以下の桁数を求める
+    std::string digits;
+    s64 fractionDigits = 0;
+    bool hasPoint = false;
+    for (; pos < text.size(); ++pos)
+    {
+        char c = text[pos];
+        if (c >= '0' && c <= '9')
+        {
+            digits += c;
+            if (hasPoint) fractionDigits++;
+        }
+        else if (c == '.' && !hasPoint) hasPoint = true;
+        else break;
+    }
+    if (digits.empty()) return false;
+
+    s64 exponent = 0;
+    if (pos < text.size() && (text[pos] == 'e' || text[pos] == 'E'))
+    {
+        pos++;
+        bool isExponentNegative = false;
+        if (pos < text.size() && (text[pos] == '-' || text[pos] == '+')) isExponentNegative = text[pos++] == '-';
+        if (pos == text.size()) return false;
+
+        for (; pos < text.size() && text[pos] >= '0' && text[pos] <= '9'; ++pos)
+        {
+            exponent = exponent * 10 + (text[pos] - '0');
+            if (exponent > MAX_EXPONENT) return false;
+        }
+        if (isExponentNegative) exponent = -exponent;
+    }
+    if (pos != text.size()) return false;
+
+    BigInt mantissa;
+    if (!BigInt::FromString(digits, mantissa)) return false;
+
+    s64 scale = fractionDigits - exponent;
+    if (scale < 0)
+    {
+        mantissa = mantissa * BigInt::Pow10(static_cast<u64>(-scale));
+        scale = 0;
+    }
+
+    if (negative) mantissa.negate();
+    rtValue = BigDecimal(std::move(mantissa), static_cast<u32>(scale));
+    return true;
+}
+
+std::string BigDecimal::toString() const
+{
+    std::string digits = mantissa_.toString();
+    bool negative = mantissa_.isNegative();
+    if (negative) digits.erase(0, 1);
+    if (scale_ == 0) return negative ? "-" + digits : digits;
+
+    // 整数部が0の場合も1桁は残す
+    if (digits.size() <= scale_) digits.insert(0, scale_ - digits.size() + 1, '0');
+    digits.insert(digits.size() - scale_, 1, '.');
+
+    size_t last = digits.find_last_not_of('0');
+    if (digits[last] == '.') last--;
+    digits.resize(last + 1);
+
+    if (negative && digits != "0") digits.insert(0, 1, '-');
+    return digits;
+}
+
+BigDecimal BigDecimal::Add(const BigDecimal& a, const BigDecimal& b)
+{
+    u32 scale = std::max(a.scale_, b.scale_);
+    return BigDecimal(Rescale(a, scale) + Rescale(b, scale), scale);
+}
+
+BigDecimal BigDecimal::Subtract(const BigDecimal& a, const BigDecimal& b)
+{
+    u32 scale = std::max(a.scale_, b.scale_);
+    return BigDecimal(Rescale(a, scale) - Rescale(b, scale), scale);
+}
+
+BigDecimal BigDecimal::Multiply(const BigDecimal& a, const BigDecimal& b)
+{
+    return BigDecimal(a.mantissa_ * b.mantissa_, a.scale_ + b.scale_);
+}
+
+bool BigDecimal::Divide(const BigDecimal& a, const BigDecimal& b, u32 scale, BigDecimal& rtResult)
+{
+    if (b.isZero()) return false;
+
+    // (ma / 10^sa) / (mb / 10^sb) * 10^scale = ma * 10^(sb + scale - sa) / mb
+    s64 exponent = static_cast<s64>(b.scale_) + scale - a.scale_;
+    BigInt dividend = (exponent > 0) ? a.mantissa_ * BigInt::Pow10(static_cast<u64>(exponent)) : a.mantissa_;
+    BigInt divisor = (exponent < 0) ? b.mantissa_ * BigInt::Pow10(static_cast<u64>(-exponent)) : b.mantissa_;
+
+    BigInt quotient;
+    BigInt remainder;
+    BigInt::DivMod(dividend, divisor, quotient, remainder);
+    rtResult = BigDecimal(std::move(quotient), scale);
+    return true;
+}
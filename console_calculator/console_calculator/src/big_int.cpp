@@ -0,0 +1,849 @@
+﻿#include "pch.h"
+
+#include "big_int.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+namespace
+{
+
+#if defined(_MSC_VER) && !defined(__clang__)
+
+u64 MulWide(u64 a, u64 b, u64& rtHigh)
+{
+    return _umul128(a, b, &rtHigh);
+}
+
+// (high, low) / divisor。highはdivisorより小さいこと
+u64 DivWide(u64 high, u64 low, u64 divisor, u64& rtRemainder)
+{
+    return _udiv128(high, low, divisor, &rtRemainder);
+}
+
+u32 CountLeadingZeros(u64 value)
+{
+    unsigned long index = 0;
+    _BitScanReverse64(&index, value);
+    return 63 - index;
+}
+
+#else
+
+using u128 = unsigned __int128;
+
+u64 MulWide(u64 a, u64 b, u64& rtHigh)
+{
+    u128 product = static_cast<u128>(a) * b;
+    rtHigh = static_cast<u64>(product >> 64);
+    return static_cast<u64>(product);
+}
+
+// (high, low) / divisor。highはdivisorより小さいこと
+u64 DivWide(u64 high, u64 low, u64 divisor, u64& rtRemainder)
+{
+    u128 dividend = (static_cast<u128>(high) << 64) | low;
+    rtRemainder = static_cast<u64>(dividend % divisor);
+    return static_cast<u64>(dividend / divisor);
+}
+
+u32 CountLeadingZeros(u64 value)
+{
+    return static_cast<u32>(__builtin_clzll(value));
+}
+
+#endif
+
+// 10進数の変換で1つのリムに入れる桁数
+constexpr u32 CHUNK_DIGITS = 19;
+constexpr u64 CHUNK_BASE = 10000000000000000000ull;
+
+// この数より多いリムを持つ数の10進数の変換は、10の累乗で分割して行う
+constexpr u32 DIVIDE_CONQUER_LIMBS = 64;
+
+size_t TrimSize(const u64* a, size_t n)
+{
+    while (n != 0 && a[n - 1] == 0) n--;
+    return n;
+}
+
+int CompareLimbs(const u64* a, size_t an, const u64* b, size_t bn)
+{
+    if (an != bn) return (an < bn) ? -1 : 1;
+    for (size_t i = an; i > 0; --i)
+    {
+        if (a[i - 1] != b[i - 1]) return (a[i - 1] < b[i - 1]) ? -1 : 1;
+    }
+
+    return 0;
+}
+
+// r = a + b。an >= bnで、rはan個。繰り上がりを返す。rはaと同じ領域でもよい
+u64 AddLimbs(u64* r, const u64* a, size_t an, const u64* b, size_t bn)
+{
+    u64 carry = 0;
+    size_t i = 0;
+    for (; i < bn; ++i)
+    {
+        u64 sum = a[i] + carry;
+        u64 carry1 = sum < carry;
+        u64 total = sum + b[i];
+        carry = carry1 | (total < sum);
+        r[i] = total;
+    }
+    for (; i < an; ++i)
+    {
+        u64 sum = a[i] + carry;
+        carry = sum < carry;
+        r[i] = sum;
+    }
+
+    return carry;
+}
+
+// r = a - b。a >= b、an >= bnで、rはan個。借りを返す。rはaと同じ領域でもよい
+u64 SubLimbs(u64* r, const u64* a, size_t an, const u64* b, size_t bn)
+{
+    u64 borrow = 0;
+    size_t i = 0;
+    for (; i < bn; ++i)
+    {
+        u64 diff = a[i] - b[i];
+        u64 borrow1 = a[i] < b[i];
+        u64 result = diff - borrow;
+        borrow = borrow1 | (diff < borrow);
+        r[i] = result;
+    }
+    for (; i < an; ++i)
+    {
+        u64 result = a[i] - borrow;
+        borrow = a[i] < borrow;
+        r[i] = result;
+    }
+
+    return borrow;
+}
+
+// r[0, n) += a[0, n) * m。繰り上がりを返す
+u64 MulAddLimbs(u64* r, const u64* a, size_t n, u64 m)
+{
+    u64 carry = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        u64 high = 0;
+        u64 low = MulWide(a[i], m, high);
+        low += carry;
+        high += low < carry;
+
+        u64 sum = r[i] + low;
+        high += sum < low;
+        r[i] = sum;
+        carry = high;
+    }
+
+    return carry;
+}
+
+// r[0, n) -= a[0, n) * m。上位へ持ち越す借りを返す
+u64 MulSubLimbs(u64* r, const u64* a, size_t n, u64 m)
+{
+    u64 borrow = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        u64 high = 0;
+        u64 low = MulWide(a[i], m, high);
+        low += borrow;
+        high += low < borrow;
+
+        high += r[i] < low;
+        r[i] -= low;
+        borrow = high;
+    }
+
+    return borrow;
+}
+
+void MulLimbs(u64* r, const u64* a, size_t an, const u64* b, size_t bn, MulAlgorithm algorithm);
+
+// rはan + bn個
+void MulSchoolbook(u64* r, const u64* a, size_t an, const u64* b, size_t bn)
+{
+    std::fill(r, r + an + bn, 0);
+    for (size_t j = 0; j < bn; ++j) r[an + j] = MulAddLimbs(r + j, a, an, b[j]);
+}
+
+// bをbn個ずつに分けたaに掛けて足し合わせる。aがbより大幅に長い場合に使用する
+void MulUnbalanced(u64* r, const u64* a, size_t an, const u64* b, size_t bn)
+{
+    std::fill(r, r + an + bn, 0);
+
+    std::vector<u64> product(bn * 2);
+    for (size_t i = 0; i < an; i += bn)
+    {
+        size_t n = std::min(bn, an - i);
+        MulLimbs(product.data(), a + i, n, b, bn, MulAlgorithm::automatic);
+        AddLimbs(r + i, r + i, an + bn - i, product.data(), n + bn);
+    }
+}
+
+// a = a1 * B^h + a0、b = b1 * B^h + b0 として3回の乗算で求める。bnはhより大きいこと
+void MulKaratsuba(u64* r, const u64* a, size_t an, const u64* b, size_t bn)
+{
+    size_t h = (an + 1) / 2;
+    const u64* a1 = a + h;
+    const u64* b1 = b + h;
+    size_t a1n = an - h;
+    size_t b1n = bn - h;
+
+    std::vector<u64> z0(h * 2);
+    std::vector<u64> z2(a1n + b1n);
+    MulLimbs(z0.data(), a, h, b, h, MulAlgorithm::automatic);
+    MulLimbs(z2.data(), a1, a1n, b1, b1n, MulAlgorithm::automatic);
+
+    // z1 = (a0 + a1)(b0 + b1) - z0 - z2
+    std::vector<u64> sumA(h + 1);
+    std::vector<u64> sumB(h + 1);
+    sumA[h] = AddLimbs(sumA.data(), a, h, a1, a1n);
+    sumB[h] = AddLimbs(sumB.data(), b, h, b1, b1n);
+
+    std::vector<u64> z1(h * 2 + 2);
+    MulLimbs(z1.data(), sumA.data(), h + 1, sumB.data(), h + 1, MulAlgorithm::automatic);
+    SubLimbs(z1.data(), z1.data(), z1.size(), z0.data(), z0.size());
+    SubLimbs(z1.data(), z1.data(), z1.size(), z2.data(), z2.size());
+
+    size_t rn = an + bn;
+    std::copy(z0.begin(), z0.end(), r);
+    std::copy(z2.begin(), z2.end(), r + h * 2);
+    AddLimbs(r + h, r + h, rn - h, z1.data(), TrimSize(z1.data(), z1.size()));
+}
+
+BigInt Part(const u64* limbs, size_t count, size_t begin, size_t length)
+{
+    if (begin >= count) return BigInt();
+    return BigInt::FromLimbs(limbs + begin, std::min(length, count - begin));
+}
+
+// 3つに分けた多項式を0、1、-1、-2、∞で評価し、Bodratoの手順で補間する
+void MulToom3(u64* r, const u64* a, size_t an, const u64* b, size_t bn)
+{
+    size_t k = (an + 2) / 3;
+    BigInt a0 = Part(a, an, 0, k);
+    BigInt a1 = Part(a, an, k, k);
+    BigInt a2 = Part(a, an, k * 2, k);
+    BigInt b0 = Part(b, bn, 0, k);
+    BigInt b1 = Part(b, bn, k, k);
+    BigInt b2 = Part(b, bn, k * 2, k);
+
+    BigInt p = a0 + a2;
+    BigInt p1 = p + a1;
+    BigInt pm1 = p - a1;
+    BigInt pm2 = (pm1 + a2).shiftLeft(1) - a0;
+
+    BigInt q = b0 + b2;
+    BigInt q1 = q + b1;
+    BigInt qm1 = q - b1;
+    BigInt qm2 = (qm1 + b2).shiftLeft(1) - b0;
+
+    BigInt r0 = a0 * b0;
+    BigInt r1 = p1 * q1;
+    BigInt rm1 = pm1 * qm1;
+    BigInt rm2 = pm2 * qm2;
+    BigInt rInf = a2 * b2;
+
+    BigInt t3 = rm2 - r1;
+    t3.divSmall(3); // 割り切れる
+    BigInt t1 = (r1 - rm1).shiftRight(1);
+    BigInt t2 = rm1 - r0;
+    t3 = (t2 - t3).shiftRight(1) + rInf.shiftLeft(1);
+    t2 = t2 + t1 - rInf;
+    t1 = t1 - t3;
+
+    u64 shift = static_cast<u64>(k) * 64;
+    BigInt result = r0 + t1.shiftLeft(shift) + t2.shiftLeft(shift * 2) + t3.shiftLeft(shift * 3) + rInf.shiftLeft(shift * 4);
+
+    size_t rn = an + bn;
+    std::fill(r, r + rn, 0);
+    std::copy(result.getLimbs(), result.getLimbs() + std::min<size_t>(rn, result.getLimbCount()), r);
+}
+
+// rはan + bn個。入力の上位の0は取り除いてから方法を選ぶ
+void MulLimbs(u64* r, const u64* a, size_t an, const u64* b, size_t bn, MulAlgorithm algorithm)
+{
+    size_t rn = an + bn;
+    an = TrimSize(a, an);
+    bn = TrimSize(b, bn);
+    if (an < bn)
+    {
+        std::swap(a, b);
+        std::swap(an, bn);
+    }
+    if (bn == 0)
+    {
+        std::fill(r, r + rn, 0);
+        return;
+    }
+    std::fill(r + an + bn, r + rn, 0);
+
+    if (algorithm == MulAlgorithm::automatic)
+    {
+        if (bn < BigInt::KARATSUBA_THRESHOLD) algorithm = MulAlgorithm::schoolbook;
+        else if (bn < BigInt::TOOM3_THRESHOLD) algorithm = MulAlgorithm::karatsuba;
+        else algorithm = MulAlgorithm::toom3;
+    }
+
+    if (algorithm == MulAlgorithm::schoolbook || bn == 1) MulSchoolbook(r, a, an, b, bn);
+    else if (bn * 2 <= an + 1) MulUnbalanced(r, a, an, b, bn);
+    else if (algorithm == MulAlgorithm::karatsuba) MulKaratsuba(r, a, an, b, bn);
+    else MulToom3(r, a, an, b, bn);
+}
+
+// Knuthのアルゴリズム D。vnは2以上で、qはun - vn + 1個、remはvn個
+void DivKnuth(const u64* u, size_t un, const u64* v, size_t vn, u64* q, u64* rem)
+{
+    // 除数の最上位ビットが立つように正規化する
+    u32 shift = CountLeadingZeros(v[vn - 1]);
+    std::vector<u64> nv(vn);
+    std::vector<u64> nu(un + 1);
+    for (size_t i = vn; i-- > 0;)
+    {
+        nv[i] = v[i] << shift;
+        if (shift != 0 && i != 0) nv[i] |= v[i - 1] >> (64 - shift);
+    }
+    nu[un] = (shift != 0) ? u[un - 1] >> (64 - shift) : 0;
+    for (size_t i = un; i-- > 0;)
+    {
+        nu[i] = u[i] << shift;
+        if (shift != 0 && i != 0) nu[i] |= u[i - 1] >> (64 - shift);
+    }
+
+    u64 top = nv[vn - 1];
+    u64 second = nv[vn - 2];
+    for (size_t j = un - vn + 1; j-- > 0;)
+    {
+        // 上位の2つのリムから商を見積もり、多くても2回の補正で正しい値にする
+        u64 qhat = 0;
+        u64 rhat = 0;
+        bool isRhatOverflow = false;
+        if (nu[j + vn] >= top)
+        {
+            qhat = ~0ull;
+            rhat = nu[j + vn - 1] + top;
+            isRhatOverflow = rhat < top;
+        }
+        else
+        {
+            qhat = DivWide(nu[j + vn], nu[j + vn - 1], top, rhat);
+        }
+
+        while (!isRhatOverflow)
+        {
+            u64 high = 0;
+            u64 low = MulWide(qhat, second, high);
+            if (high < rhat || (high == rhat && low <= nu[j + vn - 2])) break;
+
+            qhat--;
+            u64 previous = rhat;
+            rhat += top;
+            isRhatOverflow = rhat < previous;
+        }
+
+        u64 borrow = MulSubLimbs(nu.data() + j, nv.data(), vn, qhat);
+        u64 head = nu[j + vn];
+        nu[j + vn] = head - borrow;
+        if (head < borrow)
+        {
+            // 見積もりが1大きかった場合は足し戻す
+            qhat--;
+            nu[j + vn] += AddLimbs(nu.data() + j, nu.data() + j, vn, nv.data(), vn);
+        }
+
+        q[j] = qhat;
+    }
+
+    for (size_t i = 0; i < vn; ++i)
+    {
+        rem[i] = nu[i] >> shift;
+        if (shift != 0) rem[i] |= nu[i + 1] << (64 - shift);
+    }
+}
+
+// 2^(除数のビット数 + precision) / b に近い値を求める。誤差は数単位以内
+BigInt Reciprocal(const BigInt& b, u64 precision)
+{
+    // 結果の精度に必要な分だけ除数の上位のビットを使う
+    constexpr u64 GUARD_BITS = 8;
+    u64 n = b.getBitLength();
+    if (n > precision + GUARD_BITS) return Reciprocal(b.shiftRight(n - precision - GUARD_BITS), precision);
+
+    if (precision <= 60)
+    {
+        // 除数の上位64ビットで128ビットの除算を行う
+        BigInt head = (n > 64) ? b.shiftRight(n - 64) : b;
+        u64 headBits = head.getBitLength();
+        u64 exponent = headBits + precision;
+
+        u64 remainder = 0;
+        u64 high = (exponent >= 64) ? 1ull << (exponent - 64) : 0;
+        u64 low = (exponent >= 64) ? 0 : 1ull << exponent;
+        return BigInt(static_cast<s64>(DivWide(high, low, head.getLimbs()[0], remainder)));
+    }
+
+    // 半分の精度の逆数からニュートン法で2倍の精度にする
+    u64 half = precision / 2 + 4;
+    BigInt x = Reciprocal(b, half).shiftLeft(precision - half);
+    BigInt error = BigInt(1).shiftLeft(n + precision) - b * x;
+    return x + (x * error).shiftRight(n + precision);
+}
+
+// 10進数の数字の列を読み込む。長い場合は上位と下位に分けて10^(19 * 2^k)を掛けて合わせる
+BigInt ParseDigits(std::string_view digits, std::vector<BigInt>& powers)
+{
+    if (digits.size() <= static_cast<size_t>(CHUNK_DIGITS) * DIVIDE_CONQUER_LIMBS)
+    {
+        BigInt value;
+        size_t pos = 0;
+        while (pos < digits.size())
+        {
+            size_t length = (pos == 0 && digits.size() % CHUNK_DIGITS != 0) ? digits.size() % CHUNK_DIGITS : CHUNK_DIGITS;
+            u64 chunk = 0;
+            u64 scale = 1;
+            for (size_t i = 0; i < length; ++i)
+            {
+                chunk = chunk * 10 + (digits[pos + i] - '0');
+                scale *= 10;
+            }
+
+            value.mulAddSmall(scale, chunk);
+            pos += length;
+        }
+
+        return value;
+    }
+
+    size_t k = 0;
+    while ((static_cast<size_t>(CHUNK_DIGITS) << (k + 1)) < digits.size()) k++;
+    while (powers.size() <= k) powers.push_back(powers.back() * powers.back());
+
+    size_t lowLength = static_cast<size_t>(CHUNK_DIGITS) << k;
+    BigInt high = ParseDigits(digits.substr(0, digits.size() - lowLength), powers);
+    BigInt low = ParseDigits(digits.substr(digits.size() - lowLength), powers);
+    return high * powers[k] + low;
+}
+
+// 正の数を10進数にしてrtDigitsの末尾に追加する。widthが0でない場合は先頭を0で埋めてwidth桁にする
+void AppendDecimal(BigInt value, size_t width, std::string& rtDigits, std::vector<BigInt>& powers)
+{
+    if (value.getLimbCount() <= DIVIDE_CONQUER_LIMBS)
+    {
+        std::vector<u64> chunks;
+        while (!value.isZero()) chunks.push_back(value.divSmall(CHUNK_BASE));
+
+        std::string text = chunks.empty() ? "" : std::to_string(chunks.back());
+        for (size_t i = chunks.size() - (chunks.empty() ? 0 : 1); i > 0; --i)
+        {
+            std::string chunk = std::to_string(chunks[i - 1]);
+            text.append(CHUNK_DIGITS - chunk.size(), '0');
+            text += chunk;
+        }
+        if (text.empty() && width == 0) text = "0";
+
+        if (text.size() < width) rtDigits.append(width - text.size(), '0');
+        rtDigits += text;
+        return;
+    }
+
+    // 半分程度のビット数の10^(19 * 2^k)で割り、商と余りをそれぞれ変換する
+    u64 bitLength = value.getBitLength();
+    size_t k = 0;
+    while (true)
+    {
+        if (powers.size() <= k + 1) powers.push_back(powers.back() * powers.back());
+        if (powers[k + 1].getBitLength() * 2 > bitLength + 1) break;
+        k++;
+    }
+
+    BigInt quotient;
+    BigInt remainder;
+    BigInt::DivMod(value, powers[k], quotient, remainder);
+
+    size_t lowWidth = static_cast<size_t>(CHUNK_DIGITS) << k;
+    AppendDecimal(std::move(quotient), (width > lowWidth) ? width - lowWidth : 0, rtDigits, powers);
+    AppendDecimal(std::move(remainder), lowWidth, rtDigits, powers);
+}
+
+}
+
+BigInt::BigInt(s64 value)
+{
+    negative_ = value < 0;
+    u64 magnitude = negative_ ? 0 - static_cast<u64>(value) : static_cast<u64>(value);
+    if (magnitude != 0)
+    {
+        inline_[0] = magnitude;
+        size_ = 1;
+    }
+}
+
+BigInt::BigInt(const BigInt& other)
+{
+    reserve(other.size_);
+    memcpy(data(), other.getLimbs(), other.size_ * sizeof(u64));
+    size_ = other.size_;
+    negative_ = other.negative_;
+}
+
+BigInt::BigInt(BigInt&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+BigInt& BigInt::operator=(const BigInt& other)
+{
+    if (this == &other) return *this;
+
+    reserve(other.size_);
+    memcpy(data(), other.getLimbs(), other.size_ * sizeof(u64));
+    size_ = other.size_;
+    negative_ = other.negative_;
+    return *this;
+}
+
+BigInt& BigInt::operator=(BigInt&& other) noexcept
+{
+    if (this == &other) return *this;
+
+    heap_ = std::move(other.heap_);
+    memcpy(inline_, other.inline_, sizeof(inline_));
+    size_ = other.size_;
+    capacity_ = other.capacity_;
+    negative_ = other.negative_;
+
+    other.size_ = 0;
+    other.capacity_ = INLINE_LIMB_COUNT;
+    other.negative_ = false;
+    return *this;
+}
+
+void BigInt::reserve(u32 capacity)
+{
+    if (capacity <= capacity_) return;
+
+    std::unique_ptr<u64[]> limbs = std::make_unique<u64[]>(capacity);
+    memcpy(limbs.get(), data(), size_ * sizeof(u64));
+    heap_ = std::move(limbs);
+    capacity_ = capacity;
+}
+
+void BigInt::resize(u32 size)
+{
+    reserve(size);
+    if (size > size_) std::fill(data() + size_, data() + size, 0);
+    size_ = size;
+}
+
+void BigInt::trim()
+{
+    size_ = static_cast<u32>(TrimSize(data(), size_));
+    if (size_ == 0) negative_ = false;
+}
+
+BigInt BigInt::FromLimbs(const u64* limbs, size_t count)
+{
+    BigInt value;
+    value.resize(static_cast<u32>(count));
+    memcpy(value.data(), limbs, count * sizeof(u64));
+    value.trim();
+    return value;
+}
+
+bool BigInt::FromString(std::string_view text, BigInt& rtValue)
+{
+    bool negative = false;
+    if (!text.empty() && (text[0] == '-' || text[0] == '+'))
+    {
+        negative = text[0] == '-';
+        text.remove_prefix(1);
+    }
+    if (text.empty()) return false;
+
+    for (char c : text)
+    {
+        if (c < '0' || c > '9') return false;
+    }
+
+    std::vector<BigInt> powers = {BigInt(static_cast<s64>(CHUNK_BASE / 10)) * BigInt(10)};
+    rtValue = ParseDigits(text, powers);
+    if (negative) rtValue.negate();
+    return true;
+}
+
+BigInt BigInt::Pow10(u64 exponent)
+{
+    BigInt result(1);
+    BigInt base(10);
+    while (exponent != 0)
+    {
+        if (exponent & 1) result = result * base;
+        exponent >>= 1;
+        if (exponent != 0) base = base * base;
+    }
+
+    return result;
+}
+
+std::string BigInt::toString() const
+{
+    if (size_ == 0) return "0";
+
+    BigInt magnitude = *this;
+    magnitude.negative_ = false;
+
+    std::string text = negative_ ? "-" : "";
+    std::vector<BigInt> powers = {BigInt(static_cast<s64>(CHUNK_BASE / 10)) * BigInt(10)};
+    AppendDecimal(std::move(magnitude), 0, text, powers);
+    return text;
+}
+
+u64 BigInt::getBitLength() const
+{
+    if (size_ == 0) return 0;
+    return static_cast<u64>(size_) * 64 - CountLeadingZeros(getLimbs()[size_ - 1]);
+}
+
+int BigInt::CompareMagnitude(const BigInt& a, const BigInt& b)
+{
+    return CompareLimbs(a.getLimbs(), a.size_, b.getLimbs(), b.size_);
+}
+
+int BigInt::Compare(const BigInt& a, const BigInt& b)
+{
+    if (a.negative_ != b.negative_) return a.negative_ ? -1 : 1;
+
+    int result = CompareMagnitude(a, b);
+    return a.negative_ ? -result : result;
+}
+
+BigInt BigInt::AddSigned(const BigInt& a, const BigInt& b, bool bNegative)
+{
+    BigInt result;
+    if (b.size_ == 0) return a;
+
+    if (a.negative_ == bNegative)
+    {
+        const BigInt& large = (a.size_ >= b.size_) ? a : b;
+        const BigInt& small = (a.size_ >= b.size_) ? b : a;
+
+        result.resize(large.size_);
+        u64 carry = AddLimbs(result.data(), large.getLimbs(), large.size_, small.getLimbs(), small.size_);
+        if (carry != 0)
+        {
+            result.resize(large.size_ + 1);
+            result.data()[large.size_] = carry;
+        }
+        result.negative_ = bNegative;
+    }
+    else
+    {
+        int compare = CompareMagnitude(a, b);
+        if (compare == 0) return result;
+
+        const BigInt& large = (compare > 0) ? a : b;
+        const BigInt& small = (compare > 0) ? b : a;
+
+        result.resize(large.size_);
+        SubLimbs(result.data(), large.getLimbs(), large.size_, small.getLimbs(), small.size_);
+        result.negative_ = (compare > 0) ? a.negative_ : bNegative;
+    }
+
+    result.trim();
+    return result;
+}
+
+BigInt BigInt::Add(const BigInt& a, const BigInt& b)
+{
+    return AddSigned(a, b, b.negative_);
+}
+
+BigInt BigInt::Subtract(const BigInt& a, const BigInt& b)
+{
+    return AddSigned(a, b, !b.negative_);
+}
+
+BigInt BigInt::Multiply(const BigInt& a, const BigInt& b, MulAlgorithm algorithm)
+{
+    BigInt result;
+    if (a.size_ == 0 || b.size_ == 0) return result;
+
+    result.resize(a.size_ + b.size_);
+    MulLimbs(result.data(), a.getLimbs(), a.size_, b.getLimbs(), b.size_, algorithm);
+    result.negative_ = a.negative_ != b.negative_;
+    result.trim();
+    return result;
+}
+
+bool BigInt::DivMod(const BigInt& a, const BigInt& b, BigInt& rtQuotient, BigInt& rtRemainder, DivAlgorithm algorithm)
+{
+    if (b.size_ == 0) return false;
+
+    bool quotientNegative = a.negative_ != b.negative_;
+    bool remainderNegative = a.negative_;
+
+    if (CompareMagnitude(a, b) < 0)
+    {
+        rtRemainder = a;
+        rtQuotient = BigInt();
+        return true;
+    }
+
+    BigInt quotient;
+    BigInt remainder;
+    if (b.size_ == 1)
+    {
+        quotient = a;
+        remainder = BigInt(static_cast<s64>(0));
+        u64 rest = quotient.divSmall(b.getLimbs()[0]);
+        if (rest != 0)
+        {
+            remainder.resize(1);
+            remainder.data()[0] = rest;
+        }
+    }
+    else
+    {
+        if (algorithm == DivAlgorithm::automatic)
+        {
+            bool isLarge = b.size_ >= NEWTON_THRESHOLD && a.size_ - b.size_ + 1 >= NEWTON_THRESHOLD;
+            algorithm = isLarge ? DivAlgorithm::newton : DivAlgorithm::schoolbook;
+        }
+
+        if (algorithm == DivAlgorithm::schoolbook)
+        {
+            quotient.resize(a.size_ - b.size_ + 1);
+            remainder.resize(b.size_);
+            DivKnuth(a.getLimbs(), a.size_, b.getLimbs(), b.size_, quotient.data(), remainder.data());
+        }
+        else
+        {
+            // 逆数を掛けて商を見積もり、余りで補正する
+            BigInt dividend = a;
+            BigInt divisor = b;
+            dividend.negative_ = false;
+            divisor.negative_ = false;
+
+            u64 divisorBits = divisor.getBitLength();
+            u64 precision = dividend.getBitLength() - divisorBits + 2;
+            quotient = (dividend * Reciprocal(divisor, precision)).shiftRight(divisorBits + precision);
+            remainder = dividend - quotient * divisor;
+            while (remainder.negative_)
+            {
+                quotient = quotient - BigInt(1);
+                remainder = remainder + divisor;
+            }
+            while (CompareMagnitude(remainder, divisor) >= 0)
+            {
+                quotient = quotient + BigInt(1);
+                remainder = remainder - divisor;
+            }
+        }
+    }
+
+    quotient.negative_ = quotientNegative;
+    remainder.negative_ = remainderNegative;
+    quotient.trim();
+    remainder.trim();
+
+    rtQuotient = std::move(quotient);
+    rtRemainder = std::move(remainder);
+    return true;
+}
+
+BigInt BigInt::shiftLeft(u64 bits) const
+{
+    BigInt result;
+    if (size_ == 0) return result;
+
+    u32 limbShift = static_cast<u32>(bits / 64);
+    u32 bitShift = static_cast<u32>(bits % 64);
+    const u64* src = getLimbs();
+    bool isCarried = bitShift != 0 && (src[size_ - 1] >> (64 - bitShift)) != 0;
+    result.resize(size_ + limbShift + (isCarried ? 1 : 0));
+
+    u64* dst = result.data() + limbShift;
+    if (bitShift == 0)
+    {
+        memcpy(dst, src, size_ * sizeof(u64));
+    }
+    else
+    {
+        u64 carry = 0;
+        for (u32 i = 0; i < size_; ++i)
+        {
+            dst[i] = (src[i] << bitShift) | carry;
+            carry = src[i] >> (64 - bitShift);
+        }
+        if (isCarried) dst[size_] = carry;
+    }
+
+    result.negative_ = negative_;
+    result.trim();
+    return result;
+}
+
+BigInt BigInt::shiftRight(u64 bits) const
+{
+    BigInt result;
+    u64 limbShift = bits / 64;
+    if (limbShift >= size_) return result;
+
+    u32 bitShift = static_cast<u32>(bits % 64);
+    u32 size = size_ - static_cast<u32>(limbShift);
+    result.resize(size);
+
+    const u64* src = getLimbs() + limbShift;
+    u64* dst = result.data();
+    for (u32 i = 0; i < size; ++i)
+    {
+        dst[i] = src[i] >> bitShift;
+        if (bitShift != 0 && i + 1 < size) dst[i] |= src[i + 1] << (64 - bitShift);
+    }
+
+    result.negative_ = negative_;
+    result.trim();
+    return result;
+}
+
+void BigInt::mulAddSmall(u64 multiplier, u64 addend)
+{
+    u64* limbs = data();
+    u64 carry = addend;
+    for (u32 i = 0; i < size_; ++i)
+    {
+        u64 high = 0;
+        u64 low = MulWide(limbs[i], multiplier, high);
+        low += carry;
+        high += low < carry;
+        limbs[i] = low;
+        carry = high;
+    }
+
+    if (carry != 0)
+    {
+        resize(size_ + 1);
+        data()[size_ - 1] = carry;
+    }
+    trim();
+}
+
+u64 BigInt::divSmall(u64 divisor)
+{
+    u64* limbs = data();
+    u64 remainder = 0;
+    for (u32 i = size_; i > 0; --i) limbs[i - 1] = DivWide(remainder, limbs[i - 1], divisor, remainder);
+
+    trim();
+    return remainder;
+}
@@ -0,0 +1,252 @@
+﻿#include "pch.h"
+
+#include "bytecode.h"
+#include "cmd_token.h"
+#include "command.h"
+
+#include <cstring>
+
+namespace
+{
+
+struct OpeEntry
+{
+    CmdType type;
+    int priority;
+};
+
+// 演算子の命令を追加し、スタックの深さを更新する。オペランドが足りない場合はfalseを返す
+bool EmitOpe(CmdType type, Program& rtProgram, u32& rtDepth)
+{
+    if (rtDepth < 2) return false;
+
+    rtProgram.code.push_back({Bytecode::ToOpCode(type), 0, 0.0});
+    rtDepth--;
+    return true;
+}
+
+// 操車場アルゴリズムで逆ポーランド記法の順に並べる。優先順位はCommand::priority()と同じ表を使用する。
+// getType、getNum、getNameはi番目のコマンドの種類、数値、変数の名前を返す
+template <typename GetType, typename GetNum, typename GetName>
+bool CompileTokens
+(
+    size_t count, Program& rtProgram, const GetType& getType, const GetNum& getNum, const GetName& getName
+){
+    rtProgram.code.clear();
+    rtProgram.stackSize = 0;
+    rtProgram.tempCount = 0;
+    rtProgram.variables.clear();
+
+    std::vector<OpeEntry> opeStack;
+    opeStack.reserve(count);
+
+    u32 depth = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        CmdType type = getType(i);
+        if (CmdTokens::IsOperand(type))
+        {
+            if (depth == Bytecode::MAX_STACK_SIZE) return false;
+
+            if (type == CmdType::number)
+            {
+                rtProgram.code.push_back({OpCode::push, 0, getNum(i)});
+            }
+            else
+            {
+                std::string_view name = getName(i);
+                s32 index = Bytecode::FindVariable(rtProgram, name);
+                if (index < 0)
+                {
+                    index = static_cast<s32>(rtProgram.variables.size());
+                    rtProgram.variables.emplace_back(name);
+                }
+
+                rtProgram.code.push_back({OpCode::load, static_cast<u32>(index), 0.0});
+            }
+
+            depth++;
+            if (depth > rtProgram.stackSize) rtProgram.stackSize = depth;
+        }
+        else if (type == CmdType::leftParen)
+        {
+            opeStack.push_back({type, 0});
+        }
+        else if (type == CmdType::rightParen)
+        {
+            // 左括弧まで取り出す
+            while (!opeStack.empty() && opeStack.back().type != CmdType::leftParen)
+            {
+                if (!EmitOpe(opeStack.back().type, rtProgram, depth)) return false;
+                opeStack.pop_back();
+            }
+
+            if (opeStack.empty()) return false; // 対応する左括弧がない
+            opeStack.pop_back();
+        }
+        else
+        {
+            int priority = CmdTokens::GetPriority(type);
+            while (!opeStack.empty() && priority <= opeStack.back().priority)
+            {
+                if (!EmitOpe(opeStack.back().type, rtProgram, depth)) return false;
+                opeStack.pop_back();
+            }
+
+            opeStack.push_back({type, priority});
+        }
+    }
+
+    while (!opeStack.empty())
+    {
+        if (opeStack.back().type == CmdType::leftParen) return false; // 括弧が閉じられていない
+        if (!EmitOpe(opeStack.back().type, rtProgram, depth)) return false;
+        opeStack.pop_back();
+    }
+
+    // 最後に結果が1つだけ残る場合のみ正しい式
+    return depth == 1;
+}
+
+}
+
+OpCode Bytecode::ToOpCode(CmdType type)
+{
+    switch (type)
+    {
+    case CmdType::add: return OpCode::add;
+    case CmdType::subtract: return OpCode::subtract;
+    case CmdType::multiply: return OpCode::multiply;
+    default: return OpCode::divide;
+    }
+}
+
+bool Bytecode::Compile(const std::vector<std::unique_ptr<Command>>& cmds, Program& rtProgram)
+{
+    return CompileTokens
+    (
+        cmds.size(), rtProgram,
+        [&cmds](size_t i) { return cmds[i]->type(); },
+        [&cmds](size_t i) { return static_cast<const NumberCmd*>(cmds[i].get())->getNum(); },
+        [&cmds](size_t i) -> std::string_view { return static_cast<const VariableCmd*>(cmds[i].get())->getName(); }
+    );
+}
+
+bool Bytecode::Compile(const std::vector<CmdToken>& tokens, const std::vector<std::string>& names, Program& rtProgram)
+{
+    return CompileTokens
+    (
+        tokens.size(), rtProgram,
+        [&tokens](size_t i) { return tokens[i].type; },
+        [&tokens](size_t i) { return tokens[i].num; },
+        [&tokens, &names](size_t i) -> std::string_view { return names[tokens[i].nameIndex]; }
+    );
+}
+
+s32 Bytecode::FindVariable(const Program& program, std::string_view name)
+{
+    for (size_t i = 0; i < program.variables.size(); ++i)
+    {
+        if (program.variables[i] == name) return static_cast<s32>(i);
+    }
+
+    return -1;
+}
+
+u64 Bytecode::Hash(const Program& program)
+{
+    // FNV-1a
+    u64 hash = 14695981039346656037ull;
+    auto mix = [&hash](u64 value)
+    {
+        for (u32 i = 0; i < 8; ++i)
+        {
+            hash ^= (value >> (i * 8)) & 0xff;
+            hash *= 1099511628211ull;
+        }
+    };
+
+    mix(program.variables.size());
+    for (const Instruction& inst : program.code)
+    {
+        u64 bits = 0;
+        memcpy(&bits, &inst.num, sizeof(bits));
+
+        mix(static_cast<u64>(inst.op) | (static_cast<u64>(inst.index) << 8));
+        mix(bits);
+    }
+
+    return hash;
+}
+
+bool Bytecode::IsSame(const Program& a, const Program& b)
+{
+    if (a.code.size() != b.code.size() || a.variables.size() != b.variables.size()) return false;
+
+    for (size_t i = 0; i < a.code.size(); ++i)
+    {
+        const Instruction& instA = a.code[i];
+        const Instruction& instB = b.code[i];
+        if (instA.op != instB.op || instA.index != instB.index) return false;
+        if (memcmp(&instA.num, &instB.num, sizeof(double)) != 0) return false;
+    }
+
+    return true;
+}
+
+std::pair<double, bool> Bytecode::Run(const Program& program, const double* variables)
+{
+    if (program.code.empty()) return std::make_pair(0.0, false);
+    if (!program.variables.empty() && variables == nullptr) return std::make_pair(0.0, false);
+
+    double stack[MAX_STACK_SIZE];
+    double temps[MAX_TEMP_COUNT];
+    u32 top = 0;
+
+    const Instruction* inst = program.code.data();
+    const Instruction* end = inst + program.code.size();
+    for (; inst != end; ++inst)
+    {
+        switch (inst->op)
+        {
+        case OpCode::push:
+            stack[top++] = inst->num;
+            break;
+
+        case OpCode::load:
+            stack[top++] = variables[inst->index];
+            break;
+
+        case OpCode::add:
+            top--;
+            stack[top - 1] += stack[top];
+            break;
+
+        case OpCode::subtract:
+            top--;
+            stack[top - 1] -= stack[top];
+            break;
+
+        case OpCode::multiply:
+            top--;
+            stack[top - 1] *= stack[top];
+            break;
+
+        case OpCode::divide:
+            top--;
+            if (stack[top] == 0.0) return std::make_pair(0.0, false);
+            stack[top - 1] /= stack[top];
+            break;
+
+        case OpCode::store:
+            temps[inst->index] = stack[top - 1];
+            break;
+
+        case OpCode::fetch:
+            stack[top++] = temps[inst->index];
+            break;
+        }
+    }
+
+    return std::make_pair(stack[0], true);
+}
@@ -2,6 +2,43 @@
 
 #include "calculator.h"
 #include "command.h"
+#include "engine.h"
+#include "eval_cache.h"
+
+#include <cmath>
+
+namespace
+{
+
+// CmdTokens::CheckAppendに従ってコマンドの列に追加する
+bool AppendToCmds(std::vector<std::unique_ptr<Command>>& dst, std::unique_ptr<Command> src)
+{
+    if (dst.empty()) return false;
+
+    switch (CmdTokens::CheckAppend(dst.size(), dst.front()->type(), dst.back()->type(), src->type()))
+    {
+    case AppendAction::append:
+        dst.emplace_back(std::move(src));
+        return true;
+
+    case AppendAction::replace:
+        dst.back() = std::move(src);
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// Engine::Applyの結果をCommand::executeの形式で返す
+std::pair<double, bool> ApplyOpe(CmdType type, double leftNum, double rightNum)
+{
+    double result = 0.0;
+    if (Engine::Apply(type, leftNum, rightNum, result) != EvalStatus::success) return std::make_pair(0.0, false);
+    return std::make_pair(result, true);
+}
+
+}
 
 std::queue<std::unique_ptr<Command>> RPN::ToRPN
 (
@@ -116,29 +153,84 @@ std::unique_ptr<Command> RPN::CalcFromRPN
     return std::move(calcStack.top());
 }
 
-Calculator::Calculator()
+Calculator::Calculator(u32 maxEditCount)
+: history_({CmdType::number, 0, idleNum_}, maxEditCount) // 初期数値を履歴の最初にする
+{
+    cmds_.push_back(history_.getCurrent().token);
+    live_.push(cmds_.back());
+}
+
+AppendAction Calculator::appendToCmds(const CmdToken& token)
 {
-    std::unique_ptr<Command> numCmd = std::make_unique<NumberCmd>();
-    PtrAs<NumberCmd>(numCmd.get())->setNum(idleNum_);
+    if (cmds_.empty()) return AppendAction::reject;
 
-    history_.emplace_back(std::move(numCmd)); // 初期数値を履歴に追加
-    historyIt_ = history_.end() - 1;
+    AppendAction action = CmdTokens::CheckAppend(cmds_.size(), cmds_.front().type, cmds_.back().type, token.type);
+    switch (action)
+    {
+    case AppendAction::append:
+        cmds_.push_back(token);
+        live_.push(token);
+        break;
+
+    case AppendAction::replace:
+        cmds_.back() = token;
+        live_.pop();
+        live_.push(token);
+        break;
+
+    default:
+        break;
+    }
 
-    cmds_.emplace_back(historyIt_->get()->clone());
+    return action;
 }
 
-void Calculator::appendCmd(std::unique_ptr<Command>& cmd)
+void Calculator::rebuildCmds()
 {
-    bool appended = cmd->append(this, cmds_);
-    if (appended)
+    history_.getTokens(history_.getCurrentId(), cmds_);
+
+    live_.clear();
+    for (const CmdToken& token : cmds_) live_.push(token);
+}
+
+u32 Calculator::findName(std::string_view name)
+{
+    for (size_t i = 0; i < names_.size(); ++i)
     {
-        if (PtrAs<LeftParenCmd>(cmd.get())) inParenDepth++;
-        else if (PtrAs<RightParenCmd>(cmd.get())) inParenDepth--;
+        if (names_[i] == name) return static_cast<u32>(i);
+    }
+
+    names_.emplace_back(name);
+    return static_cast<u32>(names_.size() - 1);
+}
+
+CmdToken Calculator::toToken(const Command& cmd)
+{
+    CmdToken token = {cmd.type()};
+    if (token.type == CmdType::number) token.num = static_cast<const NumberCmd&>(cmd).getNum();
+    else if (token.type == CmdType::variable) token.nameIndex = findName(static_cast<const VariableCmd&>(cmd).getName());
 
-        // 履歴を更新
-        history_.erase(historyIt_ + 1, history_.end()); // イテレーターより後ろの履歴を削除
-        history_.emplace_back(cmd->clone()); // 履歴に追加
-        historyIt_ = history_.end() - 1; // イテレーターを履歴の最後に
+    return token;
+}
+
+CmdToken Calculator::toVariableToken(std::string_view name)
+{
+    return {CmdType::variable, findName(name)};
+}
+
+void Calculator::appendCmd(std::unique_ptr<Command>& cmd)
+{
+    appendToken(toToken(*cmd));
+}
+
+void Calculator::appendToken(const CmdToken& token)
+{
+    // 現在の位置から編集を追加する。以前にやり直せた編集は別の枝として残る
+    switch (appendToCmds(token))
+    {
+    case AppendAction::append: history_.push(EditType::append, token); break;
+    case AppendAction::replace: history_.push(EditType::replace, token); break;
+    default: break;
     }
 }
 
@@ -158,14 +250,22 @@ void Calculator::show()
     if (!error_)
     {
         cmdsOutput_ = "";
-        for (const auto& cmd : cmds_) cmdsOutput_ += cmd->toString() + " ";
+        for (const CmdToken& token : cmds_) cmdsOutput_ += CmdTokens::ToString(token, names_) + " ";
+
+        // 途中までの式の値を表示する
+        std::pair<double, bool> preview = getPreview();
+        if (cmds_.size() > 1)
+        {
+            if (!preview.second) cmdsOutput_ += "\n= Division by zero";
+            else if (!std::isnan(preview.first)) cmdsOutput_ += "\n= " + std::to_string(preview.first);
+        }
     }
 
     system("cls");
     std::cout << "---------------------------------------------------------------------------------------" << std::endl;
     std::cout << "Console Calculator" << std::endl;
     std::cout << "---------------------------------------------------------------------------------------" << std::endl;
-    std::cout << "Please enter one number or operator at a time." << std::endl;
+    std::cout << "Please enter numbers and operators one at a time, or an expression such as 3*(4+5)/2." << std::endl;
     std::cout << "Only '+', '-', '*', '/', '(', ')' or '=' operators are supported." << std::endl;
     std::cout << "Enter 'u' to undo, 'r' to redo." << std::endl;
     std::cout << "---------------------------------------------------------------------------------------" << std::endl;
@@ -175,166 +275,114 @@ void Calculator::show()
 
 bool Calculator::appendNumberCmd(std::vector<std::unique_ptr<Command>> &dst, std::unique_ptr<Command> src)
 {
-    if (dst.empty()) return false;
-
-    if (dst.size() == 1 && PtrAs<NumberCmd>(dst[0].get())) // 上書き
-    {
-        dst.clear();
-        dst.emplace_back(std::move(src));
-        return true;
-    }
-    else if (!PtrAs<NumberCmd>(dst.back().get()) && !PtrAs<RightParenCmd>(dst.back().get()))
-    {
-        dst.emplace_back(std::move(src));
-        return true;
-    }
-
-    return false;
+    return AppendToCmds(dst, std::move(src));
 }
 
-std::pair<double, bool> Calculator::add(double leftNum, double rightNum)
+std::pair<double, bool> Calculator::add(double leftNum, double rightNum) const
 {
-    return std::make_pair(leftNum + rightNum, true);
+    return ApplyOpe(CmdType::add, leftNum, rightNum);
 }
 
-std::pair<double, bool> Calculator::subtract(double leftNum, double rightNum)
+std::pair<double, bool> Calculator::subtract(double leftNum, double rightNum) const
 {
-    return std::make_pair(leftNum - rightNum, true);
+    return ApplyOpe(CmdType::subtract, leftNum, rightNum);
 }
 
-std::pair<double, bool> Calculator::multiply(double leftNum, double rightNum)
+std::pair<double, bool> Calculator::multiply(double leftNum, double rightNum) const
 {
-    return std::make_pair(leftNum * rightNum, true);
+    return ApplyOpe(CmdType::multiply, leftNum, rightNum);
 }
 
-std::pair<double, bool> Calculator::divide(double leftNum, double rightNum)
+std::pair<double, bool> Calculator::divide(double leftNum, double rightNum) const
 {
-    if (rightNum == 0.0)
-    {
-        cmdsOutput_ = "Error : Division by zero";
-        error_ = true;
-        return std::make_pair(0.0, false);
-    }
-
-    return std::make_pair(leftNum / rightNum, true);
+    return ApplyOpe(CmdType::divide, leftNum, rightNum);
 }
 
 bool Calculator::appendOpeCmd(std::vector<std::unique_ptr<Command>> &dst, std::unique_ptr<Command> src)
 {
-    if (dst.empty()) return false;
-
-    if (dst.size() == 1 && PtrAs<NumberCmd>(dst[0].get()))
-    {
-        dst.emplace_back(std::move(src));
-        return true;
-    }
-    else if (PtrAs<NumberCmd>(dst.back().get()))
-    {
-        dst.emplace_back(std::move(src));
-        return true;
-    }
-    else if (PtrAs<RightParenCmd>(dst.back().get()))
-    {
-        dst.emplace_back(std::move(src));
-        return true;
-    }
-
-    return false;
+    return AppendToCmds(dst, std::move(src));
 }
 
 bool Calculator::appendLeftParenCmd(std::vector<std::unique_ptr<Command>> &dst, std::unique_ptr<Command> src)
 {
-    if (dst.empty()) return false;
-
-    if (dst.size() == 1 && PtrAs<NumberCmd>(dst[0].get())) // 上書き
-    {
-        dst.clear();
-        dst.emplace_back(std::move(src));
-        return true;
-    }
-    else if (!PtrAs<NumberCmd>(dst.back().get()) && !PtrAs<RightParenCmd>(dst.back().get()))
-    {
-        dst.emplace_back(std::move(src));
-        return true;
-    }
-
-    return false;
+    return AppendToCmds(dst, std::move(src));
 }
 
 bool Calculator::appendRightParenCmd(std::vector<std::unique_ptr<Command>> &dst, std::unique_ptr<Command> src)
 {
-    if (dst.empty()) return false;
-
-    if (PtrAs<NumberCmd>(dst.back().get()) || PtrAs<RightParenCmd>(dst.back().get()))
-    {
-        dst.emplace_back(std::move(src));
-        return true;
-    }
-
-    return false;
+    return AppendToCmds(dst, std::move(src));
 }
 
 void Calculator::execute()
 {
     if (cmds_.size() >= 3) // 計算が行える場合、計算を行う
     {
-        if (inParenDepth != 0) // 括弧が閉じられていない場合
+        // 評価はEngineに任せ、状態に応じてエラーメッセージを表示する
+        double result = 0.0;
+        EvalStatus status = (cache_ != nullptr) ? 
+            Engine::Evaluate(cmds_, names_, *cache_, result) : Engine::Evaluate(cmds_, names_, nullptr, result);
+        if (status == EvalStatus::syntaxError) return; // 式が完成していない場合
+        if (status != EvalStatus::success)
         {
-            cmdsOutput_ = "Error : Parentheses are not closed";
-            error_ = true;
+            setError(Engine::ToMessage(status));
             return;
         }
 
-        // 逆ポーランド記法に変換
-        std::queue<std::unique_ptr<Command>> rpnCmds = RPN::ToRPN(cmds_.begin(), cmds_.end());
-
-        // // 逆ポーランド記法から計算
-        std::unique_ptr<Command> result = RPN::CalcFromRPN
-        (
-            this, std::move(rpnCmds), std::make_unique<NumberCmd>()
-        );
-
-        if (result == nullptr || error_) return; // 計算に失敗した場合
-
-        // 計算結果を追加
+        // 計算結果に置き換え、式は履歴に残す
         cmds_.clear();
-        cmds_.emplace_back(std::move(result));
-
-        // 履歴を結果から初期化
-        history_.clear();
-
-        std::unique_ptr<Command> numCmd = std::make_unique<NumberCmd>();
-        PtrAs<NumberCmd>(numCmd.get())->setNum(idleNum_);
+        cmds_.push_back({CmdType::number, 0, result});
+        live_.clear();
+        live_.push(cmds_.back());
 
-        history_.emplace_back(std::move(numCmd)); // 初期数値を履歴に追加
-        history_.emplace_back(cmds_.back().get()->clone()); // 結果を履歴に追加
-
-        historyIt_ =  history_.end() - 1; // イテレーターを履歴の最後に
+        history_.push(EditType::execute, cmds_.back());
     }
 }
 
 void Calculator::undo()
 {
-    if (cmds_.size() == 1) // これ以上戻れない場合
+    EditType type = history_.getCurrent().type;
+    if (!history_.undo()) return; // これ以上戻れない場合
+
+    switch (type)
     {
+    case EditType::append:
         cmds_.pop_back();
-        std::unique_ptr<Command> numCmd = std::make_unique<NumberCmd>();
-        PtrAs<NumberCmd>(numCmd.get())->setNum(idleNum_);
+        live_.pop();
+        break;
+
+    case EditType::replace:
+        cmds_.back() = history_.getCurrent().token;
+        live_.pop();
+        live_.push(cmds_.back());
+        break;
+
+    default:
+        rebuildCmds();
+        break;
+    }
+}
 
-        cmds_.emplace_back(std::move(numCmd));
+void Calculator::redo()
+{
+    if (!history_.redo()) return; // これ以上進めない場合
 
-        historyIt_ = history_.begin();
+    const HistoryEdit& edit = history_.getCurrent();
+    if (edit.type == EditType::execute)
+    {
+        cmds_.clear();
+        cmds_.push_back(edit.token);
+        live_.clear();
+        live_.push(edit.token);
         return;
     }
 
-    cmds_.pop_back();
-    historyIt_--;
+    appendToCmds(edit.token);
 }
 
-void Calculator::redo()
+bool Calculator::restore(u32 historyId)
 {
-    if (historyIt_ == history_.end() - 1) return; // これ以上進めない場合
+    if (!history_.restore(historyId)) return false;
 
-    historyIt_++;
-    historyIt_->get()->append(this, cmds_);
+    rebuildCmds();
+    return true;
 }
@@ -0,0 +1,87 @@
+﻿#include "pch.h"
+
+#include "cmd_token.h"
+#include "command.h"
+
+#include <array>
+
+namespace
+{
+
+constexpr u32 CMD_TYPE_COUNT = static_cast<u32>(CmdType::variable) + 1;
+
+// 演算子の優先順位はCommandから1度だけ取得する
+std::array<int, CMD_TYPE_COUNT> CreatePriorities()
+{
+    std::array<int, CMD_TYPE_COUNT> priorities = {};
+    priorities[static_cast<u32>(CmdType::add)] = AddCmd().priority();
+    priorities[static_cast<u32>(CmdType::subtract)] = SubtractCmd().priority();
+    priorities[static_cast<u32>(CmdType::multiply)] = MultiplyCmd().priority();
+    priorities[static_cast<u32>(CmdType::divide)] = DivideCmd().priority();
+    return priorities;
+}
+
+}
+
+int CmdTokens::GetPriority(CmdType type)
+{
+    static const std::array<int, CMD_TYPE_COUNT> priorities = CreatePriorities();
+    return priorities[static_cast<u32>(type)];
+}
+
+AppendAction CmdTokens::CheckAppend(size_t size, CmdType firstType, CmdType lastType, CmdType type)
+{
+    if (size == 0) return AppendAction::reject;
+
+    switch (type)
+    {
+    case CmdType::number:
+    case CmdType::variable:
+    case CmdType::leftParen:
+        if (size == 1 && IsOperand(firstType)) return AppendAction::replace;
+        if (!IsOperand(lastType) && lastType != CmdType::rightParen) return AppendAction::append;
+        return AppendAction::reject;
+
+    case CmdType::rightParen:
+        if (IsOperand(lastType) || lastType == CmdType::rightParen) return AppendAction::append;
+        return AppendAction::reject;
+
+    default:
+        if (IsOperand(lastType) || lastType == CmdType::rightParen) return AppendAction::append;
+        return AppendAction::reject;
+    }
+}
+
+bool CmdTokens::Append(std::vector<CmdToken>& dst, const CmdToken& token)
+{
+    if (dst.empty()) return false;
+
+    switch (CheckAppend(dst.size(), dst.front().type, dst.back().type, token.type))
+    {
+    case AppendAction::append:
+        dst.push_back(token);
+        return true;
+
+    case AppendAction::replace:
+        dst.back() = token;
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+std::string CmdTokens::ToString(const CmdToken& token, const std::vector<std::string>& names)
+{
+    switch (token.type)
+    {
+    case CmdType::number: return std::to_string(token.num);
+    case CmdType::variable: return (token.nameIndex < names.size()) ? names[token.nameIndex] : std::string();
+    case CmdType::add: return "+";
+    case CmdType::subtract: return "-";
+    case CmdType::multiply: return "*";
+    case CmdType::divide: return "/";
+    case CmdType::leftParen: return "(";
+    default: return ")";
+    }
+}
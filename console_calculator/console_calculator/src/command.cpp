@@ -13,6 +13,16 @@ bool NumberCmd::append(Calculator* calculator, std::vector<std::unique_ptr<Comma
     return calculator->appendNumberCmd(dst, this->clone());
 }
 
+std::pair<double, bool> VariableCmd::execute(Calculator* calculator, double leftNum, double rightNum)
+{
+    return std::make_pair(0.0, false); // 値はBytecode::Runなどで評価する時に渡す
+}
+
+bool VariableCmd::append(Calculator* calculator, std::vector<std::unique_ptr<Command>> &dst)
+{
+    return calculator->appendNumberCmd(dst, this->clone());
+}
+
 std::pair<double, bool> AddCmd::execute(Calculator* calculator, double leftNum, double rightNum)
 {
     return calculator->add(leftNum, rightNum);
@@ -0,0 +1,97 @@
+﻿#include "pch.h"
+
+#include "edit_history.h"
+
+#include <algorithm>
+
+EditHistory::EditHistory(const CmdToken& initialToken, u32 maxEditCount)
+: maxEditCount_(std::max(1u, maxEditCount))
+{
+    edits_.push_back({initialToken, NO_EDIT, NO_EDIT, NO_EDIT, EditType::initial});
+}
+
+void EditHistory::push(EditType type, const CmdToken& token)
+{
+    const HistoryEdit& current = edits_[current_];
+
+    u32 previous = NO_EDIT;
+    if (type == EditType::append) previous = current_;
+    else if (type == EditType::replace) previous = current.previous;
+
+    u32 id = static_cast<u32>(edits_.size());
+    edits_[current_].redo = id;
+    edits_.push_back({token, current_, previous, NO_EDIT, type});
+    current_ = id;
+
+    if (edits_.size() > static_cast<size_t>(maxEditCount_) * 2) compact();
+}
+
+bool EditHistory::undo()
+{
+    u32 parent = edits_[current_].parent;
+    if (parent == NO_EDIT) return false;
+
+    edits_[parent].redo = current_;
+    current_ = parent;
+    return true;
+}
+
+bool EditHistory::redo()
+{
+    u32 child = edits_[current_].redo;
+    if (child == NO_EDIT) return false;
+
+    current_ = child;
+    return true;
+}
+
+bool EditHistory::restore(u32 id)
+{
+    if (id >= edits_.size()) return false;
+
+    current_ = id;
+    return true;
+}
+
+void EditHistory::getTokens(u32 id, std::vector<CmdToken>& rtTokens) const
+{
+    rtTokens.clear();
+    for (u32 it = id; it != NO_EDIT; it = edits_[it].previous) rtTokens.push_back(edits_[it].token);
+    std::reverse(rtTokens.begin(), rtTokens.end());
+}
+
+void EditHistory::compact()
+{
+    // 新しい編集と現在の位置、それらのトークン列が参照する編集を残す。参照は常に古い編集を指す
+    u32 first = static_cast<u32>(edits_.size()) - maxEditCount_;
+    std::vector<u32> newIds(edits_.size(), NO_EDIT);
+    std::vector<bool> isKept(edits_.size(), false);
+    isKept[current_] = true;
+    for (u32 id = static_cast<u32>(edits_.size()); id-- > 0;)
+    {
+        if (id >= first) isKept[id] = true;
+        if (isKept[id] && edits_[id].previous != NO_EDIT) isKept[edits_[id].previous] = true;
+    }
+
+    u32 count = 0;
+    for (u32 id = 0; id < edits_.size(); ++id)
+    {
+        if (!isKept[id]) continue;
+
+        HistoryEdit edit = edits_[id];
+        edit.parent = (edit.parent != NO_EDIT) ? newIds[edit.parent] : NO_EDIT;
+        edit.previous = (edit.previous != NO_EDIT) ? newIds[edit.previous] : NO_EDIT;
+
+        newIds[id] = count;
+        edits_[count++] = edit;
+    }
+    edits_.resize(count);
+
+    // やり直す先は新しい編集を指すため、番号を付け直した後に変換する
+    for (HistoryEdit& edit : edits_)
+    {
+        if (edit.redo == NO_EDIT) continue;
+        edit.redo = (edit.redo < newIds.size()) ? newIds[edit.redo] : NO_EDIT;
+    }
+    current_ = newIds[current_];
+}
@@ -0,0 +1,254 @@
+﻿#include "pch.h"
+
+#include "engine.h"
+
+#include "eval_cache.h"
+#include "parser.h"
+
+namespace
+{
+
+// スレッドごとに再利用する作業用の命令列
+thread_local Program g_workspace;
+
+// トークンの列を作業用の命令列に変換する
+EvalStatus CompileTokens(const std::vector<CmdToken>& tokens, const std::vector<std::string>& names)
+{
+    // 括弧の対応を先に確かめ、構文エラーと区別する
+    s32 depth = 0;
+    for (const CmdToken& token : tokens)
+    {
+        if (token.type == CmdType::leftParen) depth++;
+        else if (token.type == CmdType::rightParen && --depth < 0) return EvalStatus::unmatchedParen;
+    }
+    if (depth != 0) return EvalStatus::unmatchedParen;
+
+    if (!Bytecode::Compile(tokens, names, g_workspace)) return EvalStatus::syntaxError;
+    return EvalStatus::success;
+}
+
+// 括弧の入れ子の上限。再帰が深くなりすぎないようにする
+constexpr u32 MAX_NEST_DEPTH = 256;
+
+// Parserと同じ構文の式を、命令列を作らずに多倍長の10進数で直接計算する
+class ExactEvaluator
+{
+private:
+    Tokenizer tokenizer_;
+    u32 divisionScale_;
+    Token current_ = {CmdType::number};
+    bool hasCurrent_ = false;
+    u32 nest_ = 0;
+    EvalStatus status_ = EvalStatus::success;
+    size_t errorPos_ = 0;
+
+    void advance()
+    {
+        hasCurrent_ = tokenizer_.next(current_);
+    }
+
+    bool fail(EvalStatus status, size_t position)
+    {
+        status_ = status;
+        errorPos_ = position;
+        return false;
+    }
+
+    bool isBinaryOpe() const
+    {
+        return hasCurrent_ && Parser::GetPriority(current_.type) > 0;
+    }
+
+    bool parseOperand(BigDecimal& rtValue)
+    {
+        if (!hasCurrent_) return fail(EvalStatus::syntaxError, tokenizer_.getPosition());
+
+        Token token = current_;
+        switch (token.type)
+        {
+        case CmdType::number:
+            // doubleを経由せず、書かれた通りの文字列から作る
+            if (!BigDecimal::FromString(token.name, rtValue)) return fail(EvalStatus::syntaxError, token.position);
+            advance();
+            return true;
+
+        case CmdType::variable:
+            return fail(EvalStatus::unboundVariable, token.position);
+
+        case CmdType::leftParen:
+            if (nest_ == MAX_NEST_DEPTH) return fail(EvalStatus::syntaxError, token.position);
+
+            nest_++;
+            advance();
+            if (!parseExpression(1, rtValue)) return false;
+            if (!hasCurrent_ || current_.type != CmdType::rightParen)
+            {
+                return fail(EvalStatus::syntaxError, hasCurrent_ ? current_.position : tokenizer_.getPosition());
+            }
+
+            nest_--;
+            advance();
+            return true;
+
+        case CmdType::subtract:
+        case CmdType::add:
+        {
+            // 単項演算子。続けて書かれた符号は再帰せずにまとめ、-が奇数個の場合だけ符号を反転する
+            bool isNegative = false;
+            while (hasCurrent_ && (current_.type == CmdType::subtract || current_.type == CmdType::add))
+            {
+                if (current_.type == CmdType::subtract) isNegative = !isNegative;
+                advance();
+            }
+            if (!parseOperand(rtValue)) return false;
+            if (isNegative) rtValue.negate();
+            return true;
+        }
+
+        default:
+            return fail(EvalStatus::syntaxError, token.position);
+        }
+    }
+
+public:
+    ExactEvaluator(std::string_view text, u32 divisionScale)
+    : tokenizer_(text, true), divisionScale_(divisionScale)
+    {
+    }
+
+    // minPriority以上の優先順位の演算子を左結合で計算する
+    bool parseExpression(int minPriority, BigDecimal& rtValue)
+    {
+        if (!parseOperand(rtValue)) return false;
+
+        while (isBinaryOpe())
+        {
+            int priority = Parser::GetPriority(current_.type);
+            if (priority < minPriority) break;
+
+            Token ope = current_;
+            advance();
+
+            BigDecimal right;
+            if (!parseExpression(priority + 1, right)) return false;
+
+            switch (ope.type)
+            {
+            case CmdType::add: rtValue = BigDecimal::Add(rtValue, right); break;
+            case CmdType::subtract: rtValue = BigDecimal::Subtract(rtValue, right); break;
+            case CmdType::multiply: rtValue = BigDecimal::Multiply(rtValue, right); break;
+            default:
+                if (!BigDecimal::Divide(rtValue, right, divisionScale_, rtValue))
+                {
+                    return fail(EvalStatus::divisionByZero, ope.position);
+                }
+                break;
+            }
+        }
+
+        return true;
+    }
+
+    EvalStatus evaluate(BigDecimal& rtResult)
+    {
+        advance();
+        if (!parseExpression(1, rtResult)) return status_;
+        if (hasCurrent_) fail(EvalStatus::syntaxError, current_.position);
+        else if (tokenizer_.isError()) fail(EvalStatus::syntaxError, tokenizer_.getPosition());
+
+        return status_;
+    }
+
+    size_t getErrorPos() const
+    {
+        return (tokenizer_.isError()) ? tokenizer_.getPosition() : errorPos_;
+    }
+};
+
+}
+
+const char* Engine::ToMessage(EvalStatus status)
+{
+    switch (status)
+    {
+    case EvalStatus::success: return "";
+    case EvalStatus::syntaxError: return "Error : Syntax error";
+    case EvalStatus::unmatchedParen: return "Error : Parentheses are not closed";
+    case EvalStatus::divisionByZero: return "Error : Division by zero";
+    default: return "Error : Variable is not set";
+    }
+}
+
+EvalStatus Engine::Apply(CmdType type, double leftNum, double rightNum, double& rtResult)
+{
+    switch (type)
+    {
+    case CmdType::add: rtResult = leftNum + rightNum; break;
+    case CmdType::subtract: rtResult = leftNum - rightNum; break;
+    case CmdType::multiply: rtResult = leftNum * rightNum; break;
+    case CmdType::divide:
+        if (rightNum == 0.0) return EvalStatus::divisionByZero;
+        rtResult = leftNum / rightNum;
+        break;
+
+    default: return EvalStatus::syntaxError;
+    }
+
+    return EvalStatus::success;
+}
+
+EvalStatus Engine::Run(const Program& program, const double* variables, double& rtResult)
+{
+    if (!program.variables.empty() && variables == nullptr) return EvalStatus::unboundVariable;
+
+    std::pair<double, bool> result = Bytecode::Run(program, variables);
+    if (!result.second) return EvalStatus::divisionByZero;
+
+    rtResult = result.first;
+    return EvalStatus::success;
+}
+
+EvalStatus Engine::Evaluate
+(
+    const std::vector<CmdToken>& tokens, const std::vector<std::string>& names,
+    const double* variables, double& rtResult
+){
+    EvalStatus status = CompileTokens(tokens, names);
+    if (status != EvalStatus::success) return status;
+    return Run(g_workspace, variables, rtResult);
+}
+
+EvalStatus Engine::Evaluate(std::string_view text, const double* variables, double& rtResult, size_t& rtErrorPos)
+{
+    if (!Parser::Parse(text, g_workspace, rtErrorPos)) return EvalStatus::syntaxError;
+    return Run(g_workspace, variables, rtResult);
+}
+
+EvalStatus Engine::Evaluate
+(
+    const std::vector<CmdToken>& tokens, const std::vector<std::string>& names, EvalCache& cache, double& rtResult
+){
+    EvalStatus status = CompileTokens(tokens, names);
+    if (status != EvalStatus::success) return status;
+    return cache.evaluate(g_workspace, rtResult);
+}
+
+EvalStatus Engine::Evaluate(std::string_view text, EvalCache& cache, double& rtResult, size_t& rtErrorPos)
+{
+    // 同じ文字列の結果がある場合は解析も省略する
+    EvalStatus status = EvalStatus::success;
+    if (cache.findText(text, status, rtResult)) return status;
+
+    if (!Parser::Parse(text, g_workspace, rtErrorPos)) return EvalStatus::syntaxError;
+    status = cache.evaluate(g_workspace, rtResult);
+    if (g_workspace.variables.empty()) cache.insertText(text, status, rtResult);
+    return status;
+}
+
+EvalStatus Engine::EvaluateExact(std::string_view text, u32 divisionScale, BigDecimal& rtResult, size_t& rtErrorPos)
+{
+    ExactEvaluator evaluator(text, divisionScale);
+    EvalStatus status = evaluator.evaluate(rtResult);
+    if (status != EvalStatus::success) rtErrorPos = evaluator.getErrorPos();
+    return status;
+}
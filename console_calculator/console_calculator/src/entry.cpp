@@ -1,22 +1,91 @@
 ﻿#include "pch.h"
 
 #include "calculator.h"
-#include "command.h"
+#include "parser.h"
+#include "stream_eval.h"
 
-int main()
+#include <charconv>
+#include <cstring>
+
+namespace
 {
-    std::unique_ptr<Calculator> calculator = std::make_unique<Calculator>();
 
-    std::unordered_map<char, std::unique_ptr<Command>> cmdTable;
-    cmdTable[CMD_NUMBER] = std::make_unique<NumberCmd>();
-    cmdTable['+'] = std::make_unique<AddCmd>();
-    cmdTable['-'] = std::make_unique<SubtractCmd>();
-    cmdTable['*'] = std::make_unique<MultiplyCmd>();
-    cmdTable['/'] = std::make_unique<DivideCmd>();
-    cmdTable['('] = std::make_unique<LeftParenCmd>();
-    cmdTable[')'] = std::make_unique<RightParenCmd>();
+// スレッド数を読み込む。文字列全体が0からStreamEval::MAX_THREAD_COUNTまでの整数でない場合はfalseを返す
+bool ParseThreadCount(const char* text, u32& rtThreadCount)
+{
+    const char* end = text + strlen(text);
+    std::from_chars_result result = std::from_chars(text, end, rtThreadCount);
+    return result.ec == std::errc() && result.ptr == end && rtThreadCount <= StreamEval::MAX_THREAD_COUNT;
+}
+
+// /batch 入力ファイルパス [/o 出力ファイルパス] [/threads スレッド数] [/exact]。入力、出力に-を指定すると標準入出力を使用する。
+// /exactを指定すると多倍長の10進数で誤差なく評価する
+int RunBatch(int argc, char* argv[])
+{
+    auto showUsage = []()
+    {
+        std::cerr << "Usage : console_calculator /batch input|- [/o output|-] [/threads n] [/exact]" << std::endl;
+        return RESULT_FAIL_TO_EXECUTE_CMD;
+    };
+    if (argc < 3) return showUsage();
+
+    std::string inputPath = argv[2];
+    std::string outputPath = "-";
+    u32 threadCount = 1;
+    bool isExact = false;
+    for (int i = 3; i < argc; ++i)
+    {
+        // 値を取るオプションで値が無い場合、値が正しくない場合、知らないオプションの場合は使い方を表示する
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "/exact") == 0) isExact = true;
+        else if (strcmp(argv[i], "/o") == 0 && hasValue) outputPath = argv[++i];
+        else if (strcmp(argv[i], "/threads") == 0 && hasValue)
+        {
+            if (!ParseThreadCount(argv[++i], threadCount)) return showUsage();
+        }
+        else return showUsage();
+    }
+
+    FILE* input = (inputPath == "-") ? stdin : std::fopen(inputPath.c_str(), "rb");
+    if (input == nullptr)
+    {
+        std::cerr << "Error : Failed to open " << inputPath << std::endl;
+        return RESULT_FAIL_TO_EXECUTE_CMD;
+    }
+
+    FILE* output = (outputPath == "-") ? stdout : std::fopen(outputPath.c_str(), "wb");
+    if (output == nullptr)
+    {
+        std::cerr << "Error : Failed to open " << outputPath << std::endl;
+        if (input != stdin) std::fclose(input);
+        return RESULT_FAIL_TO_EXECUTE_CMD;
+    }
+
+    size_t errorCount = 0;
+    bool succeeded = StreamEval::Run(input, output, threadCount, errorCount, isExact);
+
+    if (input != stdin) std::fclose(input);
+    if (output != stdout && std::fclose(output) != 0) succeeded = false;
+
+    if (!succeeded)
+    {
+        std::cerr << "Error : Failed to read or write" << std::endl;
+        return RESULT_FAIL_TO_EXECUTE_CMD;
+    }
+
+    // 評価できなかった行がある場合は失敗として返す
+    if (errorCount != 0) std::cerr << errorCount << " lines failed" << std::endl;
+    return (errorCount == 0) ? RESULT_SUCCESS : RESULT_FAIL_TO_EXECUTE_CMD;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "/batch") == 0) return RunBatch(argc, argv);
+
+    std::unique_ptr<Calculator> calculator = std::make_unique<Calculator>();
 
-    bool result = true;
     std::string input;
 
     while (true)
@@ -24,42 +93,35 @@ int main()
         calculator->show();
         if (calculator->getError()) return RESULT_FAIL_TO_EXECUTE_CMD;
 
-        std::cin >> input;
-        if (std::isdigit(input[0]) || (input[0] == '-' && input.size() > 1)) // 数値の場合
-        {
-            NumberCmd* numCmd = PtrAs<NumberCmd>(cmdTable[CMD_NUMBER].get());
-            if (numCmd == nullptr) return RESULT_FAIL_TO_EXECUTE_CMD;
-            numCmd->setNum(std::stod(input));
+        if (!(std::cin >> input)) break; // 入力の終端
 
-            calculator->appendCmd(cmdTable[CMD_NUMBER]);
+        if (input[0] == CMD_UNDO)
+        {
+            calculator->undo();
+            continue;
+        }
+        else if (input[0] == CMD_REDO)
+        {
+            calculator->redo();
+            continue;
         }
-        else // 数値以外の場合
+        else if (input[0] == CMD_EXECUTE)
         {
-            if (input[0] == CMD_UNDO)
-            {
-                calculator->undo();
-                continue;
-            }
-            else if (input[0] == CMD_REDO)
-            {
-                calculator->redo();
-                continue;
-            }
-            else if (input[0] == CMD_EXECUTE)
-            {
-                calculator->execute();
-                continue;
-            }
-
-            // 登録されているか確認
-            if (cmdTable.find(input[0]) == cmdTable.end())
-            {
-                calculator->setError("Error : Command not found");
-                continue;
-            }
-
-            calculator->appendCmd(cmdTable[input[0]]);
+            calculator->execute();
+            continue;
         }
+
+        // 3*(4+5)のように続けて入力されたトークンを順に追加する
+        Tokenizer tokenizer(input);
+        Token token;
+        while (tokenizer.next(token))
+        {
+            if (token.type == CmdType::variable) calculator->appendToken(calculator->toVariableToken(token.name));
+            else calculator->appendToken({token.type, 0, token.num});
+        }
+
+        // 登録されていない文字がある場合
+        if (tokenizer.isError()) calculator->setError("Error : Command not found");
     }
 
     return RESULT_SUCCESS;
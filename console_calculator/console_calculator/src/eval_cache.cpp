@@ -0,0 +1,211 @@
+﻿#include "pch.h"
+
+#include "eval_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+
+// 8バイトずつ混ぜるハッシュ。上位のビットで区画を選ぶため、最後に全てのビットを混ぜる
+u64 HashBytes(std::string_view bytes)
+{
+    constexpr u64 MULTIPLIER = 0x9e3779b97f4a7c15ull;
+
+    u64 hash = bytes.size() * MULTIPLIER;
+    size_t pos = 0;
+    for (; pos + 8 <= bytes.size(); pos += 8)
+    {
+        u64 word = 0;
+        memcpy(&word, bytes.data() + pos, sizeof(word));
+        hash = (hash ^ word) * MULTIPLIER;
+        hash = (hash << 29) | (hash >> 35);
+    }
+
+    u64 rest = 0;
+    if (pos < bytes.size()) memcpy(&rest, bytes.data() + pos, bytes.size() - pos);
+    hash = (hash ^ rest) * MULTIPLIER;
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// 命令列を正規形のバイト列にする。命令の間の詰め物は含めず、数値はビット列のまま並べる
+std::string_view ToKey(const Program& program)
+{
+    constexpr size_t INSTRUCTION_SIZE = sizeof(OpCode) + sizeof(u32) + sizeof(double);
+    thread_local std::string key;
+
+    key.resize(program.code.size() * INSTRUCTION_SIZE);
+    char* it = key.data();
+    for (const Instruction& inst : program.code)
+    {
+        memcpy(it, &inst.op, sizeof(OpCode));
+        memcpy(it + sizeof(OpCode), &inst.index, sizeof(u32));
+        memcpy(it + sizeof(OpCode) + sizeof(u32), &inst.num, sizeof(double));
+        it += INSTRUCTION_SIZE;
+    }
+
+    return key;
+}
+
+}
+
+bool EvalCache::Table::find(u64 hash, std::string_view key, EvalStatus& rtStatus, double& rtResult)
+{
+    Shard& shard = getShard(hash);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.index.find(hash);
+    if (found == shard.index.end() || found->second->key != key)
+    {
+        shard.missCount++;
+        return false;
+    }
+
+    // 最後に使用した結果として先頭に移動する
+    shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+    shard.hitCount++;
+
+    rtStatus = found->second->status;
+    rtResult = found->second->result;
+    return true;
+}
+
+void EvalCache::Table::insert(u64 hash, std::string_view key, EvalStatus status, double result, size_t capacity)
+{
+    Shard& shard = getShard(hash);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.index.find(hash);
+    if (found != shard.index.end())
+    {
+        // 同じハッシュの別のキーは新しい方で置き換える
+        Entry& entry = *found->second;
+        entry.key = key;
+        entry.status = status;
+        entry.result = result;
+        shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+        return;
+    }
+
+    shard.entries.push_front({hash, std::string(key), status, result});
+    shard.index.emplace(hash, shard.entries.begin());
+
+    if (shard.entries.size() > capacity)
+    {
+        shard.index.erase(shard.entries.back().hash);
+        shard.entries.pop_back();
+    }
+}
+
+void EvalCache::Table::clear()
+{
+    for (u32 i = 0; i < SHARD_COUNT; ++i)
+    {
+        std::lock_guard<std::mutex> lock(shards[i].mutex);
+        shards[i].entries.clear();
+        shards[i].index.clear();
+        shards[i].hitCount = 0;
+        shards[i].missCount = 0;
+    }
+}
+
+EvalCache::EvalCache(size_t capacity)
+: shardCapacity_(std::max<size_t>(1, capacity / SHARD_COUNT))
+{
+    programs_.shards = std::make_unique<Shard[]>(SHARD_COUNT);
+    texts_.shards = std::make_unique<Shard[]>(SHARD_COUNT);
+}
+
+bool EvalCache::find(const Program& program, EvalStatus& rtStatus, double& rtResult)
+{
+    std::string_view key = ToKey(program);
+    return programs_.find(HashBytes(key), key, rtStatus, rtResult);
+}
+
+void EvalCache::insert(const Program& program, EvalStatus status, double result)
+{
+    std::string_view key = ToKey(program);
+    programs_.insert(HashBytes(key), key, status, result, shardCapacity_);
+}
+
+bool EvalCache::findText(std::string_view text, EvalStatus& rtStatus, double& rtResult)
+{
+    return texts_.find(HashBytes(text), text, rtStatus, rtResult);
+}
+
+void EvalCache::insertText(std::string_view text, EvalStatus status, double result)
+{
+    texts_.insert(HashBytes(text), text, status, result, shardCapacity_);
+}
+
+EvalStatus EvalCache::evaluate(const Program& program, double& rtResult)
+{
+    if (!program.variables.empty()) return Engine::Run(program, nullptr, rtResult);
+
+    std::string_view key = ToKey(program);
+    u64 hash = HashBytes(key);
+    EvalStatus status = EvalStatus::success;
+    if (programs_.find(hash, key, status, rtResult)) return status;
+
+    status = Engine::Run(program, nullptr, rtResult);
+    programs_.insert(hash, key, status, rtResult, shardCapacity_);
+    return status;
+}
+
+u64 EvalCache::getHitCount()
+{
+    u64 count = 0;
+    for (u32 i = 0; i < SHARD_COUNT; ++i)
+    {
+        std::lock_guard<std::mutex> programLock(programs_.shards[i].mutex);
+        std::lock_guard<std::mutex> textLock(texts_.shards[i].mutex);
+        count += programs_.shards[i].hitCount + texts_.shards[i].hitCount;
+    }
+
+    return count;
+}
+
+u64 EvalCache::getMissCount()
+{
+    // 文字列で見つからなくても、命令列で見つかった場合は評価しないため数えない
+    u64 count = 0;
+    for (u32 i = 0; i < SHARD_COUNT; ++i)
+    {
+        std::lock_guard<std::mutex> lock(programs_.shards[i].mutex);
+        count += programs_.shards[i].missCount;
+    }
+
+    return count;
+}
+
+double EvalCache::getHitRate()
+{
+    u64 hitCount = getHitCount();
+    u64 total = hitCount + getMissCount();
+    return (total == 0) ? 0.0 : static_cast<double>(hitCount) / total;
+}
+
+size_t EvalCache::size()
+{
+    size_t count = 0;
+    for (u32 i = 0; i < SHARD_COUNT; ++i)
+    {
+        std::lock_guard<std::mutex> lock(programs_.shards[i].mutex);
+        count += programs_.shards[i].entries.size();
+    }
+
+    return count;
+}
+
+void EvalCache::clear()
+{
+    programs_.clear();
+    texts_.clear();
+}
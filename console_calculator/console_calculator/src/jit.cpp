@@ -0,0 +1,305 @@
+﻿#include "pch.h"
+
+#include "jit.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__linux__) && defined(__x86_64__)
+#include <sys/mman.h>
+#define CALCULATOR_USE_JIT
+#endif
+
+namespace
+{
+
+#ifdef CALCULATOR_USE_JIT
+
+constexpr u8 ZERO_REGISTER = 15;
+
+// 機械語を組み立てる。定数はコードの後ろにまとめ、RIP相対で読み込む
+class Assembler
+{
+private:
+    std::vector<u8> code_;
+    std::vector<double> constants_;
+    std::vector<std::pair<size_t, u32>> constantPatches_; // disp32の位置と定数の番号
+    std::vector<size_t> errorPatches_; // エラー処理へのrel32の位置
+
+    void emit(u8 byte) { code_.push_back(byte); }
+
+    void emit32(u32 value)
+    {
+        for (u32 i = 0; i < 4; ++i) emit(static_cast<u8>(value >> (i * 8)));
+    }
+
+    void patch32(size_t pos, s32 value)
+    {
+        for (u32 i = 0; i < 4; ++i) code_[pos + i] = static_cast<u8>(static_cast<u32>(value) >> (i * 8));
+    }
+
+    // REXプレフィックス。regがModRMのreg、rmがModRMのrmに入るレジスタ
+    void emitRex(u8 reg, u8 rm)
+    {
+        u8 rex = 0x40 | ((reg >= 8) ? 0x04 : 0) | ((rm >= 8) ? 0x01 : 0);
+        if (rex != 0x40) emit(rex);
+    }
+
+    void emitModRM(u8 mod, u8 reg, u8 rm)
+    {
+        emit(static_cast<u8>((mod << 6) | ((reg & 7) << 3) | (rm & 7)));
+    }
+
+public:
+    // pxor xmm15, xmm15
+    void zeroRegister()
+    {
+        emit(0x66);
+        emitRex(ZERO_REGISTER, ZERO_REGISTER);
+        emit(0x0F); emit(0xEF);
+        emitModRM(3, ZERO_REGISTER, ZERO_REGISTER);
+    }
+
+    // movsd xmm, [rip + 定数]
+    void loadConstant(u8 reg, double num)
+    {
+        emit(0xF2);
+        emitRex(reg, 0);
+        emit(0x0F); emit(0x10);
+        emitModRM(0, reg, 5);
+
+        constantPatches_.emplace_back(code_.size(), static_cast<u32>(constants_.size()));
+        constants_.push_back(num);
+        emit32(0);
+    }
+
+    // movsd xmm, [rdi + index * 8]
+    void loadVariable(u8 reg, u32 index)
+    {
+        emit(0xF2);
+        emitRex(reg, 0);
+        emit(0x0F); emit(0x10);
+        emitModRM(2, reg, 7);
+        emit32(index * 8);
+    }
+
+    // movapd xmm, xmm
+    void move(u8 dst, u8 src)
+    {
+        emit(0x66);
+        emitRex(dst, src);
+        emit(0x0F); emit(0x28);
+        emitModRM(3, dst, src);
+    }
+
+    // addsd、subsd、mulsd、divsd xmm, xmm
+    void arithmetic(OpCode op, u8 dst, u8 src)
+    {
+        u8 opcode = 0x58;
+        if (op == OpCode::subtract) opcode = 0x5C;
+        else if (op == OpCode::multiply) opcode = 0x59;
+        else if (op == OpCode::divide) opcode = 0x5E;
+
+        emit(0xF2);
+        emitRex(dst, src);
+        emit(0x0F); emit(opcode);
+        emitModRM(3, dst, src);
+    }
+
+    // ucomisd xmm, xmm15 の後、0と等しい場合はエラー処理へ飛ぶ。NaNの場合はPFが立つため飛ばない
+    void checkZero(u8 reg)
+    {
+        emit(0x66);
+        emitRex(reg, ZERO_REGISTER);
+        emit(0x0F); emit(0x2E);
+        emitModRM(3, reg, ZERO_REGISTER);
+
+        emit(0x7A); emit(0x06); // jp +6
+        emit(0x0F); emit(0x84); // je rel32
+        errorPatches_.push_back(code_.size());
+        emit32(0);
+    }
+
+    // movsd [rsi], xmm0、mov eax, 1、ret
+    void returnResult()
+    {
+        emit(0xF2); emit(0x0F); emit(0x11); emit(0x06);
+        emit(0xB8); emit32(1);
+        emit(0xC3);
+    }
+
+    // エラー処理（xor eax, eax、ret）と定数を配置し、飛び先を埋める
+    std::vector<u8> finish()
+    {
+        size_t errorPos = code_.size();
+        emit(0x31); emit(0xC0);
+        emit(0xC3);
+
+        for (size_t pos : errorPatches_) patch32(pos, static_cast<s32>(errorPos - (pos + 4)));
+
+        while (code_.size() % sizeof(double) != 0) emit(0xCC);
+        size_t constantPos = code_.size();
+        for (double num : constants_)
+        {
+            u8 bytes[sizeof(double)];
+            memcpy(bytes, &num, sizeof(double));
+            code_.insert(code_.end(), bytes, bytes + sizeof(double));
+        }
+
+        for (const auto& [pos, index] : constantPatches_)
+        {
+            size_t target = constantPos + index * sizeof(double);
+            patch32(pos, static_cast<s32>(target - (pos + 4)));
+        }
+
+        return std::move(code_);
+    }
+};
+
+#endif
+
+}
+
+JitFunction::JitFunction(const Program& program)
+: program_(program)
+{
+    compile();
+}
+
+JitFunction::~JitFunction()
+{
+#ifdef CALCULATOR_USE_JIT
+    if (code_ != nullptr) munmap(code_, codeSize_);
+#endif
+}
+
+void JitFunction::compile()
+{
+#ifdef CALCULATOR_USE_JIT
+    if (program_.code.empty() || program_.stackSize + program_.tempCount > MAX_REGISTER_COUNT) return;
+
+    // スタックの深さをそのままレジスタの番号にする。一時領域はスタックの後ろのレジスタに割り当てる
+    Assembler assembler;
+    bool hasDivide = false;
+    for (const Instruction& inst : program_.code) if (inst.op == OpCode::divide) hasDivide = true;
+    if (hasDivide) assembler.zeroRegister();
+
+    u8 top = 0;
+    for (const Instruction& inst : program_.code)
+    {
+        switch (inst.op)
+        {
+        case OpCode::push:
+            assembler.loadConstant(top++, inst.num);
+            break;
+
+        case OpCode::load:
+            assembler.loadVariable(top++, inst.index);
+            break;
+
+        case OpCode::store:
+            assembler.move(static_cast<u8>(program_.stackSize + inst.index), top - 1);
+            break;
+
+        case OpCode::fetch:
+            assembler.move(top++, static_cast<u8>(program_.stackSize + inst.index));
+            break;
+
+        case OpCode::divide:
+            top--;
+            assembler.checkZero(top);
+            assembler.arithmetic(inst.op, top - 1, top);
+            break;
+
+        default:
+            top--;
+            assembler.arithmetic(inst.op, top - 1, top);
+            break;
+        }
+    }
+
+    assembler.returnResult();
+    std::vector<u8> code = assembler.finish();
+
+    // 書き込んだ後に実行可能に切り替え、書き込みと実行を同時に許可しない
+    void* page = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED) return;
+
+    memcpy(page, code.data(), code.size());
+    if (mprotect(page, code.size(), PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(page, code.size());
+        return;
+    }
+
+    code_ = page;
+    codeSize_ = code.size();
+    func_ = reinterpret_cast<NativeFunc>(page);
+#endif
+}
+
+JitCache::JitCache(size_t capacity)
+: capacity_(std::max<size_t>(1, capacity))
+{
+}
+
+std::shared_ptr<const JitFunction> JitCache::find(u64 hash, const Program& program)
+{
+    auto found = index_.find(hash);
+    if (found == index_.end()) return nullptr;
+
+    for (std::list<Entry>::iterator it : found->second)
+    {
+        if (!Bytecode::IsSame(it->function->getProgram(), program)) continue;
+
+        entries_.splice(entries_.begin(), entries_, it);
+        return it->function;
+    }
+
+    return nullptr;
+}
+
+std::shared_ptr<const JitFunction> JitCache::get(const Program& program)
+{
+    u64 hash = Bytecode::Hash(program);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::shared_ptr<const JitFunction> function = find(hash, program);
+        if (function != nullptr) return function;
+    }
+
+    // 変換はロックの外で行い、同時に追加された場合は先に追加された方を使う
+    std::shared_ptr<const JitFunction> compiled = std::make_shared<JitFunction>(program);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::shared_ptr<const JitFunction> function = find(hash, program);
+    if (function != nullptr) return function;
+
+    entries_.push_front({hash, compiled});
+    index_[hash].push_back(entries_.begin());
+
+    if (entries_.size() > capacity_)
+    {
+        std::list<Entry>::iterator oldest = std::prev(entries_.end());
+        std::vector<std::list<Entry>::iterator>& bucket = index_[oldest->hash];
+        bucket.erase(std::find(bucket.begin(), bucket.end(), oldest));
+        if (bucket.empty()) index_.erase(oldest->hash);
+        entries_.pop_back();
+    }
+
+    return compiled;
+}
+
+size_t JitCache::size()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+void JitCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    index_.clear();
+    entries_.clear();
+}
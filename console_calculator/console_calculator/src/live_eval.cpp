@@ -0,0 +1,171 @@
+﻿#include "pch.h"
+
+#include "live_eval.h"
+
+#include <limits>
+
+namespace
+{
+
+template <typename Operand>
+Operand Apply(CmdType type, const Operand& left, const Operand& right)
+{
+    bool valid = left.valid && right.valid;
+    switch (type)
+    {
+    case CmdType::add: return {left.num + right.num, valid};
+    case CmdType::subtract: return {left.num - right.num, valid};
+    case CmdType::multiply: return {left.num * right.num, valid};
+    default:
+        if (right.num == 0.0) return {0.0, false};
+        return {left.num / right.num, valid};
+    }
+}
+
+}
+
+void LiveEvaluator::popOperand(Operand& rtOperand)
+{
+    // 追加する前からあった要素を初めて取り出す場合は退避する
+    Checkpoint& checkpoint = checkpoints_.back();
+    u32 index = static_cast<u32>(operands_.size() - 1);
+    if (index < checkpoint.operandLow)
+    {
+        savedOperands_.push_back(operands_.back());
+        checkpoint.operandLow = index;
+    }
+
+    rtOperand = operands_.back();
+    operands_.pop_back();
+}
+
+CmdType LiveEvaluator::popOpe()
+{
+    Checkpoint& checkpoint = checkpoints_.back();
+    u32 index = static_cast<u32>(opes_.size() - 1);
+    if (index < checkpoint.opeLow)
+    {
+        savedOpes_.push_back(opes_.back());
+        checkpoint.opeLow = index;
+    }
+
+    CmdType type = opes_.back();
+    opes_.pop_back();
+    return type;
+}
+
+void LiveEvaluator::reduce()
+{
+    CmdType type = popOpe();
+    if (operands_.size() < 2) return; // オペランドが足りない場合は演算子だけを取り除く
+
+    Operand right;
+    Operand left;
+    popOperand(right);
+    popOperand(left);
+    operands_.push_back(Apply(type, left, right));
+}
+
+void LiveEvaluator::clear()
+{
+    operands_.clear();
+    opes_.clear();
+    expectOperand_ = true;
+
+    checkpoints_.clear();
+    savedOperands_.clear();
+    savedOpes_.clear();
+}
+
+void LiveEvaluator::push(const CmdToken& token)
+{
+    checkpoints_.push_back
+    ({
+        static_cast<u32>(operands_.size()), static_cast<u32>(opes_.size()),
+        static_cast<u32>(savedOperands_.size()), static_cast<u32>(savedOpes_.size()), expectOperand_
+    });
+
+    switch (token.type)
+    {
+    case CmdType::number:
+        operands_.push_back({token.num, true});
+        expectOperand_ = false;
+        break;
+
+    case CmdType::variable:
+        operands_.push_back({std::numeric_limits<double>::quiet_NaN(), true});
+        expectOperand_ = false;
+        break;
+
+    case CmdType::leftParen:
+        opes_.push_back(token.type);
+        expectOperand_ = true;
+        break;
+
+    case CmdType::rightParen:
+        // 左括弧まで計算する。括弧内に残る演算子は2つまで
+        while (!opes_.empty() && opes_.back() != CmdType::leftParen) reduce();
+        if (!opes_.empty()) popOpe();
+        expectOperand_ = false;
+        break;
+
+    default:
+    {
+        // 優先順位が同じか高い演算子を計算してから積む
+        int priority = CmdTokens::GetPriority(token.type);
+        while
+        (
+            !opes_.empty() && opes_.back() != CmdType::leftParen &&
+            CmdTokens::GetPriority(opes_.back()) >= priority
+        ) reduce();
+
+        opes_.push_back(token.type);
+        expectOperand_ = true;
+        break;
+    }
+    }
+}
+
+void LiveEvaluator::pop()
+{
+    if (checkpoints_.empty()) return;
+    const Checkpoint& checkpoint = checkpoints_.back();
+
+    // 追加した要素を取り除き、退避した要素を取り出した順と逆に戻す
+    operands_.resize(checkpoint.operandLow);
+    for (size_t i = savedOperands_.size(); i > checkpoint.savedOperandBegin; --i) operands_.push_back(savedOperands_[i - 1]);
+    savedOperands_.resize(checkpoint.savedOperandBegin);
+
+    opes_.resize(checkpoint.opeLow);
+    for (size_t i = savedOpes_.size(); i > checkpoint.savedOpeBegin; --i) opes_.push_back(savedOpes_[i - 1]);
+    savedOpes_.resize(checkpoint.savedOpeBegin);
+
+    expectOperand_ = checkpoint.expectOperand;
+    checkpoints_.pop_back();
+}
+
+std::pair<double, bool> LiveEvaluator::preview() const
+{
+    if (operands_.empty()) return std::make_pair(0.0, true);
+
+    // スタックの演算子は括弧の各段で優先順位の低い順に並ぶため、上から順に計算すればよい
+    Operand result = operands_.back();
+    size_t operandIndex = operands_.size() - 1;
+    bool skipOpe = expectOperand_; // 右のオペランドがない末尾の演算子は計算しない
+    for (size_t i = opes_.size(); i > 0 && operandIndex > 0; --i)
+    {
+        CmdType type = opes_[i - 1];
+        if (type == CmdType::leftParen) continue;
+
+        if (skipOpe)
+        {
+            skipOpe = false;
+            continue;
+        }
+
+        result = Apply(type, operands_[--operandIndex], result);
+    }
+
+    if (!result.valid) return std::make_pair(0.0, false);
+    return std::make_pair(result.num, true);
+}
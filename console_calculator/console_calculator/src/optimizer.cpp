@@ -0,0 +1,291 @@
+﻿#include "pch.h"
+
+#include "optimizer.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+
+constexpr u32 NO_NODE = 0xffffffff;
+
+// DAGのノード。数値と変数は葉で、演算子は左右の子の番号を持つ
+struct Node
+{
+    OpCode op;
+    u32 index;
+    double num;
+    u32 left;
+    u32 right;
+};
+
+u64 ToBits(double num)
+{
+    u64 bits = 0;
+    memcpy(&bits, &num, sizeof(bits));
+    return bits;
+}
+
+struct NodeHash
+{
+    size_t operator()(const Node& node) const
+    {
+        u64 hash = ToBits(node.num);
+        hash = hash * 31 + (static_cast<u64>(node.op) | (static_cast<u64>(node.index) << 8));
+        hash = hash * 31 + node.left;
+        hash = hash * 31 + node.right;
+        return static_cast<size_t>(hash ^ (hash >> 29));
+    }
+};
+
+// 数値はビット列で比較し、0と-0を区別する
+struct NodeEqual
+{
+    bool operator()(const Node& a, const Node& b) const
+    {
+        return a.op == b.op && a.index == b.index && ToBits(a.num) == ToBits(b.num) &&
+            a.left == b.left && a.right == b.right;
+    }
+};
+
+double Calc(OpCode op, double left, double right)
+{
+    switch (op)
+    {
+    case OpCode::add: return left + right;
+    case OpCode::subtract: return left - right;
+    case OpCode::multiply: return left * right;
+    default: return left / right;
+    }
+}
+
+// 2の累乗など、逆数を掛けても割った結果と変わらない数値
+bool HasExactReciprocal(double num)
+{
+    if (!std::isnormal(num)) return false;
+
+    int exponent = 0;
+    if (std::fabs(std::frexp(num, &exponent)) != 0.5) return false;
+    return std::isnormal(1.0 / num);
+}
+
+// 同じノードを1つにまとめながらDAGを作る
+class DagBuilder
+{
+private:
+    std::vector<Node> nodes_;
+    std::vector<u32> needs_; // 評価に必要なスタックの深さ
+    std::unordered_map<Node, u32, NodeHash, NodeEqual> ids_;
+
+public:
+    const Node& get(u32 id) const { return nodes_[id]; }
+    u32 getNeed(u32 id) const { return needs_[id]; }
+
+    u32 intern(const Node& node)
+    {
+        auto [it, inserted] = ids_.try_emplace(node, static_cast<u32>(nodes_.size()));
+        if (inserted)
+        {
+            u32 need = 1;
+            if (node.left != NO_NODE)
+            {
+                u32 left = needs_[node.left];
+                u32 right = needs_[node.right];
+                need = (left == right) ? left + 1 : std::max(left, right);
+            }
+
+            nodes_.push_back(node);
+            needs_.push_back(need);
+        }
+
+        return it->second;
+    }
+
+    u32 constant(double num)
+    {
+        return intern({OpCode::push, 0, num, NO_NODE, NO_NODE});
+    }
+
+    u32 combine(OpCode op, u32 left, u32 right);
+};
+
+u32 DagBuilder::combine(OpCode op, u32 left, u32 right)
+{
+    const Node leftNode = nodes_[left];
+    const Node rightNode = nodes_[right];
+    bool isLeftConstant = leftNode.op == OpCode::push;
+    bool isRightConstant = rightNode.op == OpCode::push;
+
+    // 定数の畳み込み。0による除算は評価の時にエラーを返すため残す
+    if (isLeftConstant && isRightConstant && !(op == OpCode::divide && rightNode.num == 0.0))
+    {
+        return constant(Calc(op, leftNode.num, rightNode.num));
+    }
+
+    // 全ての値で結果のビット列が変わらない恒等式だけを使う。
+    // x + 0 は x が -0 の場合に +0 となるため簡約せず、x + -0、x - 0 のみ簡約する
+    switch (op)
+    {
+    case OpCode::add:
+        if (isRightConstant && ToBits(rightNode.num) == ToBits(-0.0)) return left;
+        if (isLeftConstant && ToBits(leftNode.num) == ToBits(-0.0)) return right;
+        break;
+
+    case OpCode::subtract:
+        if (isRightConstant && ToBits(rightNode.num) == ToBits(0.0)) return left;
+        break;
+
+    case OpCode::multiply:
+        if (isRightConstant && rightNode.num == 1.0) return left;
+        if (isLeftConstant && leftNode.num == 1.0) return right;
+        break;
+
+    case OpCode::divide:
+        if (isRightConstant && rightNode.num == 1.0) return left;
+        if (isRightConstant && HasExactReciprocal(rightNode.num))
+        {
+            return combine(OpCode::multiply, left, constant(1.0 / rightNode.num));
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    // 交換できる演算子は子の番号の順に並べ、x + y と y + x を同じノードにする
+    if ((op == OpCode::add || op == OpCode::multiply) && right < left) std::swap(left, right);
+    return intern({op, 0, 0.0, left, right});
+}
+
+struct Frame
+{
+    u32 id;
+    u8 state; // 0 : 未訪問、1 : 左の子を出力済み、2 : 両方の子を出力済み
+    bool swapped; // 交換できる演算子で、右の子から出力する場合はtrue
+};
+
+}
+
+bool Optimizer::Optimize(Program& rtProgram, OptimizeResult& rtResult)
+{
+    // 命令列からDAGを作る
+    DagBuilder builder;
+    std::vector<u32> stack;
+    stack.reserve(rtProgram.stackSize);
+
+    for (const Instruction& inst : rtProgram.code)
+    {
+        switch (inst.op)
+        {
+        case OpCode::push:
+            stack.push_back(builder.constant(inst.num));
+            break;
+
+        case OpCode::load:
+            stack.push_back(builder.intern({OpCode::load, inst.index, 0.0, NO_NODE, NO_NODE}));
+            break;
+
+        case OpCode::store:
+        case OpCode::fetch:
+            return false; // 最適化済みの命令列
+
+        default:
+        {
+            if (stack.size() < 2) return false;
+            u32 right = stack.back();
+            stack.pop_back();
+            stack.back() = builder.combine(inst.op, stack.back(), right);
+            break;
+        }
+        }
+    }
+    if (stack.size() != 1) return false;
+    u32 root = stack[0];
+
+    // 到達できるノードと、それぞれを参照する親の数を数える
+    std::unordered_map<u32, u32> useCounts;
+    std::vector<u32> pending = {root};
+    useCounts[root] = 1;
+    while (!pending.empty())
+    {
+        const Node& node = builder.get(pending.back());
+        pending.pop_back();
+        if (node.left == NO_NODE) continue;
+
+        for (u32 child : {node.left, node.right})
+        {
+            if (useCounts[child]++ == 0) pending.push_back(child);
+        }
+    }
+
+    // 帰りがけ順に命令を出力する。2回以上参照される演算子は1度だけ計算して一時領域に書き込む
+    Program optimized;
+    optimized.variables = rtProgram.variables;
+
+    std::unordered_map<u32, u32> temps;
+    std::vector<Frame> frames = {{root, 0, false}};
+    u32 depth = 0;
+    auto pushValue = [&](const Instruction& inst)
+    {
+        optimized.code.push_back(inst);
+        depth++;
+        if (depth > optimized.stackSize) optimized.stackSize = depth;
+    };
+
+    while (!frames.empty())
+    {
+        Frame frame = frames.back();
+        const Node& node = builder.get(frame.id);
+
+        if (frame.state == 0)
+        {
+            auto temp = temps.find(frame.id);
+            if (temp != temps.end())
+            {
+                pushValue({OpCode::fetch, temp->second, 0.0});
+                frames.pop_back();
+                continue;
+            }
+
+            if (node.left == NO_NODE)
+            {
+                pushValue({node.op, node.index, node.num});
+                frames.pop_back();
+                continue;
+            }
+
+            // 交換できる演算子は、深いスタックが必要な子を先に計算する
+            bool swapped = (node.op == OpCode::add || node.op == OpCode::multiply) &&
+                builder.getNeed(node.right) > builder.getNeed(node.left);
+
+            frames.back().state = 1;
+            frames.back().swapped = swapped;
+            frames.push_back({swapped ? node.right : node.left, 0, false});
+        }
+        else if (frame.state == 1)
+        {
+            frames.back().state = 2;
+            frames.push_back({frame.swapped ? node.left : node.right, 0, false});
+        }
+        else
+        {
+            optimized.code.push_back({node.op, 0, 0.0});
+            depth--;
+
+            if (useCounts[frame.id] > 1 && optimized.tempCount < Bytecode::MAX_TEMP_COUNT)
+            {
+                temps[frame.id] = optimized.tempCount;
+                optimized.code.push_back({OpCode::store, optimized.tempCount++, 0.0});
+            }
+            frames.pop_back();
+        }
+    }
+
+    if (optimized.stackSize > Bytecode::MAX_STACK_SIZE) return false;
+
+    rtResult.nodeCountBefore = static_cast<u32>(rtProgram.code.size());
+    rtResult.nodeCountAfter = static_cast<u32>(useCounts.size());
+    rtProgram = std::move(optimized);
+    return true;
+}
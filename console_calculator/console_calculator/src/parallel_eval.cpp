@@ -0,0 +1,493 @@
+﻿#include "pch.h"
+
+#include "parallel_eval.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+
+bool IsBinary(TreeOp op)
+{
+    return op == TreeOp::add || op == TreeOp::subtract || op == TreeOp::multiply || op == TreeOp::divide;
+}
+
+bool IsAdditive(TreeOp op)
+{
+    return op == TreeOp::add || op == TreeOp::subtract;
+}
+
+u32 GetLeft(const std::vector<TreeNode>& nodes, u32 node)
+{
+    return node - 1 - nodes[node - 1].size;
+}
+
+std::pair<double, bool> Apply(TreeOp op, double a, double b)
+{
+    switch (op)
+    {
+    case TreeOp::add: return std::make_pair(a + b, true);
+    case TreeOp::subtract: return std::make_pair(a - b, true);
+    case TreeOp::multiply: return std::make_pair(a * b, true);
+    case TreeOp::divide:
+        if (b == 0.0) return std::make_pair(0.0, false);
+        return std::make_pair(a / b, true);
+    default: return std::make_pair(0.0, false);
+    }
+}
+
+// 部分木の範囲を帰りがけ順に走査し、スタックで評価する
+std::pair<double, bool> RunSerial(const ExprTree& tree, const double* variables, u32 node)
+{
+    thread_local std::vector<double> buffer;
+    if (buffer.size() < tree.stackSize) buffer.resize(tree.stackSize);
+
+    double* stack = buffer.data();
+    u32 top = 0;
+
+    const TreeNode* it = tree.nodes.data() + node + 1 - tree.nodes[node].size;
+    const TreeNode* end = tree.nodes.data() + node + 1;
+    for (; it != end; ++it)
+    {
+        switch (it->op)
+        {
+        case TreeOp::number:
+            stack[top++] = it->num;
+            break;
+
+        case TreeOp::variable:
+            stack[top++] = variables[it->index];
+            break;
+
+        case TreeOp::negate:
+            stack[top - 1] = -stack[top - 1];
+            break;
+
+        case TreeOp::add:
+            top--;
+            stack[top - 1] += stack[top];
+            break;
+
+        case TreeOp::subtract:
+            top--;
+            stack[top - 1] -= stack[top];
+            break;
+
+        case TreeOp::multiply:
+            top--;
+            stack[top - 1] *= stack[top];
+            break;
+
+        case TreeOp::divide:
+            top--;
+            if (stack[top] == 0.0) return std::make_pair(0.0, false);
+            stack[top - 1] /= stack[top];
+            break;
+        }
+    }
+
+    return std::make_pair(stack[0], true);
+}
+
+// 帰りがけ順に評価する時に必要なスタックの深さ
+u32 GetStackSize(const std::vector<TreeNode>& nodes)
+{
+    u32 top = 0;
+    u32 maxTop = 0;
+    for (const TreeNode& node : nodes)
+    {
+        if (node.op == TreeOp::number || node.op == TreeOp::variable) maxTop = std::max(maxTop, ++top);
+        else if (node.op != TreeOp::negate) top--;
+    }
+    return maxTop;
+}
+
+// 命令列をそのまま木のノードに変換する
+bool BuildPlain(const Program& program, std::vector<TreeNode>& rtNodes)
+{
+    rtNodes.clear();
+    rtNodes.reserve(program.code.size());
+
+    // 積まれている部分木のノード数
+    std::vector<u32> sizes;
+    for (const Instruction& inst : program.code)
+    {
+        TreeNode node;
+        switch (inst.op)
+        {
+        case OpCode::push:
+            node.op = TreeOp::number;
+            node.num = inst.num;
+            break;
+
+        case OpCode::load:
+            if (inst.index >= program.variables.size()) return false;
+            node.op = TreeOp::variable;
+            node.index = inst.index;
+            break;
+
+        case OpCode::add:
+        case OpCode::subtract:
+        case OpCode::multiply:
+        case OpCode::divide:
+            if (sizes.size() < 2) return false;
+            node.op = (inst.op == OpCode::add) ? TreeOp::add :
+                (inst.op == OpCode::subtract) ? TreeOp::subtract :
+                (inst.op == OpCode::multiply) ? TreeOp::multiply : TreeOp::divide;
+            node.size = 1 + sizes[sizes.size() - 2] + sizes.back();
+            sizes.pop_back();
+            sizes.pop_back();
+            break;
+
+        case OpCode::store:
+        case OpCode::fetch:
+            return false;
+        }
+
+        rtNodes.push_back(node);
+        sizes.push_back(node.size);
+        if (sizes.size() > Bytecode::MAX_STACK_SIZE) return false;
+    }
+
+    return sizes.size() == 1;
+}
+
+// +、-の連鎖と*の連鎖を項の列に展開し、項を半分ずつに分けた平衡な木として書き出す。
+// -の右側の項は符号を反転した項として扱い、a - bとa + (-b)が等しいことを使って符号をまとめる
+class Rebalancer
+{
+private:
+    struct Term
+    {
+        u32 node;
+        bool isNegative;
+    };
+
+    const std::vector<TreeNode>& source_;
+    std::vector<TreeNode>& nodes_;
+    u32 depth_ = 0;
+
+    void emit(TreeOp op)
+    {
+        u32 last = static_cast<u32>(nodes_.size()) - 1;
+
+        TreeNode node;
+        node.op = op;
+        node.size = 1 + nodes_[last].size;
+        if (op != TreeOp::negate) node.size += nodes_[last - nodes_[last].size].size;
+        nodes_.push_back(node);
+    }
+
+    // [begin, end)の項の和または積を書き出す。rtIsNegativeには書き出した値の符号を反転したものが結果の場合にtrueを設定する
+    bool emitBalanced(const std::vector<Term>& terms, size_t begin, size_t end, bool isAdditive, bool& rtIsNegative)
+    {
+        if (end - begin == 1)
+        {
+            rtIsNegative = terms[begin].isNegative;
+            return rebuild(terms[begin].node);
+        }
+
+        size_t middle = begin + (end - begin) / 2;
+        bool isLeftNegative = false;
+        bool isRightNegative = false;
+        if (!emitBalanced(terms, begin, middle, isAdditive, isLeftNegative)) return false;
+        if (!emitBalanced(terms, middle, end, isAdditive, isRightNegative)) return false;
+
+        if (!isAdditive)
+        {
+            emit(TreeOp::multiply);
+            rtIsNegative = false;
+            return true;
+        }
+
+        // (-a) + (-b) = -(a + b)、(-a) + b = -(a - b)
+        emit((isLeftNegative == isRightNegative) ? TreeOp::add : TreeOp::subtract);
+        rtIsNegative = isLeftNegative;
+        return true;
+    }
+
+    bool rebuildChain(u32 node)
+    {
+        bool isAdditive = IsAdditive(source_[node].op);
+
+        // 左から順に項を集める
+        std::vector<Term> terms;
+        std::vector<Term> stack{ {node, false} };
+        while (!stack.empty())
+        {
+            Term term = stack.back();
+            stack.pop_back();
+
+            TreeOp op = source_[term.node].op;
+            bool isSame = isAdditive ? IsAdditive(op) : (op == TreeOp::multiply);
+            if (!isSame)
+            {
+                terms.push_back(term);
+                continue;
+            }
+
+            bool isRightNegative = (op == TreeOp::subtract) ? !term.isNegative : term.isNegative;
+            stack.push_back({term.node - 1, isRightNegative});
+            stack.push_back({GetLeft(source_, term.node), term.isNegative});
+        }
+
+        bool isNegative = false;
+        if (!emitBalanced(terms, 0, terms.size(), isAdditive, isNegative)) return false;
+        if (isNegative) emit(TreeOp::negate);
+        return true;
+    }
+
+public:
+    Rebalancer(const std::vector<TreeNode>& source, std::vector<TreeNode>& rtNodes) : source_(source), nodes_(rtNodes) {}
+
+    // nodeの部分木を組み替えて書き出す。入れ子が深すぎる場合はfalseを返す
+    bool rebuild(u32 node)
+    {
+        if (depth_ == ParallelEval::MAX_REBALANCE_DEPTH) return false;
+        depth_++;
+
+        // 除算は組み替えないため、左の子は再帰せずにたどる
+        std::vector<u32> divides;
+        while (source_[node].op == TreeOp::divide)
+        {
+            divides.push_back(node);
+            node = GetLeft(source_, node);
+        }
+
+        bool succeeded = true;
+        if (IsBinary(source_[node].op)) succeeded = rebuildChain(node);
+        else nodes_.push_back(source_[node]);
+
+        for (auto it = divides.rbegin(); succeeded && it != divides.rend(); ++it)
+        {
+            succeeded = rebuild(*it - 1);
+            if (succeeded) emit(TreeOp::divide);
+        }
+
+        depth_--;
+        return succeeded;
+    }
+};
+
+// fork-joinで木を評価する。分岐した右の部分木は自身のキューの新しい側に積み、
+// 合流する時にまだ奪われていなければ自身で評価する。奪われていた場合は終わるまで他のスレッドの部分木を評価して待つ
+class Scheduler
+{
+private:
+    struct Task
+    {
+        u32 node = 0;
+        std::pair<double, bool> result;
+        std::atomic<bool> isDone = false;
+    };
+
+    struct alignas(64) Queue
+    {
+        std::mutex mutex;
+        std::deque<Task*> tasks;
+    };
+
+    // 大きい側の部分木をたどる間に保留した計算
+    struct Pending
+    {
+        TreeOp op;
+        double other;
+        bool isOtherLeft;
+    };
+
+    const ExprTree& tree_;
+    const double* variables_;
+    u32 grainSize_;
+    u32 workerCount_;
+    std::unique_ptr<Queue[]> queues_;
+    std::atomic<bool> isFinished_ = false;
+
+    void push(u32 worker, Task* task)
+    {
+        std::lock_guard<std::mutex> lock(queues_[worker].mutex);
+        queues_[worker].tasks.push_back(task);
+    }
+
+    // 新しい側がtaskの場合は取り出してtrueを返す
+    bool popIf(u32 worker, Task* task)
+    {
+        std::lock_guard<std::mutex> lock(queues_[worker].mutex);
+        std::deque<Task*>& tasks = queues_[worker].tasks;
+        if (tasks.empty() || tasks.back() != task) return false;
+
+        tasks.pop_back();
+        return true;
+    }
+
+    // 他のスレッドのキューの古い側から奪う
+    Task* steal(u32 worker)
+    {
+        for (u32 i = 1; i < workerCount_; ++i)
+        {
+            Queue& queue = queues_[(worker + i) % workerCount_];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) continue;
+
+            Task* task = queue.tasks.front();
+            queue.tasks.pop_front();
+            return task;
+        }
+
+        return nullptr;
+    }
+
+    void execute(Task* task, u32 worker)
+    {
+        task->result = evaluate(task->node, worker);
+        task->isDone.store(true, std::memory_order_release);
+    }
+
+    std::pair<double, bool> join(Task& task, u32 worker)
+    {
+        if (popIf(worker, &task)) return evaluate(task.node, worker);
+
+        while (!task.isDone.load(std::memory_order_acquire))
+        {
+            Task* other = steal(worker);
+            if (other != nullptr) execute(other, worker);
+            else std::this_thread::yield();
+        }
+        return task.result;
+    }
+
+    std::pair<double, bool> evaluate(u32 node, u32 worker)
+    {
+        const std::vector<TreeNode>& nodes = tree_.nodes;
+        std::vector<Pending> pendings;
+        std::pair<double, bool> result;
+
+        while (true)
+        {
+            const TreeNode& current = nodes[node];
+            if (current.size < grainSize_ || !(IsBinary(current.op) || current.op == TreeOp::negate))
+            {
+                result = RunSerial(tree_, variables_, node);
+                break;
+            }
+
+            if (current.op == TreeOp::negate)
+            {
+                pendings.push_back({TreeOp::negate, 0.0, false});
+                node = node - 1;
+                continue;
+            }
+
+            u32 right = node - 1;
+            u32 left = GetLeft(nodes, node);
+            bool isLeftLarge = nodes[left].size >= grainSize_;
+            bool isRightLarge = nodes[right].size >= grainSize_;
+
+            if (isLeftLarge && isRightLarge)
+            {
+                Task task;
+                task.node = right;
+                push(worker, &task);
+
+                // 右の部分木が他のスレッドで評価されている場合があるため、左が失敗しても合流する
+                std::pair<double, bool> leftResult = evaluate(left, worker);
+                std::pair<double, bool> rightResult = join(task, worker);
+                if (leftResult.second && rightResult.second) result = Apply(current.op, leftResult.first, rightResult.first);
+                else result = std::make_pair(0.0, false);
+                break;
+            }
+
+            if (!isLeftLarge && !isRightLarge)
+            {
+                result = RunSerial(tree_, variables_, node);
+                break;
+            }
+
+            // 小さい側を先に評価し、大きい側は再帰せずにたどる
+            std::pair<double, bool> small = RunSerial(tree_, variables_, isLeftLarge ? right : left);
+            if (!small.second) return small;
+
+            pendings.push_back({current.op, small.first, !isLeftLarge});
+            node = isLeftLarge ? left : right;
+        }
+
+        for (auto it = pendings.rbegin(); result.second && it != pendings.rend(); ++it)
+        {
+            if (it->op == TreeOp::negate) result.first = -result.first;
+            else if (it->isOtherLeft) result = Apply(it->op, it->other, result.first);
+            else result = Apply(it->op, result.first, it->other);
+        }
+
+        return result;
+    }
+
+    void runWorker(u32 worker)
+    {
+        while (!isFinished_.load(std::memory_order_acquire))
+        {
+            Task* task = steal(worker);
+            if (task != nullptr) execute(task, worker);
+            else std::this_thread::yield();
+        }
+    }
+
+public:
+    Scheduler(const ExprTree& tree, const double* variables, u32 workerCount, u32 grainSize) :
+        tree_(tree), variables_(variables), grainSize_(grainSize), workerCount_(workerCount),
+        queues_(std::make_unique<Queue[]>(workerCount)) {}
+
+    std::pair<double, bool> run()
+    {
+        std::vector<std::thread> threads;
+        for (u32 i = 1; i < workerCount_; ++i) threads.emplace_back(&Scheduler::runWorker, this, i);
+
+        std::pair<double, bool> result = evaluate(static_cast<u32>(tree_.nodes.size()) - 1, 0);
+
+        isFinished_.store(true, std::memory_order_release);
+        for (std::thread& thread : threads) thread.join();
+        return result;
+    }
+};
+
+}
+
+bool ParallelEval::Build(const Program& program, bool isFastMath, ExprTree& rtTree)
+{
+    rtTree.variableCount = static_cast<u32>(program.variables.size());
+
+    if (!isFastMath)
+    {
+        if (!BuildPlain(program, rtTree.nodes)) return false;
+    }
+    else
+    {
+        std::vector<TreeNode> plain;
+        if (!BuildPlain(program, plain)) return false;
+
+        rtTree.nodes.clear();
+        rtTree.nodes.reserve(plain.size());
+        Rebalancer rebalancer(plain, rtTree.nodes);
+        if (!rebalancer.rebuild(static_cast<u32>(plain.size()) - 1)) rtTree.nodes = std::move(plain);
+    }
+
+    rtTree.stackSize = GetStackSize(rtTree.nodes);
+    return true;
+}
+
+std::pair<double, bool> ParallelEval::Run(const ExprTree& tree, const double* variables, u32 threadCount, u32 grainSize)
+{
+    if (tree.nodes.empty()) return std::make_pair(0.0, false);
+    if (tree.variableCount != 0 && variables == nullptr) return std::make_pair(0.0, false);
+
+    if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+    grainSize = std::max(1u, grainSize);
+
+    u32 root = static_cast<u32>(tree.nodes.size()) - 1;
+    if (threadCount == 1 || tree.nodes[root].size < grainSize) return RunSerial(tree, variables, root);
+
+    Scheduler scheduler(tree, variables, threadCount, grainSize);
+    return scheduler.run();
+}
@@ -0,0 +1,285 @@
+﻿#include "pch.h"
+
+#include "parser.h"
+#include "command.h"
+
+#include <charconv>
+
+namespace
+{
+
+// 括弧の入れ子の上限。再帰が深くなりすぎないようにする
+constexpr u32 MAX_NEST_DEPTH = 256;
+
+bool IsDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+bool IsNameStart(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+bool IsNameChar(char c)
+{
+    return IsNameStart(c) || IsDigit(c);
+}
+
+class PrattParser
+{
+private:
+    Tokenizer tokenizer_;
+    Program& program_;
+    Token current_ = {CmdType::number};
+    bool hasCurrent_ = false;
+    u32 depth_ = 0;
+    u32 nest_ = 0;
+    size_t errorPos_ = 0;
+
+    void advance()
+    {
+        hasCurrent_ = tokenizer_.next(current_);
+    }
+
+    bool fail(size_t position)
+    {
+        errorPos_ = position;
+        return false;
+    }
+
+    bool isBinaryOpe() const
+    {
+        if (!hasCurrent_) return false;
+        return Parser::GetPriority(current_.type) > 0;
+    }
+
+    bool emitPush(const Instruction& inst)
+    {
+        if (depth_ == Bytecode::MAX_STACK_SIZE) return fail(current_.position);
+
+        program_.code.push_back(inst);
+        depth_++;
+        if (depth_ > program_.stackSize) program_.stackSize = depth_;
+        return true;
+    }
+
+    void emitOpe(OpCode op)
+    {
+        program_.code.push_back({op, 0, 0.0});
+        depth_--;
+    }
+
+    bool parseOperand()
+    {
+        if (!hasCurrent_) return fail(tokenizer_.getPosition());
+
+        Token token = current_;
+        switch (token.type)
+        {
+        case CmdType::number:
+            advance();
+            return emitPush({OpCode::push, 0, token.num});
+
+        case CmdType::variable:
+        {
+            s32 index = Bytecode::FindVariable(program_, token.name);
+            if (index < 0)
+            {
+                index = static_cast<s32>(program_.variables.size());
+                program_.variables.emplace_back(token.name);
+            }
+
+            advance();
+            return emitPush({OpCode::load, static_cast<u32>(index), 0.0});
+        }
+
+        case CmdType::leftParen:
+        {
+            if (nest_ == MAX_NEST_DEPTH) return fail(token.position);
+
+            nest_++;
+            advance();
+            if (!parseExpression(1)) return false;
+            if (!hasCurrent_ || current_.type != CmdType::rightParen)
+            {
+                return fail(hasCurrent_ ? current_.position : tokenizer_.getPosition());
+            }
+
+            nest_--;
+            advance();
+            return true;
+        }
+
+        case CmdType::subtract:
+        case CmdType::add:
+        {
+            // 単項演算子。続けて書かれた符号は再帰せずにまとめ、-が奇数個の場合だけ符号を反転する。
+            // -は-1を掛けて表し、数値の場合は符号を反転する
+            bool isNegative = false;
+            while (hasCurrent_ && (current_.type == CmdType::subtract || current_.type == CmdType::add))
+            {
+                if (current_.type == CmdType::subtract) isNegative = !isNegative;
+                advance();
+            }
+
+            if (!parseOperand()) return false;
+            if (!isNegative) return true;
+
+            Instruction& last = program_.code.back();
+            if (last.op == OpCode::push)
+            {
+                last.num = -last.num;
+                return true;
+            }
+
+            if (!emitPush({OpCode::push, 0, -1.0})) return false;
+            emitOpe(OpCode::multiply);
+            return true;
+        }
+
+        default:
+            return fail(token.position);
+        }
+    }
+
+public:
+    PrattParser(std::string_view text, Program& program)
+    : tokenizer_(text), program_(program)
+    {
+    }
+
+    // minPriority以上の優先順位の演算子を左結合で読み込む
+    bool parseExpression(int minPriority)
+    {
+        if (!parseOperand()) return false;
+
+        while (isBinaryOpe())
+        {
+            int priority = Parser::GetPriority(current_.type);
+            if (priority < minPriority) break;
+
+            CmdType type = current_.type;
+            advance();
+            if (!parseExpression(priority + 1)) return false;
+
+            emitOpe(Bytecode::ToOpCode(type));
+        }
+
+        return true;
+    }
+
+    bool parse()
+    {
+        program_.code.clear();
+        program_.stackSize = 0;
+        program_.tempCount = 0;
+        program_.variables.clear();
+
+        advance();
+        if (!parseExpression(1)) return false;
+        if (hasCurrent_) return fail(current_.position); // 式の後に余分なトークンがある
+        if (tokenizer_.isError()) return fail(tokenizer_.getPosition());
+
+        return true;
+    }
+
+    size_t getErrorPos() const
+    {
+        return (tokenizer_.isError()) ? tokenizer_.getPosition() : errorPos_;
+    }
+};
+
+}
+
+bool Tokenizer::next(Token& rtToken)
+{
+    while (pos_ < text_.size() && (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\r' || text_[pos_] == '\n'))
+    {
+        pos_++;
+    }
+    if (pos_ >= text_.size() || error_) return false;
+
+    const char* begin = text_.data() + pos_;
+    const char* end = text_.data() + text_.size();
+    char c = *begin;
+
+    rtToken.position = pos_;
+    rtToken.num = 0.0;
+    rtToken.name = std::string_view();
+
+    bool isNegative = c == '-' && !afterOperand_ && begin + 1 < end && (IsDigit(begin[1]) || begin[1] == '.');
+    if (IsDigit(c) || c == '.' || isNegative)
+    {
+        rtToken.type = CmdType::number;
+        afterOperand_ = true;
+
+        // 15桁以下の整数はdoubleで正確に表せるため、from_charsを使わずに読み込む
+        const char* digit = begin + (isNegative ? 1 : 0);
+        u64 integer = 0;
+        const char* it = digit;
+        while (it < end && IsDigit(*it) && it - digit < 15) integer = integer * 10 + (*it++ - '0');
+        if (it != digit && (it == end || !(IsDigit(*it) || *it == '.' || *it == 'e' || *it == 'E')))
+        {
+            rtToken.num = static_cast<double>(integer);
+            if (isNegative) rtToken.num = -rtToken.num;
+            rtToken.name = text_.substr(pos_, it - begin);
+            pos_ += it - begin;
+            return true;
+        }
+
+        // 範囲外の場合もptrは数値の終わりを指すため、文字列だけを使う場合は受け付ける
+        std::from_chars_result result = std::from_chars(begin, end, rtToken.num);
+        if (result.ec != std::errc() && !(isTextOnly_ && result.ec == std::errc::result_out_of_range))
+        {
+            error_ = true;
+            return false;
+        }
+
+        rtToken.name = text_.substr(pos_, result.ptr - begin);
+        pos_ += result.ptr - begin;
+        return true;
+    }
+
+    if (IsNameStart(c))
+    {
+        size_t start = pos_;
+        while (pos_ < text_.size() && IsNameChar(text_[pos_])) pos_++;
+
+        rtToken.type = CmdType::variable;
+        rtToken.name = text_.substr(start, pos_ - start);
+        afterOperand_ = true;
+        return true;
+    }
+
+    switch (c)
+    {
+    case '+': rtToken.type = CmdType::add; break;
+    case '-': rtToken.type = CmdType::subtract; break;
+    case '*': rtToken.type = CmdType::multiply; break;
+    case '/': rtToken.type = CmdType::divide; break;
+    case '(': rtToken.type = CmdType::leftParen; break;
+    case ')': rtToken.type = CmdType::rightParen; break;
+    default:
+        error_ = true;
+        return false;
+    }
+
+    pos_++;
+    afterOperand_ = rtToken.type == CmdType::rightParen;
+    return true;
+}
+
+int Parser::GetPriority(CmdType type)
+{
+    return CmdTokens::GetPriority(type);
+}
+
+bool Parser::Parse(std::string_view text, Program& rtProgram, size_t& rtErrorPos)
+{
+    PrattParser parser(text, rtProgram);
+    if (parser.parse()) return true;
+
+    rtErrorPos = parser.getErrorPos();
+    return false;
+}
@@ -0,0 +1,201 @@
+﻿#include "pch.h"
+
+#include "stream_eval.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+#include "engine.h"
+#include "parser.h"
+
+namespace
+{
+
+// スレッドに分配する最小の行数
+constexpr size_t LINES_PER_THREAD = 1024;
+
+struct Worker
+{
+    Program program;
+    std::string output;
+    size_t errorCount = 0;
+};
+
+// [begin, end)の行を評価してworkerの出力に追加する
+void EvaluateLines(const std::vector<std::string_view>& lines, size_t begin, size_t end, bool isExact, Worker& worker)
+{
+    worker.output.clear();
+    for (size_t i = begin; i < end; ++i)
+    {
+        bool succeeded = isExact ? 
+            StreamEval::EvaluateLineExact(lines[i], worker.output) :
+            StreamEval::EvaluateLine(lines[i], worker.program, worker.output);
+        if (!succeeded) worker.errorCount++;
+    }
+}
+
+// 改行で区切り、末尾の\rを取り除く
+void SplitLines(const char* data, size_t size, std::vector<std::string_view>& rtLines)
+{
+    rtLines.clear();
+
+    const char* it = data;
+    const char* end = data + size;
+    while (it < end)
+    {
+        const char* newLine = static_cast<const char*>(memchr(it, '\n', end - it));
+        const char* lineEnd = (newLine != nullptr) ? newLine : end;
+
+        size_t length = lineEnd - it;
+        if (length != 0 && it[length - 1] == '\r') length--;
+        rtLines.emplace_back(it, length);
+
+        it = lineEnd + 1;
+    }
+}
+
+}
+
+bool StreamEval::EvaluateLine(std::string_view line, Program& program, std::string& rtOutput)
+{
+    if (line.find_first_not_of(" \t") == std::string_view::npos)
+    {
+        rtOutput += '\n';
+        return true;
+    }
+
+    size_t errorPos = 0;
+    if (!Parser::Parse(line, program, errorPos))
+    {
+        rtOutput += "Error : Syntax error at ";
+        rtOutput += std::to_string(errorPos);
+        rtOutput += '\n';
+        return false;
+    }
+
+    double result = 0.0;
+    EvalStatus status = Engine::Run(program, nullptr, result);
+    if (status == EvalStatus::unboundVariable)
+    {
+        rtOutput += "Error : Variable '";
+        rtOutput += program.variables[0];
+        rtOutput += "' is not set\n";
+        return false;
+    }
+    else if (status != EvalStatus::success)
+    {
+        rtOutput += Engine::ToMessage(status);
+        rtOutput += '\n';
+        return false;
+    }
+
+    // 読み込み直すと同じ値になる最短の表記で書き出す。極端に大きい、小さい値以外は指数表記にしない
+    char buff[64];
+    double absNum = std::fabs(result);
+    std::chars_format format = (absNum == 0.0 || (absNum >= 1e-5 && absNum < 1e16)) ? 
+        std::chars_format::fixed : std::chars_format::general;
+    std::to_chars_result converted = std::to_chars(buff, buff + sizeof(buff), result, format);
+    rtOutput.append(buff, converted.ptr);
+    rtOutput += '\n';
+    return true;
+}
+
+bool StreamEval::EvaluateLineExact(std::string_view line, std::string& rtOutput)
+{
+    if (line.find_first_not_of(" \t") == std::string_view::npos)
+    {
+        rtOutput += '\n';
+        return true;
+    }
+
+    BigDecimal result;
+    size_t errorPos = 0;
+    EvalStatus status = Engine::EvaluateExact(line, EXACT_DIVISION_SCALE, result, errorPos);
+    if (status == EvalStatus::syntaxError)
+    {
+        rtOutput += "Error : Syntax error at ";
+        rtOutput += std::to_string(errorPos);
+        rtOutput += '\n';
+        return false;
+    }
+    else if (status != EvalStatus::success)
+    {
+        rtOutput += Engine::ToMessage(status);
+        rtOutput += '\n';
+        return false;
+    }
+
+    rtOutput += result.toString();
+    rtOutput += '\n';
+    return true;
+}
+
+bool StreamEval::Run(FILE* input, FILE* output, u32 threadCount, size_t& rtErrorCount, bool isExact)
+{
+    rtErrorCount = 0;
+    if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(threadCount, MAX_THREAD_COUNT);
+
+    std::vector<Worker> workers(threadCount);
+    std::vector<std::string_view> lines;
+    std::vector<char> buffer(BLOCK_SIZE);
+    size_t filled = 0;
+    bool isEnd = false;
+
+    while (!isEnd)
+    {
+        // 途中の行が収まらない場合は領域を広げる
+        if (filled == buffer.size()) buffer.resize(buffer.size() * 2);
+
+        size_t readSize = fread(buffer.data() + filled, 1, buffer.size() - filled, input);
+        if (readSize == 0)
+        {
+            if (ferror(input)) return false;
+            isEnd = true;
+        }
+        filled += readSize;
+
+        // 終端でない場合は最後の改行までを処理し、残りは次のブロックへ持ち越す
+        size_t blockSize = filled;
+        if (!isEnd)
+        {
+            const char* data = buffer.data();
+            size_t lastNewLine = filled;
+            while (lastNewLine != 0 && data[lastNewLine - 1] != '\n') lastNewLine--;
+            if (lastNewLine == 0) continue;
+
+            blockSize = lastNewLine;
+        }
+
+        SplitLines(buffer.data(), blockSize, lines);
+
+        // 行を連続した範囲に分け、範囲の順に書き出す
+        size_t rangeCount = std::min<size_t>(threadCount, std::max<size_t>(1, lines.size() / LINES_PER_THREAD));
+        size_t rangeSize = (lines.size() + rangeCount - 1) / std::max<size_t>(1, rangeCount);
+
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < rangeCount; ++i)
+        {
+            size_t begin = std::min(lines.size(), i * rangeSize);
+            size_t end = std::min(lines.size(), begin + rangeSize);
+            threads.emplace_back(EvaluateLines, std::cref(lines), begin, end, isExact, std::ref(workers[i]));
+        }
+        EvaluateLines(lines, 0, std::min(lines.size(), rangeSize), isExact, workers[0]);
+        for (std::thread& thread : threads) thread.join();
+
+        for (size_t i = 0; i < rangeCount; ++i)
+        {
+            const std::string& text = workers[i].output;
+            if (fwrite(text.data(), 1, text.size(), output) != text.size()) return false;
+        }
+
+        memmove(buffer.data(), buffer.data() + blockSize, filled - blockSize);
+        filled -= blockSize;
+    }
+
+    for (const Worker& worker : workers) rtErrorCount += worker.errorCount;
+    return fflush(output) == 0;
+}
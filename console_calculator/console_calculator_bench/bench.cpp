@@ -0,0 +1,644 @@
+﻿#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <new>
+#include <random>
+#include <thread>
+
+#include "pch.h"
+
+#include "batch_eval.h"
+#include "big_int.h"
+#include "bytecode.h"
+#include "calculator.h"
+#include "command.h"
+#include "engine.h"
+#include "eval_cache.h"
+#include "jit.h"
+#include "live_eval.h"
+#include "optimizer.h"
+#include "parallel_eval.h"
+#include "parser.h"
+#include "stream_eval.h"
+
+using namespace std;
+
+// ヒープの確保回数を数えるため、グローバルなoperator new、deleteを全て置き換える。
+// 全ての形をmalloc、aligned_alloc、freeで揃え、確保と解放の組み合わせを一致させる
+static atomic<u64> g_allocCount = 0;
+
+static void* CountedAlloc(size_t size, size_t alignment, bool isNothrow)
+{
+    g_allocCount.fetch_add(1, memory_order_relaxed);
+    if (size == 0) size = 1;
+
+    // aligned_allocは大きさがalignmentの倍数である必要がある
+    void* ptr = nullptr;
+    if (alignment <= alignof(max_align_t)) ptr = malloc(size);
+    else if (size <= SIZE_MAX - (alignment - 1)) ptr = aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+
+    if (ptr == nullptr && !isNothrow) throw bad_alloc();
+    return ptr;
+}
+
+void* operator new(size_t size) { return CountedAlloc(size, 0, false); }
+void* operator new[](size_t size) { return CountedAlloc(size, 0, false); }
+void* operator new(size_t size, const nothrow_t&) noexcept { return CountedAlloc(size, 0, true); }
+void* operator new[](size_t size, const nothrow_t&) noexcept { return CountedAlloc(size, 0, true); }
+
+void* operator new(size_t size, align_val_t alignment)
+{
+    return CountedAlloc(size, static_cast<size_t>(alignment), false);
+}
+void* operator new[](size_t size, align_val_t alignment)
+{
+    return CountedAlloc(size, static_cast<size_t>(alignment), false);
+}
+void* operator new(size_t size, align_val_t alignment, const nothrow_t&) noexcept
+{
+    return CountedAlloc(size, static_cast<size_t>(alignment), true);
+}
+void* operator new[](size_t size, align_val_t alignment, const nothrow_t&) noexcept
+{
+    return CountedAlloc(size, static_cast<size_t>(alignment), true);
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+void operator delete(void* ptr, const nothrow_t&) noexcept { free(ptr); }
+void operator delete[](void* ptr, const nothrow_t&) noexcept { free(ptr); }
+
+void operator delete(void* ptr, align_val_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, align_val_t) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t, align_val_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t, align_val_t) noexcept { free(ptr); }
+void operator delete(void* ptr, align_val_t, const nothrow_t&) noexcept { free(ptr); }
+void operator delete[](void* ptr, align_val_t, const nothrow_t&) noexcept { free(ptr); }
+
+namespace
+{
+
+// 処理をiterations回実行し、1回あたりの秒数を返す
+double Measure(u32 iterations, const function<void()>& func)
+{
+    auto start = chrono::steady_clock::now();
+    for (u32 i = 0; i < iterations; ++i) func();
+    auto end = chrono::steady_clock::now();
+
+    return chrono::duration<double>(end - start).count() / iterations;
+}
+
+// 1回あたりの時間と、トークンまたは行あたりの時間を出力する
+void PrintResult(const string& name, const string& label, double seconds, size_t count, const string& unit)
+{
+    cout << left << setw(14) << name << setw(20) << label
+         << right << setw(14) << fixed << setprecision(1) << seconds * 1e9 << " ns"
+         << setw(12) << setprecision(2) << seconds * 1e9 / count << " ns/" << unit << endl;
+}
+
+void AppendNum(vector<unique_ptr<Command>>& cmds, double num)
+{
+    cmds.emplace_back(make_unique<NumberCmd>());
+    PtrAs<NumberCmd>(cmds.back().get())->setNum(num);
+}
+
+void AppendVariable(vector<unique_ptr<Command>>& cmds, const string& name)
+{
+    cmds.emplace_back(make_unique<VariableCmd>());
+    PtrAs<VariableCmd>(cmds.back().get())->setName(name);
+}
+
+// (1 + 3 * (2 + -3)) * 3 - 10 / 2 を termCount回繋げた式
+vector<unique_ptr<Command>> CreateCmds(u32 termCount)
+{
+    vector<unique_ptr<Command>> cmds;
+    for (u32 i = 0; i < termCount; ++i)
+    {
+        if (i != 0) cmds.emplace_back(make_unique<AddCmd>());
+
+        cmds.emplace_back(make_unique<LeftParenCmd>());
+        AppendNum(cmds, 1.0);
+        cmds.emplace_back(make_unique<AddCmd>());
+        AppendNum(cmds, 3.0);
+        cmds.emplace_back(make_unique<MultiplyCmd>());
+        cmds.emplace_back(make_unique<LeftParenCmd>());
+        AppendNum(cmds, 2.0);
+        cmds.emplace_back(make_unique<AddCmd>());
+        AppendNum(cmds, -3.0);
+        cmds.emplace_back(make_unique<RightParenCmd>());
+        cmds.emplace_back(make_unique<RightParenCmd>());
+        cmds.emplace_back(make_unique<MultiplyCmd>());
+        AppendNum(cmds, 3.0);
+        cmds.emplace_back(make_unique<SubtractCmd>());
+        AppendNum(cmds, 10.0);
+        cmds.emplace_back(make_unique<DivideCmd>());
+        AppendNum(cmds, 2.0);
+    }
+
+    return cmds;
+}
+
+// 処理を1回実行した時のヒープの確保回数
+u64 CountAllocs(const function<void()>& func)
+{
+    u64 start = g_allocCount.load();
+    func();
+    return g_allocCount.load() - start;
+}
+
+// 1回あたりの時間とコマンドあたりの確保回数を出力する
+void PrintAllocs(const string& name, const string& label, double seconds, u64 allocCount, size_t count)
+{
+    cout << left << setw(14) << name << setw(20) << label
+         << right << setw(14) << fixed << setprecision(1) << seconds * 1e9 << " ns"
+         << setw(12) << setprecision(2) << static_cast<double>(allocCount) / count << " allocs/cmd" << endl;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    u32 iterations = (argc > 1) ? static_cast<u32>(atoi(argv[1])) : 100000;
+    if (iterations == 0) iterations = 1;
+
+    cout << "iterations : " << iterations << endl;
+
+    unique_ptr<Calculator> calculator = make_unique<Calculator>();
+    volatile double sink = 0.0;
+
+    for (u32 termCount : {1u, 16u, 128u})
+    {
+        vector<unique_ptr<Command>> cmds = CreateCmds(termCount);
+        string name = to_string(cmds.size()) + " tokens";
+
+        // ToRPNはコマンドを移動するため、毎回複製してから変換する
+        double rpnSeconds = Measure(iterations, [&]()
+        {
+            vector<unique_ptr<Command>> copied;
+            copied.reserve(cmds.size());
+            for (const auto& cmd : cmds) copied.emplace_back(cmd->clone());
+
+            unique_ptr<Command> result = RPN::CalcFromRPN
+            (
+                calculator.get(), RPN::ToRPN(copied.begin(), copied.end()), make_unique<NumberCmd>()
+            );
+            sink = PtrAs<NumberCmd>(result.get())->getNum();
+        });
+        PrintResult(name, "rpn", rpnSeconds, cmds.size(), "token");
+
+        Program program;
+        double compileSeconds = Measure(iterations, [&]()
+        {
+            Bytecode::Compile(cmds, program);
+            sink = Bytecode::Run(program).first;
+        });
+        PrintResult(name, "compile+run", compileSeconds, cmds.size(), "token");
+
+        double runSeconds = Measure(iterations, [&]()
+        {
+            sink = Bytecode::Run(program).first;
+        });
+        PrintResult(name, "run", runSeconds, cmds.size(), "token");
+
+        // 1つずつ入力して履歴を残す。以前の実装はコマンドごとに追加先と履歴の2つを複製していた
+        auto appendLegacy = [&]()
+        {
+            vector<unique_ptr<Command>> legacyCmds;
+            vector<unique_ptr<Command>> history;
+            AppendNum(legacyCmds, 0.0);
+            for (const auto& cmd : cmds)
+            {
+                if (cmd->append(calculator.get(), legacyCmds)) history.emplace_back(cmd->clone());
+            }
+        };
+        PrintAllocs(name, "append(legacy)", Measure(iterations, appendLegacy), CountAllocs(appendLegacy), cmds.size());
+
+        auto appendCmd = [&]()
+        {
+            Calculator appended;
+            for (auto& cmd : cmds) appended.appendCmd(cmd);
+        };
+        PrintAllocs(name, "appendCmd", Measure(iterations, appendCmd), CountAllocs(appendCmd), cmds.size());
+
+        vector<CmdToken> tokens;
+        for (const auto& cmd : cmds)
+        {
+            tokens.push_back({cmd->type()});
+            if (cmd->type() == CmdType::number) tokens.back().num = PtrAs<NumberCmd>(cmd.get())->getNum();
+        }
+
+        auto appendToken = [&]()
+        {
+            Calculator appended;
+            for (const CmdToken& token : tokens) appended.appendToken(token);
+        };
+        PrintAllocs(name, "appendToken", Measure(iterations, appendToken), CountAllocs(appendToken), cmds.size());
+
+        // 1つ入力するたびに途中の値を求める。式全体を計算し直す場合は式の長さに比例して遅くなる
+        LiveEvaluator live;
+        double liveSeconds = Measure(iterations, [&]()
+        {
+            live.clear();
+            for (const CmdToken& token : tokens)
+            {
+                live.push(token);
+                sink = live.preview().first;
+            }
+        });
+        PrintResult(name, "live preview", liveSeconds, cmds.size(), "key");
+
+        vector<CmdToken> prefix;
+        u32 prefixIterations = max<u32>(1, iterations / static_cast<u32>(cmds.size()));
+        double recompileSeconds = Measure(prefixIterations, [&]()
+        {
+            prefix.clear();
+            for (const CmdToken& token : tokens)
+            {
+                prefix.push_back(token);
+                if (Bytecode::Compile(prefix, {}, program)) sink = Bytecode::Run(program).first;
+            }
+        });
+        PrintResult(name, "recompile preview", recompileSeconds, cmds.size(), "key");
+    }
+
+    // (x + 1) / (y - 2) * x - 0.5 を100万行に対して評価する
+    vector<unique_ptr<Command>> cmds;
+    cmds.emplace_back(make_unique<LeftParenCmd>());
+    AppendVariable(cmds, "x");
+    cmds.emplace_back(make_unique<AddCmd>());
+    AppendNum(cmds, 1.0);
+    cmds.emplace_back(make_unique<RightParenCmd>());
+    cmds.emplace_back(make_unique<DivideCmd>());
+    cmds.emplace_back(make_unique<LeftParenCmd>());
+    AppendVariable(cmds, "y");
+    cmds.emplace_back(make_unique<SubtractCmd>());
+    AppendNum(cmds, 2.0);
+    cmds.emplace_back(make_unique<RightParenCmd>());
+    cmds.emplace_back(make_unique<MultiplyCmd>());
+    AppendVariable(cmds, "x");
+    cmds.emplace_back(make_unique<SubtractCmd>());
+    AppendNum(cmds, 0.5);
+
+    Program program;
+    Bytecode::Compile(cmds, program);
+
+    const size_t rowCount = 1000000;
+    vector<double> x(rowCount);
+    vector<double> y(rowCount);
+    for (size_t i = 0; i < rowCount; ++i)
+    {
+        x[i] = static_cast<double>(i % 1000) * 0.5;
+        y[i] = static_cast<double>(i % 17);
+    }
+    const double* columns[] = {x.data(), y.data()};
+    vector<double> results(rowCount);
+    vector<u8> errors(rowCount);
+
+    u32 batchIterations = max(1u, iterations / 10000);
+    string name = to_string(rowCount) + " rows";
+
+    double scalarSeconds = Measure(batchIterations, [&]()
+    {
+        for (size_t i = 0; i < rowCount; ++i)
+        {
+            double variables[] = {x[i], y[i]};
+            results[i] = Bytecode::Run(program, variables).first;
+        }
+    });
+    PrintResult(name, "run(per row)", scalarSeconds, rowCount, "row");
+
+    u32 hardwareThreadCount = max(1u, thread::hardware_concurrency());
+    for (u32 threadCount : {1u, hardwareThreadCount})
+    {
+        double batchSeconds = Measure(batchIterations, [&]()
+        {
+            BatchEval::Run(program, columns, size(columns), rowCount, results.data(), errors.data(), threadCount);
+        });
+        PrintResult(name, "batch(" + to_string(threadCount) + " threads)", batchSeconds, rowCount, "row");
+
+        if (hardwareThreadCount == 1) break;
+    }
+
+    // 生成された冗長な式を最適化し、同じ行に対する評価の時間を比べる。originalは最適化せずに評価する
+    Program redundant;
+    size_t redundantErrorPos = 0;
+    Parser::Parse("((x*1)+(0))*((x*1)+(0))+(y/2+x)*(x+y/2)/(y-x*1+0.5)-(2*3+1)*((y/2+x)*1)", redundant, redundantErrorPos);
+    Program optimizedProgram = redundant;
+    OptimizeResult optimizeResult;
+    Optimizer::Optimize(optimizedProgram, optimizeResult);
+    cout << "optimize : " << optimizeResult.nodeCountBefore << " -> " << optimizeResult.nodeCountAfter << " nodes, "
+         << redundant.code.size() << " -> " << optimizedProgram.code.size() << " insts" << endl;
+
+    double redundantSeconds = Measure(batchIterations, [&]()
+    {
+        BatchEval::Run(redundant, columns, size(columns), rowCount, results.data(), errors.data(), 1, false);
+    });
+    PrintResult(name, "batch(original)", redundantSeconds, rowCount, "row");
+
+    double optimizedSeconds = Measure(batchIterations, [&]()
+    {
+        BatchEval::Run(optimizedProgram, columns, size(columns), rowCount, results.data(), errors.data(), 1, false);
+    });
+    PrintResult(name, "batch(optimized)", optimizedSeconds, rowCount, "row");
+
+    // 同じ式を変数を変えながら繰り返し評価する。評価の回数はiterationsの1000倍（既定は10^8回）
+    u64 evaluations = static_cast<u64>(iterations) * 1000;
+    cout << "evaluations : " << evaluations << endl;
+
+    double variables[] = {0.0, 3.0};
+    name = to_string(program.code.size()) + " insts";
+
+    double rpnTotal = Measure(iterations, [&]()
+    {
+        vector<unique_ptr<Command>> copied;
+        copied.reserve(cmds.size());
+        for (const auto& cmd : cmds)
+        {
+            // RPN::CalcFromRPNは変数を扱えないため、値に置き換える
+            if (cmd->type() != CmdType::variable) copied.emplace_back(cmd->clone());
+            else AppendNum(copied, variables[Bytecode::FindVariable(program, cmd->toString())]);
+        }
+
+        unique_ptr<Command> result = RPN::CalcFromRPN
+        (
+            calculator.get(), RPN::ToRPN(copied.begin(), copied.end()), make_unique<NumberCmd>()
+        );
+        if (result != nullptr) sink = PtrAs<NumberCmd>(result.get())->getNum();
+    });
+    PrintResult(name, "rpn", rpnTotal, 1, "eval");
+
+    auto measureEvaluations = [&](const function<double(const double*)>& evaluate)
+    {
+        auto start = chrono::steady_clock::now();
+        double sum = 0.0;
+        for (u64 i = 0; i < evaluations; ++i)
+        {
+            variables[0] = static_cast<double>(i & 1023);
+            sum += evaluate(variables);
+        }
+        auto end = chrono::steady_clock::now();
+
+        sink = sum;
+        return chrono::duration<double>(end - start).count() / evaluations;
+    };
+
+    double vmSeconds = measureEvaluations([&](const double* values) { return Bytecode::Run(program, values).first; });
+    PrintResult(name, "vm", vmSeconds, 1, "eval");
+
+    JitCache jitCache;
+    shared_ptr<const JitFunction> jitFunction = jitCache.get(program);
+    double jitSeconds = measureEvaluations([&](const double* values) { return jitFunction->run(values).first; });
+    PrintResult(name, jitFunction->isNative() ? "jit" : "jit(fallback)", jitSeconds, 1, "eval");
+
+    // 文字列の式を解析する速さ。トークンあたりの時間と、1秒あたりのトークン数を出力する
+    string text;
+    for (u32 i = 0; i < 20000; ++i) text += "(1.5+rate*(2-3.25e-1))/4-x*-12+";
+    text += "1";
+
+    size_t tokenCount = 0;
+    Tokenizer tokenizer(text);
+    Token token;
+    while (tokenizer.next(token)) tokenCount++;
+
+    size_t errorPos = 0;
+    Program parsed;
+    u32 parseIterations = max(1u, iterations / 1000);
+    double parseSeconds = Measure(parseIterations, [&]()
+    {
+        Parser::Parse(text, parsed, errorPos);
+    });
+    PrintResult(to_string(tokenCount) + " tokens", "parse", parseSeconds, tokenCount, "token");
+    cout << setw(34) << "" << right << setw(17) << setprecision(1) << tokenCount / parseSeconds / 1e6 << " M tokens/s" << endl;
+
+    // 複数のスレッドから同時にEngine::Evaluateを呼び出した時の1秒あたりの評価回数
+    const char* engineText = "(1.5+3*(2-0.25))/4-12*7.5+100/3";
+    u32 engineIterations = max(1u, iterations * 10);
+    for (u32 threadCount = 1; ; threadCount = min(threadCount * 2, hardwareThreadCount))
+    {
+        vector<double> results(threadCount);
+        double engineSeconds = Measure(1, [&]()
+        {
+            vector<thread> threads;
+            for (u32 t = 0; t < threadCount; ++t)
+            {
+                threads.emplace_back([&, t]()
+                {
+                    size_t errorPos = 0;
+                    for (u32 i = 0; i < engineIterations; ++i) Engine::Evaluate(engineText, nullptr, results[t], errorPos);
+                });
+            }
+            for (thread& t : threads) t.join();
+        });
+        sink = results[0];
+
+        u64 evaluationCount = static_cast<u64>(engineIterations) * threadCount;
+        PrintResult("engine", "evaluate(" + to_string(threadCount) + " threads)", engineSeconds, evaluationCount, "eval");
+        cout << setw(34) << "" << right << setw(17) << setprecision(1) << evaluationCount / engineSeconds / 1e6 << " M evals/s" << endl;
+
+        if (threadCount == hardwareThreadCount) break;
+    }
+
+    // 改行区切りの式を読み込んで書き出す。入出力は一時ファイルを使用する
+    string lines;
+    for (u32 i = 0; i < 1000000; ++i) lines += "(" + to_string(i) + "+1.5)*3.75/4-(2-" + to_string(i % 97) + ")\n";
+    size_t lineCount = 1000000;
+
+    FILE* input = tmpfile();
+    FILE* output = tmpfile();
+    if (input != nullptr && output != nullptr)
+    {
+        fwrite(lines.data(), 1, lines.size(), input);
+
+        for (u32 threadCount : {1u, hardwareThreadCount})
+        {
+            double streamSeconds = Measure(1, [&]()
+            {
+                rewind(input);
+                rewind(output);
+
+                size_t errorCount = 0;
+                StreamEval::Run(input, output, threadCount, errorCount);
+            });
+            PrintResult(to_string(lineCount) + " lines", "stream(" + to_string(threadCount) + " threads)", streamSeconds, lineCount, "line");
+
+            if (hardwareThreadCount == 1) break;
+        }
+    }
+    if (input != nullptr) fclose(input);
+    if (output != nullptr) fclose(output);
+
+    // Zipf分布で選んだ式を繰り返し評価する。キャッシュは式の種類より少ない数だけ保持する
+    {
+        const u32 expressionCount = 20000;
+        const u32 sampleCount = 200000;
+        mt19937 zipfRandom(49);
+
+        vector<string> expressions(expressionCount);
+        for (string& text : expressions)
+        {
+            text = to_string(zipfRandom() % 1000);
+            for (u32 term = 0; term < 24; ++term)
+            {
+                text += "+/*-"[zipfRandom() % 4];
+                text += "(" + to_string(zipfRandom() % 100 + 1) + "/" + to_string(zipfRandom() % 7 + 1) + ")";
+            }
+        }
+
+        // 順位kの式を1/kに比例する確率で選ぶ
+        vector<double> cdf(expressionCount);
+        double total = 0.0;
+        for (u32 k = 0; k < expressionCount; ++k) cdf[k] = (total += 1.0 / (k + 1));
+        uniform_real_distribution<double> uniform(0.0, total);
+        vector<u32> samples(sampleCount);
+        for (u32& sample : samples) sample = static_cast<u32>(lower_bound(cdf.begin(), cdf.end(), uniform(zipfRandom)) - cdf.begin());
+
+        for (u32 threadCount = 1; ; threadCount = min(threadCount * 2, hardwareThreadCount))
+        {
+            EvalCache cache(4096);
+            vector<double> results(threadCount);
+            auto run = [&](bool isCached)
+            {
+                return Measure(1, [&]()
+                {
+                    vector<thread> threads;
+                    for (u32 t = 0; t < threadCount; ++t)
+                    {
+                        threads.emplace_back([&, t]()
+                        {
+                            size_t errorPos = 0;
+                            for (u32 i = t; i < sampleCount; i += threadCount)
+                            {
+                                const string& text = expressions[samples[i]];
+                                if (isCached) Engine::Evaluate(text, cache, results[t], errorPos);
+                                else Engine::Evaluate(text, nullptr, results[t], errorPos);
+                            }
+                        });
+                    }
+                    for (thread& t : threads) t.join();
+                });
+            };
+
+            string label = "(" + to_string(threadCount) + " threads)";
+            PrintResult("zipf", "uncached" + label, run(false), sampleCount, "eval");
+            PrintResult("zipf", "cached" + label, run(true), sampleCount, "eval");
+            cout << setw(34) << "" << right << setw(14) << setprecision(1) << cache.getHitRate() * 100 << " % hit, "
+                 << cache.size() << " entries" << endl;
+            sink = results[0];
+
+            if (threadCount == hardwareThreadCount) break;
+        }
+    }
+
+    // 追加、取り消し、やり直し、計算、枝への移動を混ぜた10^6回の編集
+    {
+        const u32 editCount = 1000000;
+        mt19937 editRandom(48);
+        vector<u32> ops(editCount);
+        for (u32& op : ops) op = editRandom() % 100;
+        const CmdType editTypes[] =
+        {
+            CmdType::add, CmdType::subtract, CmdType::multiply, CmdType::divide, CmdType::leftParen, CmdType::rightParen
+        };
+
+        unique_ptr<Calculator> editCalculator;
+        double editSeconds = Measure(1, [&]()
+        {
+            editCalculator = make_unique<Calculator>();
+            for (u32 i = 0; i < editCount; ++i)
+            {
+                u32 op = ops[i];
+                if (op < 30) editCalculator->appendToken({CmdType::number, 0, static_cast<double>(op)});
+                else if (op < 55) editCalculator->appendToken({editTypes[op % 6]});
+                else if (op < 75) editCalculator->undo();
+                else if (op < 93) editCalculator->redo();
+                else if (op < 99) editCalculator->execute();
+                else editCalculator->restore(ops[i - 1] * 997 % static_cast<u32>(editCalculator->getHistory().size()));
+            }
+        });
+        sink = editCalculator->getPreview().first;
+
+        PrintResult("10^6 edits", "history", editSeconds, editCount, "edit");
+        cout << setw(34) << "" << right << setw(14) << editCalculator->getHistory().size() << " edits kept ("
+             << editCalculator->getHistory().size() * sizeof(HistoryEdit) / 1024 << " KiB)" << endl;
+    }
+
+    // 多倍長整数の乗算、除算、10進数への変換。筆算は時間がかかるため10^5桁までにする
+    mt19937_64 random(47);
+    u64 digits = 100;
+    for (u32 exponent = 3; exponent <= 6; ++exponent)
+    {
+        digits *= 10;
+        u32 limbCount = static_cast<u32>(digits * 3322 / 1000 / 64 + 1);
+        vector<u64> limbs(limbCount * 3);
+        for (u64& limb : limbs) limb = random();
+        BigInt a = BigInt::FromLimbs(limbs.data(), limbCount);
+        BigInt b = BigInt::FromLimbs(limbs.data() + limbCount, limbCount);
+        BigInt dividend = BigInt::FromLimbs(limbs.data() + limbCount, limbCount * 2);
+
+        u32 bigIterations = (digits <= 1000) ? 1000 : (digits <= 10000) ? 20 : 1;
+        string name = "10^" + to_string(exponent) + " digits";
+        BigInt quotient;
+        BigInt remainder;
+
+        PrintResult(name, "multiply", Measure(bigIterations, [&]() { quotient = a * b; }), digits, "digit");
+        if (digits <= 100000)
+        {
+            double seconds = Measure(bigIterations, [&]() { quotient = BigInt::Multiply(a, b, MulAlgorithm::schoolbook); });
+            PrintResult(name, "multiply(school)", seconds, digits, "digit");
+        }
+
+        PrintResult(name, "divide", Measure(bigIterations, [&]() { BigInt::DivMod(dividend, b, quotient, remainder); }), digits, "digit");
+        if (digits <= 100000)
+        {
+            double seconds = Measure(bigIterations, [&]()
+            {
+                BigInt::DivMod(dividend, b, quotient, remainder, DivAlgorithm::schoolbook);
+            });
+            PrintResult(name, "divide(school)", seconds, digits, "digit");
+        }
+
+        PrintResult(name, "toString", Measure(bigIterations, [&]() { sink = static_cast<double>(a.toString().size()); }), digits, "digit");
+    }
+
+    // 10^6項の積の和。組み替えない木は命令列と同じく1つのスレッドで評価し、組み替えた木はスレッド数を変えて評価する
+    {
+        const u32 termCount = 1000000;
+        uniform_real_distribution<double> distribution(0.5, 1.5);
+        mt19937 termRandom(50);
+        Program termProgram;
+        for (u32 i = 0; i < termCount; ++i)
+        {
+            termProgram.code.push_back({OpCode::push, 0, distribution(termRandom)});
+            termProgram.code.push_back({OpCode::push, 0, distribution(termRandom)});
+            termProgram.code.push_back({OpCode::multiply});
+            if (i != 0) termProgram.code.push_back({(i % 4 == 0) ? OpCode::subtract : OpCode::add});
+        }
+        termProgram.stackSize = 3;
+
+        double serialResult = 0.0;
+        double serialSeconds = Measure(10, [&]() { serialResult = Bytecode::Run(termProgram).first; });
+        PrintResult("10^6 terms", "bytecode", serialSeconds, termCount, "term");
+
+        ExprTree plainTree;
+        ExprTree fastTree;
+        ParallelEval::Build(termProgram, false, plainTree);
+        ParallelEval::Build(termProgram, true, fastTree);
+        PrintResult("10^6 terms", "tree", Measure(10, [&]() { sink = ParallelEval::Run(plainTree, nullptr, 1).first; }), termCount, "term");
+
+        for (u32 threadCount = 1; ; threadCount = min(threadCount * 2, hardwareThreadCount))
+        {
+            double fastResult = 0.0;
+            double fastSeconds = Measure(10, [&]() { fastResult = ParallelEval::Run(fastTree, nullptr, threadCount).first; });
+            PrintResult("10^6 terms", "fast(" + to_string(threadCount) + " threads)", fastSeconds, termCount, "term");
+            cout << setw(34) << "" << right << setw(17) << setprecision(2) << serialSeconds / fastSeconds << " x, relative error "
+                 << scientific << setprecision(1) << fabs(fastResult - serialResult) / fabs(serialResult) << fixed << endl;
+
+            if (threadCount == hardwareThreadCount) break;
+        }
+    }
+
+    return 0;
+}
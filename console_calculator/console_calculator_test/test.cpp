@@ -3,6 +3,25 @@
 #include "console_calculator/include/pch.h"
 #include "console_calculator/include/calculator.h"
 #include "console_calculator/include/command.h"
+#include "console_calculator/include/bytecode.h"
+#include "console_calculator/include/cmd_token.h"
+#include "console_calculator/include/edit_history.h"
+#include "console_calculator/include/engine.h"
+#include "console_calculator/include/eval_cache.h"
+#include "console_calculator/include/batch_eval.h"
+#include "console_calculator/include/big_decimal.h"
+#include "console_calculator/include/big_int.h"
+#include "console_calculator/include/jit.h"
+#include "console_calculator/include/live_eval.h"
+#include "console_calculator/include/optimizer.h"
+#include "console_calculator/include/parallel_eval.h"
+#include "console_calculator/include/parser.h"
+#include "console_calculator/include/stream_eval.h"
+
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <thread>
 
 TEST(CalculatorTest, Addition) 
 {
@@ -429,6 +448,1393 @@ TEST(CalculatorTest, EqualMinus)
     );
 }
 
+TEST(BytecodeTest, CompileParentheses)
+{
+    // (1 + 3 * (2 + -3)) * 3 - 10 / 2
+    std::vector<std::unique_ptr<Command>> cmds;
+    double nums[] = {1.0, 3.0, 2.0, -3.0, 3.0, 10.0, 2.0};
+
+    cmds.emplace_back(std::make_unique<LeftParenCmd>()); // (
+
+    cmds.emplace_back(std::make_unique<NumberCmd>());
+    PtrAs<NumberCmd>(cmds.back().get())->setNum(nums[0]); // 1
+
+    cmds.emplace_back(std::make_unique<AddCmd>()); // +
+
+    cmds.emplace_back(std::make_unique<NumberCmd>());
+    PtrAs<NumberCmd>(cmds.back().get())->setNum(nums[1]); // 3
+
+    cmds.emplace_back(std::make_unique<MultiplyCmd>()); // *
+
+    cmds.emplace_back(std::make_unique<LeftParenCmd>()); // (
+
+    cmds.emplace_back(std::make_unique<NumberCmd>());
+    PtrAs<NumberCmd>(cmds.back().get())->setNum(nums[2]); // 2
+
+    cmds.emplace_back(std::make_unique<AddCmd>()); // +
+
+    cmds.emplace_back(std::make_unique<NumberCmd>());
+    PtrAs<NumberCmd>(cmds.back().get())->setNum(nums[3]); // -3
+
+    cmds.emplace_back(std::make_unique<RightParenCmd>()); // )
+
+    cmds.emplace_back(std::make_unique<RightParenCmd>()); // )
+
+    cmds.emplace_back(std::make_unique<MultiplyCmd>()); // *
+
+    cmds.emplace_back(std::make_unique<NumberCmd>());
+    PtrAs<NumberCmd>(cmds.back().get())->setNum(nums[4]); // 3
+
+    cmds.emplace_back(std::make_unique<SubtractCmd>()); // -
+
+    cmds.emplace_back(std::make_unique<NumberCmd>());
+    PtrAs<NumberCmd>(cmds.back().get())->setNum(nums[5]); // 10
+
+    cmds.emplace_back(std::make_unique<DivideCmd>()); // /
+
+    cmds.emplace_back(std::make_unique<NumberCmd>());
+    PtrAs<NumberCmd>(cmds.back().get())->setNum(nums[6]); // 2
+
+    Program program;
+    ASSERT_TRUE(Bytecode::Compile(cmds, program));
+
+    // 1 3 2 -3 + * + 3 * 10 2 / -
+    OpCode expect[] = 
+    {
+        OpCode::push, OpCode::push, OpCode::push, OpCode::push, OpCode::add, OpCode::multiply, OpCode::add,
+        OpCode::push, OpCode::multiply, OpCode::push, OpCode::push, OpCode::divide, OpCode::subtract
+    };
+    ASSERT_EQ(std::size(expect), program.code.size());
+    for (size_t i = 0; i < program.code.size(); ++i) EXPECT_EQ(expect[i], program.code[i].op);
+    EXPECT_EQ(4u, program.stackSize);
+
+    std::pair<double, bool> result = Bytecode::Run(program);
+    EXPECT_TRUE(result.second);
+    EXPECT_DOUBLE_EQ(-11.0, result.first);
+}
+
+TEST(BytecodeTest, ZeroDivision)
+{
+    // 1 / (2 - 2)
+    std::vector<std::unique_ptr<Command>> cmds;
+    double nums[] = {1.0, 2.0, 2.0};
+
+    cmds.emplace_back(std::make_unique<NumberCmd>());
+    PtrAs<NumberCmd>(cmds.back().get())->setNum(nums[0]); // 1
+
+    cmds.emplace_back(std::make_unique<DivideCmd>()); // /
+    cmds.emplace_back(std::make_unique<LeftParenCmd>()); // (
+
+    cmds.emplace_back(std::make_unique<NumberCmd>());
+    PtrAs<NumberCmd>(cmds.back().get())->setNum(nums[1]); // 2
+
+    cmds.emplace_back(std::make_unique<SubtractCmd>()); // -
+
+    cmds.emplace_back(std::make_unique<NumberCmd>());
+    PtrAs<NumberCmd>(cmds.back().get())->setNum(nums[2]); // 2
+
+    cmds.emplace_back(std::make_unique<RightParenCmd>()); // )
+
+    Program program;
+    ASSERT_TRUE(Bytecode::Compile(cmds, program));
+    EXPECT_FALSE(Bytecode::Run(program).second);
+}
+
+TEST(BytecodeTest, IncompleteExpression)
+{
+    Program program;
+    std::vector<std::unique_ptr<Command>> cmds;
+
+    // 1 +
+    cmds.emplace_back(std::make_unique<NumberCmd>());
+    PtrAs<NumberCmd>(cmds.back().get())->setNum(1.0);
+    cmds.emplace_back(std::make_unique<AddCmd>());
+    EXPECT_FALSE(Bytecode::Compile(cmds, program));
+
+    // 1 + (2
+    cmds.emplace_back(std::make_unique<LeftParenCmd>());
+    cmds.emplace_back(std::make_unique<NumberCmd>());
+    PtrAs<NumberCmd>(cmds.back().get())->setNum(2.0);
+    EXPECT_FALSE(Bytecode::Compile(cmds, program));
+
+    // 1 + (2)
+    cmds.emplace_back(std::make_unique<RightParenCmd>());
+    ASSERT_TRUE(Bytecode::Compile(cmds, program));
+    EXPECT_DOUBLE_EQ(3.0, Bytecode::Run(program).first);
+
+    // 1 + (2))
+    cmds.emplace_back(std::make_unique<RightParenCmd>());
+    EXPECT_FALSE(Bytecode::Compile(cmds, program));
+}
+
+TEST(BatchEvalTest, Variables)
+{
+    // (x + 1) / (y - 2) * x
+    std::vector<std::unique_ptr<Command>> cmds;
+    const char* names[] = {"x", "y", "x"};
+
+    cmds.emplace_back(std::make_unique<LeftParenCmd>()); // (
+
+    cmds.emplace_back(std::make_unique<VariableCmd>());
+    PtrAs<VariableCmd>(cmds.back().get())->setName(names[0]); // x
+
+    cmds.emplace_back(std::make_unique<AddCmd>()); // +
+
+    cmds.emplace_back(std::make_unique<NumberCmd>());
+    PtrAs<NumberCmd>(cmds.back().get())->setNum(1.0); // 1
+
+    cmds.emplace_back(std::make_unique<RightParenCmd>()); // )
+    cmds.emplace_back(std::make_unique<DivideCmd>()); // /
+    cmds.emplace_back(std::make_unique<LeftParenCmd>()); // (
+
+    cmds.emplace_back(std::make_unique<VariableCmd>());
+    PtrAs<VariableCmd>(cmds.back().get())->setName(names[1]); // y
+
+    cmds.emplace_back(std::make_unique<SubtractCmd>()); // -
+
+    cmds.emplace_back(std::make_unique<NumberCmd>());
+    PtrAs<NumberCmd>(cmds.back().get())->setNum(2.0); // 2
+
+    cmds.emplace_back(std::make_unique<RightParenCmd>()); // )
+    cmds.emplace_back(std::make_unique<MultiplyCmd>()); // *
+
+    cmds.emplace_back(std::make_unique<VariableCmd>());
+    PtrAs<VariableCmd>(cmds.back().get())->setName(names[2]); // x
+
+    Program program;
+    ASSERT_TRUE(Bytecode::Compile(cmds, program));
+    ASSERT_EQ(2u, program.variables.size());
+    EXPECT_EQ(0, Bytecode::FindVariable(program, "x"));
+    EXPECT_EQ(1, Bytecode::FindVariable(program, "y"));
+    EXPECT_EQ(-1, Bytecode::FindVariable(program, "z"));
+
+    // 端数の行も含め、7行に1回0除算が起きるようにする
+    const size_t rowCount = BatchEval::PARALLEL_ROW_COUNT * 2 + 77;
+    std::vector<double> x(rowCount);
+    std::vector<double> y(rowCount);
+    for (size_t i = 0; i < rowCount; ++i)
+    {
+        x[i] = static_cast<double>(i) * 0.25 - 100.0;
+        y[i] = (i % 7 == 0) ? 2.0 : static_cast<double>(i % 13) + 0.5;
+    }
+    const double* columns[] = {x.data(), y.data()};
+
+    for (u32 threadCount : {1u, 4u})
+    {
+        std::vector<double> results(rowCount);
+        std::vector<u8> errors(rowCount, 2);
+        ASSERT_TRUE(BatchEval::Run(program, columns, 2, rowCount, results.data(), errors.data(), threadCount));
+
+        for (size_t i = 0; i < rowCount; ++i)
+        {
+            double variables[] = {x[i], y[i]};
+            std::pair<double, bool> expect = Bytecode::Run(program, variables);
+
+            ASSERT_EQ(expect.second ? 0 : 1, errors[i]) << i;
+            ASSERT_DOUBLE_EQ(expect.first, results[i]) << i;
+        }
+    }
+
+    // 変数の値を渡さない場合は評価しない
+    EXPECT_FALSE(Bytecode::Run(program).second);
+    EXPECT_FALSE(BatchEval::Run(program, nullptr, 0, 1, nullptr, nullptr));
+
+    // 列が足りない場合も評価しない
+    std::vector<double> results(rowCount);
+    std::vector<u8> errors(rowCount);
+    EXPECT_FALSE(BatchEval::Run(program, columns, 1, rowCount, results.data(), errors.data()));
+}
+
+TEST(BatchEvalTest, MatchesScalar)
+{
+    // 演算の後に値を積む式で、各行の結果が命令列を1行ずつ評価した結果と一致すること
+    const char* texts[] = 
+    {
+        "(1+2)*4", "(x+2)*4", "x*y+3", "(a+b)*(c+d)", "x-(y-(x-(y-1)))",
+        "1+2*(3-x)/(y+1)-4", "((a-b)*(c+d))/(a+2)-b*3", "(a+b)*(a+b)+(c-d)*(c-d)",
+    };
+
+    const size_t rowCount = BatchEval::LANE_COUNT * 3 + 5;
+    std::vector<std::vector<double>> values(6, std::vector<double>(rowCount));
+    for (size_t v = 0; v < values.size(); ++v)
+    {
+        for (size_t i = 0; i < rowCount; ++i) values[v][i] = static_cast<double>((i * (v + 3)) % 17) - 4.5;
+    }
+
+    for (const char* text : texts)
+    {
+        Program program;
+        size_t errorPos = 0;
+        ASSERT_TRUE(Parser::Parse(text, program, errorPos)) << text;
+
+        // 共通の部分式を一時領域に置いた命令列と、Run自身が最適化する場合も比べる
+        Program optimized = program;
+        OptimizeResult optimizeResult;
+        ASSERT_TRUE(Optimizer::Optimize(optimized, optimizeResult)) << text;
+
+        for (const Program* target : {&program, &optimized})
+        {
+            for (bool isOptimizing : {false, true})
+            {
+                std::vector<const double*> columns;
+                for (size_t v = 0; v < target->variables.size(); ++v) columns.push_back(values[v].data());
+
+                std::vector<double> results(rowCount);
+                std::vector<u8> errors(rowCount, 2);
+                ASSERT_TRUE
+                (
+                    BatchEval::Run(*target, columns.data(), columns.size(), rowCount, results.data(), errors.data(), 1, isOptimizing)
+                ) << text;
+
+                for (size_t i = 0; i < rowCount; ++i)
+                {
+                    double variables[6] = {};
+                    for (size_t v = 0; v < target->variables.size(); ++v) variables[v] = values[v][i];
+                    std::pair<double, bool> expect = Bytecode::Run(*target, variables);
+
+                    ASSERT_EQ(expect.second ? 0 : 1, errors[i]) << text << " " << i;
+                    if (expect.second)
+                    {
+                        ASSERT_DOUBLE_EQ(expect.first, results[i]) << text << " " << i;
+                    }
+                }
+            }
+        }
+    }
+}
+
+namespace
+{
+
+void AppendNum(std::vector<std::unique_ptr<Command>>& cmds, double num)
+{
+    cmds.emplace_back(std::make_unique<NumberCmd>());
+    PtrAs<NumberCmd>(cmds.back().get())->setNum(num);
+}
+
+void AppendVariable(std::vector<std::unique_ptr<Command>>& cmds, const std::string& name)
+{
+    cmds.emplace_back(std::make_unique<VariableCmd>());
+    PtrAs<VariableCmd>(cmds.back().get())->setName(name);
+}
+
+}
+
+TEST(JitTest, MatchesInterpreter)
+{
+    // x * (y - 1.5) / (z + 2) - 10 / y
+    std::vector<std::unique_ptr<Command>> cmds;
+    AppendVariable(cmds, "x");
+    cmds.emplace_back(std::make_unique<MultiplyCmd>());
+    cmds.emplace_back(std::make_unique<LeftParenCmd>());
+    AppendVariable(cmds, "y");
+    cmds.emplace_back(std::make_unique<SubtractCmd>());
+    AppendNum(cmds, 1.5);
+    cmds.emplace_back(std::make_unique<RightParenCmd>());
+    cmds.emplace_back(std::make_unique<DivideCmd>());
+    cmds.emplace_back(std::make_unique<LeftParenCmd>());
+    AppendVariable(cmds, "z");
+    cmds.emplace_back(std::make_unique<AddCmd>());
+    AppendNum(cmds, 2.0);
+    cmds.emplace_back(std::make_unique<RightParenCmd>());
+    cmds.emplace_back(std::make_unique<SubtractCmd>());
+    AppendNum(cmds, 10.0);
+    cmds.emplace_back(std::make_unique<DivideCmd>());
+    AppendVariable(cmds, "y");
+
+    Program program;
+    ASSERT_TRUE(Bytecode::Compile(cmds, program));
+
+    JitFunction function(program);
+#if defined(__linux__) && defined(__x86_64__)
+    EXPECT_TRUE(function.isNative());
+#endif
+
+    // 0除算、NaNでの除算、-0での除算を含める
+    double values[][3] = 
+    {
+        {1.0, 2.0, 3.0}, {-4.5, 0.25, 7.0}, {3.0, 0.0, 1.0}, {2.0, 5.0, -2.0},
+        {1.0, std::nan(""), 1.0}, {1.0, -0.0, 1.0}, {1e300, 1e-300, 0.5}
+    };
+    for (const auto& variables : values)
+    {
+        std::pair<double, bool> expect = Bytecode::Run(program, variables);
+        std::pair<double, bool> result = function.run(variables);
+
+        EXPECT_EQ(expect.second, result.second);
+        if (std::isnan(expect.first))
+        {
+            EXPECT_TRUE(std::isnan(result.first));
+        }
+        else
+        {
+            EXPECT_DOUBLE_EQ(expect.first, result.first);
+        }
+    }
+}
+
+TEST(JitTest, DeepStackFallsBack)
+{
+    // 1 + (2 + (3 + ... (20 * 2)))
+    std::vector<std::unique_ptr<Command>> cmds;
+    for (u32 i = 1; i < 20; ++i)
+    {
+        AppendNum(cmds, i);
+        cmds.emplace_back(std::make_unique<AddCmd>());
+        cmds.emplace_back(std::make_unique<LeftParenCmd>());
+    }
+    AppendNum(cmds, 20.0);
+    cmds.emplace_back(std::make_unique<MultiplyCmd>());
+    AppendNum(cmds, 2.0);
+    for (u32 i = 1; i < 20; ++i) cmds.emplace_back(std::make_unique<RightParenCmd>());
+
+    Program program;
+    ASSERT_TRUE(Bytecode::Compile(cmds, program));
+    ASSERT_GT(program.stackSize, JitFunction::MAX_REGISTER_COUNT);
+
+    JitFunction function(program);
+    EXPECT_FALSE(function.isNative());
+    EXPECT_DOUBLE_EQ(190.0 + 40.0, function.run().first);
+}
+
+TEST(JitTest, Cache)
+{
+    std::vector<std::unique_ptr<Command>> cmds;
+    AppendVariable(cmds, "x");
+    cmds.emplace_back(std::make_unique<MultiplyCmd>());
+    AppendNum(cmds, 3.0);
+
+    Program program;
+    ASSERT_TRUE(Bytecode::Compile(cmds, program));
+
+    JitCache cache;
+    std::shared_ptr<const JitFunction> first = cache.get(program);
+    std::shared_ptr<const JitFunction> second = cache.get(program);
+    EXPECT_EQ(first.get(), second.get());
+    EXPECT_EQ(1u, cache.size());
+
+    // 定数が異なる式は別に変換する
+    PtrAs<NumberCmd>(cmds.back().get())->setNum(4.0);
+    ASSERT_TRUE(Bytecode::Compile(cmds, program));
+
+    std::shared_ptr<const JitFunction> third = cache.get(program);
+    EXPECT_NE(first.get(), third.get());
+    EXPECT_EQ(2u, cache.size());
+
+    double x = 2.5;
+    EXPECT_DOUBLE_EQ(7.5, first->run(&x).first);
+    EXPECT_DOUBLE_EQ(10.0, third->run(&x).first);
+
+    // 上限を超えると最も長く使用していない関数を削除する。削除した関数も保持している間は使用できる
+    JitCache bounded(2);
+    std::vector<std::shared_ptr<const JitFunction>> functions;
+    for (double num : {1.0, 2.0, 3.0})
+    {
+        PtrAs<NumberCmd>(cmds.back().get())->setNum(num);
+        ASSERT_TRUE(Bytecode::Compile(cmds, program));
+        functions.push_back(bounded.get(program));
+        if (num == 2.0)
+        {
+            // x * 1を最後に使用した関数にする
+            PtrAs<NumberCmd>(cmds.back().get())->setNum(1.0);
+            ASSERT_TRUE(Bytecode::Compile(cmds, program));
+            EXPECT_EQ(functions[0].get(), bounded.get(program).get());
+        }
+    }
+    EXPECT_EQ(2u, bounded.size());
+    EXPECT_DOUBLE_EQ(5.0, functions[1]->run(&x).first);
+
+    PtrAs<NumberCmd>(cmds.back().get())->setNum(1.0);
+    ASSERT_TRUE(Bytecode::Compile(cmds, program));
+    EXPECT_EQ(functions[0].get(), bounded.get(program).get());
+
+    PtrAs<NumberCmd>(cmds.back().get())->setNum(2.0);
+    ASSERT_TRUE(Bytecode::Compile(cmds, program));
+    EXPECT_NE(functions[1].get(), bounded.get(program).get());
+    EXPECT_EQ(2u, bounded.size());
+}
+
+TEST(ParserTest, MatchesCompile)
+{
+    // (1 + 3 * (2 + -3)) * 3 - 10 / 2
+    std::vector<std::unique_ptr<Command>> cmds;
+    cmds.emplace_back(std::make_unique<LeftParenCmd>());
+    AppendNum(cmds, 1.0);
+    cmds.emplace_back(std::make_unique<AddCmd>());
+    AppendNum(cmds, 3.0);
+    cmds.emplace_back(std::make_unique<MultiplyCmd>());
+    cmds.emplace_back(std::make_unique<LeftParenCmd>());
+    AppendNum(cmds, 2.0);
+    cmds.emplace_back(std::make_unique<AddCmd>());
+    AppendNum(cmds, -3.0);
+    cmds.emplace_back(std::make_unique<RightParenCmd>());
+    cmds.emplace_back(std::make_unique<RightParenCmd>());
+    cmds.emplace_back(std::make_unique<MultiplyCmd>());
+    AppendNum(cmds, 3.0);
+    cmds.emplace_back(std::make_unique<SubtractCmd>());
+    AppendNum(cmds, 10.0);
+    cmds.emplace_back(std::make_unique<DivideCmd>());
+    AppendNum(cmds, 2.0);
+
+    Program expect;
+    ASSERT_TRUE(Bytecode::Compile(cmds, expect));
+
+    Program program;
+    size_t errorPos = 0;
+    ASSERT_TRUE(Parser::Parse("(1+3*(2+-3))*3-10/2", program, errorPos));
+    EXPECT_TRUE(Bytecode::IsSame(expect, program));
+    EXPECT_EQ(expect.stackSize, program.stackSize);
+
+    ASSERT_TRUE(Parser::Parse("  ( 1 + 3 * ( 2 + -3 ) ) * 3 - 10 / 2\n", program, errorPos));
+    EXPECT_TRUE(Bytecode::IsSame(expect, program));
+}
+
+TEST(ParserTest, Evaluate)
+{
+    std::pair<const char*, double> cases[] = 
+    {
+        {"3*(4+5)/2", 13.5}, {"10-4-3", 3.0}, {"64/4/2", 8.0}, {"2*-3", -6.0}, {"2--3", 5.0},
+        {"-(2+3)*2", -10.0}, {"- 2 * 3", -6.0}, {"+4", 4.0}, {".5+1.25e1", 13.0}, {"((((7))))", 7.0}
+    };
+
+    Program program;
+    for (const auto& [text, expect] : cases)
+    {
+        size_t errorPos = 0;
+        ASSERT_TRUE(Parser::Parse(text, program, errorPos)) << text;
+        EXPECT_DOUBLE_EQ(expect, Bytecode::Run(program).first) << text;
+    }
+
+    // 変数は初めて現れた順に番号を振る
+    size_t errorPos = 0;
+    ASSERT_TRUE(Parser::Parse("rate * (1 + rate) - -base_2", program, errorPos));
+    ASSERT_EQ(2u, program.variables.size());
+    EXPECT_EQ("rate", program.variables[0]);
+    EXPECT_EQ("base_2", program.variables[1]);
+
+    double variables[] = {0.5, 4.0};
+    EXPECT_DOUBLE_EQ(4.75, Bytecode::Run(program, variables).first);
+}
+
+TEST(ParserTest, Error)
+{
+    std::pair<const char*, size_t> cases[] = 
+    {
+        {"3+", 2}, {"(1+2", 4}, {"1+2)", 3}, {"3 $ 4", 2}, {"1 2", 2}, {"*2", 0}, {"", 0}, {"()", 1}
+    };
+
+    Program program;
+    for (const auto& [text, expectPos] : cases)
+    {
+        size_t errorPos = 100;
+        EXPECT_FALSE(Parser::Parse(text, program, errorPos)) << text;
+        EXPECT_EQ(expectPos, errorPos) << text;
+    }
+}
+
+TEST(ParserTest, UnarySigns)
+{
+    // 続けて書かれた符号は再帰せずにまとめる。-が奇数個の場合だけ符号が反転する
+    std::string text(10'000'000, '-');
+    text += "1";
+
+    Program program;
+    size_t errorPos = 0;
+    ASSERT_TRUE(Parser::Parse(text, program, errorPos));
+    EXPECT_DOUBLE_EQ(1.0, Bytecode::Run(program).first);
+
+    text.insert(0, "+-");
+    ASSERT_TRUE(Parser::Parse(text, program, errorPos));
+    EXPECT_DOUBLE_EQ(-1.0, Bytecode::Run(program).first);
+
+    // 最適化で使った一時領域の数は、解析し直すと0に戻る
+    program.tempCount = 3;
+    ASSERT_TRUE(Parser::Parse("-(2+3)", program, errorPos));
+    EXPECT_EQ(0u, program.tempCount);
+    EXPECT_DOUBLE_EQ(-5.0, Bytecode::Run(program).first);
+}
+
+TEST(ParserTest, Tokenizer)
+{
+    // 演算子の後の-は数値の符号、数値の後の-は減算
+    Tokenizer tokenizer("5-3*-2.5");
+    CmdType expectTypes[] = {CmdType::number, CmdType::subtract, CmdType::number, CmdType::multiply, CmdType::number};
+    double expectNums[] = {5.0, 0.0, 3.0, 0.0, -2.5};
+
+    Token token;
+    for (size_t i = 0; i < std::size(expectTypes); ++i)
+    {
+        ASSERT_TRUE(tokenizer.next(token));
+        EXPECT_EQ(expectTypes[i], token.type);
+        EXPECT_DOUBLE_EQ(expectNums[i], token.num);
+    }
+    EXPECT_FALSE(tokenizer.next(token));
+    EXPECT_FALSE(tokenizer.isError());
+}
+
+TEST(StreamEvalTest, EvaluateLine)
+{
+    std::pair<const char*, const char*> cases[] = 
+    {
+        {"3*(4+5)/2", "13.5\n"}, {"1/3", "0.3333333333333333\n"}, {"  ", "\n"}, {"2*(1", "Error : Syntax error at 4\n"},
+        {"1/(2-2)", "Error : Division by zero\n"}, {"x+1", "Error : Variable 'x' is not set\n"},
+        {"100000*10", "1000000\n"}, {"1/100000000", "1e-08\n"}, {"0.1+0.2", "0.30000000000000004\n"}
+    };
+
+    Program program;
+    for (const auto& [line, expect] : cases)
+    {
+        std::string output;
+        StreamEval::EvaluateLine(line, program, output);
+        EXPECT_EQ(expect, output) << line;
+    }
+}
+
+TEST(StreamEvalTest, KeepOrder)
+{
+    // ブロックをまたぐ行数を書き込み、スレッド数によらず同じ順に出力されるか確かめる
+    std::string text;
+    std::string expect;
+    size_t expectErrorCount = 0;
+    for (u32 i = 0; i < 160000; ++i)
+    {
+        if (i % 1000 == 999)
+        {
+            text += std::to_string(i) + "/0\r\n";
+            expect += "Error : Division by zero\n";
+            expectErrorCount++;
+            continue;
+        }
+
+        text += "(" + std::to_string(i) + "+0.5)*2-1\n";
+        expect += std::to_string(i * 2) + "\n";
+    }
+    text += "7*6"; // 末尾に改行がない行
+    expect += "42\n";
+    ASSERT_GT(text.size(), StreamEval::BLOCK_SIZE * 2);
+
+    // 上限を超えるスレッド数はMAX_THREAD_COUNTに抑える
+    for (u32 threadCount : {1u, 4u, UINT32_MAX})
+    {
+        FILE* input = std::tmpfile();
+        FILE* output = std::tmpfile();
+        ASSERT_NE(nullptr, input);
+        ASSERT_NE(nullptr, output);
+
+        std::fwrite(text.data(), 1, text.size(), input);
+        std::rewind(input);
+
+        size_t errorCount = 0;
+        EXPECT_TRUE(StreamEval::Run(input, output, threadCount, errorCount));
+        EXPECT_EQ(expectErrorCount, errorCount);
+
+        std::rewind(output);
+        std::string result;
+        char buff[4096];
+        for (size_t size = 0; (size = std::fread(buff, 1, sizeof(buff), output)) != 0;) result.append(buff, size);
+
+        EXPECT_TRUE(expect == result) << threadCount;
+
+        std::fclose(input);
+        std::fclose(output);
+    }
+}
+
+TEST(CmdTokenTest, CheckAppend)
+{
+    // 初期値の数値だけの場合は置き換える
+    EXPECT_EQ(AppendAction::replace, CmdTokens::CheckAppend(1, CmdType::number, CmdType::number, CmdType::number));
+    EXPECT_EQ(AppendAction::replace, CmdTokens::CheckAppend(1, CmdType::number, CmdType::number, CmdType::leftParen));
+    EXPECT_EQ(AppendAction::append, CmdTokens::CheckAppend(1, CmdType::number, CmdType::number, CmdType::add));
+
+    // 演算子が続く場合、数値の後に数値や左括弧が続く場合は追加しない
+    EXPECT_EQ(AppendAction::reject, CmdTokens::CheckAppend(2, CmdType::number, CmdType::add, CmdType::multiply));
+    EXPECT_EQ(AppendAction::reject, CmdTokens::CheckAppend(3, CmdType::number, CmdType::number, CmdType::number));
+    EXPECT_EQ(AppendAction::reject, CmdTokens::CheckAppend(3, CmdType::number, CmdType::rightParen, CmdType::leftParen));
+    EXPECT_EQ(AppendAction::reject, CmdTokens::CheckAppend(2, CmdType::leftParen, CmdType::leftParen, CmdType::rightParen));
+    EXPECT_EQ(AppendAction::append, CmdTokens::CheckAppend(3, CmdType::leftParen, CmdType::variable, CmdType::rightParen));
+}
+
+TEST(CmdTokenTest, AppendUndoRedo)
+{
+    EXPECT_EQ(16u, sizeof(CmdToken));
+
+    // 1 + 2 * 3 =
+    std::unique_ptr<Calculator> calculator = std::make_unique<Calculator>();
+    calculator->appendToken({CmdType::number, 0, 1.0});
+    calculator->appendToken({CmdType::add});
+    calculator->appendToken({CmdType::subtract}); // 演算子は続けられない
+    calculator->appendToken({CmdType::number, 0, 2.0});
+    calculator->appendToken({CmdType::multiply});
+
+    // Commandからも追加できる
+    std::unique_ptr<Command> cmd = std::make_unique<NumberCmd>();
+    PtrAs<NumberCmd>(cmd.get())->setNum(3.0);
+    calculator->appendCmd(cmd);
+
+    ASSERT_EQ(5u, calculator->getCmds().size());
+    EXPECT_EQ(CmdType::multiply, calculator->getCmds()[3].type);
+
+    // 3と*を戻し、/ 4に置き換える。置き換えた後はやり直せない
+    calculator->undo();
+    calculator->undo();
+    calculator->appendToken({CmdType::divide});
+    calculator->appendToken({CmdType::number, 0, 4.0});
+    calculator->redo();
+    ASSERT_EQ(5u, calculator->getCmds().size());
+
+    calculator->undo();
+    calculator->redo();
+    EXPECT_DOUBLE_EQ(4.0, calculator->getCmds().back().num);
+
+    calculator->execute();
+    ASSERT_EQ(1u, calculator->getCmds().size());
+    EXPECT_DOUBLE_EQ(1.5, calculator->getCmds()[0].num);
+    EXPECT_FALSE(calculator->getError());
+
+    // 計算を取り消すと式に戻り、やり直すと結果に戻る
+    calculator->undo();
+    ASSERT_EQ(5u, calculator->getCmds().size());
+    EXPECT_EQ(CmdType::divide, calculator->getCmds()[3].type);
+    EXPECT_DOUBLE_EQ(1.5, calculator->getPreview().first);
+    calculator->redo();
+    ASSERT_EQ(1u, calculator->getCmds().size());
+    EXPECT_DOUBLE_EQ(1.5, calculator->getCmds()[0].num);
+}
+
+TEST(EditHistoryTest, Branch)
+{
+    // 1 + 2 * 3 から * 3 を取り消して - 4 と入力し、元の枝に戻る
+    std::unique_ptr<Calculator> calculator = std::make_unique<Calculator>();
+    for (CmdToken token : std::vector<CmdToken>{{CmdType::number, 0, 1.0}, {CmdType::add}, {CmdType::number, 0, 2.0}})
+    {
+        calculator->appendToken(token);
+    }
+    u32 commonId = calculator->getHistory().getCurrentId();
+
+    calculator->appendToken({CmdType::multiply});
+    calculator->appendToken({CmdType::number, 0, 3.0});
+    u32 multiplyId = calculator->getHistory().getCurrentId();
+
+    calculator->undo();
+    calculator->undo();
+    EXPECT_EQ(commonId, calculator->getHistory().getCurrentId());
+    calculator->appendToken({CmdType::subtract});
+    calculator->appendToken({CmdType::number, 0, 4.0});
+    calculator->execute();
+    EXPECT_DOUBLE_EQ(-1.0, calculator->getCmds()[0].num);
+
+    ASSERT_TRUE(calculator->restore(multiplyId));
+    ASSERT_EQ(5u, calculator->getCmds().size());
+    EXPECT_DOUBLE_EQ(7.0, calculator->getPreview().first);
+
+    // 元の枝で計算した後も、全ての状態に戻れる
+    calculator->execute();
+    EXPECT_DOUBLE_EQ(7.0, calculator->getCmds()[0].num);
+    for (u32 i = 0; i < 6; ++i) calculator->undo();
+    ASSERT_EQ(1u, calculator->getCmds().size());
+    EXPECT_DOUBLE_EQ(0.0, calculator->getCmds()[0].num);
+    for (u32 i = 0; i < 6; ++i) calculator->redo();
+    EXPECT_DOUBLE_EQ(7.0, calculator->getCmds()[0].num);
+
+    EXPECT_FALSE(calculator->restore(1000));
+}
+
+TEST(EditHistoryTest, Bounded)
+{
+    // 上限を超えると古い編集は取り消せなくなる。入力中の式のトークンは残る
+    std::unique_ptr<Calculator> calculator = std::make_unique<Calculator>(16);
+    for (u32 i = 0; i < 100; ++i)
+    {
+        calculator->appendToken({CmdType::number, 0, static_cast<double>(i)});
+        calculator->appendToken({CmdType::add});
+        calculator->appendToken({CmdType::number, 0, 1.0});
+        calculator->execute();
+        EXPECT_LE(calculator->getHistory().size(), 32u);
+    }
+    EXPECT_DOUBLE_EQ(100.0, calculator->getCmds()[0].num);
+
+    u32 undoCount = 0;
+    while (calculator->getHistory().getCurrent().parent != EditHistory::NO_EDIT)
+    {
+        calculator->undo();
+        undoCount++;
+    }
+    EXPECT_GE(undoCount, 15u);
+    EXPECT_LE(undoCount, 32u);
+
+    std::vector<CmdToken> tokens;
+    calculator->getHistory().getTokens(calculator->getHistory().getCurrentId(), tokens);
+    ASSERT_EQ(calculator->getCmds().size(), tokens.size());
+    for (u32 i = 0; i < undoCount; ++i) calculator->redo();
+    EXPECT_DOUBLE_EQ(100.0, calculator->getCmds()[0].num);
+
+    // 長い式は上限を超えても全てのトークンを残す
+    for (u32 i = 0; i < 100; ++i)
+    {
+        calculator->appendToken({CmdType::add});
+        calculator->appendToken({CmdType::number, 0, 1.0});
+    }
+    EXPECT_DOUBLE_EQ(200.0, calculator->getPreview().first);
+    EXPECT_LE(calculator->getHistory().size(), 32u + 201u);
+}
+
+TEST(CmdTokenTest, ParenDepthAfterUndo)
+{
+    // ( 2 を戻して 2 と入力し直した場合、括弧が閉じられていないと扱わない
+    std::unique_ptr<Calculator> calculator = std::make_unique<Calculator>();
+    calculator->appendToken({CmdType::leftParen});
+    calculator->appendToken({CmdType::number, 0, 2.0});
+    calculator->undo();
+    calculator->undo();
+    calculator->appendToken({CmdType::number, 0, 2.0});
+    calculator->appendToken({CmdType::multiply});
+    calculator->appendToken(calculator->toVariableToken("x"));
+    ASSERT_EQ(1u, calculator->getNames().size());
+
+    calculator->execute();
+    EXPECT_TRUE(calculator->getError()); // 変数は評価できない
+
+    std::unique_ptr<Calculator> closed = std::make_unique<Calculator>();
+    closed->appendToken({CmdType::leftParen});
+    closed->appendToken({CmdType::number, 0, 2.0});
+    closed->undo();
+    closed->undo();
+    closed->appendToken({CmdType::number, 0, 2.0});
+    closed->appendToken({CmdType::multiply});
+    closed->appendToken({CmdType::number, 0, 5.0});
+    closed->execute();
+    EXPECT_FALSE(closed->getError());
+    EXPECT_DOUBLE_EQ(10.0, closed->getCmds()[0].num);
+}
+
+TEST(LiveEvalTest, MatchesCompile)
+{
+    // 乱数で式を作り、括弧が閉じている位置ごとに命令列で計算した値と比べる
+    std::mt19937 random(12345);
+    std::vector<CmdToken> tokens;
+    std::vector<std::pair<double, bool>> previews;
+    LiveEvaluator live;
+    Program program;
+
+    u32 depth = 0;
+    bool expectOperand = true;
+    while (tokens.size() < 400 || expectOperand || depth != 0)
+    {
+        CmdToken token;
+        u32 choice = random() % 8;
+        if (expectOperand)
+        {
+            if (choice < 2 && tokens.size() < 400) token = {CmdType::leftParen};
+            else token = {CmdType::number, 0, static_cast<double>(random() % 10) / 2.0};
+        }
+        else if (depth != 0 && (choice < 2 || tokens.size() >= 400)) token = {CmdType::rightParen};
+        else token = {static_cast<CmdType>(static_cast<u32>(CmdType::add) + random() % 4)};
+
+        if (token.type == CmdType::leftParen) depth++;
+        else if (token.type == CmdType::rightParen) depth--;
+        expectOperand = (token.type != CmdType::number && token.type != CmdType::rightParen);
+
+        tokens.push_back(token);
+        live.push(token);
+        previews.push_back(live.preview());
+
+        if (!expectOperand && depth == 0)
+        {
+            ASSERT_TRUE(Bytecode::Compile(tokens, {}, program));
+            std::pair<double, bool> expect = Bytecode::Run(program);
+            ASSERT_EQ(expect.second, previews.back().second) << tokens.size();
+            if (expect.second)
+            {
+                ASSERT_DOUBLE_EQ(expect.first, previews.back().first) << tokens.size();
+            }
+        }
+    }
+
+    // 取り消すと、同じ長さの時の値に戻る
+    while (live.size() > 1)
+    {
+        live.pop();
+        std::pair<double, bool> expect = previews[live.size() - 1];
+        std::pair<double, bool> result = live.preview();
+        ASSERT_EQ(expect.second, result.second) << live.size();
+        if (expect.second)
+        {
+            ASSERT_DOUBLE_EQ(expect.first, result.first) << live.size();
+        }
+    }
+}
+
+TEST(LiveEvalTest, Preview)
+{
+    // 1 + 2 * ( 3 - 3 ) の途中の値
+    CmdToken tokens[] =
+    {
+        {CmdType::number, 0, 1.0}, {CmdType::add}, {CmdType::number, 0, 2.0}, {CmdType::multiply},
+        {CmdType::leftParen}, {CmdType::number, 0, 3.0}, {CmdType::subtract}, {CmdType::number, 0, 3.0},
+        {CmdType::rightParen}, {CmdType::divide}
+    };
+    double expects[] = {1.0, 1.0, 3.0, 3.0, 3.0, 7.0, 7.0, 1.0, 1.0, 1.0};
+
+    LiveEvaluator live;
+    EXPECT_DOUBLE_EQ(0.0, live.preview().first);
+    for (size_t i = 0; i < std::size(tokens); ++i)
+    {
+        live.push(tokens[i]);
+        EXPECT_TRUE(live.preview().second);
+        EXPECT_DOUBLE_EQ(expects[i], live.preview().first) << i;
+    }
+
+    // 1 + 2 * ( 3 - 3 ) / ( 4 - 4
+    live.push({CmdType::leftParen});
+    live.push({CmdType::number, 0, 4.0});
+    live.push({CmdType::subtract});
+    live.push({CmdType::number, 0, 4.0});
+    EXPECT_FALSE(live.preview().second);
+
+    live.pop();
+    EXPECT_TRUE(live.preview().second);
+    EXPECT_DOUBLE_EQ(1.0, live.preview().first); // 1 + 2 * ( 3 - 3 ) / ( 4
+
+    // 変数を含む場合はNaN
+    live.clear();
+    live.push({CmdType::number, 0, 2.0});
+    live.push({CmdType::multiply});
+    live.push({CmdType::variable});
+    EXPECT_TRUE(std::isnan(live.preview().first));
+}
+
+TEST(LiveEvalTest, CalculatorPreview)
+{
+    // 3 * ( 4 + 5 を入力し、取り消し、やり直しの後も途中の値が変わらない
+    std::unique_ptr<Calculator> calculator = std::make_unique<Calculator>();
+    calculator->appendToken({CmdType::number, 0, 3.0});
+    calculator->appendToken({CmdType::multiply});
+    calculator->appendToken({CmdType::leftParen});
+    calculator->appendToken({CmdType::number, 0, 4.0});
+    calculator->appendToken({CmdType::add});
+    calculator->appendToken({CmdType::number, 0, 5.0});
+    EXPECT_DOUBLE_EQ(27.0, calculator->getPreview().first);
+
+    calculator->undo();
+    EXPECT_DOUBLE_EQ(12.0, calculator->getPreview().first);
+    calculator->undo();
+    calculator->undo();
+    EXPECT_DOUBLE_EQ(3.0, calculator->getPreview().first);
+    calculator->redo();
+    calculator->redo();
+    calculator->redo();
+    EXPECT_DOUBLE_EQ(27.0, calculator->getPreview().first);
+
+    for (u32 i = 0; i < 6; ++i) calculator->undo();
+    EXPECT_DOUBLE_EQ(0.0, calculator->getPreview().first);
+
+    calculator->appendToken({CmdType::number, 0, 8.0});
+    calculator->appendToken({CmdType::divide});
+    calculator->appendToken({CmdType::number, 0, 0.0});
+    EXPECT_FALSE(calculator->getPreview().second);
+
+    calculator->undo();
+    calculator->appendToken({CmdType::number, 0, 2.0});
+    calculator->execute();
+    EXPECT_DOUBLE_EQ(4.0, calculator->getPreview().first);
+}
+
+TEST(EngineTest, Status)
+{
+    double result = 0.0;
+    size_t errorPos = 0;
+    EXPECT_EQ(EvalStatus::success, Engine::Evaluate("3*(4+5)/2", nullptr, result, errorPos));
+    EXPECT_DOUBLE_EQ(13.5, result);
+
+    EXPECT_EQ(EvalStatus::syntaxError, Engine::Evaluate("3*+", nullptr, result, errorPos));
+    EXPECT_EQ(EvalStatus::divisionByZero, Engine::Evaluate("1/(2-2)", nullptr, result, errorPos));
+    EXPECT_EQ(EvalStatus::unboundVariable, Engine::Evaluate("x*2", nullptr, result, errorPos));
+
+    double variables[] = {4.0};
+    EXPECT_EQ(EvalStatus::success, Engine::Evaluate("x*2", variables, result, errorPos));
+    EXPECT_DOUBLE_EQ(8.0, result);
+
+    // 1 + ( 2 、1 ) のような括弧は構文エラーと区別する
+    std::vector<CmdToken> tokens = {{CmdType::number, 0, 1.0}, {CmdType::add}, {CmdType::leftParen}, {CmdType::number, 0, 2.0}};
+    EXPECT_EQ(EvalStatus::unmatchedParen, Engine::Evaluate(tokens, {}, nullptr, result));
+    tokens = {{CmdType::number, 0, 1.0}, {CmdType::rightParen}};
+    EXPECT_EQ(EvalStatus::unmatchedParen, Engine::Evaluate(tokens, {}, nullptr, result));
+    tokens = {{CmdType::number, 0, 1.0}, {CmdType::add}};
+    EXPECT_EQ(EvalStatus::syntaxError, Engine::Evaluate(tokens, {}, nullptr, result));
+
+    EXPECT_EQ(EvalStatus::divisionByZero, Engine::Apply(CmdType::divide, 1.0, 0.0, result));
+    EXPECT_STREQ("Error : Division by zero", Engine::ToMessage(EvalStatus::divisionByZero));
+}
+
+TEST(EngineTest, Concurrent)
+{
+    // 複数のスレッドから同時に評価し、1つのCalculatorをRPN::CalcFromRPNで共有しても結果が混ざらない
+    std::unique_ptr<Calculator> calculator = std::make_unique<Calculator>();
+    const u32 threadCount = 8;
+    std::vector<u32> failCounts(threadCount);
+
+    std::vector<std::thread> threads;
+    for (u32 t = 0; t < threadCount; ++t)
+    {
+        threads.emplace_back([&, t]()
+        {
+            for (u32 i = 0; i < 2000; ++i)
+            {
+                std::string text = "(" + std::to_string(t) + "+" + std::to_string(i) + ")*2/" + std::to_string(i % 3);
+                double result = 0.0;
+                size_t errorPos = 0;
+                EvalStatus status = Engine::Evaluate(text, nullptr, result, errorPos);
+
+                if (i % 3 == 0)
+                {
+                    if (status != EvalStatus::divisionByZero) failCounts[t]++;
+                }
+                else if (status != EvalStatus::success || result != (t + i) * 2.0 / (i % 3)) failCounts[t]++;
+
+                std::queue<std::unique_ptr<Command>> rpnCmds;
+                rpnCmds.emplace(std::make_unique<NumberCmd>());
+                PtrAs<NumberCmd>(rpnCmds.back().get())->setNum(t);
+                rpnCmds.emplace(std::make_unique<NumberCmd>());
+                PtrAs<NumberCmd>(rpnCmds.back().get())->setNum(i);
+                rpnCmds.emplace(std::make_unique<MultiplyCmd>());
+
+                std::unique_ptr<Command> rpnResult = RPN::CalcFromRPN
+                (
+                    calculator.get(), std::move(rpnCmds), std::make_unique<NumberCmd>()
+                );
+                if (rpnResult == nullptr || PtrAs<NumberCmd>(rpnResult.get())->getNum() != t * i) failCounts[t]++;
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+
+    for (u32 t = 0; t < threadCount; ++t) EXPECT_EQ(0u, failCounts[t]) << t;
+    EXPECT_FALSE(calculator->getError());
+}
+
+TEST(EvalCacheTest, HitAndMiss)
+{
+    EvalCache cache;
+    double result = 0.0;
+    size_t errorPos = 0;
+
+    // 括弧の付け方が違っても同じ命令列になる式は同じ結果を使う
+    EXPECT_EQ(EvalStatus::success, Engine::Evaluate("(1 + 2) * 3", cache, result, errorPos));
+    EXPECT_DOUBLE_EQ(9.0, result);
+    EXPECT_EQ(EvalStatus::success, Engine::Evaluate("((1 + 2)) * (3)", cache, result, errorPos));
+    EXPECT_DOUBLE_EQ(9.0, result);
+    EXPECT_EQ(EvalStatus::success, Engine::Evaluate("1 + 2 * 3", cache, result, errorPos));
+    EXPECT_DOUBLE_EQ(7.0, result);
+    EXPECT_EQ(1u, cache.getHitCount());
+    EXPECT_EQ(2u, cache.getMissCount());
+    EXPECT_EQ(2u, cache.size());
+
+    // 0除算の結果も保持する。数値はビット列で比べるため、0.0は0と同じ式で、-0は別の式になる
+    EXPECT_EQ(EvalStatus::divisionByZero, Engine::Evaluate("1 / 0", cache, result, errorPos));
+    EXPECT_EQ(EvalStatus::divisionByZero, Engine::Evaluate("1 / 0.0", cache, result, errorPos));
+    EXPECT_EQ(EvalStatus::divisionByZero, Engine::Evaluate("1 / -0", cache, result, errorPos));
+    EXPECT_EQ(2u, cache.getHitCount());
+    EXPECT_EQ(4u, cache.getMissCount());
+
+    // 変数を含む式は保持しない
+    EXPECT_EQ(EvalStatus::unboundVariable, Engine::Evaluate("x + 1", cache, result, errorPos));
+    EXPECT_EQ(4u, cache.size());
+
+    // Calculatorで共有する
+    std::shared_ptr<EvalCache> shared = std::make_shared<EvalCache>();
+    for (u32 i = 0; i < 2; ++i)
+    {
+        std::unique_ptr<Calculator> calculator = std::make_unique<Calculator>();
+        calculator->setCache(shared);
+        calculator->appendToken({CmdType::number, 0, 6.0});
+        calculator->appendToken({CmdType::divide});
+        calculator->appendToken({CmdType::number, 0, 4.0});
+        calculator->execute();
+        EXPECT_DOUBLE_EQ(1.5, calculator->getCmds()[0].num);
+    }
+    EXPECT_EQ(1u, shared->getHitCount());
+    EXPECT_DOUBLE_EQ(0.5, shared->getHitRate());
+}
+
+TEST(EvalCacheTest, Concurrent)
+{
+    // 上限を超えて追加しても結果は変わらず、保持する数は上限以下になる
+    EvalCache cache(EvalCache::SHARD_COUNT * 4);
+    std::vector<std::thread> threads;
+    std::vector<u32> failures(4, 0);
+    for (u32 t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&cache, &failures, t]()
+        {
+            size_t errorPos = 0;
+            for (u32 i = 0; i < 2000; ++i)
+            {
+                u32 n = (i * 7 + t) % 300;
+                std::string text = std::to_string(n) + " * 3 - 1 / 4";
+                double result = 0.0;
+                if (Engine::Evaluate(text, cache, result, errorPos) != EvalStatus::success || result != n * 3 - 0.25)
+                {
+                    failures[t]++;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+
+    for (u32 failure : failures) EXPECT_EQ(0u, failure);
+    EXPECT_LE(cache.size(), cache.getCapacity());
+    EXPECT_EQ(8000u, cache.getHitCount() + cache.getMissCount());
+
+    cache.clear();
+    EXPECT_EQ(0u, cache.size());
+    EXPECT_EQ(0u, cache.getHitCount());
+}
+
+TEST(OptimizerTest, Simplify)
+{
+    Program program;
+    OptimizeResult result;
+    size_t errorPos = 0;
+
+    // x + 0 は x が -0 の場合に結果が変わるため残す
+    ASSERT_TRUE(Parser::Parse("(x*1)+(0)", program, errorPos));
+    ASSERT_TRUE(Optimizer::Optimize(program, result));
+    EXPECT_EQ(5u, result.nodeCountBefore);
+    EXPECT_EQ(3u, result.nodeCountAfter);
+
+    ASSERT_TRUE(Parser::Parse("(x*1-0)/1+0*-1", program, errorPos));
+    ASSERT_TRUE(Optimizer::Optimize(program, result));
+    ASSERT_EQ(1u, program.code.size());
+    EXPECT_EQ(OpCode::load, program.code[0].op);
+
+    // 定数を畳み込み、2の累乗による除算は乗算にする
+    ASSERT_TRUE(Parser::Parse("2*3+x/4", program, errorPos));
+    ASSERT_TRUE(Optimizer::Optimize(program, result));
+    EXPECT_EQ(5u, result.nodeCountAfter);
+    for (const Instruction& inst : program.code) EXPECT_NE(OpCode::divide, inst.op);
+
+    double variables[] = {10.0};
+    EXPECT_DOUBLE_EQ(8.5, Bytecode::Run(program, variables).first);
+
+    // 0による除算は評価の時にエラーを返す
+    ASSERT_TRUE(Parser::Parse("1/(2-2)*1", program, errorPos));
+    ASSERT_TRUE(Optimizer::Optimize(program, result));
+    EXPECT_EQ(3u, program.code.size());
+    EXPECT_FALSE(Bytecode::Run(program).second);
+}
+
+TEST(OptimizerTest, CommonSubexpression)
+{
+    Program program;
+    OptimizeResult result;
+    size_t errorPos = 0;
+
+    ASSERT_TRUE(Parser::Parse("(x+y)*(x+y)+(y+x)/(x-y)", program, errorPos));
+    ASSERT_TRUE(Optimizer::Optimize(program, result));
+    EXPECT_EQ(15u, result.nodeCountBefore);
+    EXPECT_EQ(7u, result.nodeCountAfter);
+    EXPECT_EQ(1u, program.tempCount);
+
+    // 一時領域を使う最適化済みの命令列は受け付けない
+    Program optimized = program;
+    EXPECT_FALSE(Optimizer::Optimize(optimized, result));
+
+    double variables[] = {3.0, 1.0};
+    EXPECT_DOUBLE_EQ(18.0, Bytecode::Run(program, variables).first);
+
+    JitFunction function(program);
+    EXPECT_DOUBLE_EQ(18.0, function.run(variables).first);
+
+    double x[] = {3.0, 2.0, 5.0};
+    double y[] = {1.0, 2.0, -1.0};
+    const double* columns[] = {x, y};
+    double results[3];
+    u8 errors[3];
+    ASSERT_TRUE(BatchEval::Run(program, columns, 2, 3, results, errors, 1));
+    EXPECT_DOUBLE_EQ(18.0, results[0]);
+    EXPECT_EQ(1, errors[1]);
+    EXPECT_DOUBLE_EQ(16.0 + 4.0 / 6.0, results[2]);
+}
+
+TEST(OptimizerTest, MatchesOriginal)
+{
+    // 乱数で作った式を最適化し、特殊な値を含む変数に対して結果のビット列が変わらないか確かめる
+    const char* leaves[] = {"x", "y", "0", "-0", "1", "2", "0.5", "3", "x", "y"};
+    const char* opes[] = {"+", "-", "*", "/"};
+    std::mt19937 random(777);
+
+    double specials[] = {0.0, -0.0, 1.0, -2.5, 0.5, INFINITY, -INFINITY, NAN, 1e300, 4.9e-324};
+    for (u32 caseIndex = 0; caseIndex < 300; ++caseIndex)
+    {
+        std::string text = leaves[random() % 10];
+        for (u32 i = 0; i < 12; ++i)
+        {
+            std::string right = leaves[random() % 10];
+            if (random() % 3 == 0) right = "(" + right + opes[random() % 4] + leaves[random() % 10] + ")";
+            text = ((random() % 2 == 0) ? "(" + text + ")" : text) + opes[random() % 4] + right;
+        }
+
+        Program original;
+        size_t errorPos = 0;
+        ASSERT_TRUE(Parser::Parse(text, original, errorPos)) << text;
+
+        Program optimized = original;
+        OptimizeResult result;
+        ASSERT_TRUE(Optimizer::Optimize(optimized, result)) << text;
+        EXPECT_LE(result.nodeCountAfter, result.nodeCountBefore);
+        EXPECT_LE(optimized.stackSize, original.stackSize);
+
+        for (double xValue : specials)
+        {
+            for (double yValue : specials)
+            {
+                double variables[2] = {0.0, 0.0};
+                s32 xIndex = Bytecode::FindVariable(original, "x");
+                s32 yIndex = Bytecode::FindVariable(original, "y");
+                if (xIndex >= 0) variables[xIndex] = xValue;
+                if (yIndex >= 0) variables[yIndex] = yValue;
+
+                std::pair<double, bool> expect = Bytecode::Run(original, variables);
+                std::pair<double, bool> actual = Bytecode::Run(optimized, variables);
+                ASSERT_EQ(expect.second, actual.second) << text;
+                if (!expect.second || (std::isnan(expect.first) && std::isnan(actual.first))) continue;
+                ASSERT_EQ(0, memcmp(&expect.first, &actual.first, sizeof(double))) << text << " " << xValue << " " << yValue;
+            }
+        }
+    }
+}
+
+TEST(BigIntTest, Multiply)
+{
+    // 乱数の絶対値と符号で、全ての乗算の方法が筆算と同じ結果になるか確かめる
+    std::mt19937_64 random(47);
+    auto makeRandom = [&](u32 limbCount)
+    {
+        std::vector<u64> limbs(limbCount);
+        for (u64& limb : limbs) limb = random();
+
+        BigInt value = BigInt::FromLimbs(limbs.data(), limbs.size());
+        if (random() % 2 == 0) value.negate();
+        return value;
+    };
+
+    for (u32 aCount : {1u, 2u, 33u, 161u, 400u})
+    {
+        for (u32 bCount : {1u, 40u, 170u, 500u})
+        {
+            BigInt a = makeRandom(aCount);
+            BigInt b = makeRandom(bCount);
+            BigInt expect = BigInt::Multiply(a, b, MulAlgorithm::schoolbook);
+
+            EXPECT_TRUE(BigInt::Multiply(a, b, MulAlgorithm::karatsuba) == expect) << aCount << " " << bCount;
+            EXPECT_TRUE(BigInt::Multiply(a, b, MulAlgorithm::toom3) == expect) << aCount << " " << bCount;
+            EXPECT_TRUE(a * b == expect) << aCount << " " << bCount;
+        }
+    }
+}
+
+TEST(BigIntTest, DivMod)
+{
+    std::mt19937_64 random(48);
+    for (u32 aCount : {1u, 3u, 80u, 300u})
+    {
+        for (u32 bCount : {1u, 2u, 50u, 200u})
+        {
+            std::vector<u64> limbs(aCount + bCount);
+            for (u64& limb : limbs) limb = random();
+            BigInt a = BigInt::FromLimbs(limbs.data(), aCount);
+            BigInt b = BigInt::FromLimbs(limbs.data() + aCount, bCount);
+            a.negate();
+
+            BigInt quotient;
+            BigInt remainder;
+            ASSERT_TRUE(BigInt::DivMod(a, b, quotient, remainder, DivAlgorithm::schoolbook));
+            EXPECT_TRUE(quotient * b + remainder == a);
+            EXPECT_LT(BigInt::CompareMagnitude(remainder, b), 0);
+            EXPECT_TRUE(remainder.isZero() || remainder.isNegative());
+
+            BigInt newtonQuotient;
+            BigInt newtonRemainder;
+            ASSERT_TRUE(BigInt::DivMod(a, b, newtonQuotient, newtonRemainder, DivAlgorithm::newton));
+            EXPECT_TRUE(newtonQuotient == quotient) << aCount << " " << bCount;
+            EXPECT_TRUE(newtonRemainder == remainder) << aCount << " " << bCount;
+        }
+    }
+
+    BigInt quotient;
+    BigInt remainder;
+    EXPECT_FALSE(BigInt::DivMod(BigInt(1), BigInt(), quotient, remainder));
+}
+
+TEST(BigIntTest, String)
+{
+    // 小さい値はヒープを確保しない
+    BigInt small(-1234567890123);
+    EXPECT_TRUE(small.isInline());
+    EXPECT_EQ("-1234567890123", small.toString());
+    EXPECT_TRUE((BigInt(1).shiftLeft(127) + BigInt(1)).isInline());
+
+    BigInt value;
+    ASSERT_TRUE(BigInt::FromString("-000123456789012345678901234567890", value));
+    EXPECT_EQ("-123456789012345678901234567890", value.toString());
+    EXPECT_FALSE(BigInt::FromString("12a", value));
+    EXPECT_EQ("0", BigInt().toString());
+
+    // 分割して変換する長さの数
+    BigInt large = BigInt::Pow10(5000) - BigInt(1);
+    std::string text = large.toString();
+    EXPECT_EQ(std::string(5000, '9'), text);
+
+    BigInt parsed;
+    ASSERT_TRUE(BigInt::FromString(text, parsed));
+    EXPECT_TRUE(parsed == large);
+}
+
+TEST(BigDecimalTest, Evaluate)
+{
+    BigDecimal result;
+    size_t errorPos = 0;
+    auto evaluate = [&](std::string_view text)
+    {
+        EXPECT_EQ(EvalStatus::success, Engine::EvaluateExact(text, 20, result, errorPos)) << text;
+        return result.toString();
+    };
+
+    EXPECT_EQ("0.3", evaluate("0.1 + 0.2"));
+    EXPECT_EQ("-2.5", evaluate("-(1.5 + 1)"));
+    EXPECT_EQ("0.33333333333333333333", evaluate("1 / 3"));
+    EXPECT_EQ("123456789012345678901234567890", evaluate("123456789012345678901 * 1000000000 + 234567890"));
+    EXPECT_EQ("1500", evaluate("1.5e3"));
+    EXPECT_EQ("0", evaluate("0.25 * 4 - 1"));
+
+    // doubleで表せない大きさの数値も、書かれた通りの桁で計算する
+    EXPECT_EQ("1" + std::string(400, '0'), evaluate("1e400"));
+    EXPECT_EQ("1" + std::string(400, '0'), evaluate(std::string(400, '9') + " + 1"));
+    EXPECT_EQ("-0.0000000002", evaluate("-2e-10"));
+    EXPECT_EQ("0." + std::string(399, '0') + "3", evaluate("3e-400"));
+
+    // 続けて書かれた符号は再帰せずにまとめる
+    std::string signs(10'000'000, '-');
+    EXPECT_EQ("5", evaluate(signs + "5"));
+    EXPECT_EQ("-5", evaluate("-" + signs + "5"));
+
+    EXPECT_EQ(EvalStatus::divisionByZero, Engine::EvaluateExact("1 / (2 - 2)", 20, result, errorPos));
+    EXPECT_EQ(EvalStatus::unboundVariable, Engine::EvaluateExact("x + 1", 20, result, errorPos));
+    EXPECT_EQ(EvalStatus::syntaxError, Engine::EvaluateExact("1 + * 2", 20, result, errorPos));
+    EXPECT_EQ(4, errorPos);
+
+    std::string output;
+    EXPECT_TRUE(StreamEval::EvaluateLineExact("10 / 4", output));
+    EXPECT_EQ("2.5\n", output);
+}
+
+TEST(ParallelEvalTest, MatchesSerial)
+{
+    // 組み替えない場合は分岐する大きさを小さくしても、命令列と同じビット列の結果になる
+    const char* leaves[] = {"x", "y", "0.5", "3", "1.25", "7", "x", "y"};
+    const char* opes[] = {"+", "-", "*", "/"};
+    std::mt19937 random(2024);
+
+    for (u32 caseIndex = 0; caseIndex < 20; ++caseIndex)
+    {
+        std::string text = leaves[random() % 8];
+        for (u32 i = 0; i < 2000; ++i)
+        {
+            std::string right = leaves[random() % 8];
+            if (random() % 3 == 0) right = "(" + right + opes[random() % 4] + leaves[random() % 8] + ")";
+            text = ((random() % 50 == 0) ? "(" + text + ")" : text) + opes[random() % 4] + right;
+        }
+
+        Program program;
+        size_t errorPos = 0;
+        ASSERT_TRUE(Parser::Parse(text, program, errorPos));
+
+        ExprTree tree;
+        ASSERT_TRUE(ParallelEval::Build(program, false, tree));
+        EXPECT_EQ(program.code.size(), tree.nodes.size());
+
+        double variables[2] = {1.5, -0.75};
+        std::pair<double, bool> expect = Bytecode::Run(program, variables);
+        for (u32 threadCount : {1u, 2u, 4u})
+        {
+            std::pair<double, bool> actual = ParallelEval::Run(tree, variables, threadCount, 16);
+            ASSERT_EQ(expect.second, actual.second);
+            if (!expect.second || (std::isnan(expect.first) && std::isnan(actual.first))) continue;
+            ASSERT_EQ(0, memcmp(&expect.first, &actual.first, sizeof(double))) << caseIndex << " " << threadCount;
+        }
+    }
+
+    // 分岐した部分木の0除算
+    Program program;
+    size_t errorPos = 0;
+    std::string text = "(1";
+    for (u32 i = 0; i < 500; ++i) text += "+1";
+    text += ")*(2";
+    for (u32 i = 0; i < 500; ++i) text += "+1";
+    text += "/(1-1))";
+    ASSERT_TRUE(Parser::Parse(text, program, errorPos));
+
+    ExprTree tree;
+    ASSERT_TRUE(ParallelEval::Build(program, true, tree));
+    EXPECT_FALSE(ParallelEval::Run(tree, nullptr, 4, 8).second);
+
+    // 一時領域を使う命令列は変換しない
+    Program optimized;
+    ASSERT_TRUE(Parser::Parse("(x+1)*(x+1)", optimized, errorPos));
+    OptimizeResult result;
+    ASSERT_TRUE(Optimizer::Optimize(optimized, result));
+    EXPECT_FALSE(ParallelEval::Build(optimized, false, tree));
+}
+
+TEST(ParallelEvalTest, FastMath)
+{
+    // 長い和と積を組み替え、スレッド数によらず同じ結果になるか確かめる
+    std::mt19937 random(99);
+    std::uniform_real_distribution<double> distribution(0.5, 2.0);
+
+    std::string text = "x";
+    for (u32 i = 0; i < 20000; ++i)
+    {
+        text += (i % 3 == 0) ? "-" : "+";
+        text += std::to_string(distribution(random));
+        if (i % 5 == 0) text += "*" + std::to_string(distribution(random)) + "*x";
+    }
+
+    Program program;
+    size_t errorPos = 0;
+    ASSERT_TRUE(Parser::Parse(text, program, errorPos));
+
+    ExprTree tree;
+    ASSERT_TRUE(ParallelEval::Build(program, true, tree));
+
+    double x = 1.125;
+    double expect = Bytecode::Run(program, &x).first;
+    std::pair<double, bool> first = ParallelEval::Run(tree, &x, 1, 64);
+    ASSERT_TRUE(first.second);
+    EXPECT_NEAR(expect, first.first, std::fabs(expect) * 1e-12);
+
+    for (u32 threadCount : {2u, 3u, 8u, 2u})
+    {
+        std::pair<double, bool> actual = ParallelEval::Run(tree, &x, threadCount, 64);
+        ASSERT_TRUE(actual.second);
+        EXPECT_EQ(0, memcmp(&first.first, &actual.first, sizeof(double))) << threadCount;
+    }
+
+    // 符号の反転をまとめる
+    auto evaluate = [&](std::string_view text)
+    {
+        EXPECT_TRUE(Parser::Parse(text, program, errorPos)) << text;
+        EXPECT_TRUE(ParallelEval::Build(program, true, tree)) << text;
+        return ParallelEval::Run(tree, nullptr, 2, 1).first;
+    };
+    EXPECT_EQ(-6.0, evaluate("0-1-2-3"));
+    EXPECT_EQ(-2.0, evaluate("1-(2+3-(4-2))"));
+    EXPECT_EQ(24.0, evaluate("1*2*(3*4)"));
+    EXPECT_EQ(1.5, evaluate("6/4/(2-1)"));
+    EXPECT_EQ(10.0, evaluate("(2-5)*(1-(3+2))-2"));
+}
+
 int main(int argc, char **argv) 
 {
     ::testing::InitGoogleTest(&argc, argv);
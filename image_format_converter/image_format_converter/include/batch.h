@@ -0,0 +1,52 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+
+#include "converter.h"
+#include "image_hash.h"
+
+struct BatchOption
+{
+    std::string sourceDir;
+    std::string exportDir; // sourceDirと同じ階層で書き出す
+    std::string exportExt;
+    bool useDedup = true; // ピクセルが一致する画像は1回だけ変換する
+    bool useHardLink = true; // 重複した画像の出力をハードリンクにする。falseの場合や失敗した場合はコピーする
+    bool useVerify = false; // ハッシュが一致した画像を、ファイルまたはピクセルを比較して確かめる
+};
+
+enum class DuplicateType
+{
+    none = 0, // グループの代表として変換した
+    bytes, // 代表とファイルの内容が一致する
+    pixels, // 代表と解析したピクセルが一致する
+};
+
+struct BatchEntry
+{
+    std::string sourcePath;
+    std::string exportPath; // 拡張子だけが違う入力と重なる場合は、a.bmp.pngのように入力の拡張子を残す
+    u32 result = SUCCESS;
+    u32 group = 0; // ピクセルが一致する画像のグループ。代表の入力パスの順に振る
+    DuplicateType duplicateType = DuplicateType::none;
+    u64 exportSize = 0;
+    Hash128 fileHash;
+    Hash128 pixelHash;
+};
+
+// フォルダ内の画像をまとめて変換する。全ての画像を並列に解析してハッシュを求め、同じピクセルの画像は1回だけ変換する。
+// 変換は解析したピクセルをそのまま使い、重複した画像の出力はリンクまたはコピーする
+namespace Batch
+{
+
+// sourceDir以下の変換できるファイルを名前順に列挙する。exportDir以下は除く
+std::vector<std::string> FindSources(const Converter& converter, const BatchOption& option);
+
+// entriesはFindSourcesの順に並ぶ
+std::vector<BatchEntry> Run(const Converter& converter, const BatchOption& option);
+
+// 重複のあるグループを1件1行の"グループ\t種類\t入力パス\t出力パス"で書き出す。種類はsource、bytes、pixels
+std::string FormatReport(const std::vector<BatchEntry>& entries);
+
+}
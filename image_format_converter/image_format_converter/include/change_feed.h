@@ -0,0 +1,43 @@
+﻿#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "type.h"
+
+// 監視モードで変換したファイルの通知。ビューアーなどがテクスチャを再読み込みするために使う
+struct ChangeEvent
+{
+    u32 result = 0; // 変換の結果。SUCCESS以外の場合、exportPathは書き換えられていない
+    f64 milliseconds = 0.0; // 変更を検知してから書き出し終えるまでの時間
+    std::string sourcePath;
+    std::string exportPath;
+};
+
+// 変更の通知を1件1行のテキストとして読み書きする。各行は"結果\t時間\t入力パス\t出力パス"
+namespace ChangeFeed
+{
+
+std::string Format(const ChangeEvent& event);
+
+// 改行を含まない1行を解析する。形式が異なる場合はfalseを返す
+bool Parse(std::string_view line, ChangeEvent& rtEvent);
+
+}
+
+// 追記されていくフィードファイルから、前回読み込んだ位置以降の通知を読み込む
+class ChangeFeedReader
+{
+private:
+    std::string path_;
+    u64 offset_ = 0;
+    std::string pendingLine_; // 書き込み途中の行
+
+public:
+    ChangeFeedReader(std::string path) : path_(std::move(path)) {}
+    ~ChangeFeedReader() = default;
+
+    // 新しく追記された通知を返す。ファイルが存在しない場合は空
+    std::vector<ChangeEvent> poll();
+};
@@ -5,6 +5,7 @@
 #include <string>
 
 #include <map>
+#include <vector>
 
 #include "type.h"
 
@@ -34,6 +35,9 @@ public :
     std::unique_ptr<u8[]> pixels = nullptr;
 };
 
+// 幅、高さが正で、BGRAのピクセルデータのサイズがu32に収まるか確認する
+bool IsValidImageSize(s64 width, s64 height);
+
 class IConverter
 {
 private :
@@ -42,24 +46,55 @@ public :
     IConverter(std::string ext) : ext_(ext) {}
     virtual ~IConverter() = default;
     
-    bool judgeExt(std::string_view importPath);
-    virtual std::unique_ptr<u8[]> load(std::string_view importPath);
-    virtual std::unique_ptr<FileData> analysis(std::unique_ptr<u8[]>& importData) = 0;
-    virtual std::unique_ptr<u8[]> convert(std::unique_ptr<FileData>& fileData, u32& rtDataSize) = 0;
-    virtual u32 write(std::string_view exportPath, u8 *data, const u32 dataSize);
+    bool judgeExt(std::string_view importPath) const;
+    virtual std::unique_ptr<u8[]> load(std::string_view importPath, u32& rtDataSize) const;
+    virtual std::unique_ptr<FileData> analysis(const u8* importData, u32 dataSize) const = 0;
+    virtual std::unique_ptr<u8[]> convert(const FileData& fileData, u32& rtDataSize) const = 0;
+    virtual u32 write(std::string_view exportPath, const u8 *data, const u32 dataSize) const;
 };
 
+// addObserverで変換クラスを登録し終えた後は、複数のスレッドから同時に解析、変換を呼び出せる
 class Converter
 {
 private :
     std::map<std::string, std::unique_ptr<IConverter>> observers_;
 
+    // パスまたは拡張子から変換クラスを取得。見つからない場合はnullptr
+    const IConverter* findObserver(std::string_view path) const;
+
 public :
     Converter() = default;
     ~Converter() = default;
 
     void addObserver(std::string ext, std::unique_ptr<IConverter> observer);
+
+    // パスまたは拡張子に対応する変換クラスが登録されているか
+    bool isSupported(std::string_view path) const { return findObserver(path) != nullptr; }
     
-    std::unique_ptr<FileData> fileAnalysis(std::string_view importPath);
-    u32 fileConvert(std::string_view exportPath, std::unique_ptr<FileData> &fileData);
+    std::unique_ptr<FileData> fileAnalysis(std::string_view importPath) const;
+    u32 fileConvert(std::string_view exportPath, std::unique_ptr<FileData> &fileData) const;
+
+    // メモリ上のデータを解析する。標準出力には何も出力せず、結果はrtResultで返す
+    std::unique_ptr<FileData> dataAnalysis
+    (
+        std::string_view importExt, const u8* importData, u32 importSize, u32& rtResult
+    ) const;
+
+    // 呼び出し側のバッファに変換結果を書き込む。容量が足りない場合はERROR_BUFFER_TOO_SMALLを返し、
+    // rtDataSizeに必要なサイズを設定する。この時の変換結果は破棄するため、大きさが分からない場合はvector版を使う
+    u32 dataConvert
+    (
+        std::string_view exportExt, const FileData& fileData, 
+        u8* exportData, u32 exportCapacity, u32& rtDataSize
+    ) const;
+
+    // 変換結果の大きさに合わせてrtDataを確保して書き込む
+    u32 dataConvert(std::string_view exportExt, const FileData& fileData, std::vector<u8>& rtData) const;
+
+    // 解析と変換をまとめて行う
+    u32 dataConvert
+    (
+        std::string_view importExt, const u8* importData, u32 importSize,
+        std::string_view exportExt, u8* exportData, u32 exportCapacity, u32& rtDataSize
+    ) const;
 };
\ No newline at end of file
@@ -0,0 +1,55 @@
+﻿#pragma once
+
+// 他のプロセスやC言語から変換機能を組み込むためのAPI
+// IfcConvertは標準出力に何も出力せず、一つのIfcConverterを複数のスレッドから同時に使用できる
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct IfcConverter IfcConverter;
+typedef struct IfcEncodedData IfcEncodedData;
+
+// 戻り値。pch.hの定数と同じ値
+enum IfcResult
+{
+    IFC_SUCCESS = 0,
+    IFC_ERROR_INVALID_ARGUMENTS = 1,
+    IFC_ERROR_CONVERSION_FAILED = 4,
+    IFC_ERROR_UNSUPPORTED_FORMAT = 5,
+    IFC_ERROR_ANALYSIS_FAILED = 6,
+    IFC_ERROR_BUFFER_TOO_SMALL = 7,
+};
+
+// bmp、tga、dds、pngを登録した変換器を作成する。useTgaCompressionが0以外の場合、TGAはRLE圧縮で書き出す。失敗した場合はNULLを返す
+IfcConverter* IfcCreateConverter(int useTgaCompression);
+void IfcDestroyConverter(IfcConverter* converter);
+
+// importDataをexportExtの形式に変換し、exportDataに書き込む。拡張子は"bmp"のようにドットなしで指定する
+// 変換中に例外が発生した場合はIFC_ERROR_CONVERSION_FAILEDを返す
+// exportDataの容量が足りない場合はIFC_ERROR_BUFFER_TOO_SMALLを返し、rtDataSizeに必要なサイズを設定する。
+// この時の変換結果は破棄するため、確保し直して呼び出すと再度変換する。大きさが分からない場合はIfcConvertAllocを使う
+unsigned int IfcConvert
+(
+    const IfcConverter* converter,
+    const char* importExt, const unsigned char* importData, unsigned int importSize,
+    const char* exportExt, unsigned char* exportData, unsigned int exportCapacity, unsigned int* rtDataSize
+);
+
+// IfcConvertと同じく変換し、変換結果の大きさに合わせて確保した領域を*rtEncodedDataに設定する。
+// 失敗した場合は*rtEncodedDataにNULLを設定する。受け取った領域はIfcDestroyEncodedDataで解放する
+unsigned int IfcConvertAlloc
+(
+    const IfcConverter* converter,
+    const char* importExt, const unsigned char* importData, unsigned int importSize,
+    const char* exportExt, IfcEncodedData** rtEncodedData
+);
+
+// 変換結果の先頭を返し、rtDataSizeに大きさを設定する。領域はIfcDestroyEncodedDataを呼ぶまで有効
+const unsigned char* IfcGetEncodedData(const IfcEncodedData* encodedData, unsigned int* rtDataSize);
+void IfcDestroyEncodedData(IfcEncodedData* encodedData);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,31 @@
+﻿#pragma once
+
+#include <vector>
+
+#include "type.h"
+
+enum class DeflateLevel
+{
+    fast = 0, // ハッシュチェーンを短くし、遅延一致を行わない
+    best, // ハッシュチェーンを長くし、遅延一致を行う
+};
+
+// RFC 1951のDeflate圧縮、展開
+namespace Deflate
+{
+
+// dataをDeflateブロック列に圧縮する。isFinalがfalseの場合は最後に空の非圧縮ブロックを置いてバイト境界に揃えるため、
+// 独立に圧縮した複数の出力を連結し、最後の出力だけisFinalをtrueにすれば一つのストリームになる
+std::vector<u8> Compress(const u8* data, u32 dataSize, DeflateLevel level, bool isFinal);
+
+// Deflateストリームを展開し、dstにちょうどdstSizeバイト書き込めた場合のみtrueを返す
+// rtReadSizeにはストリームの終端までに読み込んだバイト数を設定する
+bool Uncompress(const u8* src, u32 srcSize, u8* dst, u32 dstSize, u32& rtReadSize);
+
+// RFC 1950のAdler-32チェックサム
+u32 Adler32(const u8* data, u32 dataSize, u32 adler = 1);
+
+// Adler32(a)とAdler32(b)から、aとbを連結したデータのチェックサムを求める
+u32 Adler32Combine(u32 adler1, u32 adler2, u32 dataSize2);
+
+}
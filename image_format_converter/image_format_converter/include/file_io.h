@@ -0,0 +1,22 @@
+﻿#pragma once
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "type.h"
+
+// fopen_sなどプラットフォーム依存のファイル操作を隠蔽する
+namespace FileIO
+{
+
+// ファイル全体を読み込む。失敗した場合はnullptrを返す
+std::unique_ptr<u8[]> Load(std::string_view path, u32& rtSize);
+
+// ファイル全体をrtDataに読み込む。rtDataの確保済みの領域を再利用する。成功：SUCCESS、失敗：ERROR_FILE_OPERATION
+u32 Load(std::string_view path, std::vector<u8>& rtData);
+
+// データをファイルに書き出す。成功：SUCCESS、失敗：ERROR_FILE_OPERATION
+u32 Write(std::string_view path, const u8* data, const u32 dataSize);
+
+}
@@ -3,6 +3,7 @@
 #include <string>
 
 #include "converter.h"
+#include "quantizer.h"
 
 #pragma pack(push, 1)
 struct BmpFileHeader
@@ -32,10 +33,18 @@ struct BmpInfoHeader
 
 class BMP : public IConverter
 {
+private:
+    QuantizeOption quantize_;
+
 public:
-    BMP() : IConverter("bmp") {}
+    // quantizeを有効にした場合、色数を超える不透明な画像を減色して8ビットのカラーパレットで書き出す
+    BMP(QuantizeOption quantize = {}) : IConverter("bmp"), quantize_(quantize) {}
     ~BMP() override = default;
 
-    std::unique_ptr<FileData> analysis(std::unique_ptr<u8[]>& importData) final;
-    std::unique_ptr<u8[]> convert(std::unique_ptr<FileData>& fileData, u32& rtDataSize) final;
+    std::unique_ptr<FileData> analysis(const u8* importData, u32 dataSize) const final;
+    std::unique_ptr<u8[]> convert(const FileData& fileData, u32& rtDataSize) const final;
+
+    // 先頭のファイルヘッダーとインフォヘッダーを読み込み、対応している形式か確認する。
+    // 大きさは幅が正、高さが0以外であることだけを確認し、全体を展開できるかは呼び出し側で確認する
+    static bool ReadHeader(const u8* importData, u32 dataSize, BmpFileHeader& rtFileHeader, BmpInfoHeader& rtInfoHeader);
 };
\ No newline at end of file
@@ -2,11 +2,34 @@
 
 #include <memory>
 #include <string>
-
-#include <d3d11.h>
+#include <vector>
 
 #include "converter.h"
 
+// d3d11.hに依存しないよう、DDSで使用する列挙値をローカルに定義する（値はDXGI_FORMAT、D3D10_RESOURCE_DIMENSIONと同じ）
+enum DdsDxgiFormat : u32
+{
+    DDS_DXGI_FORMAT_UNKNOWN = 0,
+    DDS_DXGI_FORMAT_R8G8B8A8_UNORM = 28,
+    DDS_DXGI_FORMAT_R8G8B8A8_UNORM_SRGB = 29,
+    DDS_DXGI_FORMAT_B8G8R8A8_UNORM = 87,
+    DDS_DXGI_FORMAT_B8G8R8A8_UNORM_SRGB = 91,
+};
+
+enum DdsResourceDimension : u32
+{
+    DDS_RESOURCE_DIMENSION_UNKNOWN = 0,
+    DDS_RESOURCE_DIMENSION_BUFFER = 1,
+    DDS_RESOURCE_DIMENSION_TEXTURE1D = 2,
+    DDS_RESOURCE_DIMENSION_TEXTURE2D = 3,
+    DDS_RESOURCE_DIMENSION_TEXTURE3D = 4,
+};
+
+constexpr u32 DDS_MAGIC = 0x20534444; // "DDS "
+constexpr u32 DDS_FOURCC_DX10 = 0x30315844; // "DX10"
+constexpr u32 DDS_MISC_TEXTURECUBE = 0x4; // D3D11_RESOURCE_MISC_TEXTURECUBE
+constexpr u32 DDS_CUBE_FACE_COUNT = 6;
+
 #pragma pack(push, 1)
 struct DdsPixelFormat
 {
@@ -42,20 +65,55 @@ struct DdsHeader
 // DDS_HEADER_DX10構造体の定義
 struct DdsHeaderDx10 
 {
-    DXGI_FORMAT dxgiFormat; // DXGIフォーマット
-    D3D10_RESOURCE_DIMENSION resourceDimension; // リソースの次元（例: 2D, 3D）
+    DdsDxgiFormat dxgiFormat; // DXGIフォーマット
+    DdsResourceDimension resourceDimension; // リソースの次元（例: 2D, 3D）
     u32 miscFlag; // キューブマップなどの特性
     u32 arraySize; // 配列テクスチャの要素数
     u32 reserved; // 予約領域
 };
 #pragma pack(pop)
 
+enum class DdsTextureType
+{
+    texture2D = 0,
+    textureArray,
+    cubeMap,
+};
+
+// 配列テクスチャ、キューブマップを構成する画像ら
+// 各スライスはFileDataと同じく左下から右上に並んだBGRA。キューブマップは+X、-X、+Y、-Y、+Z、-Zの順に6枚ずつ並ぶ
+class DdsTexture
+{
+public:
+    DdsTextureType type = DdsTextureType::texture2D;
+    std::vector<std::unique_ptr<FileData>> slices;
+};
+
 class DDS : public IConverter
 {
+private:
+    // 全てのスライスの書き込み先を先に求めておき、各スライスを並列に反転して書き込む
+    std::unique_ptr<u8[]> convertSlices
+    (
+        const std::vector<const FileData*>& slices, DdsTextureType type, u32& rtDataSize
+    ) const;
+
 public:
     DDS() : IConverter("dds") {}
     ~DDS() final = default;
 
-    std::unique_ptr<FileData> analysis(std::unique_ptr<u8[]>& importData) final;
-    std::unique_ptr<u8[]> convert(std::unique_ptr<FileData>& fileData, u32& rtDataSize) final;
+    // 配列テクスチャ、キューブマップの場合は先頭のスライスのみを返す
+    std::unique_ptr<FileData> analysis(const u8* importData, u32 dataSize) const final;
+    std::unique_ptr<u8[]> convert(const FileData& fileData, u32& rtDataSize) const final;
+
+    // 全てのスライスを並列に解析する。ミップマップは先頭のレベルのみ読み込む
+    std::unique_ptr<DdsTexture> analysisTexture(const u8* importData, u32 dataSize) const;
+
+    // 全てのスライスを1つのDDSに書き出す。スライスは全て同じサイズで、キューブマップは6の倍数でなければならない
+    // 条件を満たさない場合はnullptrを返す
+    std::unique_ptr<u8[]> convertTexture(const DdsTexture& texture, u32& rtDataSize) const;
+
+    // 横（4x3）または縦（3x4）の十字に並んだ展開図をキューブマップの6面に分割する
+    // 縦の展開図の-Z面は上下左右が反転しているものとして扱う。展開図の形でない場合はnullptrを返す
+    std::unique_ptr<DdsTexture> splitCross(const FileData& cross) const;
 };
\ No newline at end of file
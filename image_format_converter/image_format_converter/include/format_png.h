@@ -0,0 +1,54 @@
+﻿#pragma once
+
+#include <vector>
+
+#include "converter.h"
+#include "deflate.h"
+
+constexpr u8 PNG_SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+#pragma pack(push, 1)
+struct PngImageHeader
+{
+    u32 width;           // 画像の幅（ビッグエンディアン）
+    u32 height;          // 画像の高さ（ビッグエンディアン）
+    u8 bitDepth;         // チャンネルあたりのビット数
+    u8 colorType;        // カラータイプ
+    u8 compression;      // 圧縮方式
+    u8 filter;           // フィルタ方式
+    u8 interlace;        // インターレース方式
+};
+#pragma pack(pop)
+
+enum PngFilterType : u8
+{
+    PNG_FILTER_NONE = 0,
+    PNG_FILTER_SUB,
+    PNG_FILTER_UP,
+    PNG_FILTER_AVERAGE,
+    PNG_FILTER_PAETH,
+};
+
+class PNG : public IConverter
+{
+private:
+    DeflateLevel level_ = DeflateLevel::fast;
+
+public:
+    PNG(DeflateLevel level = DeflateLevel::fast) : IConverter("png"), level_(level) {}
+    ~PNG() final = default;
+
+    std::unique_ptr<FileData> analysis(const u8* importData, u32 dataSize) const final;
+    std::unique_ptr<u8[]> convert(const FileData& fileData, u32& rtDataSize) const final;
+
+    // ピクセルをカラータイプの並びにし、行ごとにフィルタを選んで適用し、行グループごとに並列にDeflate圧縮した
+    // zlibストリームを返す。カラータイプが3の場合はpaletteのインデックスに置き換える
+    std::vector<u8> compress(const FileData& fileData, u8 colorType, const std::vector<BGRA>& palette) const;
+
+    // zlibストリームを展開してフィルタを戻し、左上から右下に並んだRGBAのピクセルを返す
+    // カラータイプが3の場合はpaletteの色に置き換える。展開に失敗した場合はnullptrを返す
+    std::unique_ptr<u8[]> uncompress
+    (
+        const u8* zlibData, u32 zlibSize, s32 width, s32 height, u8 colorType, const std::vector<RGBA>& palette
+    ) const;
+};
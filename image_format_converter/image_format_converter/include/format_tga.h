@@ -4,6 +4,7 @@
 #include <vector>
 
 #include "converter.h"
+#include "quantizer.h"
 
 #pragma pack(push, 1)
 struct TgaFileHeader
@@ -27,14 +28,26 @@ class TGA : public IConverter
 {
 private:
     bool useCompression_ = false;
+    QuantizeOption quantize_;
 
 public:
-    TGA(bool useCompression = false) : useCompression_(useCompression), IConverter("tga") {}
+    // quantizeを有効にした場合、色数を超える画像を減色してカラーマップで書き出す
+    TGA(bool useCompression = false, QuantizeOption quantize = {}) 
+    : IConverter("tga"), useCompression_(useCompression), quantize_(quantize) {}
     ~TGA() final = default;
 
-    std::unique_ptr<FileData> analysis(std::unique_ptr<u8[]>& importData) final;
-    std::unique_ptr<u8[]> convert(std::unique_ptr<FileData>& fileData, u32& rtDataSize) final;
+    std::unique_ptr<FileData> analysis(const u8* importData, u32 dataSize) const final;
+    std::unique_ptr<u8[]> convert(const FileData& fileData, u32& rtDataSize) const final;
 
-    std::unique_ptr<u8[]> uncompress(std::unique_ptr<u8[]>& importData, u32 dataOffset, s32 width, s32 height, u16 pixelDepth);
-    std::vector<u8> compress(std::unique_ptr<FileData>& fileData);
+    // 先頭のヘッダーを読み込み、対応している形式か確認する。カラーマップ画像の場合はカラーマップの形式も確認する
+    static bool ReadHeader(const u8* importData, u32 dataSize, TgaFileHeader& rtHeader);
+
+    // ピクセルあたりpixelDepthビットのまま展開する。展開に失敗した場合はnullptrを返す
+    std::unique_ptr<u8[]> uncompress
+    (
+        const u8* importData, u32 dataSize, u32 dataOffset, s32 width, s32 height, u16 pixelDepth
+    ) const;
+
+    // ピクセルあたりpixelBytesバイトに詰められたピクセルを、行ごとにRLE圧縮する
+    std::vector<u8> compress(const u8* pixels, s32 width, s32 height, u32 pixelBytes) const;
 };
\ No newline at end of file
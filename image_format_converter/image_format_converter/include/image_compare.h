@@ -0,0 +1,29 @@
+﻿#pragma once
+
+#include "converter.h"
+
+struct CompareResult
+{
+    bool isSameSize = false;
+    bool isEqual = false;
+    u32 maxAbsError = 0; // チャンネルごとの差の絶対値の最大値
+    f64 mse = 0.0; // B、G、R、Aの全チャンネルの平均二乗誤差
+    f64 psnr = 0.0; // 一致する場合は無限大
+    f64 ssim = 0.0; // 輝度の8x8ウィンドウごとのSSIMの平均
+};
+
+// 2つの画像を比較する。行を複数のスレッドに分配し、SSE2が使える場合はベクトル化して計算する
+namespace ImageCompare
+{
+
+// 完全に一致するか判定する。不一致が見つかった時点で全てのスレッドが打ち切る
+bool IsEqual(const FileData& a, const FileData& b);
+
+// 一致判定と全ての指標を計算する
+CompareResult Compare(const FileData& a, const FileData& b);
+
+// ピクセルごとの差を可視化した画像を作成する。差がないピクセルはaを暗くした灰色、
+// 差があるピクセルは差が大きいほど赤から黄色になる。サイズが異なる場合はnullptrを返す
+std::unique_ptr<FileData> CreateHeatMap(const FileData& a, const FileData& b);
+
+}
@@ -0,0 +1,28 @@
+﻿#pragma once
+
+#include "converter.h"
+
+struct Hash128
+{
+    u64 low = 0;
+    u64 high = 0;
+
+    bool operator==(const Hash128& other) const { return low == other.low && high == other.high; }
+    bool operator!=(const Hash128& other) const { return !(*this == other); }
+    bool operator<(const Hash128& other) const { return (high != other.high) ? high < other.high : low < other.low; }
+};
+
+// 重複した画像を見つけるための128ビットのハッシュ。暗号学的な強度はない。
+// 64バイトごとに8つの64ビットのレーンへ積和し、SSE2が使える場合は2レーンずつベクトル化する
+namespace ImageHash
+{
+
+Hash128 Hash(const u8* data, u64 dataSize, u64 seed = 0);
+
+// Hashと同じ値を返すスカラー版
+Hash128 HashScalar(const u8* data, u64 dataSize, u64 seed = 0);
+
+// 幅、高さとピクセルのハッシュ。ピクセルが一致する画像は元の形式によらず同じ値になる
+Hash128 HashImage(const FileData& fileData);
+
+}
@@ -0,0 +1,55 @@
+﻿#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "type.h"
+
+namespace Parallel
+{
+
+// 使用するスレッド数。ハードウェアスレッド数（最低1）
+u32 GetThreadCount();
+
+// [0, count)のインデックスを複数のスレッドに分配してfuncを呼び出す。全て終了するまで戻らない
+// funcの中から呼び出した場合は、スレッドを増やさずに呼び出したスレッドで順に処理する。
+// funcが例外を投げた場合は、全てのスレッドを終えてから最初の例外を呼び出したスレッドで投げ直す
+void For(u32 count, const std::function<void(u32 index)>& func);
+
+// Forの処理の中から呼び出されているか
+bool IsInParallel();
+
+}
+
+// 常駐するワーカースレッドらに処理を順に割り当てる。スレッドの生成を処理ごとに行わないため、
+// 小さな処理を繰り返し投げる用途に使う。デストラクタは残っている処理を全て終えてから戻る
+class WorkerPool
+{
+private:
+    std::vector<std::thread> threads_;
+    std::deque<std::function<void()>> jobs_;
+    std::mutex mutex_;
+    std::condition_variable jobCondition_;
+    std::condition_variable idleCondition_;
+    u32 runningCount_ = 0;
+    bool isStopping_ = false;
+
+    void workerLoop();
+
+public:
+    // threadCountが0の場合はParallel::GetThreadCount()
+    WorkerPool(u32 threadCount = 0);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void push(std::function<void()> job);
+
+    // 全ての処理が終わるまで待つ
+    void waitIdle();
+};
@@ -7,10 +7,14 @@
 
 #include "type.h"
 
+#ifdef _WIN32
 #include <Windows.h>
+#endif
 
 #include <fstream>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <vector>
 #include <iostream>
 #include <memory>
@@ -31,3 +35,7 @@ constexpr u32 ERROR_INVALID_ARGUMENTS = 1;
 constexpr u32 ERROR_FILE_OPERATION = 2;
 constexpr u32 ERROR_FILE_LOAD_FAILED = 3;
 constexpr u32 ERROR_CONVERSION_FAILED = 4;
+constexpr u32 ERROR_UNSUPPORTED_FORMAT = 5;
+constexpr u32 ERROR_ANALYSIS_FAILED = 6;
+constexpr u32 ERROR_BUFFER_TOO_SMALL = 7;
+constexpr u32 ERROR_IMAGES_DIFFERENT = 8;
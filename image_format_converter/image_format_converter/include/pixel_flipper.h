@@ -23,7 +23,7 @@ enum PixelStorageOrder
 class PixelFlipper
 {
 private :
-    FlippedType type_;
+    FlippedType type_ = FlippedType::none;
     
 public :
     PixelFlipper() = default;
@@ -37,25 +37,25 @@ public :
 
     void getPixelsFlippedWithPadBGRA
     (
-        std::unique_ptr<u8[]>& src, u32 dataOffset, u32 imageSize, u16 pixelDepth, 
+        const u8* src, u32 dataOffset, u32 imageSize, u16 pixelDepth, 
         std::unique_ptr<u8[]>& pixels, s32 width, s32 height
     );
 
     void getPixelsFlippedBGRA
     (
-        std::unique_ptr<u8[]>& src, u32 dataOffset, u32 imageSize, u16 pixelDepth, 
+        const u8* src, u32 dataOffset, u32 imageSize, u16 pixelDepth, 
         std::unique_ptr<u8[]>& pixels, s32 width, s32 height
     );
 
     void getPixelsFlippedRGBA
     (
-        std::unique_ptr<u8[]>& src, u32 dataOffset, u32 imageSize, u16 pixelDepth, 
+        const u8* src, u32 dataOffset, u32 imageSize, u16 pixelDepth, 
         std::unique_ptr<u8[]>& pixels, s32 width, s32 height
     );
 
     void insertPixelsFlippedRGBA
     (
         std::unique_ptr<u8[]> &target, u32 dataOffset, 
-        std::unique_ptr<u8[]> &pixels, s32 width, s32 height
+        const std::unique_ptr<u8[]> &pixels, s32 width, s32 height
     );
 };
\ No newline at end of file
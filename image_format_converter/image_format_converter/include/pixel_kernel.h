@@ -0,0 +1,92 @@
+﻿#pragma once
+
+#include <array>
+#include <utility>
+
+#include "type.h"
+#include "pixel_flipper.h"
+
+// 元データのチャンネルの並び
+enum class ChannelOrder
+{
+    bgra = 0,
+    rgba,
+};
+
+// 画像1枚分のピクセルを並べ替えながらBGRAに変換するカーネル
+// 元データのバイト数、反転、チャンネルの並び、行末のパディングの有無ごとにコンパイル時に特殊化し、
+// 画像ごとにテーブルから1度だけ選ぶことで、ピクセルごとの分岐をなくす
+namespace PixelKernel
+{
+
+using Kernel = void (*)(const u8* src, u8* dst, s32 width, s32 height);
+
+// srcのピクセルを順に読み込み、FLIPに従って反転した位置のdstにBGRAとして書き込む
+// 3バイトの場合のアルファは0xff。HAS_PADDINGの場合、元データの各行は4バイト境界に揃えられている
+// RGBAの順に並び替えるだけなので、ORDERがrgbaのカーネルはBGRAからRGBAへの変換にも使える
+template <u32 SRC_BYTES, FlippedType FLIP, ChannelOrder ORDER, bool HAS_PADDING>
+void Convert(const u8* src, u8* dst, s32 width, s32 height)
+{
+    static_assert(SRC_BYTES == 3 || SRC_BYTES == 4);
+
+    constexpr bool FLIP_X = FLIP == FlippedType::x || FLIP == FlippedType::xy;
+    constexpr bool FLIP_Y = FLIP == FlippedType::y || FLIP == FlippedType::xy;
+    constexpr u32 RED = (ORDER == ChannelOrder::bgra) ? 2 : 0;
+    constexpr u32 BLUE = 2 - RED;
+
+    const size_t rowSize = static_cast<size_t>(width) * 4;
+    const u32 padding = (HAS_PADDING) ? (4 - (width * SRC_BYTES) % 4) % 4 : 0;
+
+    for (s32 y = 0; y < height; ++y)
+    {
+        u8* dstRow = dst + ((FLIP_Y) ? height - 1 - y : y) * rowSize;
+        for (s32 x = 0; x < width; ++x)
+        {
+            u8* pixel = dstRow + static_cast<size_t>((FLIP_X) ? width - 1 - x : x) * 4;
+            pixel[0] = src[BLUE];
+            pixel[1] = src[1];
+            pixel[2] = src[RED];
+            if constexpr (SRC_BYTES == 4) pixel[3] = src[3];
+            else pixel[3] = 0xff;
+
+            src += SRC_BYTES;
+        }
+
+        if constexpr (HAS_PADDING) src += padding;
+    }
+}
+
+// テーブルのインデックス。ビット0がパディング、ビット1がチャンネルの並び、ビット2～3が反転、ビット4がバイト数（3、4）
+constexpr u32 KERNEL_COUNT = 2 * 4 * 2 * 2;
+
+constexpr u32 GetIndex(u32 srcBytes, FlippedType flip, ChannelOrder order, bool hasPadding)
+{
+    return ((srcBytes == 4) ? 16 : 0) | (static_cast<u32>(flip) << 2) | (static_cast<u32>(order) << 1) | ((hasPadding) ? 1 : 0);
+}
+
+template <u32 INDEX>
+constexpr Kernel MakeKernel()
+{
+    return &Convert
+    <
+        ((INDEX & 16) != 0) ? 4 : 3, static_cast<FlippedType>((INDEX >> 2) & 3), 
+        static_cast<ChannelOrder>((INDEX >> 1) & 1), (INDEX & 1) != 0
+    >;
+}
+
+template <size_t... INDICES>
+constexpr std::array<Kernel, sizeof...(INDICES)> MakeTable(std::index_sequence<INDICES...>)
+{
+    return {MakeKernel<INDICES>()...};
+}
+
+inline constexpr std::array<Kernel, KERNEL_COUNT> KERNEL_TABLE = MakeTable(std::make_index_sequence<KERNEL_COUNT>{});
+
+// 組み合わせに対応するカーネルを返す。3、4バイト以外の場合はnullptr
+constexpr Kernel Find(u32 srcBytes, FlippedType flip, ChannelOrder order, bool hasPadding)
+{
+    if (srcBytes != 3 && srcBytes != 4) return nullptr;
+    return KERNEL_TABLE[GetIndex(srcBytes, flip, order, hasPadding)];
+}
+
+}
@@ -0,0 +1,68 @@
+﻿#pragma once
+
+#include <vector>
+
+#include "converter.h"
+
+constexpr u32 MAX_PALETTE_SIZE = 256;
+
+enum class AlphaType
+{
+    opaque = 0, // 全てのアルファが0xff
+    binary, // アルファが0または0xffのみ
+    translucent, // 半透明のピクセルを含む
+};
+
+// 画像を最小のレイアウトで書き出すための解析結果
+struct PixelLayout
+{
+    AlphaType alphaType = AlphaType::translucent;
+    bool isGray = false; // 全ピクセルのB、G、Rが等しい
+
+    // 使用されている色がMAX_PALETTE_SIZE以下の場合はその色。アルファの小さい順に並ぶ。超える場合は空
+    std::vector<BGRA> palette;
+
+    bool isOpaque() const { return alphaType == AlphaType::opaque; }
+};
+
+// MAX_PALETTE_SIZE色までの色と、そのインデックスの表。開番地法のハッシュ表で色からインデックスを引く
+class ColorTable
+{
+private:
+    std::vector<u64> entries_; // 0は空。下位32ビットが色、上位32ビットがインデックス + 1
+    u32 count_ = 0;
+
+public:
+    ColorTable();
+    ColorTable(const std::vector<BGRA>& palette);
+    ~ColorTable() = default;
+
+    // 新しい色には追加した順のインデックスを割り当てる。MAX_PALETTE_SIZE色を超える場合はfalseを返す
+    bool add(u32 color);
+
+    // 見つからない場合は0を返す
+    u8 find(u32 color) const;
+
+    u32 getCount() const { return count_; }
+    std::vector<u32> getColors() const;
+};
+
+namespace Layout
+{
+
+// 行を複数のスレッドに分配し、アルファ、グレースケール、色数を解析する。SSE2が使える場合はベクトル化する
+PixelLayout Analysis(const FileData& fileData);
+
+// 左下から数えてy行目の各ピクセルをpixelBytesバイト（1: グレースケール、3: BGR、4: BGRA）に詰める
+void PackRow(const FileData& fileData, u32 y, u32 pixelBytes, u8* rtRow);
+
+// 左下から数えてy行目の各ピクセルをパレットのインデックスに置き換える
+void PackRowIndices(const FileData& fileData, u32 y, const ColorTable& table, u8* rtRow);
+
+// インデックスをパレットの色に置き換えてBGRAに並べる。パレットの範囲外のインデックスがある場合はfalseを返す
+bool UnpackIndices(const u8* indices, u32 count, const std::vector<BGRA>& palette, u8* rtPixels);
+
+// グレースケールの値をそのまま色とする256色のパレット
+std::vector<BGRA> GetGrayPalette();
+
+}
@@ -0,0 +1,61 @@
+﻿#pragma once
+
+#include <vector>
+
+#include "converter.h"
+
+enum class DitherType
+{
+    none = 0,
+    ordered, // 4x4のベイヤー行列でしきい値をずらす。行ごとに並列に処理できる
+    floydSteinberg, // 誤差を右と下の行へ拡散する。行を往復しながら順に処理する
+};
+
+// 256色を超える画像をカラーパレットで書き出すための減色の設定
+struct QuantizeOption
+{
+    u32 colorCount = 0; // パレットの色数。0の場合は減色しない
+    u32 refineCount = 4; // 中央値分割の後にk-meansで色を調整する回数
+    DitherType dither = DitherType::none;
+
+    bool isEnabled() const { return colorCount != 0; }
+};
+
+// パレットのBGRAをk-d木に並べ、最も近い色を探す
+class PaletteTree
+{
+private:
+    struct Node
+    {
+        s32 color[4];
+        u8 index;
+        u8 axis;
+        s16 left;
+        s16 right;
+    };
+
+    std::vector<Node> nodes_;
+    s16 root_ = -1;
+
+    s16 build(std::vector<u8>& indices, u32 begin, u32 end, const std::vector<BGRA>& palette);
+    void search(s16 node, const s32* color, u8& rtIndex, s32& rtDistance) const;
+
+public:
+    PaletteTree(const std::vector<BGRA>& palette);
+    ~PaletteTree() = default;
+
+    // colorはB、G、R、Aの順
+    u8 findNearest(const s32* color) const;
+};
+
+// メディアンカットで色空間を分割した後、k-meansで各色を調整してパレットを作る
+namespace Quantizer
+{
+
+// colorCount色以下のパレットを作る。色は5ビットに丸めたヒストグラムで数え、行を並列に集計する
+std::vector<BGRA> CreatePalette(const FileData& fileData, u32 colorCount, u32 refineCount);
+
+// 各ピクセルを最も近いパレットの色のインデックスに置き換える。FileDataと同じく左下から右上の順に並ぶ
+std::vector<u8> Map(const FileData& fileData, const std::vector<BGRA>& palette, DitherType dither);
+
+}
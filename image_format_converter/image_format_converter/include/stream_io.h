@@ -0,0 +1,62 @@
+﻿#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "converter.h"
+
+// 標準入力やパイプなど、シークできないストリームを先頭から順に読み込む
+class StreamReader
+{
+private:
+    FILE* stream_ = nullptr;
+    u64 position_ = 0;
+
+public:
+    StreamReader(FILE* stream) : stream_(stream) {}
+    ~StreamReader() = default;
+
+    // sizeバイトを読み込む。途中で終端に達した場合はfalseを返す
+    bool read(u8* rtData, size_t size);
+
+    // sizeバイトを読み捨てる
+    bool skip(u64 size);
+
+    // 終端まで読み捨てる
+    void skipToEnd();
+
+    // 終端までをrtDataの末尾に追加する
+    bool readToEnd(std::vector<u8>& rtData);
+
+    // 読み込んだバイト数
+    u64 getPosition() const { return position_; }
+};
+
+// 標準入出力をファイルの代わりに使用する。BMP、TGA、DDSはヘッダーの後を1行ずつ読み込んでFileDataに直接展開し、
+// ファイル全体をメモリに置かない。PNGなどそれ以外の形式は終端まで読み込んでから解析する
+namespace StreamIO
+{
+
+// 形式の判別に使用する先頭のバイト数
+constexpr u32 PREFIX_SIZE = 18;
+
+// Windowsで標準入出力の改行コードが変換されないようにする
+void SetBinaryMode(FILE* stream);
+
+// 先頭のバイト列から形式を判別し、拡張子を返す。判別できない場合は空を返す
+std::string DetectFormat(const u8* prefix, u32 prefixSize);
+
+// 形式を判別して解析する。rtExtには判別した拡張子を設定する。
+// 解析に失敗した場合も残りのデータは読み捨て、書き込み側のプロセスが途中で止まらないようにする
+std::unique_ptr<FileData> Decode
+(
+    const Converter& converter, StreamReader& reader, std::string& rtExt, u32& rtResult
+);
+
+// データを全て書き込む。成功：SUCCESS、失敗：ERROR_FILE_OPERATION
+u32 Write(FILE* stream, const u8* data, size_t dataSize);
+
+}
@@ -0,0 +1,137 @@
+﻿#pragma once
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "converter.h"
+
+// 上から順に行を読み込める画像。タイル化ではバンド単位で読み込み、画像全体をメモリに置かない
+class IRowSource
+{
+public:
+    virtual ~IRowSource() = default;
+
+    virtual s32 getWidth() const = 0;
+    virtual s32 getHeight() const = 0;
+
+    // 上から数えてy行目からcount行を、上から順にBGRAで読み込む。失敗した場合はfalseを返す
+    virtual bool read(u32 y, u32 count, u8* rtPixels) = 0;
+};
+
+// 解析済みのFileDataから行を読み込む
+class FileDataRowSource : public IRowSource
+{
+private:
+    std::unique_ptr<FileData> fileData_;
+
+public:
+    FileDataRowSource(std::unique_ptr<FileData> fileData) : fileData_(std::move(fileData)) {}
+    ~FileDataRowSource() override = default;
+
+    s32 getWidth() const override { return fileData_->width; }
+    s32 getHeight() const override { return fileData_->height; }
+    bool read(u32 y, u32 count, u8* rtPixels) override;
+};
+
+// 非圧縮のBMP（8、24、32ビット）から必要な行だけをファイルから読み込む。
+// ピクセルデータがu32に収まらない大きな画像も扱える
+class BmpRowSource : public IRowSource
+{
+private:
+    std::ifstream file_;
+    s32 width_ = 0;
+    s32 height_ = 0;
+    u16 pixelDepth_ = 0;
+    bool isBottomUp_ = true;
+    u64 dataOffset_ = 0;
+    u64 rowSize_ = 0;
+    std::vector<BGRA> palette_;
+    std::vector<u8> rowBuffer_;
+
+public:
+    BmpRowSource() = default;
+    ~BmpRowSource() override = default;
+
+    // 対応していない形式の場合はfalseを返す
+    bool open(std::string_view path);
+
+    s32 getWidth() const override { return width_; }
+    s32 getHeight() const override { return height_; }
+    bool read(u32 y, u32 count, u8* rtPixels) override;
+};
+
+struct TileOption
+{
+    u32 tileSize = 256; // 2の倍数
+    std::string exportExt = "png"; // タイルの形式。Converterに登録されている拡張子
+    bool isPacked = false; // trueの場合は全てのタイルを1つのコンテナファイルにまとめる
+};
+
+constexpr u32 TILE_PACK_SIGNATURE = 0x4b415054; // "TPAK"
+constexpr u32 TILE_PACK_VERSION = 1;
+
+#pragma pack(push, 1)
+struct TilePackHeader
+{
+    u32 signature;      // TILE_PACK_SIGNATURE
+    u32 version;        // TILE_PACK_VERSION
+    u32 width;          // 最も大きいレベルの幅
+    u32 height;         // 最も大きいレベルの高さ
+    u32 tileSize;       // タイルの幅、高さ
+    u32 levelCount;     // レベル数
+    u32 tileCount;      // タイル数
+    char ext[8];        // タイルの形式の拡張子（null終端）
+    u64 indexOffset;    // ファイル先頭からインデックスまでのオフセット
+};
+
+struct TilePackEntry
+{
+    u32 level;  // 0が最も小さいレベル
+    u32 x;      // 左から数えたタイルの位置
+    u32 y;      // 上から数えたタイルの位置
+    u32 size;   // タイルのデータのサイズ
+    u64 offset; // ファイル先頭からタイルのデータまでのオフセット
+};
+#pragma pack(pop)
+
+// 画像を2分の1ずつ縮小したレベルらに分け、各レベルをタイルに切り出す。
+// レベル0は画像全体が1枚のタイルに収まる大きさで、最後のレベルが元の画像になる
+namespace TilePyramid
+{
+
+u32 GetLevelCount(s32 width, s32 height, u32 tileSize);
+
+// BMPは行ごとに読み込み、読み込めない場合やそれ以外の形式は画像全体を解析する。失敗した場合はnullptrを返す
+std::unique_ptr<IRowSource> OpenSource(const Converter& converter, std::string_view path);
+
+// タイルを書き出す。isPackedがfalseの場合はexportPathのフォルダに「レベル/x_y.拡張子」として、
+// trueの場合はexportPathのコンテナファイルに書き出す。
+// 画像をtileSize行のバンドごとに読み込み、各レベルのバンドのタイルを並列に変換するため、
+// 使用するメモリは画像の幅とタイルのサイズに比例する
+u32 Build(const Converter& converter, IRowSource& source, const TileOption& option, std::string_view exportPath);
+
+}
+
+// タイルのコンテナファイルからタイルを読み込む
+class TilePackReader
+{
+private:
+    std::string path_;
+    TilePackHeader header_ = {};
+    std::vector<TilePackEntry> entries_; // レベル、y、xの順に並ぶ
+
+public:
+    TilePackReader() = default;
+    ~TilePackReader() = default;
+
+    // 成功：SUCCESS、失敗：ERROR_FILE_OPERATION、ERROR_ANALYSIS_FAILED
+    u32 open(std::string_view path);
+
+    const TilePackHeader& getHeader() const { return header_; }
+
+    // タイルのデータを読み込む。成功：SUCCESS、見つからない場合：ERROR_INVALID_ARGUMENTS
+    u32 load(u32 level, u32 x, u32 y, std::vector<u8>& rtData) const;
+};
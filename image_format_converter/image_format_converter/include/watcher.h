@@ -0,0 +1,91 @@
+﻿#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "change_feed.h"
+#include "converter.h"
+#include "parallel.h"
+
+struct WatchOption
+{
+    std::string sourceDir; // 監視するフォルダ。サブフォルダも監視する
+    std::string exportDir; // 出力先のフォルダ。sourceDirからの相対パスを保って書き出す
+    std::string exportExt; // 出力形式の拡張子
+    u32 debounceMilliseconds = 50; // 最後に保存されてからこの時間が経つまで変換を待つ
+    u32 threadCount = 0; // 変換するスレッド数。0の場合はハードウェアスレッド数
+};
+
+// inotifyでフォルダを監視し、保存されたファイルだけを常駐したConverterとワーカーで変換し直す（Linuxのみ）
+// 短い間隔の保存はまとめて1回の変換にし、変換中に保存された場合は変換後にもう一度変換する
+class Watcher
+{
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct PendingFile
+    {
+        Clock::time_point detectedTime; // 最初に保存を検知した時刻
+        Clock::time_point startTime; // 変換を始める時刻
+    };
+
+    const Converter& converter_;
+    WatchOption option_;
+    std::function<void(const ChangeEvent&)> onChange_;
+
+    int inotifyFd_ = -1;
+    std::map<int, std::string> watchDirs_; // 監視記述子と、監視しているフォルダ
+
+    std::mutex mutex_;
+    std::map<std::string, PendingFile> pendingFiles_;
+    std::set<std::string> runningFiles_;
+
+    // 読み込み、書き出しに使うバッファ。確保した領域を使い回す
+    std::mutex bufferMutex_;
+    std::vector<std::vector<u8>> buffers_;
+
+    // 処理中の変換が他のメンバを参照するため、最初に破棄されるよう最後に宣言する
+    std::unique_ptr<WorkerPool> workerPool_;
+
+    void addWatch(const std::string& dir);
+    void readEvents();
+
+    // 監視を始める前に書き込まれたファイルのうち、出力がないか古いものを変換待ちにする。
+    // 新しく作られたフォルダと、イベントが溢れて失われた場合に使用する
+    void scanDir(const std::string& dir, Clock::time_point now);
+    void pushPending(const std::string& path, Clock::time_point now);
+    void startDueFiles();
+    void convertFile(const std::string& sourcePath, Clock::time_point detectedTime);
+
+    std::vector<u8> acquireBuffer();
+    void releaseBuffer(std::vector<u8> buffer);
+
+public:
+    // onChangeはワーカースレッドから、変換を終えるたびに呼ばれる
+    Watcher(const Converter& converter, WatchOption option, std::function<void(const ChangeEvent&)> onChange);
+    ~Watcher();
+
+    Watcher(const Watcher&) = delete;
+    Watcher& operator=(const Watcher&) = delete;
+
+    // 監視を始める。成功：SUCCESS、失敗：ERROR_FILE_OPERATION
+    u32 start();
+
+    // 最大timeoutMilliseconds待って変更を読み込み、待ち時間が過ぎたファイルの変換を始める
+    void poll(u32 timeoutMilliseconds);
+
+    // isStoppedがtrueになるまでpollを繰り返す
+    void run(const std::atomic<bool>& isStopped);
+
+    // 変換待ち、変換中のファイルがないか
+    bool isIdle();
+
+    // 入力ファイルのパスから出力ファイルのパスを求める
+    std::string getExportPath(const std::string& sourcePath) const;
+};
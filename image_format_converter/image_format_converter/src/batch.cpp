@@ -0,0 +1,338 @@
+﻿#include "pch.h"
+
+#include "batch.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <set>
+
+#include "file_io.h"
+#include "parallel.h"
+
+using namespace std;
+
+namespace
+{
+
+struct Group
+{
+    u32 representative = 0;
+    vector<u32> duplicates;
+};
+
+// isKeepingExtがtrueの場合は入力の拡張子を残して、a.bmpをa.bmp.pngのようにする
+string GetExportPath(const BatchOption& option, const filesystem::path& sourcePath, bool isKeepingExt)
+{
+    filesystem::path relativePath = sourcePath.lexically_relative(option.sourceDir);
+    filesystem::path exportPath = filesystem::path(option.exportDir) / relativePath;
+    if (isKeepingExt) exportPath += "." + option.exportExt;
+    else exportPath.replace_extension("." + option.exportExt);
+
+    return exportPath.string();
+}
+
+// 拡張子だけが違う入力は同じ出力先になるため、重なる入力は拡張子を残して区別する。
+// それでも重なる場合は、後の入力をERROR_INVALID_ARGUMENTSにする
+void AssignExportPaths(const BatchOption& option, vector<BatchEntry>& rtEntries)
+{
+    map<string, vector<u32>> indices;
+    for (u32 i = 0; i < rtEntries.size(); ++i)
+    {
+        rtEntries[i].exportPath = GetExportPath(option, rtEntries[i].sourcePath, false);
+        indices[rtEntries[i].exportPath].push_back(i);
+    }
+
+    for (const auto& [exportPath, sameIndices] : indices)
+    {
+        if (sameIndices.size() <= 1) continue;
+        for (u32 index : sameIndices) rtEntries[index].exportPath = GetExportPath(option, rtEntries[index].sourcePath, true);
+    }
+
+    set<string> exportPaths;
+    for (BatchEntry& entry : rtEntries)
+    {
+        if (!exportPaths.insert(entry.exportPath).second) entry.result = ERROR_INVALID_ARGUMENTS;
+    }
+}
+
+bool IsInside(const filesystem::path& path, const filesystem::path& dir)
+{
+    auto mismatch = std::mismatch(dir.begin(), dir.end(), path.begin(), path.end());
+    return mismatch.first == dir.end();
+}
+
+// 解析したピクセルを変換して書き出す
+u32 WriteEntry(const Converter& converter, const BatchOption& option, BatchEntry& entry, const FileData& fileData)
+{
+    vector<u8> exportData;
+    u32 result = converter.dataConvert(option.exportExt, fileData, exportData);
+    if (result != SUCCESS) return result;
+
+    error_code error;
+    filesystem::create_directories(filesystem::path(entry.exportPath).parent_path(), error);
+
+    entry.exportSize = exportData.size();
+    return FileIO::Write(entry.exportPath, exportData.data(), static_cast<u32>(exportData.size()));
+}
+
+// 入力を読み込んで解析する
+u32 LoadEntry
+(
+    const Converter& converter, const BatchEntry& entry,
+    vector<u8>& rtImportData, unique_ptr<FileData>& rtFileData
+){
+    u32 result = FileIO::Load(entry.sourcePath, rtImportData);
+    if (result != SUCCESS) return result;
+
+    rtFileData = converter.dataAnalysis
+    (
+        entry.sourcePath, rtImportData.data(), static_cast<u32>(rtImportData.size()), result
+    );
+    return result;
+}
+
+// 入力を解析して変換し、書き出す。解析したピクセルと読み込んだファイルはrtFileData、rtImportDataに残す
+u32 ConvertEntry
+(
+    const Converter& converter, const BatchOption& option, BatchEntry& entry,
+    vector<u8>& rtImportData, unique_ptr<FileData>& rtFileData
+){
+    u32 result = LoadEntry(converter, entry, rtImportData, rtFileData);
+    if (rtFileData == nullptr) return result;
+
+    return WriteEntry(converter, option, entry, *rtFileData);
+}
+
+// 代表の出力をハードリンクまたはコピーする
+u32 WriteDuplicate(const string& representativePath, const string& exportPath, bool useHardLink)
+{
+    // 既に同じファイルの場合は、消すと代表の出力も失われるため何もしない
+    error_code error;
+    if (filesystem::equivalent(representativePath, exportPath, error)) return SUCCESS;
+
+    filesystem::create_directories(filesystem::path(exportPath).parent_path(), error);
+    filesystem::remove(exportPath, error);
+
+    if (useHardLink)
+    {
+        filesystem::create_hard_link(representativePath, exportPath, error);
+        if (!error) return SUCCESS;
+    }
+
+    filesystem::copy_file(representativePath, exportPath, filesystem::copy_options::overwrite_existing, error);
+    return (error) ? ERROR_FILE_OPERATION : SUCCESS;
+}
+
+// ハッシュが一致した画像が代表と同じか確かめる
+bool IsSameImage
+(
+    const Converter& converter, const BatchEntry& entry,
+    const vector<u8>& representativeData, const FileData& representative
+){
+    vector<u8> importData;
+    if (FileIO::Load(entry.sourcePath, importData) != SUCCESS) return false;
+    if (entry.duplicateType == DuplicateType::bytes) return importData == representativeData;
+
+    u32 result = SUCCESS;
+    unique_ptr<FileData> fileData = converter.dataAnalysis
+    (
+        entry.sourcePath, importData.data(), static_cast<u32>(importData.size()), result
+    );
+    if (fileData == nullptr) return false;
+    if (fileData->width != representative.width || fileData->height != representative.height) return false;
+
+    size_t size = static_cast<size_t>(fileData->width) * fileData->height * 4;
+    return memcmp(fileData->pixels.get(), representative.pixels.get(), size) == 0;
+}
+
+const char* GetDuplicateTypeName(DuplicateType type)
+{
+    switch (type)
+    {
+    case DuplicateType::bytes: return "bytes";
+    case DuplicateType::pixels: return "pixels";
+    default: return "source";
+    }
+}
+
+}
+
+vector<string> Batch::FindSources(const Converter& converter, const BatchOption& option)
+{
+    error_code error;
+    filesystem::path exportDir = filesystem::weakly_canonical(option.exportDir, error);
+
+    vector<string> sources;
+    filesystem::recursive_directory_iterator it(option.sourceDir, filesystem::directory_options::skip_permission_denied, error);
+    for (; !error && it != filesystem::recursive_directory_iterator(); it.increment(error))
+    {
+        if (!it->is_regular_file(error)) continue;
+
+        string path = it->path().string();
+        if (!converter.isSupported(path)) continue;
+        if (IsInside(filesystem::weakly_canonical(it->path(), error), exportDir)) continue;
+
+        sources.push_back(path);
+    }
+
+    sort(sources.begin(), sources.end());
+    return sources;
+}
+
+vector<BatchEntry> Batch::Run(const Converter& converter, const BatchOption& option)
+{
+    vector<string> sources = FindSources(converter, option);
+    vector<BatchEntry> entries(sources.size());
+    for (size_t i = 0; i < sources.size(); ++i) entries[i].sourcePath = sources[i];
+    AssignExportPaths(option, entries);
+
+    // 全ての画像を並列に解析し、ファイルとピクセルのハッシュを求める。ピクセルは保持しない。
+    // ピクセルのハッシュを最初に求めた画像は、解析したピクセルをそのまま使って変換しておく。
+    // 変換結果はピクセルだけで決まるため、どの画像が変換しても同じ内容になる
+    u32 entryCount = static_cast<u32>(entries.size());
+    mutex claimMutex;
+    map<Hash128, u32> claims; // ピクセルのハッシュと、変換した画像
+    vector<u32> claimResults(entryCount, SUCCESS);
+    if (option.useDedup)
+    {
+        Parallel::For(entryCount, [&](u32 index)
+        {
+            BatchEntry& entry = entries[index];
+            if (entry.result != SUCCESS) return;
+
+            vector<u8> importData;
+            entry.result = FileIO::Load(entry.sourcePath, importData);
+            if (entry.result != SUCCESS) return;
+
+            entry.fileHash = ImageHash::Hash(importData.data(), importData.size());
+
+            unique_ptr<FileData> fileData = converter.dataAnalysis
+            (
+                entry.sourcePath, importData.data(), static_cast<u32>(importData.size()), entry.result
+            );
+            if (fileData == nullptr) return;
+            entry.pixelHash = ImageHash::HashImage(*fileData);
+
+            {
+                lock_guard<mutex> lock(claimMutex);
+                if (!claims.emplace(entry.pixelHash, index).second) return;
+            }
+            claimResults[index] = WriteEntry(converter, option, entry, *fileData);
+        });
+    }
+
+    // 入力パスの順に、ピクセルのハッシュが初めて現れた画像を代表にする。グループは1から振り、0は解析に失敗した画像
+    vector<Group> groups;
+    map<Hash128, u32> groupIndices;
+    for (u32 i = 0; i < entryCount; ++i)
+    {
+        BatchEntry& entry = entries[i];
+        if (entry.result != SUCCESS) continue;
+
+        auto [found, isInserted] = (option.useDedup) ?
+            groupIndices.emplace(entry.pixelHash, static_cast<u32>(groups.size())) :
+            make_pair(groupIndices.end(), true);
+
+        if (isInserted)
+        {
+            entry.group = static_cast<u32>(groups.size()) + 1;
+            groups.push_back({i, {}});
+            continue;
+        }
+
+        Group& group = groups[found->second];
+        const BatchEntry& representative = entries[group.representative];
+        entry.group = found->second + 1;
+        entry.duplicateType = (entry.fileHash == representative.fileHash) ? DuplicateType::bytes : DuplicateType::pixels;
+        group.duplicates.push_back(i);
+    }
+
+    // グループごとに代表の出力を用意し、重複した画像は代表の出力を共有する
+    Parallel::For(static_cast<u32>(groups.size()), [&](u32 groupIndex)
+    {
+        const Group& group = groups[groupIndex];
+        BatchEntry& representative = entries[group.representative];
+
+        // 確かめる場合はハッシュの衝突に備え、代表は代表自身のピクセルから変換する
+        auto claim = claims.find(representative.pixelHash);
+        vector<u8> importData;
+        unique_ptr<FileData> fileData;
+        if (claim == claims.end() || (option.useVerify && claim->second != group.representative))
+        {
+            representative.result = ConvertEntry(converter, option, representative, importData, fileData);
+        }
+        else if (claimResults[claim->second] != SUCCESS)
+        {
+            representative.result = claimResults[claim->second];
+        }
+        else if (claim->second != group.representative)
+        {
+            const BatchEntry& claimed = entries[claim->second];
+            representative.result = WriteDuplicate(claimed.exportPath, representative.exportPath, option.useHardLink);
+            representative.exportSize = claimed.exportSize;
+        }
+
+        // 確かめる場合は代表を解析し直して比べる
+        if (representative.result == SUCCESS && option.useVerify && !group.duplicates.empty() && fileData == nullptr)
+        {
+            LoadEntry(converter, representative, importData, fileData);
+        }
+
+        for (u32 index : group.duplicates)
+        {
+            BatchEntry& entry = entries[index];
+            if (representative.result != SUCCESS)
+            {
+                entry.result = representative.result;
+                continue;
+            }
+
+            // ハッシュが衝突していた場合は、その画像も変換する
+            if (option.useVerify && (fileData == nullptr || !IsSameImage(converter, entry, importData, *fileData)))
+            {
+                vector<u8> entryData;
+                unique_ptr<FileData> entryFileData;
+                entry.duplicateType = DuplicateType::none;
+                entry.result = ConvertEntry(converter, option, entry, entryData, entryFileData);
+                continue;
+            }
+
+            entry.result = WriteDuplicate(representative.exportPath, entry.exportPath, option.useHardLink);
+            entry.exportSize = representative.exportSize;
+        }
+    });
+
+    return entries;
+}
+
+string Batch::FormatReport(const vector<BatchEntry>& entries)
+{
+    // 重複のあるグループだけを、代表、重複の順に並べる
+    map<u32, vector<const BatchEntry*>> groups;
+    for (const BatchEntry& entry : entries)
+    {
+        if (entry.group != 0) groups[entry.group].push_back(&entry);
+    }
+
+    string report;
+    for (const auto& [group, members] : groups)
+    {
+        if (members.size() <= 1) continue;
+
+        vector<const BatchEntry*> sorted = members;
+        stable_sort(sorted.begin(), sorted.end(), [](const BatchEntry* a, const BatchEntry* b)
+        {
+            return a->duplicateType == DuplicateType::none && b->duplicateType != DuplicateType::none;
+        });
+
+        for (const BatchEntry* entry : sorted)
+        {
+            report += to_string(group) + "\t" + GetDuplicateTypeName(entry->duplicateType) + "\t";
+            report += entry->sourcePath + "\t" + entry->exportPath + "\n";
+        }
+    }
+
+    return report;
+}
@@ -0,0 +1,86 @@
+﻿#include "pch.h"
+
+#include "change_feed.h"
+
+#include <charconv>
+
+using namespace std;
+
+string ChangeFeed::Format(const ChangeEvent& event)
+{
+    char milliseconds[32];
+    snprintf(milliseconds, sizeof(milliseconds), "%.3f", event.milliseconds);
+
+    return to_string(event.result) + "\t" + milliseconds + "\t" + event.sourcePath + "\t" + event.exportPath + "\n";
+}
+
+bool ChangeFeed::Parse(string_view line, ChangeEvent& rtEvent)
+{
+    string_view fields[4];
+    for (u32 i = 0; i < 3; ++i)
+    {
+        size_t tab = line.find('\t');
+        if (tab == string_view::npos) return false;
+
+        fields[i] = line.substr(0, tab);
+        line.remove_prefix(tab + 1);
+    }
+    fields[3] = line;
+
+    auto [resultEnd, resultError] = from_chars(fields[0].data(), fields[0].data() + fields[0].size(), rtEvent.result);
+    if (resultError != errc() || resultEnd != fields[0].data() + fields[0].size()) return false;
+
+    rtEvent.milliseconds = atof(string(fields[1]).c_str());
+    rtEvent.sourcePath = fields[2];
+    rtEvent.exportPath = fields[3];
+    return true;
+}
+
+vector<ChangeEvent> ChangeFeedReader::poll()
+{
+    vector<ChangeEvent> rtEvents;
+
+#ifdef _WIN32
+    FILE* fp = nullptr;
+    if (fopen_s(&fp, path_.c_str(), "rb") != 0) fp = nullptr;
+#else
+    FILE* fp = fopen(path_.c_str(), "rb");
+#endif
+    if (fp == nullptr) return rtEvents;
+
+    // ファイルが作り直された場合は先頭から読み直す
+    fseek(fp, 0L, SEEK_END);
+    long size = ftell(fp);
+    if (size < 0 || static_cast<u64>(size) < offset_)
+    {
+        offset_ = 0;
+        pendingLine_.clear();
+    }
+
+    if (size > 0 && static_cast<u64>(size) > offset_)
+    {
+        string data(static_cast<size_t>(size - offset_), '\0');
+        fseek(fp, static_cast<long>(offset_), SEEK_SET);
+        size_t readSize = fread(data.data(), 1, data.size(), fp);
+        offset_ += readSize;
+        data.resize(readSize);
+
+        pendingLine_ += data;
+
+        // 改行まで書き込まれた行のみ解析し、残りは次回に回す
+        size_t lineStart = 0;
+        for (size_t lineEnd = pendingLine_.find('\n'); lineEnd != string::npos; lineEnd = pendingLine_.find('\n', lineStart))
+        {
+            ChangeEvent event;
+            if (ChangeFeed::Parse(string_view(pendingLine_).substr(lineStart, lineEnd - lineStart), event))
+            {
+                rtEvents.push_back(move(event));
+            }
+            lineStart = lineEnd + 1;
+        }
+        pendingLine_.erase(0, lineStart);
+    }
+
+    fclose(fp);
+    return rtEvents;
+}
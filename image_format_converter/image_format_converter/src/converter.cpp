@@ -1,10 +1,20 @@
 ﻿#include "pch.h"
 
 #include "converter.h"
+#include "file_io.h"
 
 using namespace std;
 
-bool IConverter::judgeExt(std::string_view importPath)
+bool IsValidImageSize(s64 width, s64 height)
+{
+    if (width <= 0 || height <= 0) return false;
+
+    // 掛ける前に範囲を確認する。u32の幅、高さをそのまま掛けるとs64でも桁あふれする
+    if (width > INT32_MAX || height > INT32_MAX) return false;
+    return width <= static_cast<s64>(UINT32_MAX / 4) / height;
+}
+
+bool IConverter::judgeExt(std::string_view importPath) const
 {
 	string_view ext = importPath.substr(importPath.find_last_of('.') + 1);
 
@@ -12,104 +22,148 @@ bool IConverter::judgeExt(std::string_view importPath)
     return false;
 }
 
-unique_ptr<u8[]> IConverter::load(string_view importPath)
+unique_ptr<u8[]> IConverter::load(string_view importPath, u32& rtDataSize) const
 {
-    FILE* fp = nullptr;
-	errno_t error;
+    return FileIO::Load(importPath, rtDataSize);
+}
 
-	error = fopen_s(&fp, importPath.data(), "rb");
+u32 IConverter::write(string_view exportPath, const u8 *data, const u32 dataSize) const
+{
+    return FileIO::Write(exportPath, data, dataSize);
+}
 
-	if (error != 0) return nullptr;
+void Converter::addObserver(string ext, unique_ptr<IConverter> observer)
+{
+	observers_.emplace(ext, move(observer));
+}
 
-	//ファイルの末尾へ移動して、サイズを計算
-	fseek(fp, 0L, SEEK_END);
-	fpos_t size;
-	fgetpos(fp, &size);
+const IConverter* Converter::findObserver(string_view path) const
+{
+    for (auto& observer : observers_)
+    {
+        if (observer.second->judgeExt(path)) return observer.second.get();
+    }
 
-	//ファイルの最初に移動
-	fseek(fp, 0L, SEEK_SET);
+    return nullptr;
+}
+
+unique_ptr<FileData> Converter::fileAnalysis(string_view importPath) const
+{
+    const IConverter* observer = findObserver(importPath);
+    if (observer == nullptr)
+    {
+        cout << "解析できるファイル形式が見つかりませんでした。" << endl;
+        return nullptr;
+    }
 
-	unique_ptr<u8[]> rtBuff = make_unique<u8[]>(size);
+    u32 importSize = 0;
+    unique_ptr<u8[]> importFileBuff = observer->load(importPath, importSize);
+    if (importFileBuff == nullptr)
+    {
+        cout << "ファイルの読み込みに失敗しました。" << endl;
+        return nullptr;
+    }
 
-	//サイズ分のデータを読み込む
-	fread(rtBuff.get(), 1, size, fp);
-	fclose(fp);
+    unique_ptr<FileData> fileData = observer->analysis(importFileBuff.get(), importSize);
+    if (fileData == nullptr)
+    {
+        cout << "ファイルの解析に失敗しました。" << endl;
+        return nullptr;
+    }
 
-	return rtBuff;
+    return fileData;
 }
 
-u32 IConverter::write(string_view exportPath, u8 *data, const u32 dataSize)
+u32 Converter::fileConvert(string_view exportPath, unique_ptr<FileData> &fileData) const
 {
-    FILE* fp = nullptr;
-	errno_t error;
+    const IConverter* observer = findObserver(exportPath);
+    if (observer == nullptr)
+    {
+        cout << "変換できるファイル形式が見つかりませんでした。" << endl;
+        return ERROR_FILE_OPERATION;
+    }
 
-	error = fopen_s(&fp, exportPath.data(), "wb");
+    u32 dataSize = 0;
+    unique_ptr<u8[]> exportBuff = observer->convert(*fileData, dataSize);
+    if (exportBuff == nullptr)
+    {
+        cout << "ファイルの変換に失敗しました。" << endl;
+        return ERROR_CONVERSION_FAILED;
+    }
 
-	if (error != 0) return ERROR_FILE_OPERATION;
+    u32 result = observer->write(exportPath, exportBuff.get(), dataSize);
+    if (result != SUCCESS)
+    {
+        cout << "ファイルの書き出しに失敗しました。" << endl;
+        return result;
+    }
+
+    return result;
+}
+
+unique_ptr<FileData> Converter::dataAnalysis
+(
+    string_view importExt, const u8* importData, u32 importSize, u32& rtResult
+) const {
+    const IConverter* observer = findObserver(importExt);
+    if (observer == nullptr)
+    {
+        rtResult = ERROR_UNSUPPORTED_FORMAT;
+        return nullptr;
+    }
 
-	fwrite(data, sizeof(u8), dataSize, fp);
-	fclose(fp);
+    if (importData == nullptr || importSize == 0)
+    {
+        rtResult = ERROR_INVALID_ARGUMENTS;
+        return nullptr;
+    }
+
+    unique_ptr<FileData> fileData = observer->analysis(importData, importSize);
+    rtResult = (fileData != nullptr) ? SUCCESS : ERROR_ANALYSIS_FAILED;
 
-	return SUCCESS;
+    return fileData;
 }
 
-void Converter::addObserver(string ext, unique_ptr<IConverter> observer)
-{
-	observers_.emplace(ext, move(observer));
+u32 Converter::dataConvert
+(
+    string_view exportExt, const FileData& fileData, 
+    u8* exportData, u32 exportCapacity, u32& rtDataSize
+) const {
+    const IConverter* observer = findObserver(exportExt);
+    if (observer == nullptr) return ERROR_UNSUPPORTED_FORMAT;
+
+    u32 dataSize = 0;
+    unique_ptr<u8[]> exportBuff = observer->convert(fileData, dataSize);
+    if (exportBuff == nullptr) return ERROR_CONVERSION_FAILED;
+
+    rtDataSize = dataSize;
+    if (exportData == nullptr || exportCapacity < dataSize) return ERROR_BUFFER_TOO_SMALL;
+
+    memcpy(exportData, exportBuff.get(), dataSize);
+    return SUCCESS;
 }
-unique_ptr<FileData> Converter::fileAnalysis(string_view importPath)
+
+u32 Converter::dataConvert(string_view exportExt, const FileData& fileData, vector<u8>& rtData) const
 {
-	for (auto& observer : observers_)
-	{
-		if (observer.second->judgeExt(importPath))
-		{
-			unique_ptr<u8[]> importFileBuff = observer.second->load(importPath);
-            if (importFileBuff == nullptr)
-            {
-                cout << "ファイルの読み込みに失敗しました。" << endl;
-                return nullptr;
-            }
-
-			unique_ptr<FileData> fileData = observer.second->analysis(importFileBuff);
-			if (fileData == nullptr)
-			{
-				cout << "ファイルの解析に失敗しました。" << endl;
-				return nullptr;
-			}
-
-			return fileData;
-		}
-	}
-
-	cout << "解析できるファイル形式が見つかりませんでした。" << endl;
-	return nullptr;
+    const IConverter* observer = findObserver(exportExt);
+    if (observer == nullptr) return ERROR_UNSUPPORTED_FORMAT;
+
+    u32 dataSize = 0;
+    unique_ptr<u8[]> exportBuff = observer->convert(fileData, dataSize);
+    if (exportBuff == nullptr) return ERROR_CONVERSION_FAILED;
+
+    rtData.assign(exportBuff.get(), exportBuff.get() + dataSize);
+    return SUCCESS;
 }
 
-u32 Converter::fileConvert(string_view exportPath, unique_ptr<FileData> &fileData)
-{
-	for (auto& observer : observers_)
-    {
-		if (observer.second->judgeExt(exportPath))
-		{
-			u32 dataSize = 0;
-			unique_ptr<u8[]> exportBuff = observer.second->convert(fileData, dataSize);
-			if (exportBuff == nullptr)
-			{
-				cout << "ファイルの変換に失敗しました。" << endl;
-				return ERROR_CONVERSION_FAILED;
-			}
-
-			u32 result = observer.second->write(exportPath, exportBuff.get(), dataSize);
-			if (result != SUCCESS)
-			{
-				cout << "ファイルの書き出しに失敗しました。" << endl;
-				return result;
-			}
-
-			return result;
-		}
-	}
-
-	cout << "変換できるファイル形式が見つかりませんでした。" << endl;
-	return ERROR_FILE_OPERATION;
-}
\ No newline at end of file
+u32 Converter::dataConvert
+(
+    string_view importExt, const u8* importData, u32 importSize,
+    string_view exportExt, u8* exportData, u32 exportCapacity, u32& rtDataSize
+) const {
+    u32 result = SUCCESS;
+    unique_ptr<FileData> fileData = dataAnalysis(importExt, importData, importSize, result);
+    if (fileData == nullptr) return result;
+
+    return dataConvert(exportExt, *fileData, exportData, exportCapacity, rtDataSize);
+}
@@ -0,0 +1,128 @@
+﻿#include "pch.h"
+
+#include "converter_api.h"
+
+#include "converter.h"
+#include "format_bmp.h"
+#include "format_tga.h"
+#include "format_dds.h"
+#include "format_png.h"
+
+using namespace std;
+
+static_assert(IFC_SUCCESS == SUCCESS);
+static_assert(IFC_ERROR_INVALID_ARGUMENTS == ERROR_INVALID_ARGUMENTS);
+static_assert(IFC_ERROR_CONVERSION_FAILED == ERROR_CONVERSION_FAILED);
+static_assert(IFC_ERROR_UNSUPPORTED_FORMAT == ERROR_UNSUPPORTED_FORMAT);
+static_assert(IFC_ERROR_ANALYSIS_FAILED == ERROR_ANALYSIS_FAILED);
+static_assert(IFC_ERROR_BUFFER_TOO_SMALL == ERROR_BUFFER_TOO_SMALL);
+
+struct IfcConverter
+{
+    Converter converter;
+};
+
+struct IfcEncodedData
+{
+    vector<u8> data;
+};
+
+IfcConverter* IfcCreateConverter(int useTgaCompression)
+{
+    try
+    {
+        unique_ptr<IfcConverter> rtConverter = make_unique<IfcConverter>();
+        rtConverter->converter.addObserver("bmp", make_unique<BMP>());
+        rtConverter->converter.addObserver("tga", make_unique<TGA>(useTgaCompression != 0));
+        rtConverter->converter.addObserver("dds", make_unique<DDS>());
+        rtConverter->converter.addObserver("png", make_unique<PNG>());
+
+        return rtConverter.release();
+    }
+    catch (...)
+    {
+        return nullptr;
+    }
+}
+
+void IfcDestroyConverter(IfcConverter* converter)
+{
+    delete converter;
+}
+
+unsigned int IfcConvert
+(
+    const IfcConverter* converter,
+    const char* importExt, const unsigned char* importData, unsigned int importSize,
+    const char* exportExt, unsigned char* exportData, unsigned int exportCapacity, unsigned int* rtDataSize
+){
+    if (converter == nullptr || importExt == nullptr || exportExt == nullptr || rtDataSize == nullptr)
+    {
+        return IFC_ERROR_INVALID_ARGUMENTS;
+    }
+
+    // C言語の呼び出し側に例外を伝えないよう、メモリの確保に失敗した場合などはエラーとして返す
+    try
+    {
+        u32 dataSize = 0;
+        u32 result = converter->converter.dataConvert
+        (
+            importExt, importData, importSize,
+            exportExt, exportData, exportCapacity, dataSize
+        );
+
+        *rtDataSize = dataSize;
+        return result;
+    }
+    catch (...)
+    {
+        *rtDataSize = 0;
+        return IFC_ERROR_CONVERSION_FAILED;
+    }
+}
+
+unsigned int IfcConvertAlloc
+(
+    const IfcConverter* converter,
+    const char* importExt, const unsigned char* importData, unsigned int importSize,
+    const char* exportExt, IfcEncodedData** rtEncodedData
+){
+    if (rtEncodedData == nullptr) return IFC_ERROR_INVALID_ARGUMENTS;
+    *rtEncodedData = nullptr;
+    if (converter == nullptr || importExt == nullptr || exportExt == nullptr) return IFC_ERROR_INVALID_ARGUMENTS;
+
+    try
+    {
+        u32 result = SUCCESS;
+        unique_ptr<FileData> fileData = converter->converter.dataAnalysis(importExt, importData, importSize, result);
+        if (fileData == nullptr) return result;
+
+        unique_ptr<IfcEncodedData> encodedData = make_unique<IfcEncodedData>();
+        result = converter->converter.dataConvert(exportExt, *fileData, encodedData->data);
+        if (result != SUCCESS) return result;
+
+        *rtEncodedData = encodedData.release();
+        return IFC_SUCCESS;
+    }
+    catch (...)
+    {
+        return IFC_ERROR_CONVERSION_FAILED;
+    }
+}
+
+const unsigned char* IfcGetEncodedData(const IfcEncodedData* encodedData, unsigned int* rtDataSize)
+{
+    if (encodedData == nullptr)
+    {
+        if (rtDataSize != nullptr) *rtDataSize = 0;
+        return nullptr;
+    }
+
+    if (rtDataSize != nullptr) *rtDataSize = static_cast<unsigned int>(encodedData->data.size());
+    return encodedData->data.data();
+}
+
+void IfcDestroyEncodedData(IfcEncodedData* encodedData)
+{
+    delete encodedData;
+}
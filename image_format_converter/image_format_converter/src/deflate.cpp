@@ -0,0 +1,869 @@
+﻿#include "pch.h"
+
+#include "deflate.h"
+
+#include <algorithm>
+#include <bit>
+
+using namespace std;
+
+namespace
+{
+
+constexpr u32 MIN_MATCH = 3;
+constexpr u32 MAX_MATCH = 258;
+constexpr u32 WINDOW_SIZE = 32768;
+constexpr u32 HASH_BITS = 15;
+constexpr u32 BLOCK_INPUT_SIZE = 1 << 17; // 1ブロックにまとめる入力のサイズ
+constexpr u32 MAX_STORED_SIZE = 65535;
+
+constexpr u32 LITLEN_COUNT = 286;
+constexpr u32 DIST_COUNT = 30;
+constexpr u32 CLEN_COUNT = 19;
+constexpr u32 END_OF_BLOCK = 256;
+constexpr u32 MAX_BITS = 15;
+constexpr u32 MAX_CLEN_BITS = 7;
+
+const u16 LENGTH_BASE[29] =
+{
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+const u8 LENGTH_EXTRA[29] =
+{
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+const u16 DIST_BASE[30] =
+{
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+const u8 DIST_EXTRA[30] =
+{
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+const u8 CLEN_ORDER[CLEN_COUNT] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+struct LevelParam
+{
+    u32 maxChain; // ハッシュチェーンを辿る最大回数
+    u32 niceLength; // この長さ以上の一致が見つかれば探索をやめる
+    bool lazy; // 次の位置により長い一致があればそちらを使う
+};
+
+LevelParam GetLevelParam(DeflateLevel level)
+{
+    if (level == DeflateLevel::best) return {256, MAX_MATCH, true};
+    return {8, 32, false};
+}
+
+// 一致長から長さ符号（0～28）を引くテーブル
+struct LengthCodeTable
+{
+    u8 code[MAX_MATCH + 1] = {};
+
+    LengthCodeTable()
+    {
+        for (u32 i = 0; i < 29; ++i)
+        {
+            for (u32 len = LENGTH_BASE[i]; len < LENGTH_BASE[i] + (1u << LENGTH_EXTRA[i]) && len <= MAX_MATCH; ++len)
+            {
+                code[len] = static_cast<u8>(i);
+            }
+        }
+    }
+};
+const LengthCodeTable LENGTH_CODE;
+
+u32 GetDistCode(u32 dist)
+{
+    u32 value = dist - 1;
+    if (value < 4) return value;
+
+    u32 log2 = 31 - countl_zero(value);
+    return 2 * log2 + ((value >> (log2 - 1)) & 1);
+}
+
+u32 ReverseBits(u32 code, u32 length)
+{
+    u32 rtCode = 0;
+    for (u32 i = 0; i < length; ++i)
+    {
+        rtCode = (rtCode << 1) | (code & 1);
+        code >>= 1;
+    }
+    return rtCode;
+}
+
+class BitWriter
+{
+private:
+    vector<u8>& out_;
+    u64 bitBuff_ = 0;
+    u32 bitCount_ = 0;
+
+public:
+    BitWriter(vector<u8>& out) : out_(out) {}
+
+    // 下位ビットから順に書き込む
+    void write(u32 bits, u32 count)
+    {
+        bitBuff_ |= static_cast<u64>(bits) << bitCount_;
+        bitCount_ += count;
+        while (bitCount_ >= 8)
+        {
+            out_.push_back(static_cast<u8>(bitBuff_));
+            bitBuff_ >>= 8;
+            bitCount_ -= 8;
+        }
+    }
+
+    void alignToByte()
+    {
+        if (bitCount_ > 0) write(0, 8 - bitCount_);
+    }
+
+    void writeBytes(const u8* data, u32 dataSize)
+    {
+        assert(bitCount_ == 0);
+        out_.insert(out_.end(), data, data + dataSize);
+    }
+};
+
+// 頻度から最大maxBitsビットに制限したハフマン符号長を求める
+void BuildCodeLengths(const u32* freqs, u32 count, u32 maxBits, u8* rtLengths)
+{
+    fill(rtLengths, rtLengths + count, 0);
+
+    vector<pair<u32, u32>> symbols; // 頻度、シンボル
+    for (u32 i = 0; i < count; ++i)
+    {
+        if (freqs[i] != 0) symbols.emplace_back(freqs[i], i);
+    }
+
+    if (symbols.empty()) return;
+    if (symbols.size() == 1)
+    {
+        rtLengths[symbols[0].second] = 1;
+        return;
+    }
+
+    sort(symbols.begin(), symbols.end());
+
+    // 葉と内部節点の二つのキューから、頻度の小さいものを二つずつ取り出して木を作る
+    u32 leafCount = static_cast<u32>(symbols.size());
+    vector<u64> weights(leafCount * 2 - 1);
+    vector<u32> parents(leafCount * 2 - 1);
+    for (u32 i = 0; i < leafCount; ++i) weights[i] = symbols[i].first;
+
+    u32 leaf = 0;
+    u32 node = leafCount;
+    for (u32 next = leafCount; next < leafCount * 2 - 1; ++next)
+    {
+        u32 children[2];
+        for (u32& child : children)
+        {
+            if (leaf < leafCount && (node >= next || weights[leaf] <= weights[node])) child = leaf++;
+            else child = node++;
+        }
+
+        weights[next] = weights[children[0]] + weights[children[1]];
+        parents[children[0]] = next;
+        parents[children[1]] = next;
+    }
+
+    // 根から深さを求め、符号長ごとの個数を数える
+    vector<u32> depths(leafCount * 2 - 1, 0);
+    vector<u32> lengthCounts(leafCount + 1, 0);
+    for (s32 i = static_cast<s32>(leafCount) * 2 - 3; i >= 0; --i)
+    {
+        depths[i] = depths[parents[i]] + 1;
+        if (static_cast<u32>(i) < leafCount) lengthCounts[depths[i]]++;
+    }
+
+    // maxBitsを超える符号を切り詰め、クラフトの不等式を満たすよう調整する
+    vector<u32> counts(maxBits + 1, 0);
+    for (u32 len = 1; len < lengthCounts.size(); ++len) counts[min(len, maxBits)] += lengthCounts[len];
+
+    u32 total = 0;
+    for (u32 len = maxBits; len > 0; --len) total += counts[len] << (maxBits - len);
+    while (total != (1u << maxBits))
+    {
+        counts[maxBits]--;
+        for (u32 len = maxBits - 1; len > 0; --len)
+        {
+            if (counts[len] != 0)
+            {
+                counts[len]--;
+                counts[len + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+
+    // 頻度の小さいシンボルから長い符号を割り当てる
+    u32 index = 0;
+    for (u32 len = maxBits; len > 0; --len)
+    {
+        for (u32 i = 0; i < counts[len]; ++i) rtLengths[symbols[index++].second] = static_cast<u8>(len);
+    }
+}
+
+// 符号長から、書き込み順にビットを反転したカノニカルハフマン符号を求める
+void BuildCodes(const u8* lengths, u32 count, u16* rtCodes)
+{
+    u32 lengthCounts[MAX_BITS + 1] = {};
+    for (u32 i = 0; i < count; ++i) lengthCounts[lengths[i]]++;
+    lengthCounts[0] = 0;
+
+    u32 nextCode[MAX_BITS + 1] = {};
+    u32 code = 0;
+    for (u32 len = 1; len <= MAX_BITS; ++len)
+    {
+        code = (code + lengthCounts[len - 1]) << 1;
+        nextCode[len] = code;
+    }
+
+    for (u32 i = 0; i < count; ++i)
+    {
+        if (lengths[i] != 0) rtCodes[i] = static_cast<u16>(ReverseBits(nextCode[lengths[i]]++, lengths[i]));
+    }
+}
+
+struct Token
+{
+    u16 length; // distが0の場合はリテラル
+    u16 dist;
+};
+
+class Matcher
+{
+private:
+    const u8* data_;
+    u32 dataSize_;
+    LevelParam param_;
+
+    vector<s32> head_;
+    vector<s32> prev_;
+
+    u32 hash(u32 pos) const
+    {
+        u32 value = data_[pos] | (data_[pos + 1] << 8) | (data_[pos + 2] << 16);
+        return (value * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+public:
+    Matcher(const u8* data, u32 dataSize, LevelParam param)
+    : data_(data), dataSize_(dataSize), param_(param), head_(1 << HASH_BITS, -1), prev_(WINDOW_SIZE, -1) {}
+
+    void insert(u32 pos)
+    {
+        if (pos + MIN_MATCH > dataSize_) return;
+
+        u32 h = hash(pos);
+        prev_[pos & (WINDOW_SIZE - 1)] = head_[h];
+        head_[h] = static_cast<s32>(pos);
+    }
+
+    // posから始まる最長一致を探し、長さを返す。見つからない場合は0
+    u32 find(u32 pos, u32 end, u32& rtDist) const
+    {
+        u32 maxLength = min(MAX_MATCH, end - pos);
+        if (maxLength < MIN_MATCH || pos + MIN_MATCH > dataSize_) return 0;
+
+        const u8* target = data_ + pos;
+        u32 bestLength = MIN_MATCH - 1;
+        u32 chain = param_.maxChain;
+
+        for (s32 candidate = head_[hash(pos)]; candidate >= 0 && chain > 0; --chain)
+        {
+            u32 candidatePos = static_cast<u32>(candidate);
+            if (candidatePos >= pos || pos - candidatePos > WINDOW_SIZE) break;
+
+            const u8* source = data_ + candidatePos;
+            if (source[bestLength] == target[bestLength] && source[0] == target[0] && source[1] == target[1])
+            {
+                u32 length = 2;
+                while (length < maxLength && source[length] == target[length]) length++;
+
+                if (length > bestLength)
+                {
+                    bestLength = length;
+                    rtDist = pos - candidatePos;
+                    if (length >= param_.niceLength || length == maxLength) break;
+                }
+            }
+
+            candidate = prev_[candidatePos & (WINDOW_SIZE - 1)];
+        }
+
+        return (bestLength >= MIN_MATCH) ? bestLength : 0;
+    }
+};
+
+void WriteStoredBlocks(BitWriter& writer, const u8* data, u32 dataSize, bool isFinal)
+{
+    u32 pos = 0;
+    do
+    {
+        u32 size = min(MAX_STORED_SIZE, dataSize - pos);
+        bool isLast = pos + size >= dataSize;
+
+        writer.write((isFinal && isLast) ? 1 : 0, 1);
+        writer.write(0, 2);
+        writer.alignToByte();
+        writer.write(size, 16);
+        writer.write(~size & 0xffff, 16);
+        if (size != 0) writer.writeBytes(data + pos, size);
+
+        pos += size;
+    } while (pos < dataSize);
+}
+
+// トークン列を動的ハフマンブロックとして書き込む。非圧縮の方が小さい場合は非圧縮ブロックにする
+void WriteBlock(BitWriter& writer, const vector<Token>& tokens, const u8* data, u32 dataSize, bool isFinal)
+{
+    u32 litFreqs[LITLEN_COUNT] = {};
+    u32 distFreqs[DIST_COUNT] = {};
+    u64 extraBits = 0;
+    for (const Token& token : tokens)
+    {
+        if (token.dist == 0)
+        {
+            litFreqs[token.length]++;
+            continue;
+        }
+
+        u32 lengthCode = LENGTH_CODE.code[token.length];
+        u32 distCode = GetDistCode(token.dist);
+        litFreqs[257 + lengthCode]++;
+        distFreqs[distCode]++;
+        extraBits += LENGTH_EXTRA[lengthCode] + DIST_EXTRA[distCode];
+    }
+    litFreqs[END_OF_BLOCK] = 1;
+
+    u8 litLengths[LITLEN_COUNT];
+    u8 distLengths[DIST_COUNT];
+    BuildCodeLengths(litFreqs, LITLEN_COUNT, MAX_BITS, litLengths);
+    BuildCodeLengths(distFreqs, DIST_COUNT, MAX_BITS, distLengths);
+
+    // 距離符号が一つも使われない場合も、一つは符号を定義する
+    if (all_of(distLengths, distLengths + DIST_COUNT, [](u8 len) { return len == 0; })) distLengths[0] = 1;
+
+    u32 litCount = LITLEN_COUNT;
+    while (litCount > 257 && litLengths[litCount - 1] == 0) litCount--;
+    u32 distCount = DIST_COUNT;
+    while (distCount > 1 && distLengths[distCount - 1] == 0) distCount--;
+
+    // 符号長の列を16（直前の繰り返し）、17、18（0の繰り返し）でランレングス符号化する
+    vector<u8> allLengths(litLengths, litLengths + litCount);
+    allLengths.insert(allLengths.end(), distLengths, distLengths + distCount);
+
+    vector<pair<u8, u8>> clenSymbols; // シンボル、追加ビットの値
+    u32 clenFreqs[CLEN_COUNT] = {};
+    for (u32 i = 0; i < allLengths.size();)
+    {
+        u8 len = allLengths[i];
+        u32 run = 1;
+        while (i + run < allLengths.size() && allLengths[i + run] == len) run++;
+
+        if (len == 0 && run >= 3)
+        {
+            u32 count = min(run, 138u);
+            if (count >= 11) clenSymbols.emplace_back(18, static_cast<u8>(count - 11));
+            else clenSymbols.emplace_back(17, static_cast<u8>(count - 3));
+            i += count;
+        }
+        else if (len != 0 && run >= 4)
+        {
+            clenSymbols.emplace_back(len, 0);
+            u32 count = min(run - 1, 6u);
+            clenSymbols.emplace_back(16, static_cast<u8>(count - 3));
+            i += 1 + count;
+        }
+        else
+        {
+            clenSymbols.emplace_back(len, 0);
+            i++;
+        }
+
+        clenFreqs[clenSymbols.back().first]++;
+        if (clenSymbols.size() >= 2 && clenSymbols.back().first == 16) clenFreqs[clenSymbols[clenSymbols.size() - 2].first]++;
+    }
+
+    u8 clenLengths[CLEN_COUNT];
+    BuildCodeLengths(clenFreqs, CLEN_COUNT, MAX_CLEN_BITS, clenLengths);
+
+    u32 clenCount = CLEN_COUNT;
+    while (clenCount > 4 && clenLengths[CLEN_ORDER[clenCount - 1]] == 0) clenCount--;
+
+    // 動的ハフマンブロックのビット数を求め、非圧縮ブロックと比べる
+    u64 dynamicBits = 3 + 5 + 5 + 4 + 3 * clenCount + extraBits;
+    for (u32 i = 0; i < CLEN_COUNT; ++i) dynamicBits += static_cast<u64>(clenFreqs[i]) * clenLengths[i];
+    for (const auto& symbol : clenSymbols)
+    {
+        if (symbol.first == 16) dynamicBits += 2;
+        else if (symbol.first == 17) dynamicBits += 3;
+        else if (symbol.first == 18) dynamicBits += 7;
+    }
+    for (u32 i = 0; i < LITLEN_COUNT; ++i) dynamicBits += static_cast<u64>(litFreqs[i]) * litLengths[i];
+    for (u32 i = 0; i < DIST_COUNT; ++i) dynamicBits += static_cast<u64>(distFreqs[i]) * distLengths[i];
+
+    u64 storedBits = static_cast<u64>(dataSize) * 8 + (dataSize / MAX_STORED_SIZE + 1) * 40;
+    if (storedBits <= dynamicBits)
+    {
+        WriteStoredBlocks(writer, data, dataSize, isFinal);
+        return;
+    }
+
+    u16 litCodes[LITLEN_COUNT] = {};
+    u16 distCodes[DIST_COUNT] = {};
+    u16 clenCodes[CLEN_COUNT] = {};
+    BuildCodes(litLengths, LITLEN_COUNT, litCodes);
+    BuildCodes(distLengths, DIST_COUNT, distCodes);
+    BuildCodes(clenLengths, CLEN_COUNT, clenCodes);
+
+    // ブロックヘッダー
+    writer.write(isFinal ? 1 : 0, 1);
+    writer.write(2, 2); // 動的ハフマン
+    writer.write(litCount - 257, 5);
+    writer.write(distCount - 1, 5);
+    writer.write(clenCount - 4, 4);
+    for (u32 i = 0; i < clenCount; ++i) writer.write(clenLengths[CLEN_ORDER[i]], 3);
+
+    for (const auto& symbol : clenSymbols)
+    {
+        writer.write(clenCodes[symbol.first], clenLengths[symbol.first]);
+        if (symbol.first == 16) writer.write(symbol.second, 2);
+        else if (symbol.first == 17) writer.write(symbol.second, 3);
+        else if (symbol.first == 18) writer.write(symbol.second, 7);
+    }
+
+    // 圧縮データ
+    for (const Token& token : tokens)
+    {
+        if (token.dist == 0)
+        {
+            writer.write(litCodes[token.length], litLengths[token.length]);
+            continue;
+        }
+
+        u32 lengthCode = LENGTH_CODE.code[token.length];
+        writer.write(litCodes[257 + lengthCode], litLengths[257 + lengthCode]);
+        writer.write(token.length - LENGTH_BASE[lengthCode], LENGTH_EXTRA[lengthCode]);
+
+        u32 distCode = GetDistCode(token.dist);
+        writer.write(distCodes[distCode], distLengths[distCode]);
+        writer.write(token.dist - DIST_BASE[distCode], DIST_EXTRA[distCode]);
+    }
+
+    writer.write(litCodes[END_OF_BLOCK], litLengths[END_OF_BLOCK]);
+}
+
+class BitReader
+{
+private:
+    const u8* src_;
+    u32 srcSize_;
+    u32 pos_ = 0;
+    u64 bitBuff_ = 0;
+    u32 bitCount_ = 0;
+    bool overrun_ = false;
+
+public:
+    BitReader(const u8* src, u32 srcSize) : src_(src), srcSize_(srcSize) {}
+
+    void refill()
+    {
+        while (bitCount_ <= 56 && pos_ < srcSize_)
+        {
+            bitBuff_ |= static_cast<u64>(src_[pos_++]) << bitCount_;
+            bitCount_ += 8;
+        }
+    }
+
+    u32 peek() const { return static_cast<u32>(bitBuff_); }
+    u32 getBitCount() const { return bitCount_; }
+    bool isOverrun() const { return overrun_; }
+
+    void consume(u32 count)
+    {
+        bitBuff_ >>= count;
+        bitCount_ -= count;
+    }
+
+    u32 read(u32 count)
+    {
+        if (count == 0) return 0;
+        if (bitCount_ < count)
+        {
+            refill();
+            if (bitCount_ < count)
+            {
+                overrun_ = true;
+                return 0;
+            }
+        }
+
+        u32 bits = static_cast<u32>(bitBuff_ & ((1ull << count) - 1));
+        consume(count);
+        return bits;
+    }
+
+    // バイト境界に揃え、バッファに残っているバイトを入力に戻す
+    void alignToByte()
+    {
+        consume(bitCount_ % 8);
+        pos_ -= bitCount_ / 8;
+        bitBuff_ = 0;
+        bitCount_ = 0;
+    }
+
+    bool readBytes(u8* dst, u32 size)
+    {
+        if (srcSize_ - pos_ < size)
+        {
+            overrun_ = true;
+            return false;
+        }
+
+        memcpy(dst, src_ + pos_, size);
+        pos_ += size;
+        return true;
+    }
+
+    u32 getReadSize() const { return pos_ - bitCount_ / 8; }
+};
+
+constexpr u32 FAST_BITS = 10;
+
+class HuffmanDecoder
+{
+private:
+    u16 fast_[1 << FAST_BITS]; // (シンボル << 4) | 符号長。0の場合はテーブルにない
+    u16 counts_[MAX_BITS + 1];
+    u16 symbols_[288];
+
+public:
+    bool build(const u8* lengths, u32 count)
+    {
+        fill(begin(counts_), end(counts_), 0);
+        for (u32 i = 0; i < count; ++i) counts_[lengths[i]]++;
+        counts_[0] = 0;
+
+        // 符号が多すぎないか確認。足りない場合は許容する
+        s32 left = 1;
+        for (u32 len = 1; len <= MAX_BITS; ++len)
+        {
+            left = (left << 1) - counts_[len];
+            if (left < 0) return false;
+        }
+
+        u16 offsets[MAX_BITS + 2] = {};
+        for (u32 len = 1; len <= MAX_BITS; ++len) offsets[len + 1] = offsets[len] + counts_[len];
+        for (u32 i = 0; i < count; ++i)
+        {
+            if (lengths[i] != 0) symbols_[offsets[lengths[i]]++] = static_cast<u16>(i);
+        }
+
+        // 短い符号は下位ビットから直接引けるテーブルに登録する
+        fill(begin(fast_), end(fast_), 0);
+        u32 code = 0;
+        u32 index = 0;
+        for (u32 len = 1; len <= MAX_BITS; ++len)
+        {
+            for (u32 i = 0; i < counts_[len]; ++i, ++code, ++index)
+            {
+                if (len > FAST_BITS) continue;
+
+                u16 entry = static_cast<u16>((symbols_[index] << 4) | len);
+                for (u32 bits = ReverseBits(code, len); bits < (1u << FAST_BITS); bits += 1u << len) fast_[bits] = entry;
+            }
+            code <<= 1;
+        }
+
+        return true;
+    }
+
+    // シンボルを一つ読み込む。失敗した場合は-1
+    s32 decode(BitReader& reader) const
+    {
+        if (reader.getBitCount() < MAX_BITS) reader.refill();
+
+        u16 entry = fast_[reader.peek() & ((1 << FAST_BITS) - 1)];
+        if (entry != 0 && (entry & 15u) <= reader.getBitCount())
+        {
+            reader.consume(entry & 15u);
+            return entry >> 4;
+        }
+
+        // テーブルにない長い符号は1ビットずつ辿る
+        s32 code = 0;
+        s32 first = 0;
+        s32 index = 0;
+        for (u32 len = 1; len <= MAX_BITS; ++len)
+        {
+            code |= reader.read(1);
+            if (reader.isOverrun()) return -1;
+
+            s32 count = counts_[len];
+            if (code - count < first) return symbols_[index + (code - first)];
+
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+
+        return -1;
+    }
+};
+
+bool InflateCodes
+(
+    BitReader& reader, const HuffmanDecoder& litDecoder, const HuffmanDecoder& distDecoder,
+    u8* dst, u32 dstSize, u32& outPos
+){
+    while (true)
+    {
+        s32 symbol = litDecoder.decode(reader);
+        if (symbol < 0) return false;
+
+        if (symbol < 256)
+        {
+            if (outPos >= dstSize) return false;
+            dst[outPos++] = static_cast<u8>(symbol);
+            continue;
+        }
+
+        if (symbol == END_OF_BLOCK) return true;
+
+        u32 lengthCode = symbol - 257;
+        if (lengthCode >= 29) return false;
+        u32 length = LENGTH_BASE[lengthCode] + reader.read(LENGTH_EXTRA[lengthCode]);
+
+        s32 distCode = distDecoder.decode(reader);
+        if (distCode < 0 || distCode >= static_cast<s32>(DIST_COUNT)) return false;
+        u32 dist = DIST_BASE[distCode] + reader.read(DIST_EXTRA[distCode]);
+
+        if (reader.isOverrun() || dist > outPos || length > dstSize - outPos) return false;
+
+        // 一致が重なる場合があるため1バイトずつコピーする
+        const u8* src = dst + outPos - dist;
+        for (u32 i = 0; i < length; ++i) dst[outPos + i] = src[i];
+        outPos += length;
+    }
+}
+
+bool ReadDynamicTables(BitReader& reader, HuffmanDecoder& litDecoder, HuffmanDecoder& distDecoder)
+{
+    u32 litCount = reader.read(5) + 257;
+    u32 distCount = reader.read(5) + 1;
+    u32 clenCount = reader.read(4) + 4;
+    if (reader.isOverrun() || litCount > LITLEN_COUNT || distCount > DIST_COUNT) return false;
+
+    u8 clenLengths[CLEN_COUNT] = {};
+    for (u32 i = 0; i < clenCount; ++i) clenLengths[CLEN_ORDER[i]] = static_cast<u8>(reader.read(3));
+
+    HuffmanDecoder clenDecoder;
+    if (!clenDecoder.build(clenLengths, CLEN_COUNT)) return false;
+
+    u8 lengths[LITLEN_COUNT + DIST_COUNT] = {};
+    for (u32 i = 0; i < litCount + distCount;)
+    {
+        s32 symbol = clenDecoder.decode(reader);
+        if (symbol < 0) return false;
+
+        if (symbol < 16)
+        {
+            lengths[i++] = static_cast<u8>(symbol);
+            continue;
+        }
+
+        u8 len = 0;
+        u32 repeat = 0;
+        if (symbol == 16)
+        {
+            if (i == 0) return false;
+            len = lengths[i - 1];
+            repeat = 3 + reader.read(2);
+        }
+        else if (symbol == 17) repeat = 3 + reader.read(3);
+        else repeat = 11 + reader.read(7);
+
+        if (reader.isOverrun() || i + repeat > litCount + distCount) return false;
+        while (repeat-- > 0) lengths[i++] = len;
+    }
+
+    if (lengths[END_OF_BLOCK] == 0) return false;
+
+    return litDecoder.build(lengths, litCount) && distDecoder.build(lengths + litCount, distCount);
+}
+
+}
+
+vector<u8> Deflate::Compress(const u8* data, u32 dataSize, DeflateLevel level, bool isFinal)
+{
+    vector<u8> rtData;
+    rtData.reserve(dataSize / 2 + 64);
+
+    BitWriter writer(rtData);
+    LevelParam param = GetLevelParam(level);
+    Matcher matcher(data, dataSize, param);
+
+    vector<Token> tokens;
+    tokens.reserve(BLOCK_INPUT_SIZE);
+
+    u32 pos = 0;
+    while (pos < dataSize)
+    {
+        u32 blockStart = pos;
+        u32 blockEnd = min(dataSize, pos + BLOCK_INPUT_SIZE);
+        tokens.clear();
+
+        while (pos < blockEnd)
+        {
+            u32 dist = 0;
+            u32 length = matcher.find(pos, blockEnd, dist);
+            if (length == 0)
+            {
+                tokens.push_back({data[pos], 0});
+                matcher.insert(pos);
+                pos++;
+                continue;
+            }
+
+            // 遅延一致。次の位置の方が長く一致する場合は、現在の位置をリテラルにする
+            bool isInserted = false;
+            while (param.lazy && length < param.niceLength && pos + 1 < blockEnd)
+            {
+                matcher.insert(pos);
+                isInserted = true;
+
+                u32 nextDist = 0;
+                u32 nextLength = matcher.find(pos + 1, blockEnd, nextDist);
+                if (nextLength <= length) break;
+
+                tokens.push_back({data[pos], 0});
+                pos++;
+                isInserted = false;
+                length = nextLength;
+                dist = nextDist;
+            }
+
+            tokens.push_back({static_cast<u16>(length), static_cast<u16>(dist)});
+            for (u32 i = (isInserted) ? 1 : 0; i < length; ++i) matcher.insert(pos + i);
+            pos += length;
+        }
+
+        WriteBlock(writer, tokens, data + blockStart, blockEnd - blockStart, isFinal && pos >= dataSize);
+    }
+
+    if (dataSize == 0) WriteStoredBlocks(writer, nullptr, 0, isFinal);
+
+    // 続くストリームと連結できるよう、空の非圧縮ブロックでバイト境界に揃える
+    if (!isFinal) WriteStoredBlocks(writer, nullptr, 0, false);
+
+    writer.alignToByte();
+    return rtData;
+}
+
+bool Deflate::Uncompress(const u8* src, u32 srcSize, u8* dst, u32 dstSize, u32& rtReadSize)
+{
+    BitReader reader(src, srcSize);
+    u32 outPos = 0;
+
+    bool isFinal = false;
+    while (!isFinal)
+    {
+        isFinal = reader.read(1) == 1;
+        u32 type = reader.read(2);
+        if (reader.isOverrun()) return false;
+
+        if (type == 0) // 非圧縮
+        {
+            reader.alignToByte();
+            u32 size = reader.read(16);
+            u32 inverted = reader.read(16);
+            if (reader.isOverrun() || size != (~inverted & 0xffff)) return false;
+
+            reader.alignToByte();
+            if (size > dstSize - outPos || !reader.readBytes(dst + outPos, size)) return false;
+            outPos += size;
+        }
+        else if (type == 1) // 固定ハフマン
+        {
+            u8 lengths[288 + DIST_COUNT];
+            fill(lengths, lengths + 144, 8);
+            fill(lengths + 144, lengths + 256, 9);
+            fill(lengths + 256, lengths + 280, 7);
+            fill(lengths + 280, lengths + 288, 8);
+            fill(lengths + 288, lengths + 288 + DIST_COUNT, 5);
+
+            HuffmanDecoder litDecoder;
+            HuffmanDecoder distDecoder;
+            litDecoder.build(lengths, 288);
+            distDecoder.build(lengths + 288, DIST_COUNT);
+
+            if (!InflateCodes(reader, litDecoder, distDecoder, dst, dstSize, outPos)) return false;
+        }
+        else if (type == 2) // 動的ハフマン
+        {
+            HuffmanDecoder litDecoder;
+            HuffmanDecoder distDecoder;
+            if (!ReadDynamicTables(reader, litDecoder, distDecoder)) return false;
+
+            if (!InflateCodes(reader, litDecoder, distDecoder, dst, dstSize, outPos)) return false;
+        }
+        else return false;
+    }
+
+    reader.alignToByte();
+    rtReadSize = reader.getReadSize();
+
+    return outPos == dstSize;
+}
+
+u32 Deflate::Adler32(const u8* data, u32 dataSize, u32 adler)
+{
+    constexpr u32 BASE = 65521;
+    constexpr u32 NMAX = 5552; // 剰余を取らずに加算できる最大のバイト数
+
+    u32 a = adler & 0xffff;
+    u32 b = adler >> 16;
+    while (dataSize > 0)
+    {
+        u32 size = min(dataSize, NMAX);
+        dataSize -= size;
+        while (size-- > 0)
+        {
+            a += *data++;
+            b += a;
+        }
+
+        a %= BASE;
+        b %= BASE;
+    }
+
+    return (b << 16) | a;
+}
+
+u32 Deflate::Adler32Combine(u32 adler1, u32 adler2, u32 dataSize2)
+{
+    constexpr u64 BASE = 65521;
+
+    u64 rem = dataSize2 % BASE;
+    u64 sum1 = adler1 & 0xffff;
+    u64 sum2 = (rem * sum1) % BASE;
+    sum1 += (adler2 & 0xffff) + BASE - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + BASE - rem;
+
+    if (sum1 >= BASE) sum1 -= BASE;
+    if (sum1 >= BASE) sum1 -= BASE;
+    if (sum2 >= (BASE << 1)) sum2 -= (BASE << 1);
+    if (sum2 >= BASE) sum2 -= BASE;
+
+    return static_cast<u32>(sum1 | (sum2 << 16));
+}
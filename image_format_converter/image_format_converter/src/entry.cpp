@@ -2,15 +2,31 @@
 
 #include "converter.h"
 
+#include "batch.h"
+#include "file_io.h"
 #include "format_bmp.h"
 #include "format_tga.h"
 #include "format_dds.h"
+#include "format_png.h"
+#include "image_compare.h"
+#include "parallel.h"
+#include "pixel_layout.h"
+#include "stream_io.h"
+#include "tile_pyramid.h"
+
+#ifdef __linux__
+#include <csignal>
+#include <mutex>
+
+#include "watcher.h"
+#endif
 
 using namespace std;
 
 namespace
 {
 
+#ifdef _WIN32
 string WideCharToMultiByteString(const wstring& wstr) 
 {
     if (wstr.empty()) return std::string();
@@ -19,42 +35,414 @@ string WideCharToMultiByteString(const wstring& wstr)
     WideCharToMultiByte(CP_UTF8, 0, &wstr[0], (int)wstr.size(), &strTo[0], size_needed, NULL, NULL);
     return strTo;
 }
+#endif
 
+void AddObservers(Converter& converter, const QuantizeOption& quantize = {})
+{
+    converter.addObserver("bmp", make_unique<BMP>(quantize));
+    converter.addObserver("tga", make_unique<TGA>(true, quantize)); // 圧縮を使用する
+    converter.addObserver("dds", make_unique<DDS>());
+    converter.addObserver("png", make_unique<PNG>(DeflateLevel::best));
 }
 
-int main(int argc, char* argv[])
+// /c 画像A 画像B [/d 差分画像] [/e]
+// 2つの画像を比較し、一致する場合はSUCCESS、異なる場合はERROR_IMAGES_DIFFERENTを返す
+// /eを指定した場合は一致判定のみ行い、不一致が見つかった時点で打ち切る
+u32 RunCompare(int argc, char* argv[])
 {
-    // 引数の数が合わない場合、エラーを出力して終了
-    if (argc != 5)
+    string heatMapPath;
+    bool isEqualityOnly = false;
+    for (int i = 4; i < argc; ++i)
     {
-        cout << "引数の数が合いません。以下の例のように実行してください。" << endl;
-        cout << "image_format_converter.exe /i ファイルパス /o 出力フォルダ" << endl;
+        if (string(argv[i]) == "/d" && i + 1 < argc) heatMapPath = argv[++i];
+        else if (string(argv[i]) == "/e") isEqualityOnly = true;
+        else
+        {
+            cout << "引数が不正です。以下の例のように実行してください。" << endl;
+            cout << "image_format_converter.exe /c 画像ファイルパス 画像ファイルパス [/d 差分画像ファイルパス] [/e]" << endl;
+            return ERROR_INVALID_ARGUMENTS;
+        }
+    }
+
+    Converter converter;
+    AddObservers(converter);
+
+    unique_ptr<FileData> a = converter.fileAnalysis(argv[2]);
+    if (a == nullptr) return ERROR_FILE_OPERATION;
+
+    unique_ptr<FileData> b = converter.fileAnalysis(argv[3]);
+    if (b == nullptr) return ERROR_FILE_OPERATION;
+
+    bool isEqual = false;
+    if (isEqualityOnly) isEqual = ImageCompare::IsEqual(*a, *b);
+    else
+    {
+        CompareResult result = ImageCompare::Compare(*a, *b);
+        if (!result.isSameSize)
+        {
+            cout << "画像のサイズが異なります。" 
+                 << a->width << "x" << a->height << ", " << b->width << "x" << b->height << endl;
+            return ERROR_IMAGES_DIFFERENT;
+        }
+
+        isEqual = result.isEqual;
+        cout << "max abs error : " << result.maxAbsError << endl;
+        cout << "MSE           : " << result.mse << endl;
+        cout << "PSNR          : " << result.psnr << " dB" << endl;
+        cout << "SSIM          : " << result.ssim << endl;
+    }
+
+    cout << ((isEqual) ? "一致しました。" : "一致しませんでした。") << endl;
 
+    if (!heatMapPath.empty())
+    {
+        unique_ptr<FileData> heatMap = ImageCompare::CreateHeatMap(*a, *b);
+        if (heatMap == nullptr)
+        {
+            cout << "画像のサイズが異なるため、差分画像を作成できません。" << endl;
+            return ERROR_IMAGES_DIFFERENT;
+        }
+
+        u32 result = converter.fileConvert(heatMapPath, heatMap);
+        if (result != SUCCESS) return result;
+    }
+
+    return (isEqual) ? SUCCESS : ERROR_IMAGES_DIFFERENT;
+}
+
+// /array 出力ファイルパス 画像1 画像2 ...
+// /cube 出力ファイルパス +X -X +Y -Y +Z -Zの画像、または /cube 出力ファイルパス 十字の展開図
+// 画像らを並列に解析し、1つのDDS（配列テクスチャ、キューブマップ）として書き出す
+u32 RunTexture(int argc, char* argv[], bool isCubeMap)
+{
+    u32 imageCount = argc - 3;
+    if (isCubeMap && imageCount != 1 && imageCount != DDS_CUBE_FACE_COUNT)
+    {
+        cout << "キューブマップには6枚の画像、または十字の展開図を1枚指定してください。" << endl;
         return ERROR_INVALID_ARGUMENTS;
     }
 
-    // /i、/oがそれぞれ一つずつ指定されているか確認
-    int isArgCorrect = 1;
-    isArgCorrect *= (string(argv[1]) == "/i" && string(argv[3]) == "/i") ? 0 : 1;
-    isArgCorrect *= (string(argv[1]) == "/o" && string(argv[3]) == "/o") ? 0 : 1;
+    Converter converter;
+    AddObservers(converter);
+
+    unique_ptr<DdsTexture> texture = make_unique<DdsTexture>();
+    texture->type = (isCubeMap) ? DdsTextureType::cubeMap : DdsTextureType::textureArray;
+    texture->slices.resize(imageCount);
+
+    Parallel::For(imageCount, [&](u32 index)
+    {
+        texture->slices[index] = converter.fileAnalysis(argv[3 + index]);
+    });
+
+    for (const unique_ptr<FileData>& slice : texture->slices)
+    {
+        if (slice == nullptr) return ERROR_FILE_OPERATION;
+    }
 
-    if (isArgCorrect != 1)
+    DDS dds;
+    if (isCubeMap && imageCount == 1)
     {
-        cout << "引数が不正です。/i、/oを使用し、入力ファイル、出力フォルダを指定してください。" << endl;
+        texture = dds.splitCross(*texture->slices[0]);
+        if (texture == nullptr)
+        {
+            cout << "十字の展開図（4x3または3x4）ではありません。" << endl;
+            return ERROR_INVALID_ARGUMENTS;
+        }
+    }
+
+    u32 dataSize = 0;
+    unique_ptr<u8[]> data = dds.convertTexture(*texture, dataSize);
+    if (data == nullptr)
+    {
+        cout << "画像のサイズが揃っていないため、変換できません。" << endl;
+        return ERROR_CONVERSION_FAILED;
+    }
+
+    return dds.write(argv[2], data.get(), dataSize);
+}
+
+// /i - /o - [/f 出力拡張子]
+// 標準入力から読み込み、標準出力に書き出す。入力の形式は先頭のバイト列から判別し、
+// 出力の形式は/f、出力ファイルの拡張子、入力の形式の順に決める。標準出力を汚さないよう、メッセージは標準エラー出力に出す
+u32 RunStream(const string& importPath, const string& exportPath, string exportExt, const QuantizeOption& quantize)
+{
+    Converter converter;
+    AddObservers(converter, quantize);
+
+    u32 result = SUCCESS;
+    string importExt;
+    unique_ptr<FileData> fileData;
+    if (importPath == "-")
+    {
+        StreamIO::SetBinaryMode(stdin);
+        StreamReader reader(stdin);
+        fileData = StreamIO::Decode(converter, reader, importExt, result);
+    }
+    else
+    {
+        vector<u8> importData;
+        importExt = importPath.substr(importPath.find_last_of('.') + 1);
+        result = FileIO::Load(importPath, importData);
+        if (result == SUCCESS)
+        {
+            fileData = converter.dataAnalysis(importExt, importData.data(), static_cast<u32>(importData.size()), result);
+        }
+    }
+
+    if (fileData == nullptr)
+    {
+        cerr << "入力画像を解析できませんでした。" << endl;
+        return result;
+    }
+
+    if (exportExt.empty()) exportExt = (exportPath == "-") ? importExt : exportPath.substr(exportPath.find_last_of('.') + 1);
+
+    vector<u8> exportData;
+    result = converter.dataConvert(exportExt, *fileData, exportData);
+    if (result != SUCCESS)
+    {
+        cerr << "変換できませんでした。" << endl;
+        return result;
+    }
+
+    if (exportPath == "-")
+    {
+        StreamIO::SetBinaryMode(stdout);
+        result = StreamIO::Write(stdout, exportData.data(), exportData.size());
+    }
+    else result = FileIO::Write(exportPath, exportData.data(), static_cast<u32>(exportData.size()));
+
+    if (result != SUCCESS) cerr << "書き出しに失敗しました。" << endl;
+    return result;
+}
+
+// /tile 入力画像 出力先 拡張子 [/size タイルのサイズ] [/pack]
+// 画像を縮小したレベルらに分け、タイルに切り出して書き出す。/packを指定した場合は出力先を1つのコンテナファイルにする
+u32 RunTile(int argc, char* argv[])
+{
+    TileOption option;
+    option.exportExt = argv[4];
+    for (int i = 5; i < argc; ++i)
+    {
+        if (string(argv[i]) == "/size" && i + 1 < argc) option.tileSize = static_cast<u32>(strtoul(argv[++i], nullptr, 10));
+        else if (string(argv[i]) == "/pack") option.isPacked = true;
+        else
+        {
+            cout << "引数が不正です。以下の例のように実行してください。" << endl;
+            cout << "image_format_converter.exe /tile 画像ファイルパス 出力先 拡張子 [/size タイルのサイズ] [/pack]" << endl;
+            return ERROR_INVALID_ARGUMENTS;
+        }
+    }
+
+    Converter converter;
+    AddObservers(converter);
+
+    unique_ptr<IRowSource> source = TilePyramid::OpenSource(converter, argv[2]);
+    if (source == nullptr) return ERROR_FILE_OPERATION;
+
+    u32 result = TilePyramid::Build(converter, *source, option, argv[3]);
+    if (result == ERROR_INVALID_ARGUMENTS) cout << "タイルのサイズは2の倍数を指定してください。" << endl;
+    else if (result == ERROR_UNSUPPORTED_FORMAT) cout << "変換できるファイル形式が見つかりませんでした。" << endl;
+    else if (result != SUCCESS) cout << "タイルの書き出しに失敗しました。" << endl;
+
+    return result;
+}
+
+// /batch 入力フォルダ 出力フォルダ 出力拡張子 [/report レポートファイル] [/nodedup] [/copy] [/verify]
+// フォルダ内の画像をまとめて変換する。ピクセルが一致する画像は1回だけ変換し、他の出力はハードリンクにする
+u32 RunBatch(int argc, char* argv[])
+{
+    BatchOption option;
+    option.sourceDir = argv[2];
+    option.exportDir = argv[3];
+    option.exportExt = argv[4];
+
+    string reportPath;
+    for (int i = 5; i < argc; ++i)
+    {
+        if (string(argv[i]) == "/report" && i + 1 < argc) reportPath = argv[++i];
+        else if (string(argv[i]) == "/nodedup") option.useDedup = false;
+        else if (string(argv[i]) == "/copy") option.useHardLink = false;
+        else if (string(argv[i]) == "/verify") option.useVerify = true;
+        else
+        {
+            cout << "引数が不正です。以下の例のように実行してください。" << endl;
+            cout << "image_format_converter /batch 入力フォルダ 出力フォルダ 出力拡張子 [/report レポートファイル] [/nodedup] [/copy] [/verify]" << endl;
+            return ERROR_INVALID_ARGUMENTS;
+        }
+    }
+
+    Converter converter;
+    AddObservers(converter);
+
+    if (!converter.isSupported(option.exportExt))
+    {
+        cout << "出力形式に対応していません。" << endl;
+        return ERROR_UNSUPPORTED_FORMAT;
+    }
+
+    vector<BatchEntry> entries = Batch::Run(converter, option);
+
+    u32 result = SUCCESS;
+    u32 convertedCount = 0;
+    u32 duplicateCount = 0;
+    u64 sharedSize = 0;
+    for (const BatchEntry& entry : entries)
+    {
+        if (entry.result != SUCCESS)
+        {
+            cout << "変換に失敗しました：" << entry.sourcePath << endl;
+            if (result == SUCCESS) result = entry.result;
+        }
+        else if (entry.duplicateType == DuplicateType::none) ++convertedCount;
+        else
+        {
+            ++duplicateCount;
+            sharedSize += entry.exportSize;
+        }
+    }
+
+    cout << entries.size() << "件中、" << convertedCount << "件を変換し、" << duplicateCount << "件の重複した画像で";
+    cout << sharedSize << "バイトの出力を共有しました。" << endl;
+
+    if (!reportPath.empty())
+    {
+        string report = Batch::FormatReport(entries);
+        if (FileIO::Write(reportPath, reinterpret_cast<const u8*>(report.data()), static_cast<u32>(report.size())) != SUCCESS)
+        {
+            cout << "レポートを書き出せませんでした。" << endl;
+            if (result == SUCCESS) result = ERROR_FILE_OPERATION;
+        }
+    }
+
+    return result;
+}
+
+#ifdef __linux__
+atomic<bool> gIsWatchStopped = false;
+
+// /watch 監視フォルダ 出力フォルダ 出力拡張子 [/feed フィードファイル] [/debounce ミリ秒]
+// Ctrl+Cで終了するまで監視フォルダを監視し、保存されたファイルを変換する
+// 変換するたびに標準出力とフィードファイルに変更を1行ずつ出力する
+u32 RunWatch(int argc, char* argv[])
+{
+    WatchOption option;
+    option.sourceDir = argv[2];
+    option.exportDir = argv[3];
+    option.exportExt = argv[4];
+
+    string feedPath;
+    for (int i = 5; i < argc; ++i)
+    {
+        if (string(argv[i]) == "/feed" && i + 1 < argc) feedPath = argv[++i];
+        else if (string(argv[i]) == "/debounce" && i + 1 < argc) option.debounceMilliseconds = atoi(argv[++i]);
+        else
+        {
+            cout << "引数が不正です。以下の例のように実行してください。" << endl;
+            cout << "image_format_converter /watch 監視フォルダ 出力フォルダ 出力拡張子 [/feed フィードファイル] [/debounce ミリ秒]" << endl;
+            return ERROR_INVALID_ARGUMENTS;
+        }
+    }
+
+    Converter converter;
+    AddObservers(converter);
+
+    if (!converter.isSupported(option.exportExt))
+    {
+        cout << "出力形式に対応していません。" << endl;
+        return ERROR_UNSUPPORTED_FORMAT;
+    }
+
+    FILE* feed = (feedPath.empty()) ? nullptr : fopen(feedPath.c_str(), "ab");
+    mutex feedMutex;
+
+    Watcher watcher(converter, option, [&](const ChangeEvent& event)
+    {
+        string line = ChangeFeed::Format(event);
+
+        lock_guard<mutex> lock(feedMutex);
+        cout << line << flush;
+        if (feed != nullptr)
+        {
+            fwrite(line.data(), 1, line.size(), feed);
+            fflush(feed);
+        }
+    });
+
+    if (watcher.start() != SUCCESS)
+    {
+        cout << "フォルダを監視できませんでした。" << endl;
+        if (feed != nullptr) fclose(feed);
+        return ERROR_FILE_OPERATION;
+    }
+
+    signal(SIGINT, [](int) { gIsWatchStopped = true; });
+    signal(SIGTERM, [](int) { gIsWatchStopped = true; });
+
+    watcher.run(gIsWatchStopped);
+
+    // 変換中のファイルを書き出し終えてから閉じる
+    while (!watcher.isIdle()) watcher.poll(10);
+    if (feed != nullptr) fclose(feed);
+
+    return SUCCESS;
+}
+#endif
+
+}
+
+int main(int argc, char* argv[])
+{
+    // 比較モード
+    if (argc >= 4 && string(argv[1]) == "/c") return RunCompare(argc, argv);
+
+    // 配列テクスチャ、キューブマップの作成
+    if (argc >= 4 && string(argv[1]) == "/array") return RunTexture(argc, argv, false);
+    if (argc >= 4 && string(argv[1]) == "/cube") return RunTexture(argc, argv, true);
+
+    // タイルピラミッドの作成
+    if (argc >= 5 && string(argv[1]) == "/tile") return RunTile(argc, argv);
+
+    // フォルダ単位の一括変換
+    if (argc >= 5 && string(argv[1]) == "/batch") return RunBatch(argc, argv);
+
+#ifdef __linux__
+    // 監視モード
+    if (argc >= 5 && string(argv[1]) == "/watch") return RunWatch(argc, argv);
+#endif
+
+    // 引数の数が合わない場合、エラーを出力して終了
+    if (argc < 5 || argc % 2 == 0)
+    {
+        cout << "引数の数が合いません。以下の例のように実行してください。" << endl;
+        cout << "image_format_converter.exe /i ファイルパス /o 出力フォルダ [/f 出力拡張子] [/q 色数] [/dither ordered|fs]" << endl;
+
         return ERROR_INVALID_ARGUMENTS;
     }
 
+    // /i、/oがそれぞれ一つずつ指定されているか確認
     string importPath;
     string exportPath;
-    for (int i = 1; i <= 3; i += 2)
+    string exportExt;
+    QuantizeOption quantize;
+    for (int i = 1; i < argc; i += 2)
     {
-        assert(i <= 3);
-
-        if (string(argv[i]) == "/i") importPath = argv[i+1]; // 入力ファイルパスを取得
-        else if (string(argv[i]) == "/o") exportPath = argv[i+1]; // 出力フォルダパスを取得
+        string option = argv[i];
+        string value = argv[i+1];
+        u32 number = static_cast<u32>(strtoul(value.c_str(), nullptr, 10));
+        if (option == "/i" && importPath.empty()) importPath = value; // 入力ファイルパスを取得
+        else if (option == "/o" && exportPath.empty()) exportPath = value; // 出力フォルダパスを取得
+        else if (option == "/f" && exportExt.empty()) exportExt = value; // 出力形式を取得
+        else if (option == "/q" && number >= 2 && number <= MAX_PALETTE_SIZE) quantize.colorCount = number; // 減色後の色数
+        else if (option == "/dither" && value == "ordered") quantize.dither = DitherType::ordered;
+        else if (option == "/dither" && value == "fs") quantize.dither = DitherType::floydSteinberg;
+        else
+        {
+            cout << "引数が不正です。/i、/oを使用し、入力ファイル、出力フォルダを指定してください。" << endl;
+            return ERROR_INVALID_ARGUMENTS;
+        }
     }
 
-
     // 引数が正しく取得できているか確認
     if (importPath.empty() || exportPath.empty())
     {
@@ -62,11 +450,12 @@ int main(int argc, char* argv[])
         return ERROR_FILE_LOAD_FAILED;
     }
 
+    // -や出力形式を指定した場合は、標準入出力に対応した変換を行う
+    if (importPath == "-" || exportPath == "-" || !exportExt.empty()) return RunStream(importPath, exportPath, exportExt, quantize);
+
     // 変換Subjectに変換クラスを登録
     Converter converter;
-    converter.addObserver("bmp", make_unique<BMP>());
-    converter.addObserver("tga", make_unique<TGA>(true)); // 圧縮を使用する
-    converter.addObserver("dds", make_unique<DDS>());
+    AddObservers(converter, quantize);
 
     // ファイルの読み込み、解析を行い、ファイルデータを取得
     unique_ptr<FileData> fileData = converter.fileAnalysis(importPath);
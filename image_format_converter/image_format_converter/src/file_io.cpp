@@ -0,0 +1,87 @@
+﻿#include "pch.h"
+
+#include "file_io.h"
+
+using namespace std;
+
+namespace
+{
+
+FILE* OpenFile(const string& path, const char* mode)
+{
+#ifdef _WIN32
+    FILE* fp = nullptr;
+    if (fopen_s(&fp, path.c_str(), mode) != 0) return nullptr;
+    return fp;
+#else
+    return fopen(path.c_str(), mode);
+#endif
+}
+
+}
+
+unique_ptr<u8[]> FileIO::Load(string_view path, u32& rtSize)
+{
+    // string_viewはnull終端が保証されないため、stringにコピーしてから開く
+    FILE* fp = OpenFile(string(path), "rb");
+    if (fp == nullptr) return nullptr;
+
+    //ファイルの末尾へ移動して、サイズを計算
+    fseek(fp, 0L, SEEK_END);
+    long size = ftell(fp);
+
+    //ファイルの最初に移動
+    fseek(fp, 0L, SEEK_SET);
+
+    if (size < 0)
+    {
+        fclose(fp);
+        return nullptr;
+    }
+
+    unique_ptr<u8[]> rtBuff = make_unique<u8[]>(size);
+
+    //サイズ分のデータを読み込む
+    size_t readSize = fread(rtBuff.get(), 1, size, fp);
+    fclose(fp);
+
+    if (readSize != static_cast<size_t>(size)) return nullptr;
+
+    rtSize = static_cast<u32>(size);
+    return rtBuff;
+}
+
+u32 FileIO::Load(string_view path, vector<u8>& rtData)
+{
+    FILE* fp = OpenFile(string(path), "rb");
+    if (fp == nullptr) return ERROR_FILE_OPERATION;
+
+    fseek(fp, 0L, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0L, SEEK_SET);
+
+    if (size < 0 || static_cast<u64>(size) > UINT32_MAX)
+    {
+        fclose(fp);
+        return ERROR_FILE_OPERATION;
+    }
+
+    rtData.resize(size);
+    size_t readSize = fread(rtData.data(), 1, size, fp);
+    fclose(fp);
+
+    if (readSize != static_cast<size_t>(size)) return ERROR_FILE_OPERATION;
+    return SUCCESS;
+}
+
+u32 FileIO::Write(string_view path, const u8* data, const u32 dataSize)
+{
+    FILE* fp = OpenFile(string(path), "wb");
+    if (fp == nullptr) return ERROR_FILE_OPERATION;
+
+    size_t writtenSize = fwrite(data, sizeof(u8), dataSize, fp);
+    fclose(fp);
+
+    if (writtenSize != dataSize) return ERROR_FILE_OPERATION;
+    return SUCCESS;
+}
@@ -3,68 +3,156 @@
 #include "format_bmp.h"
 
 #include "pixel_flipper.h"
+#include "pixel_layout.h"
 
 using namespace std;
 
-unique_ptr<FileData> BMP::analysis(unique_ptr<u8[]> &importData)
+namespace
 {
-    BmpFileHeader* fileHeader = reinterpret_cast<BmpFileHeader*>(importData.get());
-    BmpInfoHeader* infoHeader = reinterpret_cast<BmpInfoHeader*>(importData.get() + sizeof(BmpFileHeader));
 
-    // BMPファイルであることを確認
-    if (fileHeader->fileType != 0x4d42) return nullptr;
+u32 GetRowSize(s64 width, u16 pixelDepth)
+{
+    return static_cast<u32>((width * pixelDepth / 8 + 3) & ~3ll); // 4バイト境界に揃える
+}
+
+}
+
+unique_ptr<FileData> BMP::analysis(const u8* importData, u32 dataSize) const
+{
+    BmpFileHeader fileHeader;
+    BmpInfoHeader infoHeader;
+    if (!ReadHeader(importData, dataSize, fileHeader, infoHeader)) return nullptr;
+
+    bool isIndexed = infoHeader.pixelDepth == 8;
+    s64 height = infoHeader.height;
+    if (!IsValidImageSize(infoHeader.width, abs(height))) return nullptr;
+
+    // パディングを含めたピクセルデータがファイル内に収まっているか確認
+    u64 rowSize = GetRowSize(infoHeader.width, infoHeader.pixelDepth);
+    if (fileHeader.fileOffBits + rowSize * abs(height) > dataSize) return nullptr;
 
     unique_ptr<FileData> fileData = make_unique<FileData>();
 
-    fileData->width = infoHeader->width;
-    fileData->height = infoHeader->height;
-    u32 size = fileData->width * abs(fileData->height) * 4;
+    fileData->width = infoHeader.width;
+    fileData->height = static_cast<s32>(abs(height));
+    u32 size = fileData->width * fileData->height * 4;
     fileData->pixels = make_unique<u8[]>(size);
 
     // BMPファイルのピクセルデータの格納順を取得
     PixelStorageOrder order;
-    if (fileData->height > 0) order = PixelStorageOrder::bottomLeftToTopRight;
+    if (infoHeader.height > 0) order = PixelStorageOrder::bottomLeftToTopRight;
     else order = PixelStorageOrder::topLeftToBottomRight;
 
     PixelFlipper flipper;
     flipper.getFlipTypeToBLTR(order);
 
-    if (infoHeader->compression == 3 ||infoHeader->compression == 0 )
+    if (isIndexed)
     {
-        flipper.getPixelsFlippedWithPadBGRA
-        (
-            importData, fileHeader->fileOffBits, size, infoHeader->pixelDepth,
-            fileData->pixels, fileData->width, fileData->height
-        );
+        // カラーパレットはインフォヘッダーの直後にBGR0の順に並ぶ。clrUsedが0の場合は256色
+        u32 paletteOffset = sizeof(BmpFileHeader) + infoHeader.size;
+        u32 paletteSize = (infoHeader.clrUsed == 0) ? MAX_PALETTE_SIZE : infoHeader.clrUsed;
+        if (static_cast<u64>(paletteOffset) + paletteSize * 4 > dataSize) return nullptr;
+
+        vector<BGRA> palette(paletteSize);
+        memcpy(palette.data(), importData + paletteOffset, paletteSize * 4);
+        for (BGRA& color : palette) color.a = 0xff;
+
+        // パディングを除いてBGRAに展開してから、格納順を揃える
+        unique_ptr<u8[]> srcPixels = make_unique<u8[]>(size);
+        for (s32 y = 0; y < fileData->height; ++y)
+        {
+            const u8* indices = importData + fileHeader.fileOffBits + rowSize * y;
+            u8* dst = &srcPixels[static_cast<size_t>(y) * fileData->width * 4];
+            if (!Layout::UnpackIndices(indices, fileData->width, palette, dst)) return nullptr;
+        }
+
+        flipper.getPixelsFlippedBGRA(srcPixels.get(), 0, size, 32, fileData->pixels, fileData->width, fileData->height);
+        return fileData;
     }
 
+    flipper.getPixelsFlippedWithPadBGRA
+    (
+        importData, fileHeader.fileOffBits, size, infoHeader.pixelDepth,
+        fileData->pixels, fileData->width, fileData->height
+    );
+
     return fileData;
 }
 
-unique_ptr<u8[]> BMP::convert(unique_ptr<FileData> &fileData, u32 &rtDataSize)
+bool BMP::ReadHeader(const u8* importData, u32 dataSize, BmpFileHeader& rtFileHeader, BmpInfoHeader& rtInfoHeader)
 {
+    if (importData == nullptr || dataSize < sizeof(BmpFileHeader) + sizeof(BmpInfoHeader)) return false;
+
+    memcpy(&rtFileHeader, importData, sizeof(BmpFileHeader));
+    memcpy(&rtInfoHeader, importData + sizeof(BmpFileHeader), sizeof(BmpInfoHeader));
+
+    // BMPファイルであることを確認
+    if (rtFileHeader.fileType != 0x4d42) return false;
+
+    // 非圧縮、BI_BITFIELDSの24、32ビットと、非圧縮の8ビットのカラーパレットのみ対応
+    bool isIndexed = rtInfoHeader.pixelDepth == 8;
+    if (rtInfoHeader.compression != 3 && rtInfoHeader.compression != 0) return false;
+    if (rtInfoHeader.pixelDepth != 24 && rtInfoHeader.pixelDepth != 32 && !isIndexed) return false;
+    if (isIndexed && rtInfoHeader.compression != 0) return false;
+    if (isIndexed && rtInfoHeader.clrUsed > MAX_PALETTE_SIZE) return false;
+
+    // 高さが負の場合は上の行から並ぶ
+    return rtInfoHeader.width > 0 && rtInfoHeader.height != 0 && rtInfoHeader.height != INT32_MIN;
+}
+
+unique_ptr<u8[]> BMP::convert(const FileData &fileData, u32 &rtDataSize) const
+{
+    // 不透明な画像は24ビット、さらに256色以下でより小さくなる場合は8ビットのカラーパレットで書き出す
+    PixelLayout layout = Layout::Analysis(fileData);
+    u16 pixelDepth = 32;
+    if (layout.isOpaque()) pixelDepth = 24;
+
+    // 減色する場合は、量子化したパレットのインデックスを書き出す。8ビットのBMPはアルファを持てないため不透明な画像のみ
+    vector<u8> indices;
+    if 
+    (
+        quantize_.isEnabled() && layout.isOpaque() && 
+        (layout.palette.empty() || layout.palette.size() > quantize_.colorCount)
+    ){
+        layout.palette = Quantizer::CreatePalette(fileData, quantize_.colorCount, quantize_.refineCount);
+        indices = Quantizer::Map(fileData, layout.palette, quantize_.dither);
+    }
+
+    u64 height = fileData.height;
+    if 
+    (
+        layout.isOpaque() && !layout.palette.empty() && 
+        layout.palette.size() * 4 + GetRowSize(fileData.width, 8) * height < GetRowSize(fileData.width, 24) * height
+    ){
+        pixelDepth = 8;
+    }
+
+    u32 paletteSize = (pixelDepth == 8) ? static_cast<u32>(layout.palette.size()) : 0;
+    u32 rowSize = GetRowSize(fileData.width, pixelDepth);
+
     BmpFileHeader fileHeader;
     fileHeader.fileType = 0x4d42; // BM
-    fileHeader.fileSize = sizeof(BmpFileHeader) + sizeof(BmpInfoHeader) + fileData->width * fileData->height * 4;
+    fileHeader.fileOffBits = sizeof(BmpFileHeader) + sizeof(BmpInfoHeader) + paletteSize * 4;
+    fileHeader.fileSize = fileHeader.fileOffBits + rowSize * fileData.height;
     fileHeader.fileReserved1 = 0;
     fileHeader.fileReserved2 = 0;
-    fileHeader.fileOffBits = sizeof(BmpFileHeader) + sizeof(BmpInfoHeader);
 
 	rtDataSize = fileHeader.fileSize;
 
     BmpInfoHeader infoHeader;
     infoHeader.size = sizeof(BmpInfoHeader);
-    infoHeader.width = fileData->width;
-    infoHeader.height = abs(fileData->height); // bottom left to top right
+    infoHeader.width = fileData.width;
+    infoHeader.height = abs(fileData.height); // bottom left to top right
     infoHeader.planes = 1;
-    infoHeader.pixelDepth = 32;
+    infoHeader.pixelDepth = pixelDepth;
     infoHeader.compression = 0;
-    infoHeader.sizeImage = fileData->width * fileData->height * 4;
+    infoHeader.sizeImage = rowSize * fileData.height;
     infoHeader.xDpi = 0;
     infoHeader.yDpi = 0;
-    infoHeader.clrUsed = 0;
+    infoHeader.clrUsed = paletteSize;
     infoHeader.clrImportant = 0;
 
+    // パディングを0にするため値初期化する
     unique_ptr<u8[]> rtBuff = make_unique<u8[]>(rtDataSize);
 
     // ヘッダー情報を書き込む
@@ -79,14 +167,24 @@ unique_ptr<u8[]> BMP::convert(unique_ptr<FileData> &fileData, u32 &rtDataSize)
         rtBuff[sizeof(BmpFileHeader) + i] = reinterpret_cast<u8*>(&infoHeader)[i];
     }
 
+    // カラーパレットを書き込む。予約領域は0にする
+    u8* palette = &rtBuff[sizeof(BmpFileHeader) + sizeof(BmpInfoHeader)];
+    for (u32 i = 0; i < paletteSize; ++i)
+    {
+        palette[i * 4] = layout.palette[i].b;
+        palette[i * 4 + 1] = layout.palette[i].g;
+        palette[i * 4 + 2] = layout.palette[i].r;
+    }
+
     // ピクセルデータを書き込む
-    for (u32 i = 0; i < infoHeader.sizeImage; i += 4)
+    ColorTable table(layout.palette);
+    for (s32 y = 0; y < fileData.height; ++y)
 	{
-		rtBuff[fileHeader.fileOffBits + i] = fileData->pixels[i];
-		rtBuff[fileHeader.fileOffBits + i + 1] = fileData->pixels[i + 1];
-		rtBuff[fileHeader.fileOffBits + i + 2] = fileData->pixels[i + 2];
-		rtBuff[fileHeader.fileOffBits + i + 3] = fileData->pixels[i + 3];
+        u8* row = &rtBuff[fileHeader.fileOffBits + static_cast<size_t>(rowSize) * y];
+        if (pixelDepth == 8 && !indices.empty()) memcpy(row, &indices[static_cast<size_t>(fileData.width) * y], fileData.width);
+        else if (pixelDepth == 8) Layout::PackRowIndices(fileData, y, table, row);
+        else Layout::PackRow(fileData, y, pixelDepth / 8, row);
 	}
 
     return rtBuff;
-}
\ No newline at end of file
+}
@@ -1,68 +1,173 @@
 ﻿#include "pch.h"
 
 #include "format_dds.h"
+#include "parallel.h"
 #include "pixel_flipper.h"
 
 using namespace std;
 
-unique_ptr<FileData> DDS::analysis(unique_ptr<u8[]> &importData)
+namespace
 {
-    u32 magic = *reinterpret_cast<u32*>(importData.get());
-    if (magic != 0x20534444)
-    {
-        cout << "DDSファイルのマジックナンバーが不正です。" << endl;
-        return nullptr;
-    }
 
-    DdsHeader* header = reinterpret_cast<DdsHeader*>(importData.get() + sizeof(u32));
+constexpr u32 DDS_HEADER_SIZE = sizeof(u32) + sizeof(DdsHeader) + sizeof(DdsHeaderDx10);
+constexpr u32 DDSD_MIPMAPCOUNT = 0x00020000;
+constexpr u32 DDSCAPS_COMPLEX = 0x00000008;
+constexpr u32 DDSCAPS2_CUBEMAP_ALLFACES = 0x0000fe00; // DDSCAPS2_CUBEMAPと6面全てのフラグ
 
-    unique_ptr<FileData> fileData = make_unique<FileData>();
+// ファイル内のスライスの並び
+struct DdsLayout
+{
+    u32 width = 0;
+    u32 height = 0;
+    DdsTextureType type = DdsTextureType::texture2D;
+    u32 sliceCount = 0;
+    u32 sliceStride = 0; // ミップマップを含めた1スライスのバイト数
+};
 
-    fileData->width = header->width;
-    fileData->height = header->height;
+// ヘッダーを読み込み、全てのスライスがデータに収まるか確認する
+bool ReadLayout(const u8* importData, u32 dataSize, DdsLayout& rtLayout)
+{
+    if (dataSize < DDS_HEADER_SIZE) return false;
 
-    u32 imageSize = fileData->width * fileData->height * 4;
-    fileData->pixels = make_unique<u8[]>(imageSize);
+    // DDSファイルのマジックナンバーを確認
+    u32 magic = *reinterpret_cast<const u32*>(importData);
+    if (magic != DDS_MAGIC) return false;
+
+    const DdsHeader* header = reinterpret_cast<const DdsHeader*>(importData + sizeof(u32));
+
+    // DDSファイルはDX10ヘッダーが存在するもののみ対応
+    if (header->ddspf.fourCC != DDS_FOURCC_DX10) return false;
 
-    u32 dataOffset = sizeof(u32) + sizeof(DdsHeader);
-    if (header->ddspf.fourCC = 0x30315844) dataOffset += sizeof(DdsHeaderDx10); // DDS_HEADER_DX10が存在する
-    else
+    const DdsHeaderDx10* headerDx10 = reinterpret_cast<const DdsHeaderDx10*>(importData + sizeof(u32) + sizeof(DdsHeader));
+
+    // DXGI_FORMAT_R8G8B8A8_UNORM_SRGB以外のフォーマットは対応していない
+    if (headerDx10->dxgiFormat != DDS_DXGI_FORMAT_R8G8B8A8_UNORM_SRGB) return false;
+    if (headerDx10->resourceDimension != DDS_RESOURCE_DIMENSION_TEXTURE2D) return false;
+
+    if (!IsValidImageSize(header->width, header->height)) return false;
+
+    rtLayout.width = header->width;
+    rtLayout.height = header->height;
+
+    // 配列テクスチャ、キューブマップの要素数
+    u64 sliceCount = max(1u, headerDx10->arraySize);
+    if ((headerDx10->miscFlag & DDS_MISC_TEXTURECUBE) != 0)
     {
-        cout << "DX10ヘッダーが存在しません。DDSファイルはDX10でのみ対応しています。" << endl;
-        return nullptr;
+        rtLayout.type = DdsTextureType::cubeMap;
+        sliceCount *= DDS_CUBE_FACE_COUNT;
     }
-    
-    DdsHeaderDx10* headerDx10 = reinterpret_cast<DdsHeaderDx10*>(importData.get() + sizeof(u32) + sizeof(DdsHeader));
-    if (headerDx10->dxgiFormat != DXGI_FORMAT_R8G8B8A8_UNORM_SRGB)
+    else if (sliceCount > 1) rtLayout.type = DdsTextureType::textureArray;
+
+    // 各スライスはミップマップを全て含んで並ぶため、2番目以降のレベルは読み飛ばす
+    u32 mipCount = ((header->flags & DDSD_MIPMAPCOUNT) != 0) ? max(1u, header->mipMapCount) : 1;
+    if (mipCount > 32) return false;
+
+    // 幅、高さはIsValidImageSizeで確認済みのため各レベルのバイト数はu32に収まる。
+    // 合計はデータの残りを超えた時点で打ち切り、スライス数との積も桁あふれしないよう割り算で比べる
+    u64 pixelDataSize = dataSize - DDS_HEADER_SIZE;
+    u64 sliceStride = 0;
+    for (u32 mip = 0; mip < mipCount; ++mip)
     {
-        cout << "DXGI_FORMAT_R8G8B8A8_UNORM_SRGB以外のフォーマットは対応していません。" << endl;
-        return nullptr;
+        sliceStride += static_cast<u64>(max(1u, rtLayout.width >> mip)) * max(1u, rtLayout.height >> mip) * 4;
+        if (sliceStride > pixelDataSize) return false;
     }
 
+    if (sliceCount > pixelDataSize / sliceStride) return false;
+
+    rtLayout.sliceCount = static_cast<u32>(sliceCount);
+    rtLayout.sliceStride = static_cast<u32>(sliceStride);
+    return true;
+}
+
+unique_ptr<FileData> ReadSlice(const u8* importData, const DdsLayout& layout, u32 sliceIndex)
+{
+    unique_ptr<FileData> fileData = make_unique<FileData>();
+
+    fileData->width = layout.width;
+    fileData->height = layout.height;
+
+    u32 imageSize = fileData->width * fileData->height * 4;
+    fileData->pixels = make_unique<u8[]>(imageSize);
+
     PixelFlipper flipper;
     flipper.getFlipTypeToBLTR(PixelStorageOrder::topLeftToBottomRight); // ddsは左上から右下に並んでいる
 
+    u32 dataOffset = DDS_HEADER_SIZE + layout.sliceStride * sliceIndex;
     flipper.getPixelsFlippedRGBA(importData, dataOffset, imageSize, 32, fileData->pixels, fileData->width, fileData->height);
 
     return fileData;
 }
 
-unique_ptr<u8[]> DDS::convert(unique_ptr<FileData> &fileData, u32 &rtDataSize)
+}
+
+unique_ptr<FileData> DDS::analysis(const u8* importData, u32 dataSize) const
+{
+    DdsLayout layout;
+    if (!ReadLayout(importData, dataSize, layout)) return nullptr;
+
+    return ReadSlice(importData, layout, 0);
+}
+
+unique_ptr<u8[]> DDS::convert(const FileData &fileData, u32 &rtDataSize) const
+{
+    return convertSlices({&fileData}, DdsTextureType::texture2D, rtDataSize);
+}
+
+unique_ptr<DdsTexture> DDS::analysisTexture(const u8* importData, u32 dataSize) const
 {
-    u32 magic = 0x20534444;
+    DdsLayout layout;
+    if (!ReadLayout(importData, dataSize, layout)) return nullptr;
+
+    unique_ptr<DdsTexture> texture = make_unique<DdsTexture>();
+    texture->type = layout.type;
+    texture->slices.resize(layout.sliceCount);
+
+    Parallel::For(layout.sliceCount, [&](u32 index)
+    {
+        texture->slices[index] = ReadSlice(importData, layout, index);
+    });
+
+    return texture;
+}
+
+unique_ptr<u8[]> DDS::convertTexture(const DdsTexture& texture, u32& rtDataSize) const
+{
+    if (texture.slices.empty()) return nullptr;
+
+    vector<const FileData*> slices;
+    for (const unique_ptr<FileData>& slice : texture.slices)
+    {
+        if (slice == nullptr || slice->pixels == nullptr) return nullptr;
+        if (slice->width != texture.slices[0]->width || slice->height != texture.slices[0]->height) return nullptr;
+
+        slices.push_back(slice.get());
+    }
+
+    if (texture.type == DdsTextureType::cubeMap && slices.size() % DDS_CUBE_FACE_COUNT != 0) return nullptr;
+
+    return convertSlices(slices, texture.type, rtDataSize);
+}
+
+unique_ptr<u8[]> DDS::convertSlices
+(
+    const vector<const FileData*>& slices, DdsTextureType type, u32& rtDataSize
+) const {
+    const FileData& first = *slices[0];
+    u32 magic = DDS_MAGIC;
 
     DdsHeader header;
     header.size = sizeof(DdsHeader);
     header.flags = 0x00021007; // DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT
-    header.height = fileData->height;
-    header.width = fileData->width;
+    header.height = first.height;
+    header.width = first.width;
     header.pitchOrLinearSize = 0;
     header.depth = 0;
     header.mipMapCount = 0;
+    memset(header.reserved1, 0, sizeof(header.reserved1));
 
     header.ddspf.size = sizeof(DdsPixelFormat);
     header.ddspf.flags = 0x00000004;  // DDPF_FOURCC
-    header.ddspf.fourCC = 0x30315844; // DX10
+    header.ddspf.fourCC = DDS_FOURCC_DX10;
     header.ddspf.RGBBitCount = 0;
     header.ddspf.RBitMask = 0;
     header.ddspf.GBitMask = 0;
@@ -76,37 +181,98 @@ unique_ptr<u8[]> DDS::convert(unique_ptr<FileData> &fileData, u32 &rtDataSize)
     header.reserved2 = 0;
 
     DdsHeaderDx10 headerDx10;
-    headerDx10.dxgiFormat = DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;
-    headerDx10.resourceDimension = D3D10_RESOURCE_DIMENSION_TEXTURE2D;
+    headerDx10.dxgiFormat = DDS_DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;
+    headerDx10.resourceDimension = DDS_RESOURCE_DIMENSION_TEXTURE2D;
     headerDx10.miscFlag = 0;
-    headerDx10.arraySize = 1;
+    headerDx10.arraySize = static_cast<u32>(slices.size());
     headerDx10.reserved = 0;
 
-    u32 imageSize = fileData->width * fileData->height * 4;
-    rtDataSize = sizeof(u32) + sizeof(DdsHeader) + sizeof(DdsHeaderDx10) + imageSize;
+    if (type == DdsTextureType::cubeMap)
+    {
+        header.caps |= DDSCAPS_COMPLEX;
+        header.caps2 = DDSCAPS2_CUBEMAP_ALLFACES;
+        headerDx10.miscFlag = DDS_MISC_TEXTURECUBE;
+        headerDx10.arraySize = static_cast<u32>(slices.size() / DDS_CUBE_FACE_COUNT); // キューブの数
+    }
+    else if (slices.size() > 1) header.caps |= DDSCAPS_COMPLEX;
+
+    u64 imageSize = static_cast<u64>(first.width) * first.height * 4;
+    u64 dataSize = DDS_HEADER_SIZE + imageSize * slices.size();
+    if (dataSize > UINT32_MAX) return nullptr;
 
+    rtDataSize = static_cast<u32>(dataSize);
     unique_ptr<u8[]> rtBuff = make_unique<u8[]>(rtDataSize);
 
-    // マジックナンバーを書き込む
-    for (size_t i = 0; i < sizeof(u32); ++i) rtBuff[i] = reinterpret_cast<u8*>(&magic)[i];
+    // マジックナンバー、ヘッダー情報を書き込む
+    memcpy(&rtBuff[0], &magic, sizeof(u32));
+    memcpy(&rtBuff[sizeof(u32)], &header, sizeof(DdsHeader));
+    memcpy(&rtBuff[sizeof(u32) + sizeof(DdsHeader)], &headerDx10, sizeof(DdsHeaderDx10));
+
+    // ピクセル格納順が合うよう反転させ、BGRAをRGBAに変換して各スライスの位置に書き込む
+    Parallel::For(static_cast<u32>(slices.size()), [&](u32 index)
+    {
+        PixelFlipper flipper;
+        flipper.getFlipTypeToTLBR(PixelStorageOrder::bottomLeftToTopRight); // FileDataは左下から右上に並んでいる
+
+        u32 dataOffset = DDS_HEADER_SIZE + static_cast<u32>(imageSize) * index;
+        flipper.insertPixelsFlippedRGBA(rtBuff, dataOffset, slices[index]->pixels, first.width, first.height);
+    });
+
+    return rtBuff;
+}
+
+unique_ptr<DdsTexture> DDS::splitCross(const FileData& cross) const
+{
+    // 展開図での各面の位置（列、上から数えた行）。+X、-X、+Y、-Y、+Z、-Zの順
+    struct FacePosition
+    {
+        u32 column;
+        u32 row;
+    };
+    const FacePosition HORIZONTAL[DDS_CUBE_FACE_COUNT] = {{2, 1}, {0, 1}, {1, 0}, {1, 2}, {1, 1}, {3, 1}};
+    const FacePosition VERTICAL[DDS_CUBE_FACE_COUNT] = {{2, 1}, {0, 1}, {1, 0}, {1, 2}, {1, 1}, {1, 3}};
+
+    bool isHorizontal = cross.width * 3 == cross.height * 4;
+    bool isVertical = cross.width * 4 == cross.height * 3;
+    if (cross.pixels == nullptr || (!isHorizontal && !isVertical)) return nullptr;
 
-    // ヘッダー情報を書き込む
-    for (size_t i = 0; i < sizeof(DdsHeader); ++i) rtBuff[sizeof(u32) + i] = reinterpret_cast<u8*>(&header)[i];
+    u32 faceSize = (isHorizontal) ? cross.width / 4 : cross.width / 3;
+    u32 rowCount = (isHorizontal) ? 3 : 4;
+    if (faceSize == 0) return nullptr;
 
-    // DX10ヘッダー情報を書き込む
-    for (size_t i = 0; i < sizeof(DdsHeaderDx10); ++i)
+    unique_ptr<DdsTexture> texture = make_unique<DdsTexture>();
+    texture->type = DdsTextureType::cubeMap;
+    texture->slices.resize(DDS_CUBE_FACE_COUNT);
+
+    Parallel::For(DDS_CUBE_FACE_COUNT, [&](u32 face)
     {
-        rtBuff[sizeof(u32) + sizeof(DdsHeader) + i] = reinterpret_cast<u8*>(&headerDx10)[i];
-    }
+        FacePosition position = (isHorizontal) ? HORIZONTAL[face] : VERTICAL[face];
+        bool isRotated = !isHorizontal && face == 5;
 
-    PixelFlipper flipper;
-    flipper.getFlipTypeToTLBR(PixelStorageOrder::bottomLeftToTopRight); // FileDataは左下から右上に並んでいる
+        unique_ptr<FileData> fileData = make_unique<FileData>();
+        fileData->width = faceSize;
+        fileData->height = faceSize;
+        fileData->pixels = make_unique<u8[]>(faceSize * faceSize * 4);
 
-    u32 dataOffset = sizeof(u32) + sizeof(DdsHeader) + sizeof(DdsHeaderDx10);
+        // FileDataは下の行から並ぶため、上から数えた行を下から数えた位置に直す
+        u32 startX = position.column * faceSize;
+        u32 startY = (rowCount - 1 - position.row) * faceSize;
+        for (u32 y = 0; y < faceSize; ++y)
+        {
+            for (u32 x = 0; x < faceSize; ++x)
+            {
+                u32 srcX = startX + ((isRotated) ? faceSize - 1 - x : x);
+                u32 srcY = startY + ((isRotated) ? faceSize - 1 - y : y);
+                memcpy
+                (
+                    &fileData->pixels[(y * faceSize + x) * 4], 
+                    &cross.pixels[(static_cast<size_t>(srcY) * cross.width + srcX) * 4], 4
+                );
+            }
+        }
 
-    // ピクセル格納順が合うよう反転させ、BGRAをRGBAに変換して書き込む
-    flipper.insertPixelsFlippedRGBA(rtBuff, dataOffset, fileData->pixels, fileData->width, fileData->height);
+        texture->slices[face] = move(fileData);
+    });
 
-    return rtBuff;
+    return texture;
 }
-    
\ No newline at end of file
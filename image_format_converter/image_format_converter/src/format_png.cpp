@@ -0,0 +1,537 @@
+﻿#include "pch.h"
+
+#include "format_png.h"
+
+#include "parallel.h"
+#include "pixel_layout.h"
+
+using namespace std;
+
+namespace
+{
+
+constexpr u32 ROW_GROUP_SIZE = 1 << 18; // 並列に圧縮する行グループの目安のバイト数
+constexpr u32 MAX_IDAT_SIZE = 1 << 20; // 1つのIDATチャンクに書き込む最大のバイト数
+
+struct Crc32Table
+{
+    u32 values[256];
+
+    Crc32Table()
+    {
+        for (u32 i = 0; i < 256; ++i)
+        {
+            u32 crc = i;
+            for (u32 bit = 0; bit < 8; ++bit) crc = (crc & 1) ? 0xedb88320u ^ (crc >> 1) : crc >> 1;
+            values[i] = crc;
+        }
+    }
+};
+const Crc32Table CRC32_TABLE;
+
+u32 Crc32(const u8* data, u32 dataSize, u32 crc = 0)
+{
+    crc = ~crc;
+    for (u32 i = 0; i < dataSize; ++i) crc = CRC32_TABLE.values[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+u32 ReadBigEndian(const u8* src)
+{
+    return (static_cast<u32>(src[0]) << 24) | (static_cast<u32>(src[1]) << 16) | (src[2] << 8) | src[3];
+}
+
+void WriteBigEndian(vector<u8>& out, u32 value)
+{
+    out.push_back(static_cast<u8>(value >> 24));
+    out.push_back(static_cast<u8>(value >> 16));
+    out.push_back(static_cast<u8>(value >> 8));
+    out.push_back(static_cast<u8>(value));
+}
+
+void WriteChunk(vector<u8>& out, const char* type, const u8* data, u32 dataSize)
+{
+    WriteBigEndian(out, dataSize);
+
+    size_t typeOffset = out.size();
+    out.insert(out.end(), type, type + 4);
+    if (dataSize != 0) out.insert(out.end(), data, data + dataSize);
+
+    WriteBigEndian(out, Crc32(out.data() + typeOffset, dataSize + 4));
+}
+
+u32 GetChannelCount(u8 colorType)
+{
+    switch (colorType)
+    {
+    case 0: return 1; // グレースケール
+    case 2: return 3; // RGB
+    case 3: return 1; // パレット
+    case 4: return 2; // グレースケール + アルファ
+    case 6: return 4; // RGBA
+    default: return 0;
+    }
+}
+
+u8 PaethPredictor(u8 a, u8 b, u8 c)
+{
+    s32 p = static_cast<s32>(a) + b - c;
+    s32 pa = abs(p - a);
+    s32 pb = abs(p - b);
+    s32 pc = abs(p - c);
+
+    if (pa <= pb && pa <= pc) return a;
+    if (pb <= pc) return b;
+    return c;
+}
+
+// 1行分のフィルタを適用する。prevが先頭行の場合は0の行を渡す
+void ApplyFilter(PngFilterType type, const u8* row, const u8* prev, u32 rowSize, u32 bpp, u8* dst)
+{
+    for (u32 i = 0; i < rowSize; ++i)
+    {
+        u8 a = (i >= bpp) ? row[i - bpp] : 0;
+        u8 b = prev[i];
+        u8 c = (i >= bpp) ? prev[i - bpp] : 0;
+
+        u8 predicted = 0;
+        switch (type)
+        {
+        case PNG_FILTER_NONE: predicted = 0; break;
+        case PNG_FILTER_SUB: predicted = a; break;
+        case PNG_FILTER_UP: predicted = b; break;
+        case PNG_FILTER_AVERAGE: predicted = static_cast<u8>((a + b) / 2); break;
+        case PNG_FILTER_PAETH: predicted = PaethPredictor(a, b, c); break;
+        }
+
+        dst[i] = static_cast<u8>(row[i] - predicted);
+    }
+}
+
+// フィルタを戻す。rowにはフィルタ適用後のデータを渡し、その場で元に戻す
+bool RemoveFilter(u8 type, u8* row, const u8* prev, u32 rowSize, u32 bpp)
+{
+    switch (type)
+    {
+    case PNG_FILTER_NONE:
+        break;
+
+    case PNG_FILTER_SUB:
+        for (u32 i = bpp; i < rowSize; ++i) row[i] += row[i - bpp];
+        break;
+
+    case PNG_FILTER_UP:
+        for (u32 i = 0; i < rowSize; ++i) row[i] += prev[i];
+        break;
+
+    case PNG_FILTER_AVERAGE:
+        for (u32 i = 0; i < rowSize; ++i)
+        {
+            u8 a = (i >= bpp) ? row[i - bpp] : 0;
+            row[i] += static_cast<u8>((a + prev[i]) / 2);
+        }
+        break;
+
+    case PNG_FILTER_PAETH:
+        for (u32 i = 0; i < rowSize; ++i)
+        {
+            u8 a = (i >= bpp) ? row[i - bpp] : 0;
+            u8 c = (i >= bpp) ? prev[i - bpp] : 0;
+            row[i] += PaethPredictor(a, prev[i], c);
+        }
+        break;
+
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+// 残差を符号付きとみなした絶対値の合計。小さいほど圧縮しやすい
+u64 SumAbsResidual(const u8* data, u32 dataSize)
+{
+    u64 sum = 0;
+    for (u32 i = 0; i < dataSize; ++i) sum += abs(static_cast<s32>(static_cast<s8>(data[i])));
+    return sum;
+}
+
+// FileDataのy行目（上から数える）をカラータイプの並びで取り出す
+void GetRow(const FileData& fileData, u32 y, u8 colorType, const ColorTable& table, u8* dst)
+{
+    u32 srcY = fileData.height - 1 - y;
+    const u8* src = &fileData.pixels[static_cast<size_t>(srcY) * fileData.width * 4];
+    switch (colorType)
+    {
+    case 0:
+        Layout::PackRow(fileData, srcY, 1, dst);
+        break;
+
+    case 2:
+        for (s32 x = 0; x < fileData.width; ++x)
+        {
+            dst[x * 3 + 0] = src[x * 4 + 2];
+            dst[x * 3 + 1] = src[x * 4 + 1];
+            dst[x * 3 + 2] = src[x * 4 + 0];
+        }
+        break;
+
+    case 3:
+        Layout::PackRowIndices(fileData, srcY, table, dst);
+        break;
+
+    case 4:
+        for (s32 x = 0; x < fileData.width; ++x)
+        {
+            dst[x * 2 + 0] = src[x * 4 + 0];
+            dst[x * 2 + 1] = src[x * 4 + 3];
+        }
+        break;
+
+    case 6:
+        for (s32 x = 0; x < fileData.width; ++x)
+        {
+            dst[x * 4 + 0] = src[x * 4 + 2];
+            dst[x * 4 + 1] = src[x * 4 + 1];
+            dst[x * 4 + 2] = src[x * 4 + 0];
+            dst[x * 4 + 3] = src[x * 4 + 3];
+        }
+        break;
+    }
+}
+
+// 画像を表せる最も小さいカラータイプを選ぶ
+u8 GetColorType(const PixelLayout& layout, u32 pixelCount)
+{
+    if (layout.isOpaque() && layout.isGray) return 0;
+
+    u32 trueColorBytes = (layout.isGray) ? 2 : (layout.isOpaque()) ? 3 : 4;
+    if 
+    (
+        !layout.palette.empty() && 
+        layout.palette.size() * 4 + pixelCount < static_cast<u64>(pixelCount) * trueColorBytes
+    ){
+        return 3;
+    }
+
+    if (layout.isGray) return 4;
+    return (layout.isOpaque()) ? 2 : 6;
+}
+
+}
+
+unique_ptr<FileData> PNG::analysis(const u8* importData, u32 dataSize) const
+{
+    constexpr u32 SIGNATURE_SIZE = sizeof(PNG_SIGNATURE);
+    if (dataSize < SIGNATURE_SIZE || memcmp(importData, PNG_SIGNATURE, SIGNATURE_SIZE) != 0) return nullptr;
+
+    // チャンクを順に読み込み、IDATチャンクのデータを連結する
+    PngImageHeader header = {};
+    vector<RGBA> palette;
+    bool hasHeader = false;
+    bool hasEnd = false;
+    vector<u8> zlibData;
+
+    u32 offset = SIGNATURE_SIZE;
+    while (!hasEnd)
+    {
+        if (dataSize - offset < 12) return nullptr;
+
+        u32 chunkSize = ReadBigEndian(importData + offset);
+        const u8* type = importData + offset + 4;
+        const u8* chunkData = type + 4;
+        if (chunkSize > dataSize - offset - 12) return nullptr;
+
+        u32 crc = ReadBigEndian(chunkData + chunkSize);
+        if (Crc32(type, chunkSize + 4) != crc) return nullptr;
+
+        if (memcmp(type, "IHDR", 4) == 0)
+        {
+            if (hasHeader || chunkSize != sizeof(PngImageHeader)) return nullptr;
+            memcpy(&header, chunkData, sizeof(PngImageHeader));
+            hasHeader = true;
+        }
+        else if (!hasHeader) return nullptr; // IHDRは先頭のチャンクでなければならない
+        else if (memcmp(type, "IDAT", 4) == 0) zlibData.insert(zlibData.end(), chunkData, chunkData + chunkSize);
+        else if (memcmp(type, "PLTE", 4) == 0)
+        {
+            if (!palette.empty() || chunkSize % 3 != 0 || chunkSize / 3 > MAX_PALETTE_SIZE) return nullptr;
+
+            palette.resize(chunkSize / 3);
+            for (u32 i = 0; i < palette.size(); ++i)
+            {
+                palette[i] = {chunkData[i * 3], chunkData[i * 3 + 1], chunkData[i * 3 + 2], 0xff};
+            }
+        }
+        else if (memcmp(type, "tRNS", 4) == 0 && header.colorType == 3)
+        {
+            // パレットの先頭から順にアルファを並べる。省略された色は不透明
+            if (chunkSize > palette.size()) return nullptr;
+            for (u32 i = 0; i < chunkSize; ++i) palette[i].a = chunkData[i];
+        }
+        else if (memcmp(type, "IEND", 4) == 0) hasEnd = true;
+        else if ((type[0] & 0x20) == 0) return nullptr; // 未対応の必須チャンク
+
+        offset += chunkSize + 12;
+    }
+
+    s64 width = ReadBigEndian(reinterpret_cast<const u8*>(&header.width));
+    s64 height = ReadBigEndian(reinterpret_cast<const u8*>(&header.height));
+
+    // 8ビット、非インターレースのグレースケール、RGB、パレット、グレースケール + アルファ、RGBAのみ対応
+    if (header.bitDepth != 8 || GetChannelCount(header.colorType) == 0) return nullptr;
+    if (header.colorType == 3 && palette.empty()) return nullptr;
+    if (header.compression != 0 || header.filter != 0 || header.interlace != 0) return nullptr;
+    if (!IsValidImageSize(width, height)) return nullptr;
+
+    unique_ptr<FileData> fileData = make_unique<FileData>();
+    fileData->width = static_cast<s32>(width);
+    fileData->height = static_cast<s32>(height);
+
+    unique_ptr<u8[]> rgbaPixels = uncompress
+    (
+        zlibData.data(), static_cast<u32>(zlibData.size()), fileData->width, fileData->height, 
+        header.colorType, palette
+    );
+    if (rgbaPixels == nullptr) return nullptr;
+
+    // 左上から右下に並んだRGBAを、左下から右上に並んだBGRAにする
+    u32 rowSize = fileData->width * 4;
+    fileData->pixels = make_unique<u8[]>(static_cast<size_t>(rowSize) * fileData->height);
+    for (s32 y = 0; y < fileData->height; ++y)
+    {
+        const u8* src = &rgbaPixels[static_cast<size_t>(y) * rowSize];
+        u8* dst = &fileData->pixels[static_cast<size_t>(fileData->height - 1 - y) * rowSize];
+        for (u32 i = 0; i < rowSize; i += 4)
+        {
+            dst[i + 0] = src[i + 2];
+            dst[i + 1] = src[i + 1];
+            dst[i + 2] = src[i + 0];
+            dst[i + 3] = src[i + 3];
+        }
+    }
+
+    return fileData;
+}
+
+unique_ptr<u8[]> PNG::convert(const FileData& fileData, u32& rtDataSize) const
+{
+    PixelLayout layout = Layout::Analysis(fileData);
+    u8 colorType = GetColorType(layout, fileData.width * fileData.height);
+    vector<u8> zlibData = compress(fileData, colorType, layout.palette);
+
+    vector<u8> headerData;
+    WriteBigEndian(headerData, fileData.width);
+    WriteBigEndian(headerData, fileData.height);
+    headerData.push_back(8); // ビット深度
+    headerData.push_back(colorType);
+    headerData.push_back(0); // 圧縮方式
+    headerData.push_back(0); // フィルタ方式
+    headerData.push_back(0); // インターレースなし
+    assert(headerData.size() == sizeof(PngImageHeader));
+
+    vector<u8> rtData;
+    rtData.reserve(zlibData.size() + 64 + (zlibData.size() / MAX_IDAT_SIZE) * 12);
+    rtData.insert(rtData.end(), PNG_SIGNATURE, PNG_SIGNATURE + sizeof(PNG_SIGNATURE));
+    WriteChunk(rtData, "IHDR", headerData.data(), static_cast<u32>(headerData.size()));
+
+    // パレットはアルファの小さい順に並ぶため、tRNSは最後の不透明でない色までにする
+    if (colorType == 3)
+    {
+        vector<u8> paletteData;
+        vector<u8> alphaData;
+        for (const BGRA& color : layout.palette)
+        {
+            paletteData.push_back(color.r);
+            paletteData.push_back(color.g);
+            paletteData.push_back(color.b);
+            if (color.a != 0xff) alphaData.push_back(color.a);
+        }
+
+        WriteChunk(rtData, "PLTE", paletteData.data(), static_cast<u32>(paletteData.size()));
+        if (!alphaData.empty()) WriteChunk(rtData, "tRNS", alphaData.data(), static_cast<u32>(alphaData.size()));
+    }
+
+    u32 zlibSize = static_cast<u32>(zlibData.size());
+    for (u32 offset = 0; offset < zlibSize; offset += MAX_IDAT_SIZE)
+    {
+        WriteChunk(rtData, "IDAT", zlibData.data() + offset, min(MAX_IDAT_SIZE, zlibSize - offset));
+    }
+    WriteChunk(rtData, "IEND", nullptr, 0);
+
+    rtDataSize = static_cast<u32>(rtData.size());
+    unique_ptr<u8[]> rtBuff = make_unique<u8[]>(rtDataSize);
+    memcpy(rtBuff.get(), rtData.data(), rtDataSize);
+
+    return rtBuff;
+}
+
+vector<u8> PNG::compress(const FileData& fileData, u8 colorType, const vector<BGRA>& palette) const
+{
+    u32 bpp = GetChannelCount(colorType);
+    u32 rowSize = fileData.width * bpp;
+    ColorTable table(palette);
+    u32 height = fileData.height;
+
+    // スレッド数によらず同じ出力になるよう、行グループの分け方は行のサイズだけで決める
+    u32 rowsPerGroup = max(1u, ROW_GROUP_SIZE / rowSize);
+    u32 groupCount = (height + rowsPerGroup - 1) / rowsPerGroup;
+
+    struct RowGroup
+    {
+        vector<u8> compressed;
+        u32 adler = 1;
+        u32 filteredSize = 0;
+    };
+    vector<RowGroup> groups(groupCount);
+
+    Parallel::For(groupCount, [&](u32 groupIndex)
+    {
+        u32 startY = groupIndex * rowsPerGroup;
+        u32 endY = min(height, startY + rowsPerGroup);
+
+        vector<u8> filtered(static_cast<size_t>(endY - startY) * (rowSize + 1));
+        vector<u8> prev(rowSize, 0);
+        vector<u8> row(rowSize);
+        vector<u8> candidate(rowSize);
+
+        // グループ先頭の行も、直前の行を参照してフィルタを選ぶ
+        if (startY > 0) GetRow(fileData, startY - 1, colorType, table, prev.data());
+
+        for (u32 y = startY; y < endY; ++y)
+        {
+            GetRow(fileData, y, colorType, table, row.data());
+
+            u8* dst = &filtered[static_cast<size_t>(y - startY) * (rowSize + 1)];
+            u64 bestSum = UINT64_MAX;
+            for (u8 type = PNG_FILTER_NONE; type <= PNG_FILTER_PAETH; ++type)
+            {
+                ApplyFilter
+                (
+                    static_cast<PngFilterType>(type), row.data(), prev.data(), rowSize, bpp, 
+                    candidate.data()
+                );
+
+                u64 sum = SumAbsResidual(candidate.data(), rowSize);
+                if (sum < bestSum)
+                {
+                    bestSum = sum;
+                    dst[0] = type;
+                    memcpy(dst + 1, candidate.data(), rowSize);
+                }
+            }
+
+            swap(prev, row);
+        }
+
+        RowGroup& group = groups[groupIndex];
+        group.filteredSize = static_cast<u32>(filtered.size());
+        group.adler = Deflate::Adler32(filtered.data(), group.filteredSize);
+        group.compressed = Deflate::Compress
+        (
+            filtered.data(), group.filteredSize, level_, groupIndex + 1 == groupCount
+        );
+    });
+
+    // zlibヘッダー。FLGは圧縮レベルの目安と、ヘッダーが31の倍数になるチェックビット
+    vector<u8> rtData;
+    rtData.push_back(0x78);
+    rtData.push_back((level_ == DeflateLevel::best) ? 0xda : 0x01);
+
+    u32 adler = 1;
+    for (const RowGroup& group : groups)
+    {
+        rtData.insert(rtData.end(), group.compressed.begin(), group.compressed.end());
+        adler = Deflate::Adler32Combine(adler, group.adler, group.filteredSize);
+    }
+
+    // 高さが0の場合は空のストリームにする
+    if (groupCount == 0)
+    {
+        vector<u8> empty = Deflate::Compress(nullptr, 0, level_, true);
+        rtData.insert(rtData.end(), empty.begin(), empty.end());
+    }
+
+    WriteBigEndian(rtData, adler);
+    return rtData;
+}
+
+unique_ptr<u8[]> PNG::uncompress
+(
+    const u8* zlibData, u32 zlibSize, s32 width, s32 height, u8 colorType, const vector<RGBA>& palette
+) const {
+    // zlibヘッダーとAdler-32を含めた最小のサイズ
+    if (zlibSize < 6) return nullptr;
+
+    u8 cmf = zlibData[0];
+    u8 flg = zlibData[1];
+    if ((cmf & 0x0f) != 8 || ((cmf << 8) | flg) % 31 != 0 || (flg & 0x20) != 0) return nullptr;
+
+    u32 bpp = GetChannelCount(colorType);
+    u64 rowSize = static_cast<u64>(width) * bpp;
+    u64 filteredSize = (rowSize + 1) * height;
+    if (filteredSize > UINT32_MAX) return nullptr;
+
+    vector<u8> filtered(filteredSize);
+    u32 readSize = 0;
+    if (!Deflate::Uncompress(zlibData + 2, zlibSize - 2, filtered.data(), static_cast<u32>(filteredSize), readSize))
+    {
+        return nullptr;
+    }
+
+    if (zlibSize - 2 - readSize < 4) return nullptr;
+    if (ReadBigEndian(zlibData + 2 + readSize) != Deflate::Adler32(filtered.data(), static_cast<u32>(filteredSize)))
+    {
+        return nullptr;
+    }
+
+    // フィルタを戻しながら、各カラータイプをRGBAに変換する
+    unique_ptr<u8[]> pixels = make_unique<u8[]>(static_cast<size_t>(width) * height * 4);
+    vector<u8> zeroRow(rowSize, 0);
+    const u8* prev = zeroRow.data();
+    for (s32 y = 0; y < height; ++y)
+    {
+        u8* filterType = &filtered[y * (rowSize + 1)];
+        u8* row = filterType + 1;
+        if (!RemoveFilter(*filterType, row, prev, static_cast<u32>(rowSize), bpp)) return nullptr;
+
+        u8* dst = &pixels[static_cast<size_t>(y) * width * 4];
+        for (s32 x = 0; x < width; ++x)
+        {
+            const u8* src = row + x * bpp;
+            u8* pixel = dst + x * 4;
+            switch (colorType)
+            {
+            case 0:
+                pixel[0] = pixel[1] = pixel[2] = src[0];
+                pixel[3] = 0xff;
+                break;
+
+            case 2:
+                pixel[0] = src[0];
+                pixel[1] = src[1];
+                pixel[2] = src[2];
+                pixel[3] = 0xff;
+                break;
+
+            case 3:
+                if (src[0] >= palette.size()) return nullptr;
+                memcpy(pixel, &palette[src[0]], 4);
+                break;
+
+            case 4:
+                pixel[0] = pixel[1] = pixel[2] = src[0];
+                pixel[3] = src[1];
+                break;
+
+            case 6:
+                memcpy(pixel, src, 4);
+                break;
+            }
+        }
+
+        prev = row;
+    }
+
+    return pixels;
+}
@@ -3,92 +3,209 @@
 #include "format_tga.h"
 
 #include "pixel_flipper.h"
+#include "pixel_layout.h"
 
 using namespace std;
 
-unique_ptr<FileData> TGA::analysis(unique_ptr<u8[]> &importData)
+namespace
+{
+
+bool IsColorMapped(u8 imageType)
+{
+    return imageType == 1 || imageType == 9;
+}
+
+bool IsGray(u8 imageType)
+{
+    return imageType == 3 || imageType == 11;
+}
+
+bool IsCompressed(u8 imageType)
 {
-    TgaFileHeader* fileHeader = reinterpret_cast<TgaFileHeader*>(importData.get());
+    return imageType >= 9;
+}
+
+}
+
+unique_ptr<FileData> TGA::analysis(const u8* importData, u32 dataSize) const
+{
+    TgaFileHeader fileHeader;
+    if (!ReadHeader(importData, dataSize, fileHeader)) return nullptr;
+
+    u8 imageType = fileHeader.imageType;
+    bool isIndexed = IsColorMapped(imageType) || IsGray(imageType);
+
+    u32 dataOffset = sizeof(TgaFileHeader) + fileHeader.idLength;
+
+    // カラーマップ画像はカラーマップをパレットとして読み込み、それ以外でカラーマップが存在する場合は読み飛ばす
+    vector<BGRA> palette;
+    if (IsColorMapped(imageType))
+    {
+        u32 entryBytes = fileHeader.colorMapDepth / 8;
+        if (dataOffset + fileHeader.colorMapLength * entryBytes > dataSize) return nullptr;
+
+        // インデックスはcolorMapIndexから始まるため、それより前の色は範囲外として扱えるよう詰めずに置く
+        palette.resize(fileHeader.colorMapIndex + fileHeader.colorMapLength);
+        for (u32 i = 0; i < fileHeader.colorMapLength; ++i)
+        {
+            const u8* entry = importData + dataOffset + i * entryBytes;
+            palette[fileHeader.colorMapIndex + i] = {entry[0], entry[1], entry[2], (entryBytes == 4) ? entry[3] : u8(0xff)};
+        }
+    }
+    else if (IsGray(imageType)) palette = Layout::GetGrayPalette();
+
+    if (fileHeader.colorMapType == 1) dataOffset += fileHeader.colorMapLength * ((fileHeader.colorMapDepth + 7) / 8);
+    if (dataOffset > dataSize) return nullptr;
 
     unique_ptr<FileData> fileData = make_unique<FileData>();
 
-    fileData->width = fileHeader->width;
-    fileData->height = fileHeader->height;
+    fileData->width = fileHeader.width;
+    fileData->height = fileHeader.height;
 
     u32 size = fileData->width * fileData->height * 4;
-    fileData->pixels = make_unique<u8[]>(size);
-
-    u32 dataOffset = sizeof(TgaFileHeader) + fileHeader->idLength;
 
     // ビット5とビット4を取得
-    u8 bit5 = (fileHeader->imageDescriptor >> 5) & 1;
-    u8 bit4 = (fileHeader->imageDescriptor >> 4) & 1;
+    u8 bit5 = (fileHeader.imageDescriptor >> 5) & 1;
+    u8 bit4 = (fileHeader.imageDescriptor >> 4) & 1;
 
     PixelStorageOrder order;
     if (bit5 == 0 && bit4 == 0) order = PixelStorageOrder::bottomLeftToTopRight;
     else if (bit5 == 0 && bit4 == 1) order = PixelStorageOrder::topLeftToBottomRight;
     else if (bit5 == 1 && bit4 == 0) order = PixelStorageOrder::bottomRightToTopLeft;
-    else if (bit5 == 1 && bit4 == 1) order = PixelStorageOrder::topRightToBottomLeft;
-    else
-    {
-        cout << "画像記述子のビット5とビット4が不正です。" << endl;
-        return nullptr;
-    }
+    else order = PixelStorageOrder::topRightToBottomLeft;
 
     PixelFlipper flipper;
     flipper.getFlipTypeToBLTR(order);
 
-    if (fileHeader->imageType == 2)
+    // RLE圧縮されている場合は展開したピクセルを、そうでない場合はファイルのピクセルを参照する
+    u32 pixelCount = fileData->width * fileData->height;
+    u32 pixelBytes = fileHeader.pixelDepth / 8;
+    const u8* srcPixels = importData + dataOffset;
+    unique_ptr<u8[]> uncompressedData;
+    if (IsCompressed(imageType))
     {
-        flipper.getPixelsFlippedBGRA
+        uncompressedData = uncompress
         (
-            importData, dataOffset, size, fileHeader->pixelDepth,
-            fileData->pixels, fileData->width, fileData->height
+            importData, dataSize, dataOffset, 
+            fileData->width, fileData->height, fileHeader.pixelDepth
         );
+        if (uncompressedData == nullptr) return nullptr;
+
+        srcPixels = uncompressedData.get();
     }
-    else if (fileHeader->imageType == 10)
-    {
-        unique_ptr<u8[]> uncompressedData = uncompress
-        (
-            importData, dataOffset, 
-            fileData->width, fileData->height, fileHeader->pixelDepth
-        );
+    else if (dataOffset + static_cast<u64>(pixelCount) * pixelBytes > dataSize) return nullptr;
 
+    fileData->pixels = make_unique<u8[]>(size);
+    if (!isIndexed)
+    {
         flipper.getPixelsFlippedBGRA
         (
-            uncompressedData, 0, size, 32,
+            srcPixels, 0, size, fileHeader.pixelDepth,
             fileData->pixels, fileData->width, fileData->height
         );
+        return fileData;
     }
 
+    // インデックスをBGRAに展開してから、格納順を揃える
+    unique_ptr<u8[]> bgraPixels = make_unique<u8[]>(size);
+    if (!Layout::UnpackIndices(srcPixels, pixelCount, palette, bgraPixels.get())) return nullptr;
+
+    flipper.getPixelsFlippedBGRA(bgraPixels.get(), 0, size, 32, fileData->pixels, fileData->width, fileData->height);
     return fileData;
 }
 
-unique_ptr<u8[]> TGA::convert(unique_ptr<FileData> &fileData, u32 &rtDataSize)
+bool TGA::ReadHeader(const u8* importData, u32 dataSize, TgaFileHeader& rtHeader)
 {
+    if (importData == nullptr || dataSize < sizeof(TgaFileHeader)) return false;
+
+    memcpy(&rtHeader, importData, sizeof(TgaFileHeader));
+    u8 imageType = rtHeader.imageType;
+    if (rtHeader.colorMapType > 1) return false;
+
+    // 24、32ビットのフルカラー画像、8ビットのカラーマップ画像、8ビットのグレースケール画像（非圧縮、RLE圧縮）のみ対応
+    bool isIndexed = IsColorMapped(imageType) || IsGray(imageType);
+    if (imageType != 2 && imageType != 10 && !isIndexed) return false;
+    if (!isIndexed && rtHeader.pixelDepth != 24 && rtHeader.pixelDepth != 32) return false;
+    if (isIndexed && rtHeader.pixelDepth != 8) return false;
+    if (!IsValidImageSize(rtHeader.width, rtHeader.height)) return false;
+
+    // カラーマップ画像は24、32ビットのカラーマップをパレットとして使う
+    if (!IsColorMapped(imageType)) return true;
+    if (rtHeader.colorMapType != 1 || (rtHeader.colorMapDepth != 24 && rtHeader.colorMapDepth != 32)) return false;
+    return rtHeader.colorMapIndex + rtHeader.colorMapLength <= MAX_PALETTE_SIZE;
+}
+
+unique_ptr<u8[]> TGA::convert(const FileData &fileData, u32 &rtDataSize) const
+{
+    // 不透明なグレースケールはグレースケール、256色以下でより小さくなる場合はカラーマップ、
+    // 不透明な画像は24ビットで書き出す
+    PixelLayout layout = Layout::Analysis(fileData);
+    u32 pixelCount = fileData.width * fileData.height;
+    u32 trueColorBytes = (layout.isOpaque()) ? 3 : 4;
+    u32 colorMapBytes = trueColorBytes;
+
+    // 減色する場合は、量子化したパレットのインデックスを書き出す。グレースケールは既に1バイトのため減色しない
+    bool isGrayOutput = layout.isOpaque() && layout.isGray;
+    vector<u8> indices;
+    if 
+    (
+        quantize_.isEnabled() && !isGrayOutput &&
+        (layout.palette.empty() || layout.palette.size() > quantize_.colorCount)
+    ){
+        layout.palette = Quantizer::CreatePalette(fileData, quantize_.colorCount, quantize_.refineCount);
+        indices = Quantizer::Map(fileData, layout.palette, quantize_.dither);
+    }
+
+    u8 imageType = 2;
+    u32 pixelBytes = trueColorBytes;
+    if (isGrayOutput)
+    {
+        imageType = 3;
+        pixelBytes = 1;
+    }
+    else if 
+    (
+        !layout.palette.empty() && 
+        layout.palette.size() * colorMapBytes + pixelCount < static_cast<u64>(pixelCount) * trueColorBytes
+    ){
+        imageType = 1;
+        pixelBytes = 1;
+    }
+
+    if (useCompression_) imageType += 8;
+
+    u16 colorMapLength = IsColorMapped(imageType) ? static_cast<u16>(layout.palette.size()) : 0;
+
     TgaFileHeader fileHeader;
     fileHeader.idLength = 0;
-    fileHeader.colorMapType = 0;
-    fileHeader.imageType = (useCompression_) ? 10 : 2;
+    fileHeader.colorMapType = IsColorMapped(imageType) ? 1 : 0;
+    fileHeader.imageType = imageType;
     fileHeader.colorMapIndex = 0;
-    fileHeader.colorMapLength = 0;
-    fileHeader.colorMapDepth = 0;
+    fileHeader.colorMapLength = colorMapLength;
+    fileHeader.colorMapDepth = IsColorMapped(imageType) ? colorMapBytes * 8 : 0;
     fileHeader.xOrigin = 0;
     fileHeader.yOrigin = 0;
-    fileHeader.width = fileData->width;
-    fileHeader.height = fileData->height;
-    fileHeader.pixelDepth = 32;
-    fileHeader.imageDescriptor = 0; // bottom left to top right
-
-    u32 imageSize = fileData->width * fileData->height * 4;
-
-    vector<u8> compressedData;
-    if (useCompression_) // 圧縮する場合
+    fileHeader.width = fileData.width;
+    fileHeader.height = fileData.height;
+    fileHeader.pixelDepth = pixelBytes * 8;
+    fileHeader.imageDescriptor = (trueColorBytes == 4) ? 8 : 0; // アルファのビット数。bottom left to top right
+
+    // ピクセルを出力するバイト数に詰める
+    u32 rowSize = fileData.width * pixelBytes;
+    vector<u8> packedPixels(static_cast<size_t>(rowSize) * fileData.height);
+    ColorTable table(layout.palette);
+    for (s32 y = 0; y < fileData.height; ++y)
     {
-        compressedData = compress(fileData); // 圧縮
-        rtDataSize = sizeof(TgaFileHeader) + compressedData.size();
+        u8* row = &packedPixels[static_cast<size_t>(rowSize) * y];
+        if (IsColorMapped(imageType) && !indices.empty()) memcpy(row, &indices[static_cast<size_t>(rowSize) * y], rowSize);
+        else if (IsColorMapped(imageType)) Layout::PackRowIndices(fileData, y, table, row);
+        else Layout::PackRow(fileData, y, pixelBytes, row);
     }
-    else rtDataSize = sizeof(TgaFileHeader) + imageSize; // 圧縮しない場合
+
+    if (useCompression_) packedPixels = compress(packedPixels.data(), fileData.width, fileData.height, pixelBytes);
+
+    u32 colorMapSize = colorMapLength * colorMapBytes;
+    rtDataSize = sizeof(TgaFileHeader) + colorMapSize + static_cast<u32>(packedPixels.size());
 
 	unique_ptr<u8[]> rtBuff = make_unique<u8[]>(rtDataSize);
 
@@ -98,180 +215,127 @@ unique_ptr<u8[]> TGA::convert(unique_ptr<FileData> &fileData, u32 &rtDataSize)
         rtBuff[i] = reinterpret_cast<u8*>(&fileHeader)[i];
     }
 
-    // ピクセルデータを書き込む
-    if (useCompression_) // 圧縮する場合
+    // カラーマップを書き込む
+    u8* colorMap = &rtBuff[sizeof(TgaFileHeader)];
+    for (u32 i = 0; i < colorMapLength; ++i)
     {
-        for (u32 i = 0; i < compressedData.size(); i++)
-        {
-            rtBuff[sizeof(TgaFileHeader) + i] = compressedData[i];
-        }
+        memcpy(colorMap + i * colorMapBytes, &layout.palette[i], colorMapBytes);
     }
-    else
-    {
-        for (u32 i = 0; i < imageSize; i++)
-        {
-            rtBuff[sizeof(TgaFileHeader) + i] = fileData->pixels[i];
-        }
-    }
-
-    return rtBuff;
-}
-
-namespace
-{
 
-u32 GetIndex(u32 x, u32 y, s32 width, s32 height)
-{
-    return y * width * 4 + x * 4;
-}
+    // ピクセルデータを書き込む
+    if (!packedPixels.empty()) memcpy(colorMap + colorMapSize, packedPixels.data(), packedPixels.size());
 
+    return rtBuff;
 }
 
-unique_ptr<u8[]> TGA::uncompress(unique_ptr<u8[]> &importData, u32 dataOffset, s32 width, s32 height, u16 pixelDepth)
-{
-    u32 maxAlpha = 255;
-    unique_ptr<u8[]> pixels = make_unique<u8[]>(width * height * 4);
-
-    u8* src = importData.get() + dataOffset;
+unique_ptr<u8[]> TGA::uncompress
+(
+    const u8* importData, u32 dataSize, u32 dataOffset, s32 width, s32 height, u16 pixelDepth
+) const {
+    u32 pixelCount = width * height;
     u16 clrWidth = pixelDepth / 8;
+    unique_ptr<u8[]> pixels = make_unique<u8[]>(static_cast<size_t>(pixelCount) * clrWidth);
 
-    for (u32 y = 0; y < height; y++)
-    {
-        for (u32 x = 0; x < width;)
-        {
-            if (*src & 0x80) // Repeat
-            {
-                u32 count = (*src & 0x7F) + 1;
-                src++;
+    const u8* src = importData + dataOffset;
+    const u8* srcEnd = importData + dataSize;
 
-                BGRA* pixel = reinterpret_cast<BGRA*>(src);
-                for (u32 i = 0; i < count; i++)
-                {
-                    assert(y*width*4 + x + 3 < width*height*4);
-
-                    pixels[GetIndex(x, y, width, height) ] = pixel->b;
-                    pixels[GetIndex(x, y, width, height) + 1] = pixel->g;
-                    pixels[GetIndex(x, y, width, height) + 2] = pixel->r;
-                    pixels[GetIndex(x, y, width, height) + 3] = (clrWidth == 4) ? pixel->a : 0xff;
-                    x++;
-                }
-
-                src += clrWidth;
-            }
-            else // Literal
-            {
-                u32 count = (*src & 0x7F) + 1;
-                src++;
+    // パケットは行をまたぐことがあるため、ピクセルを一列に並んだものとして展開する
+    u32 pixelIndex = 0;
+    while (pixelIndex < pixelCount)
+    {
+        if (src >= srcEnd) return nullptr;
 
-                for (u32 i = 0; i < count; i++)
-                {
-                    assert(y*width*4 + x + 3 < width*height*4);
+        bool isRepeat = (*src & 0x80) != 0;
+        u32 count = (*src & 0x7F) + 1;
+        src++;
 
-                    BGRA* pixel = reinterpret_cast<BGRA*>(src);
-                    pixels[GetIndex(x, y, width, height)] = pixel->b;
-                    pixels[GetIndex(x, y, width, height) + 1] = pixel->g;
-                    pixels[GetIndex(x, y, width, height) + 2] = pixel->r;
-                    pixels[GetIndex(x, y, width, height) + 3] = (clrWidth == 4) ? pixel->a : 0xff;
+        // 画像の末尾を超えるパケットは切り詰める
+        if (count > pixelCount - pixelIndex) count = pixelCount - pixelIndex;
 
-                    src += clrWidth;
-                    x++;
-                }
-            }
+        u32 srcSize = (isRepeat) ? clrWidth : clrWidth * count;
+        if (static_cast<u32>(srcEnd - src) < srcSize) return nullptr;
 
-            if (x >= width) break;
+        // Repeatは同じピクセル、Literalは続くピクセルを順に書き込む
+        u8* dst = &pixels[static_cast<size_t>(pixelIndex) * clrWidth];
+        if (isRepeat)
+        {
+            for (u32 i = 0; i < count; i++) memcpy(dst + i * clrWidth, src, clrWidth);
         }
+        else memcpy(dst, src, srcSize);
+
+        src += srcSize;
+        pixelIndex += count;
     }
 
     return pixels;
 }
 
-namespace
-{
-
-bool IsSameBGRA(BGRA* a, BGRA* b)
-{
-    return a->b == b->b && a->g == b->g && a->r == b->r && a->a == b->a;
-}
-
-}
-
-vector<u8> TGA::compress(unique_ptr<FileData> &fileData)
+vector<u8> TGA::compress(const u8* pixels, s32 width, s32 height, u32 pixelBytes) const
 {
     vector<u8> compressData;
 
+    auto isSamePixel = [pixelBytes](const u8* a, const u8* b)
+    {
+        return memcmp(a, b, pixelBytes) == 0;
+    };
+
     u32 runMaxLen = 128;
-    for (u32 y = 0; y < fileData->height; y++)
+    for (u32 y = 0; y < static_cast<u32>(height); y++)
     {
-        for (u32 x = 0; x < fileData->width;)
+        const u8* row = pixels + static_cast<size_t>(y) * width * pixelBytes;
+        for (u32 x = 0; x < static_cast<u32>(width);)
         {
-            u8* thisPixelStart = &fileData->pixels[y*fileData->width*4 + x*4];
-            BGRA* thisPixel = reinterpret_cast<BGRA*>(thisPixelStart);
+            const u8* thisPixel = row + x * pixelBytes;
 
-            if (x + 1 == fileData->width) // 判定するべき次のピクセルがない場合はLiteral
+            if (x + 1 == static_cast<u32>(width)) // 判定するべき次のピクセルがない場合はLiteral
             {
-                u32 count = 1;
-                compressData.push_back(count - 1);
-                compressData.push_back(thisPixel->b);
-                compressData.push_back(thisPixel->g);
-                compressData.push_back(thisPixel->r);
-                compressData.push_back(thisPixel->a);
-                
+                compressData.push_back(0);
+                compressData.insert(compressData.end(), thisPixel, thisPixel + pixelBytes);
                 break;
             }
 
-            u8* nextPixelStart = thisPixelStart + 4;
-            BGRA* nextPixel = reinterpret_cast<BGRA*>(nextPixelStart);
-
-            if (IsSameBGRA(thisPixel, nextPixel)) // Repeat
+            if (isSamePixel(thisPixel, thisPixel + pixelBytes)) // Repeat
             {
                 u32 count = 1;
-                for (u32 i = 0; i < runMaxLen; i++)
+                for (u32 i = 0; i < runMaxLen - 1; i++) // 1パケットは最大128ピクセル
                 {
-                    if (x + i >= fileData->width) break;
+                    if (x + 1 + i >= static_cast<u32>(width)) break; // 行末を超えて読まない
 
-                    BGRA* judgePixel = reinterpret_cast<BGRA*>(nextPixelStart + i*4);
-                    if (IsSameBGRA(thisPixel, judgePixel)) count++;
+                    if (isSamePixel(thisPixel, row + (x + 1 + i) * pixelBytes)) count++;
                     else break;
                 }
 
                 compressData.push_back(0x80 | (count - 1));
-                compressData.push_back(thisPixel->b);
-                compressData.push_back(thisPixel->g);
-                compressData.push_back(thisPixel->r);
-                compressData.push_back(thisPixel->a);
+                compressData.insert(compressData.end(), thisPixel, thisPixel + pixelBytes);
 
                 x += count;
             }
             else // Literal
             {
+                const u8* judgedPixel = thisPixel;
                 u32 count = 0;
                 for (u32 i = 0; i < runMaxLen; i++)
                 {
-                    if (x + i >= fileData->width) break;
+                    if (x + 1 + i >= static_cast<u32>(width)) // 行末のピクセルは次のピクセルがないためLiteralに含める
+                    {
+                        count++;
+                        break;
+                    }
 
-                    BGRA* judgePixel = reinterpret_cast<BGRA*>(nextPixelStart + i*4);
-                    if (!IsSameBGRA(thisPixel, judgePixel))
+                    const u8* nextPixel = row + (x + 1 + i) * pixelBytes;
+                    if (!isSamePixel(judgedPixel, nextPixel))
                     {
                         count++;
-                        thisPixel = judgePixel;
+                        judgedPixel = nextPixel;
                     }
                     else break;
                 }
 
                 compressData.push_back(count - 1);
-                for (u32 i = 0; i < count; i++)
-                {
-                    BGRA* pixel = reinterpret_cast<BGRA*>(thisPixelStart + i*4);
-                    compressData.push_back(pixel->b);
-                    compressData.push_back(pixel->g);
-                    compressData.push_back(pixel->r);
-                    compressData.push_back(pixel->a);
-                }
+                compressData.insert(compressData.end(), thisPixel, thisPixel + count * pixelBytes);
 
                 x += count;
             }
-
-            if (x >= fileData->width) break;
         }
     }
 
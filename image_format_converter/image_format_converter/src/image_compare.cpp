@@ -0,0 +1,260 @@
+﻿#include "pch.h"
+
+#include "image_compare.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+#include "parallel.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMAGE_COMPARE_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+
+constexpr u32 ROWS_PER_TASK = 32; // 1回の処理で担当する行数
+constexpr s32 SSIM_WINDOW = 8;
+constexpr s32 SSIM_STRIDE = 4;
+
+bool IsSameSize(const FileData& a, const FileData& b)
+{
+    return a.width == b.width && a.height == b.height && a.pixels != nullptr && b.pixels != nullptr;
+}
+
+u32 GetTaskCount(s32 height)
+{
+    return (static_cast<u32>(height) + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+}
+
+// 差の絶対値の最大値と二乗和を加算する
+void AccumulateError(const u8* a, const u8* b, u32 size, u32& rtMaxAbs, u64& rtSquareSum)
+{
+    u32 i = 0;
+
+#ifdef IMAGE_COMPARE_USE_SSE2
+    // 32ビットの各レーンは1回で最大4 * 255^2増えるため、オーバーフローする前に64ビットに移す
+    constexpr u32 FLUSH_INTERVAL = 4096 * 16;
+
+    const __m128i zero = _mm_setzero_si128();
+    __m128i maxVec = zero;
+    while (i + 16 <= size)
+    {
+        u32 blockEnd = min(size, i + FLUSH_INTERVAL);
+        __m128i sumVec = zero;
+        for (; i + 16 <= blockEnd; i += 16)
+        {
+            __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+            __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+            __m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+            maxVec = _mm_max_epu8(maxVec, diff);
+
+            __m128i low = _mm_unpacklo_epi8(diff, zero);
+            __m128i high = _mm_unpackhi_epi8(diff, zero);
+            sumVec = _mm_add_epi32(sumVec, _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high)));
+        }
+
+        u32 sums[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sums), sumVec);
+        rtSquareSum += static_cast<u64>(sums[0]) + sums[1] + sums[2] + sums[3];
+    }
+
+    u8 maxes[16];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(maxes), maxVec);
+    for (u8 value : maxes) rtMaxAbs = max<u32>(rtMaxAbs, value);
+#endif
+
+    for (; i < size; ++i)
+    {
+        u32 diff = (a[i] > b[i]) ? a[i] - b[i] : b[i] - a[i];
+        rtMaxAbs = max(rtMaxAbs, diff);
+        rtSquareSum += diff * diff;
+    }
+}
+
+// BGRAのピクセルから輝度（BT.601）を求める
+void GetLuminance(const FileData& fileData, vector<f32>& rtLuminance)
+{
+    u32 pixelCount = static_cast<u32>(fileData.width) * fileData.height;
+    rtLuminance.resize(pixelCount);
+
+    Parallel::For(GetTaskCount(fileData.height), [&](u32 task)
+    {
+        u32 start = task * ROWS_PER_TASK * fileData.width;
+        u32 end = min(pixelCount, start + ROWS_PER_TASK * fileData.width);
+        const u8* src = fileData.pixels.get();
+        for (u32 i = start; i < end; ++i)
+        {
+            rtLuminance[i] = 0.114f * src[i * 4] + 0.587f * src[i * 4 + 1] + 0.299f * src[i * 4 + 2];
+        }
+    });
+}
+
+f64 ComputeSsim(const FileData& a, const FileData& b)
+{
+    constexpr f64 C1 = (0.01 * 255) * (0.01 * 255);
+    constexpr f64 C2 = (0.03 * 255) * (0.03 * 255);
+
+    vector<f32> lumA;
+    vector<f32> lumB;
+    GetLuminance(a, lumA);
+    GetLuminance(b, lumB);
+
+    // 画像がウィンドウより小さい場合は画像全体を1つのウィンドウにする
+    s32 windowWidth = min(SSIM_WINDOW, a.width);
+    s32 windowHeight = min(SSIM_WINDOW, a.height);
+    u32 windowCountX = (a.width - windowWidth) / SSIM_STRIDE + 1;
+    u32 windowCountY = (a.height - windowHeight) / SSIM_STRIDE + 1;
+    f64 windowSize = static_cast<f64>(windowWidth) * windowHeight;
+
+    vector<f64> rowSums(windowCountY, 0.0);
+    Parallel::For(windowCountY, [&](u32 wy)
+    {
+        for (u32 wx = 0; wx < windowCountX; ++wx)
+        {
+            f32 sumA = 0.0f;
+            f32 sumB = 0.0f;
+            f32 sumAA = 0.0f;
+            f32 sumBB = 0.0f;
+            f32 sumAB = 0.0f;
+            for (s32 y = 0; y < windowHeight; ++y)
+            {
+                u32 offset = (wy * SSIM_STRIDE + y) * a.width + wx * SSIM_STRIDE;
+                const f32* rowA = &lumA[offset];
+                const f32* rowB = &lumB[offset];
+                for (s32 x = 0; x < windowWidth; ++x)
+                {
+                    sumA += rowA[x];
+                    sumB += rowB[x];
+                    sumAA += rowA[x] * rowA[x];
+                    sumBB += rowB[x] * rowB[x];
+                    sumAB += rowA[x] * rowB[x];
+                }
+            }
+
+            f64 meanA = sumA / windowSize;
+            f64 meanB = sumB / windowSize;
+            f64 varA = max(0.0, sumAA / windowSize - meanA * meanA);
+            f64 varB = max(0.0, sumBB / windowSize - meanB * meanB);
+            f64 covariance = sumAB / windowSize - meanA * meanB;
+
+            rowSums[wy] += ((2 * meanA * meanB + C1) * (2 * covariance + C2)) 
+                / ((meanA * meanA + meanB * meanB + C1) * (varA + varB + C2));
+        }
+    });
+
+    f64 sum = 0.0;
+    for (f64 rowSum : rowSums) sum += rowSum;
+    return sum / (static_cast<f64>(windowCountX) * windowCountY);
+}
+
+}
+
+bool ImageCompare::IsEqual(const FileData& a, const FileData& b)
+{
+    if (!IsSameSize(a, b)) return false;
+
+    u32 rowSize = a.width * 4;
+    atomic<bool> isMismatch = false;
+    Parallel::For(GetTaskCount(a.height), [&](u32 task)
+    {
+        u32 endY = min(static_cast<u32>(a.height), (task + 1) * ROWS_PER_TASK);
+        for (u32 y = task * ROWS_PER_TASK; y < endY; ++y)
+        {
+            if (isMismatch.load(memory_order_relaxed)) return;
+
+            size_t offset = static_cast<size_t>(y) * rowSize;
+            if (memcmp(a.pixels.get() + offset, b.pixels.get() + offset, rowSize) != 0)
+            {
+                isMismatch.store(true, memory_order_relaxed);
+                return;
+            }
+        }
+    });
+
+    return !isMismatch;
+}
+
+CompareResult ImageCompare::Compare(const FileData& a, const FileData& b)
+{
+    CompareResult rtResult;
+    rtResult.isSameSize = IsSameSize(a, b);
+    if (!rtResult.isSameSize) return rtResult;
+
+    u32 rowSize = a.width * 4;
+    u32 taskCount = GetTaskCount(a.height);
+    vector<u32> maxAbsErrors(taskCount, 0);
+    vector<u64> squareSums(taskCount, 0);
+    Parallel::For(taskCount, [&](u32 task)
+    {
+        u32 endY = min(static_cast<u32>(a.height), (task + 1) * ROWS_PER_TASK);
+        size_t offset = static_cast<size_t>(task) * ROWS_PER_TASK * rowSize;
+        u32 size = (endY - task * ROWS_PER_TASK) * rowSize;
+
+        AccumulateError(a.pixels.get() + offset, b.pixels.get() + offset, size, maxAbsErrors[task], squareSums[task]);
+    });
+
+    u64 squareSum = 0;
+    for (u32 task = 0; task < taskCount; ++task)
+    {
+        rtResult.maxAbsError = max(rtResult.maxAbsError, maxAbsErrors[task]);
+        squareSum += squareSums[task];
+    }
+
+    rtResult.isEqual = rtResult.maxAbsError == 0;
+    rtResult.mse = static_cast<f64>(squareSum) / (static_cast<f64>(rowSize) * a.height);
+    rtResult.psnr = (rtResult.isEqual) 
+        ? numeric_limits<f64>::infinity() : 10.0 * log10(255.0 * 255.0 / rtResult.mse);
+    rtResult.ssim = (rtResult.isEqual) ? 1.0 : ComputeSsim(a, b);
+
+    return rtResult;
+}
+
+unique_ptr<FileData> ImageCompare::CreateHeatMap(const FileData& a, const FileData& b)
+{
+    if (!IsSameSize(a, b)) return nullptr;
+
+    unique_ptr<FileData> heatMap = make_unique<FileData>();
+    heatMap->width = a.width;
+    heatMap->height = a.height;
+
+    u32 pixelCount = static_cast<u32>(a.width) * a.height;
+    heatMap->pixels = make_unique<u8[]>(pixelCount * 4);
+
+    Parallel::For(GetTaskCount(a.height), [&](u32 task)
+    {
+        u32 start = task * ROWS_PER_TASK * a.width;
+        u32 end = min(pixelCount, start + ROWS_PER_TASK * a.width);
+        for (u32 i = start; i < end; ++i)
+        {
+            const u8* pixelA = &a.pixels[i * 4];
+            const u8* pixelB = &b.pixels[i * 4];
+            u8* dst = &heatMap->pixels[i * 4];
+
+            u32 diff = 0;
+            for (u32 c = 0; c < 4; ++c) diff = max<u32>(diff, abs(pixelA[c] - pixelB[c]));
+
+            if (diff == 0)
+            {
+                u8 grey = static_cast<u8>((pixelA[0] + pixelA[1] * 2 + pixelA[2]) / 16);
+                dst[0] = grey;
+                dst[1] = grey;
+                dst[2] = grey;
+            }
+            else
+            {
+                dst[0] = 0;
+                dst[1] = static_cast<u8>(min<u32>(255, diff * 4));
+                dst[2] = 255;
+            }
+            dst[3] = 0xff;
+        }
+    });
+
+    return heatMap;
+}
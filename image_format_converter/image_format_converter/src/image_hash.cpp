@@ -0,0 +1,206 @@
+﻿#include "pch.h"
+
+#include "image_hash.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMAGE_HASH_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+
+constexpr u32 LANE_COUNT = 8;
+constexpr u32 STRIPE_SIZE = LANE_COUNT * 8;
+constexpr u32 STRIPES_PER_BLOCK = 16; // この数のストライプごとにレーンを撹拌する
+
+constexpr u64 PRIME64_1 = 0x9e3779b185ebca87ull;
+constexpr u64 PRIME64_2 = 0xc2b2ae3d27d4eb4full;
+constexpr u32 PRIME32_1 = 0x9e3779b1u;
+
+// 各レーンの鍵。円周率の16進表記の桁
+alignas(16) constexpr u64 ACCUMULATE_KEYS[LANE_COUNT] =
+{
+    0x243f6a8885a308d3ull, 0x13198a2e03707344ull, 0xa4093822299f31d0ull, 0x082efa98ec4e6c89ull,
+    0x452821e638d01377ull, 0xbe5466cf34e90c6cull, 0xc0ac29b7c97c50ddull, 0x3f84d5b5b5470917ull,
+};
+alignas(16) constexpr u64 SCRAMBLE_KEYS[LANE_COUNT] =
+{
+    0x9216d5d98979fb1bull, 0xd1310ba698dfb5acull, 0x2ffd72dbd01adfb7ull, 0xb8e1afed6a267e96ull,
+    0xba7c9045f12c7f99ull, 0x24a19947b3916cf7ull, 0x0801f2e2858efc16ull, 0x636920d871574e69ull,
+};
+
+u64 LoadU64(const u8* data)
+{
+    u64 value;
+    memcpy(&value, data, 8);
+    return value;
+}
+
+// 64ビット同士の128ビットの積の上位と下位の排他的論理和
+u64 MultiplyFold(u64 a, u64 b)
+{
+    u64 aLow = a & 0xffffffff;
+    u64 aHigh = a >> 32;
+    u64 bLow = b & 0xffffffff;
+    u64 bHigh = b >> 32;
+
+    u64 lowLow = aLow * bLow;
+    u64 highLow = aHigh * bLow;
+    u64 lowHigh = aLow * bHigh;
+    u64 highHigh = aHigh * bHigh;
+
+    u64 cross = (lowLow >> 32) + (highLow & 0xffffffff) + lowHigh;
+    u64 high = highHigh + (highLow >> 32) + (cross >> 32);
+    u64 low = (cross << 32) | (lowLow & 0xffffffff);
+    return high ^ low;
+}
+
+u64 Avalanche(u64 h)
+{
+    h ^= h >> 37;
+    h *= 0x165667919e3779f9ull;
+    h ^= h >> 32;
+    return h;
+}
+
+u64 MergeLanes(const u64* lanes, const u64* keys, u64 start)
+{
+    u64 result = start;
+    for (u32 i = 0; i < LANE_COUNT; i += 2) result += MultiplyFold(lanes[i] ^ keys[i], lanes[i + 1] ^ keys[i + 1]);
+    return Avalanche(result);
+}
+
+Hash128 Finalize(const u64* lanes, u64 dataSize)
+{
+    Hash128 hash;
+    hash.low = MergeLanes(lanes, ACCUMULATE_KEYS, dataSize * PRIME64_1);
+    hash.high = MergeLanes(lanes, SCRAMBLE_KEYS, ~(dataSize * PRIME64_2));
+    return hash;
+}
+
+// 各レーンに、鍵と混ぜたデータの上位32ビットと下位32ビットの積と、隣のレーンのデータを加える
+void AccumulateScalar(u64* lanes, const u8* stripe)
+{
+    for (u32 i = 0; i < LANE_COUNT; ++i)
+    {
+        u64 data = LoadU64(stripe + i * 8);
+        u64 dataKey = data ^ ACCUMULATE_KEYS[i];
+        lanes[i ^ 1] += data;
+        lanes[i] += (dataKey & 0xffffffff) * (dataKey >> 32);
+    }
+}
+
+void ScrambleScalar(u64* lanes)
+{
+    for (u32 i = 0; i < LANE_COUNT; ++i)
+    {
+        u64 lane = lanes[i];
+        lane ^= lane >> 47;
+        lane ^= SCRAMBLE_KEYS[i];
+        lanes[i] = lane * PRIME32_1;
+    }
+}
+
+#ifdef IMAGE_HASH_USE_SSE2
+void AccumulateSse2(__m128i* lanes, const u8* stripe)
+{
+    const __m128i* keys = reinterpret_cast<const __m128i*>(ACCUMULATE_KEYS);
+    for (u32 i = 0; i < LANE_COUNT / 2; ++i)
+    {
+        __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(stripe) + i);
+        __m128i dataKey = _mm_xor_si128(data, _mm_load_si128(keys + i));
+        __m128i product = _mm_mul_epu32(dataKey, _mm_srli_epi64(dataKey, 32));
+        __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+        lanes[i] = _mm_add_epi64(lanes[i], _mm_add_epi64(product, swapped));
+    }
+}
+
+void ScrambleSse2(__m128i* lanes)
+{
+    const __m128i* keys = reinterpret_cast<const __m128i*>(SCRAMBLE_KEYS);
+    const __m128i prime = _mm_set1_epi32(static_cast<s32>(PRIME32_1));
+    for (u32 i = 0; i < LANE_COUNT / 2; ++i)
+    {
+        __m128i lane = _mm_xor_si128(lanes[i], _mm_srli_epi64(lanes[i], 47));
+        lane = _mm_xor_si128(lane, _mm_load_si128(keys + i));
+
+        // SSE2には64ビットの乗算がないため、32ビットの積2つから組み立てる
+        __m128i low = _mm_mul_epu32(lane, prime);
+        __m128i high = _mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(lane, 32), prime), 32);
+        lanes[i] = _mm_add_epi64(low, high);
+    }
+}
+#endif
+
+void InitLanes(u64* lanes, u64 seed)
+{
+    for (u32 i = 0; i < LANE_COUNT; ++i) lanes[i] = ACCUMULATE_KEYS[LANE_COUNT - 1 - i] ^ seed;
+}
+
+}
+
+Hash128 ImageHash::Hash(const u8* data, u64 dataSize, u64 seed)
+{
+#ifdef IMAGE_HASH_USE_SSE2
+    alignas(16) u64 initLanes[LANE_COUNT];
+    InitLanes(initLanes, seed);
+
+    __m128i lanes[LANE_COUNT / 2];
+    for (u32 i = 0; i < LANE_COUNT / 2; ++i) lanes[i] = _mm_load_si128(reinterpret_cast<const __m128i*>(initLanes) + i);
+
+    u64 stripeCount = dataSize / STRIPE_SIZE;
+    for (u64 i = 0; i < stripeCount; ++i)
+    {
+        AccumulateSse2(lanes, data + i * STRIPE_SIZE);
+        if ((i + 1) % STRIPES_PER_BLOCK == 0) ScrambleSse2(lanes);
+    }
+
+    // 端数は0で埋めたストライプとして処理する。長さは最後に混ぜるため、0で終わるデータとは区別される
+    u64 remaining = dataSize % STRIPE_SIZE;
+    if (remaining != 0)
+    {
+        u8 stripe[STRIPE_SIZE] = {};
+        memcpy(stripe, data + stripeCount * STRIPE_SIZE, remaining);
+        AccumulateSse2(lanes, stripe);
+    }
+
+    alignas(16) u64 result[LANE_COUNT];
+    for (u32 i = 0; i < LANE_COUNT / 2; ++i) _mm_store_si128(reinterpret_cast<__m128i*>(result) + i, lanes[i]);
+
+    return Finalize(result, dataSize);
+#else
+    return HashScalar(data, dataSize, seed);
+#endif
+}
+
+Hash128 ImageHash::HashScalar(const u8* data, u64 dataSize, u64 seed)
+{
+    u64 lanes[LANE_COUNT];
+    InitLanes(lanes, seed);
+
+    u64 stripeCount = dataSize / STRIPE_SIZE;
+    for (u64 i = 0; i < stripeCount; ++i)
+    {
+        AccumulateScalar(lanes, data + i * STRIPE_SIZE);
+        if ((i + 1) % STRIPES_PER_BLOCK == 0) ScrambleScalar(lanes);
+    }
+
+    u64 remaining = dataSize % STRIPE_SIZE;
+    if (remaining != 0)
+    {
+        u8 stripe[STRIPE_SIZE] = {};
+        memcpy(stripe, data + stripeCount * STRIPE_SIZE, remaining);
+        AccumulateScalar(lanes, stripe);
+    }
+
+    return Finalize(lanes, dataSize);
+}
+
+Hash128 ImageHash::HashImage(const FileData& fileData)
+{
+    u64 seed = (static_cast<u64>(static_cast<u32>(fileData.width)) << 32) | static_cast<u32>(fileData.height);
+    return Hash(fileData.pixels.get(), static_cast<u64>(fileData.width) * fileData.height * 4, seed);
+}
@@ -0,0 +1,146 @@
+﻿#include "pch.h"
+
+#include "parallel.h"
+
+#include <atomic>
+#include <exception>
+#include <thread>
+
+using namespace std;
+
+namespace
+{
+
+// Parallel::Forの処理を実行中のスレッドか
+thread_local bool g_isInParallel = false;
+
+// 処理の間だけg_isInParallelを設定し、例外で抜けた場合も元に戻す
+struct ParallelScope
+{
+    bool wasInParallel = g_isInParallel;
+
+    ParallelScope() { g_isInParallel = true; }
+    ~ParallelScope() { g_isInParallel = wasInParallel; }
+};
+
+}
+
+u32 Parallel::GetThreadCount()
+{
+    u32 threadCount = thread::hardware_concurrency();
+    return (threadCount == 0) ? 1 : threadCount;
+}
+
+bool Parallel::IsInParallel()
+{
+    return g_isInParallel;
+}
+
+void Parallel::For(u32 count, const function<void(u32 index)>& func)
+{
+    // 入れ子にするとスレッド数の2乗のスレッドを作るため、既に並列に処理している場合は呼び出したスレッドで処理する
+    u32 threadCount = g_isInParallel ? 1 : min(GetThreadCount(), count);
+    if (threadCount <= 1)
+    {
+        for (u32 i = 0; i < count; ++i) func(i);
+        return;
+    }
+
+    // 処理時間に偏りがあっても均等になるよう、インデックスを一つずつ取り出して処理する。
+    // funcが例外を投げた場合は最初の例外を保持し、残りのインデックスを取り出させずに終える
+    atomic<u32> next = 0;
+    exception_ptr error = nullptr;
+    mutex errorMutex;
+    auto worker = [&]()
+    {
+        ParallelScope scope;
+        try
+        {
+            for (u32 i = next++; i < count; i = next++) func(i);
+        }
+        catch (...)
+        {
+            lock_guard<mutex> lock(errorMutex);
+            if (error == nullptr) error = current_exception();
+            next = count;
+        }
+    };
+
+    // スレッドを作れなかった場合は、作れたスレッドだけで処理する
+    vector<thread> threads;
+    try
+    {
+        threads.reserve(threadCount - 1);
+        for (u32 i = 0; i < threadCount - 1; ++i) threads.emplace_back(worker);
+    }
+    catch (...)
+    {
+    }
+
+    worker(); // 呼び出し元のスレッドも処理に参加する
+    for (thread& t : threads) t.join();
+
+    // ワーカースレッドで投げられた例外は、呼び出したスレッドで投げ直す
+    if (error != nullptr) rethrow_exception(error);
+}
+
+WorkerPool::WorkerPool(u32 threadCount)
+{
+    if (threadCount == 0) threadCount = Parallel::GetThreadCount();
+
+    threads_.reserve(threadCount);
+    for (u32 i = 0; i < threadCount; ++i) threads_.emplace_back(&WorkerPool::workerLoop, this);
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        isStopping_ = true;
+    }
+    jobCondition_.notify_all();
+
+    for (thread& t : threads_) t.join();
+}
+
+void WorkerPool::push(function<void()> job)
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        jobs_.push_back(move(job));
+    }
+    jobCondition_.notify_one();
+}
+
+void WorkerPool::waitIdle()
+{
+    unique_lock<mutex> lock(mutex_);
+    idleCondition_.wait(lock, [&]() { return jobs_.empty() && runningCount_ == 0; });
+}
+
+void WorkerPool::workerLoop()
+{
+    while (true)
+    {
+        function<void()> job;
+        {
+            unique_lock<mutex> lock(mutex_);
+            jobCondition_.wait(lock, [&]() { return isStopping_ || !jobs_.empty(); });
+
+            // 停止する場合も、残っている処理を全て終えてから抜ける
+            if (jobs_.empty()) return;
+
+            job = move(jobs_.front());
+            jobs_.pop_front();
+            runningCount_++;
+        }
+
+        job();
+
+        {
+            lock_guard<mutex> lock(mutex_);
+            runningCount_--;
+            if (jobs_.empty() && runningCount_ == 0) idleCondition_.notify_all();
+        }
+    }
+}
@@ -3,6 +3,7 @@
 #include "pixel_flipper.h"
 
 #include "converter.h"
+#include "pixel_kernel.h"
 
 using namespace std;
 
@@ -53,172 +54,46 @@ void PixelFlipper::getFlipTypeToTLBR(PixelStorageOrder order)
 }
 
 void PixelFlipper::getPixelsFlippedWithPadBGRA(
-    unique_ptr<u8[]> &src, u32 dataOffset, u32 imageSize, u16 pixelDepth,
+    const u8* src, u32 dataOffset, [[maybe_unused]] u32 imageSize, u16 pixelDepth,
     unique_ptr<u8[]> &pixels, s32 width, s32 height)
 {
-    u16 clrWidth = pixelDepth / 8;
-    u32 srcIndex = dataOffset;
+    assert(imageSize == static_cast<u32>(width * height * 4));
 
-    for (u32 i = 0; i < imageSize; i += 4)
-    {
-        u32 x = (i / 4) % width;
-        u32 y = (i / 4) / width;
-
-        u32 flippedIndex;
-        switch (type_)
-        {
-        case FlippedType::x:
-            flippedIndex = y * width * 4 + (width - x - 1) * 4;
-            break;
-        case FlippedType::y:
-            flippedIndex = (height - y - 1) * width * 4 + x * 4;
-            break;
-        case FlippedType::xy:
-            flippedIndex = (height - y - 1) * width * 4 + (width - x - 1) * 4;
-            break;
-        default:
-            flippedIndex = i;
-            break;
-        }
-
-        assert(flippedIndex < imageSize);
-
-        BGRA* pixel = reinterpret_cast<BGRA*>(&src[srcIndex]);
-        pixels[flippedIndex] = pixel->b;
-        pixels[flippedIndex + 1] = pixel->g;
-        pixels[flippedIndex + 2] = pixel->r;
-        pixels[flippedIndex + 3] = (clrWidth == 4) ? pixel->a : 0xff;
-
-        srcIndex += clrWidth;
-
-		// 行末の場合は、パディングを考慮
-		if (x == width - 1) srcIndex += (4 - (width * clrWidth) % 4) % 4;
-    }
+    PixelKernel::Kernel kernel = PixelKernel::Find(pixelDepth / 8, type_, ChannelOrder::bgra, true);
+    assert(kernel != nullptr);
+    kernel(src + dataOffset, pixels.get(), width, height);
 }
 
 void PixelFlipper::getPixelsFlippedBGRA
 (
-    unique_ptr<u8[]> &src, u32 dataOffset, u32 imageSize, u16 pixelDepth, 
+    const u8* src, u32 dataOffset, [[maybe_unused]] u32 imageSize, u16 pixelDepth, 
     unique_ptr<u8[]> &pixels, s32 width, s32 height
 ){
-    u16 clrWidth = pixelDepth / 8;
-    u32 srcIndex = dataOffset;
+    assert(imageSize == static_cast<u32>(width * height * 4));
 
-    for (u32 i = 0; i < imageSize; i += 4)
-    {
-        u32 x = (i / 4) % width;
-        u32 y = (i / 4) / width;
-
-        u32 flippedIndex;
-        switch (type_)
-        {
-        case FlippedType::x:
-            flippedIndex = y * width * 4 + (width - x - 1) * 4;
-            break;
-        case FlippedType::y:
-            flippedIndex = (height - y - 1) * width * 4 + x * 4;
-            break;
-        case FlippedType::xy:
-            flippedIndex = (height - y - 1) * width * 4 + (width - x - 1) * 4;
-            break;
-        default:
-            flippedIndex = i;
-            break;
-        }
-
-        assert(flippedIndex < imageSize);
-
-        BGRA* pixel = reinterpret_cast<BGRA*>(&src[srcIndex]);
-        pixels[flippedIndex] = pixel->b;
-        pixels[flippedIndex + 1] = pixel->g;
-        pixels[flippedIndex + 2] = pixel->r;
-        pixels[flippedIndex + 3] = (clrWidth == 4) ? pixel->a : 0xff;
-
-        srcIndex += clrWidth;
-    }
+    PixelKernel::Kernel kernel = PixelKernel::Find(pixelDepth / 8, type_, ChannelOrder::bgra, false);
+    assert(kernel != nullptr);
+    kernel(src + dataOffset, pixels.get(), width, height);
 }
 
 void PixelFlipper::getPixelsFlippedRGBA
 (
-    unique_ptr<u8[]> &src, u32 dataOffset, u32 imageSize, u16 pixelDepth, 
+    const u8* src, u32 dataOffset, [[maybe_unused]] u32 imageSize, u16 pixelDepth, 
     unique_ptr<u8[]> &pixels, s32 width, s32 height
 ){
-    u16 clrWidth = pixelDepth / 8;
-    u32 srcIndex = dataOffset;
+    assert(imageSize == static_cast<u32>(width * height * 4));
 
-    for (u32 i = 0; i < imageSize; i += 4)
-    {
-        u32 x = (i / 4) % width;
-        u32 y = (i / 4) / width;
-
-        u32 flippedIndex;
-        switch (type_)
-        {
-        case FlippedType::x:
-            flippedIndex = y * width * 4 + (width - x - 1) * 4;
-            break;
-        case FlippedType::y:
-            flippedIndex = (height - y - 1) * width * 4 + x * 4;
-            break;
-        case FlippedType::xy:
-            flippedIndex = (height - y - 1) * width * 4 + (width - x - 1) * 4;
-            break;
-        default:
-            flippedIndex = i;
-            break;
-        }
-
-        assert(flippedIndex < imageSize);
-
-        RGBA* pixel = reinterpret_cast<RGBA*>(&src[srcIndex]);
-        pixels[flippedIndex] = pixel->b;
-        pixels[flippedIndex + 1] = pixel->g;
-        pixels[flippedIndex + 2] = pixel->r;
-        pixels[flippedIndex + 3] = (clrWidth == 4) ? pixel->a : 0xff;
-
-        srcIndex += clrWidth;
-    }
+    PixelKernel::Kernel kernel = PixelKernel::Find(pixelDepth / 8, type_, ChannelOrder::rgba, false);
+    assert(kernel != nullptr);
+    kernel(src + dataOffset, pixels.get(), width, height);
 }
 
 void PixelFlipper::insertPixelsFlippedRGBA
 (
     unique_ptr<u8[]> &target, u32 dataOffset, 
-    unique_ptr<u8[]> &pixels, s32 width, s32 height
+    const unique_ptr<u8[]> &pixels, s32 width, s32 height
 ){
-    u16 clrWidth = 4;
-    u32 pixelIndex = 0;
-    u32 imageSize = width * height * 4;
-
-    for (u32 i = 0; i < imageSize; i += 4)
-    {
-        u32 x = (i / 4) % width;
-        u32 y = (i / 4) / width;
-
-        u32 flippedIndex;
-        switch (type_)
-        {
-        case FlippedType::x:
-            flippedIndex = y * width * 4 + (width - x - 1) * 4;
-            break;
-        case FlippedType::y:
-            flippedIndex = (height - y - 1) * width * 4 + x * 4;
-            break;
-        case FlippedType::xy:
-            flippedIndex = (height - y - 1) * width * 4 + (width - x - 1) * 4;
-            break;
-        default:
-            flippedIndex = i;
-            break;
-        }
-
-        assert(flippedIndex < imageSize);
-
-        BGRA* pixel = reinterpret_cast<BGRA*>(&pixels[pixelIndex]);
-        target[dataOffset + flippedIndex] = pixel->r;
-        target[dataOffset + flippedIndex + 1] = pixel->g;
-        target[dataOffset + flippedIndex + 2] = pixel->b;
-        target[dataOffset + flippedIndex + 3] = pixel->a;
-
-        pixelIndex += clrWidth;
-    }
+    // RとBの入れ替えは対称なので、RGBAからBGRAへのカーネルでBGRAからRGBAに変換できる
+    PixelKernel::Kernel kernel = PixelKernel::Find(4, type_, ChannelOrder::rgba, false);
+    kernel(pixels.get(), target.get() + dataOffset, width, height);
 }
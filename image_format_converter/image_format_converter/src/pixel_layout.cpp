@@ -0,0 +1,275 @@
+﻿#include "pch.h"
+
+#include "pixel_layout.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include "parallel.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PIXEL_LAYOUT_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+
+constexpr u32 ROWS_PER_TASK = 32; // 1回の処理で担当する行数
+constexpr u32 COLOR_TABLE_SIZE = 1024; // MAX_PALETTE_SIZEの4倍にして衝突を減らす
+constexpr u64 ENTRY_INDEX_SHIFT = 32;
+
+u32 GetColorHash(u32 color)
+{
+    return (color * 0x9e3779b1u) >> 22; // 上位10ビット
+}
+
+u32 LoadColor(const u8* pixel)
+{
+    u32 color;
+    memcpy(&color, pixel, 4);
+    return color;
+}
+
+BGRA ToBGRA(u32 color)
+{
+    BGRA pixel;
+    memcpy(&pixel, &color, 4);
+    return pixel;
+}
+
+struct TaskResult
+{
+    bool isOpaque = true;
+    bool isBinaryAlpha = true;
+    bool isGray = true;
+    ColorTable colors;
+};
+
+// 1行分のアルファとグレースケールを判定し、該当しなくなったフラグを下ろす
+void AnalysisFlags(const u8* row, u32 rowSize, TaskResult& rtResult)
+{
+    u32 i = 0;
+
+#ifdef PIXEL_LAYOUT_USE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_cmpeq_epi8(zero, zero);
+    __m128i andVec = ones;
+    __m128i binaryVec = ones;
+    __m128i grayVec = ones;
+    for (; i + 16 <= rowSize; i += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+        andVec = _mm_and_si128(andVec, v);
+        binaryVec = _mm_and_si128(binaryVec, _mm_or_si128(_mm_cmpeq_epi8(v, zero), _mm_cmpeq_epi8(v, ones)));
+
+        // 各ピクセルを1バイトずらして比較し、B == GとG == Rを調べる
+        grayVec = _mm_and_si128(grayVec, _mm_cmpeq_epi8(v, _mm_srli_epi32(v, 8)));
+    }
+
+    constexpr s32 ALPHA_MASK = 0x8888;
+    constexpr s32 GRAY_MASK = 0x3333;
+    if ((_mm_movemask_epi8(_mm_cmpeq_epi8(andVec, ones)) & ALPHA_MASK) != ALPHA_MASK) rtResult.isOpaque = false;
+    if ((_mm_movemask_epi8(binaryVec) & ALPHA_MASK) != ALPHA_MASK) rtResult.isBinaryAlpha = false;
+    if ((_mm_movemask_epi8(grayVec) & GRAY_MASK) != GRAY_MASK) rtResult.isGray = false;
+#endif
+
+    for (; i < rowSize; i += 4)
+    {
+        u8 alpha = row[i + 3];
+        if (alpha != 0xff) rtResult.isOpaque = false;
+        if (alpha != 0 && alpha != 0xff) rtResult.isBinaryAlpha = false;
+        if (row[i] != row[i + 1] || row[i + 1] != row[i + 2]) rtResult.isGray = false;
+    }
+}
+
+}
+
+ColorTable::ColorTable() : entries_(COLOR_TABLE_SIZE, 0) {}
+
+ColorTable::ColorTable(const vector<BGRA>& palette) : entries_(COLOR_TABLE_SIZE, 0)
+{
+    for (const BGRA& color : palette) add(LoadColor(reinterpret_cast<const u8*>(&color)));
+}
+
+bool ColorTable::add(u32 color)
+{
+    for (u32 slot = GetColorHash(color);; slot = (slot + 1) % COLOR_TABLE_SIZE)
+    {
+        u64 entry = entries_[slot];
+        if (entry == 0)
+        {
+            if (count_ == MAX_PALETTE_SIZE) return false;
+
+            count_++;
+            entries_[slot] = (static_cast<u64>(count_) << ENTRY_INDEX_SHIFT) | color;
+            return true;
+        }
+
+        if (static_cast<u32>(entry) == color) return true;
+    }
+}
+
+u8 ColorTable::find(u32 color) const
+{
+    for (u32 slot = GetColorHash(color);; slot = (slot + 1) % COLOR_TABLE_SIZE)
+    {
+        u64 entry = entries_[slot];
+        if (entry == 0) return 0;
+        if (static_cast<u32>(entry) == color) return static_cast<u8>((entry >> ENTRY_INDEX_SHIFT) - 1);
+    }
+}
+
+vector<u32> ColorTable::getColors() const
+{
+    vector<u32> colors(count_);
+    for (u64 entry : entries_)
+    {
+        if (entry != 0) colors[(entry >> ENTRY_INDEX_SHIFT) - 1] = static_cast<u32>(entry);
+    }
+
+    return colors;
+}
+
+PixelLayout Layout::Analysis(const FileData& fileData)
+{
+    u32 rowSize = fileData.width * 4;
+    u32 height = fileData.height;
+    u32 taskCount = (height + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+
+    // 色数が上限を超えたスレッドがあれば、他のスレッドも色の収集を打ち切る
+    vector<TaskResult> results(taskCount);
+    atomic<bool> hasManyColors = false;
+
+    Parallel::For(taskCount, [&](u32 task)
+    {
+        TaskResult& result = results[task];
+        u32 endY = min(height, (task + 1) * ROWS_PER_TASK);
+        for (u32 y = task * ROWS_PER_TASK; y < endY; ++y)
+        {
+            const u8* row = &fileData.pixels[static_cast<size_t>(y) * rowSize];
+            if (!result.isBinaryAlpha && !result.isGray && hasManyColors.load(memory_order_relaxed)) break;
+
+            AnalysisFlags(row, rowSize, result);
+            if (hasManyColors.load(memory_order_relaxed)) continue;
+
+            // 同じ色が続く場合はハッシュ表を引かない
+            u32 prevColor = LoadColor(row);
+            if (!result.colors.add(prevColor)) hasManyColors = true;
+            for (u32 i = 4; i < rowSize && !hasManyColors.load(memory_order_relaxed); i += 4)
+            {
+                u32 color = LoadColor(row + i);
+                if (color == prevColor) continue;
+
+                prevColor = color;
+                if (!result.colors.add(color)) hasManyColors = true;
+            }
+        }
+    });
+
+    PixelLayout layout;
+    bool isOpaque = true;
+    bool isBinaryAlpha = true;
+    layout.isGray = true;
+
+    ColorTable colors;
+    for (const TaskResult& result : results)
+    {
+        isOpaque = isOpaque && result.isOpaque;
+        isBinaryAlpha = isBinaryAlpha && result.isBinaryAlpha;
+        layout.isGray = layout.isGray && result.isGray;
+
+        if (hasManyColors) continue;
+        for (u32 color : result.colors.getColors())
+        {
+            if (!colors.add(color)) hasManyColors = true;
+        }
+    }
+
+    if (isOpaque) layout.alphaType = AlphaType::opaque;
+    else if (isBinaryAlpha) layout.alphaType = AlphaType::binary;
+    else layout.alphaType = AlphaType::translucent;
+
+    // 出力がスレッド数によらないよう並べ替える。リトルエンディアンのBGRAはアルファが最上位になる
+    if (!hasManyColors)
+    {
+        vector<u32> sortedColors = colors.getColors();
+        sort(sortedColors.begin(), sortedColors.end());
+
+        layout.palette.reserve(sortedColors.size());
+        for (u32 color : sortedColors) layout.palette.push_back(ToBGRA(color));
+    }
+
+    return layout;
+}
+
+void Layout::PackRow(const FileData& fileData, u32 y, u32 pixelBytes, u8* rtRow)
+{
+    const u8* src = &fileData.pixels[static_cast<size_t>(y) * fileData.width * 4];
+    switch (pixelBytes)
+    {
+    case 1:
+        for (s32 x = 0; x < fileData.width; ++x) rtRow[x] = src[x * 4];
+        break;
+
+    case 3:
+        for (s32 x = 0; x < fileData.width; ++x)
+        {
+            rtRow[x * 3] = src[x * 4];
+            rtRow[x * 3 + 1] = src[x * 4 + 1];
+            rtRow[x * 3 + 2] = src[x * 4 + 2];
+        }
+        break;
+
+    case 4:
+        memcpy(rtRow, src, static_cast<size_t>(fileData.width) * 4);
+        break;
+
+    default:
+        assert(false);
+        break;
+    }
+}
+
+void Layout::PackRowIndices(const FileData& fileData, u32 y, const ColorTable& table, u8* rtRow)
+{
+    const u8* src = &fileData.pixels[static_cast<size_t>(y) * fileData.width * 4];
+    u32 prevColor = 0;
+    u8 prevIndex = 0;
+    for (s32 x = 0; x < fileData.width; ++x)
+    {
+        u32 color = LoadColor(src + x * 4);
+        if (x == 0 || color != prevColor)
+        {
+            prevColor = color;
+            prevIndex = table.find(color);
+        }
+
+        rtRow[x] = prevIndex;
+    }
+}
+
+bool Layout::UnpackIndices(const u8* indices, u32 count, const vector<BGRA>& palette, u8* rtPixels)
+{
+    for (u32 i = 0; i < count; ++i)
+    {
+        if (indices[i] >= palette.size()) return false;
+        memcpy(rtPixels + i * 4, &palette[indices[i]], 4);
+    }
+
+    return true;
+}
+
+vector<BGRA> Layout::GetGrayPalette()
+{
+    vector<BGRA> palette(256);
+    for (u32 i = 0; i < 256; ++i)
+    {
+        u8 value = static_cast<u8>(i);
+        palette[i] = {value, value, value, 0xff};
+    }
+
+    return palette;
+}
@@ -0,0 +1,480 @@
+﻿#include "pch.h"
+
+#include "quantizer.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include "parallel.h"
+#include "pixel_layout.h"
+
+using namespace std;
+
+namespace
+{
+
+constexpr u32 ROWS_PER_TASK = 32; // 1回の処理で担当する行数
+constexpr u32 SAMPLES_PER_TASK = 4096; // k-meansで1回の処理が担当するヒストグラムの要素数
+constexpr u32 CHANNEL_COUNT = 4;
+
+constexpr s32 BAYER_MATRIX[4][4] =
+{
+    {0, 8, 2, 10},
+    {12, 4, 14, 6},
+    {3, 11, 1, 9},
+    {15, 7, 13, 5},
+};
+
+u32 LoadColor(const u8* pixel)
+{
+    u32 color;
+    memcpy(&color, pixel, 4);
+    return color;
+}
+
+// 各チャンネルの上位5ビットを並べたヒストグラムのキー
+u32 GetHistogramKey(u32 color)
+{
+    return ((color >> 3) & 0x1f) | ((color >> 6) & 0x3e0) | ((color >> 9) & 0x7c00) | ((color >> 12) & 0xf8000);
+}
+
+// ヒストグラムの1要素。キーが同じピクセルのチャンネルごとの合計
+struct ColorBin
+{
+    u32 key = 0;
+    u32 count = 0;
+    u64 sums[CHANNEL_COUNT] = {};
+};
+
+// ヒストグラムの1要素に含まれるピクセルの平均色と数
+struct Sample
+{
+    float color[CHANNEL_COUNT];
+    u32 count;
+};
+
+// 色空間を分割した箱。samplesの[begin, end)を含む
+struct Box
+{
+    u32 begin = 0;
+    u32 end = 0;
+    u64 count = 0;
+    u32 axis = 0; // 広がりの最も大きいチャンネル
+    float range = 0;
+};
+
+// キーの順に並べ、同じキーの要素を1つにまとめる
+void MergeBins(vector<ColorBin>& bins)
+{
+    sort(bins.begin(), bins.end(), [](const ColorBin& a, const ColorBin& b) { return a.key < b.key; });
+
+    size_t count = 0;
+    for (size_t i = 0; i < bins.size(); ++i)
+    {
+        if (count != 0 && bins[count - 1].key == bins[i].key)
+        {
+            ColorBin& merged = bins[count - 1];
+            merged.count += bins[i].count;
+            for (u32 c = 0; c < CHANNEL_COUNT; ++c) merged.sums[c] += bins[i].sums[c];
+        }
+        else bins[count++] = bins[i];
+    }
+
+    bins.resize(count);
+}
+
+// 行をタスクに分けてヒストグラムを作る。各タスクはキーと色を並べて整列し、同じキーをまとめる
+vector<Sample> CreateHistogram(const FileData& fileData)
+{
+    u32 taskCount = (fileData.height + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+    vector<vector<ColorBin>> taskBins(taskCount);
+
+    Parallel::For(taskCount, [&](u32 task)
+    {
+        u32 beginRow = task * ROWS_PER_TASK;
+        u32 endRow = min(beginRow + ROWS_PER_TASK, static_cast<u32>(fileData.height));
+
+        vector<u64> entries;
+        entries.reserve(static_cast<size_t>(endRow - beginRow) * fileData.width);
+        for (u32 y = beginRow; y < endRow; ++y)
+        {
+            const u8* row = fileData.pixels.get() + static_cast<size_t>(y) * fileData.width * 4;
+            for (s32 x = 0; x < fileData.width; ++x)
+            {
+                u32 color = LoadColor(row + x * 4);
+                entries.push_back((static_cast<u64>(GetHistogramKey(color)) << 32) | color);
+            }
+        }
+        sort(entries.begin(), entries.end());
+
+        vector<ColorBin>& bins = taskBins[task];
+        for (u64 entry : entries)
+        {
+            u32 key = static_cast<u32>(entry >> 32);
+            if (bins.empty() || bins.back().key != key) bins.push_back({key, 0, {}});
+
+            ColorBin& bin = bins.back();
+            bin.count++;
+            for (u32 c = 0; c < CHANNEL_COUNT; ++c) bin.sums[c] += (entry >> (c * 8)) & 0xff;
+        }
+    });
+
+    vector<ColorBin> bins;
+    for (const vector<ColorBin>& task : taskBins) bins.insert(bins.end(), task.begin(), task.end());
+    MergeBins(bins);
+
+    vector<Sample> samples(bins.size());
+    for (size_t i = 0; i < bins.size(); ++i)
+    {
+        samples[i].count = bins[i].count;
+        for (u32 c = 0; c < CHANNEL_COUNT; ++c) samples[i].color[c] = static_cast<float>(bins[i].sums[c]) / bins[i].count;
+    }
+
+    return samples;
+}
+
+void MeasureBox(const vector<Sample>& samples, Box& rtBox)
+{
+    float minColor[CHANNEL_COUNT] = {255, 255, 255, 255};
+    float maxColor[CHANNEL_COUNT] = {0, 0, 0, 0};
+    rtBox.count = 0;
+    for (u32 i = rtBox.begin; i < rtBox.end; ++i)
+    {
+        rtBox.count += samples[i].count;
+        for (u32 c = 0; c < CHANNEL_COUNT; ++c)
+        {
+            minColor[c] = min(minColor[c], samples[i].color[c]);
+            maxColor[c] = max(maxColor[c], samples[i].color[c]);
+        }
+    }
+
+    rtBox.axis = 0;
+    rtBox.range = 0;
+    for (u32 c = 0; c < CHANNEL_COUNT; ++c)
+    {
+        if (maxColor[c] - minColor[c] > rtBox.range)
+        {
+            rtBox.axis = c;
+            rtBox.range = maxColor[c] - minColor[c];
+        }
+    }
+}
+
+// ピクセル数と広がりの積が最も大きい箱を、広がりの最も大きいチャンネルのピクセル数の中央で2つに分ける
+vector<Box> MedianCut(vector<Sample>& samples, u32 colorCount)
+{
+    vector<Box> boxes(1);
+    boxes[0].end = static_cast<u32>(samples.size());
+    MeasureBox(samples, boxes[0]);
+
+    while (boxes.size() < colorCount)
+    {
+        auto target = max_element(boxes.begin(), boxes.end(), [](const Box& a, const Box& b)
+        {
+            return a.count * a.range < b.count * b.range;
+        });
+        if (target->range == 0) break;
+
+        Box box = *target;
+        sort(samples.begin() + box.begin, samples.begin() + box.end, [&](const Sample& a, const Sample& b)
+        {
+            return a.color[box.axis] < b.color[box.axis];
+        });
+
+        u32 split = box.begin + 1;
+        u64 half = box.count / 2;
+        u64 count = samples[box.begin].count;
+        while (split < box.end - 1 && count < half) count += samples[split++].count;
+
+        Box lower = box;
+        lower.end = split;
+        MeasureBox(samples, lower);
+
+        Box upper = box;
+        upper.begin = split;
+        MeasureBox(samples, upper);
+
+        *target = lower;
+        boxes.push_back(upper);
+    }
+
+    return boxes;
+}
+
+BGRA ToBGRA(const double* sums, u64 count)
+{
+    u8 color[CHANNEL_COUNT];
+    for (u32 c = 0; c < CHANNEL_COUNT; ++c)
+    {
+        color[c] = static_cast<u8>(min(255.0, round(sums[c] / count)));
+    }
+
+    return {color[0], color[1], color[2], color[3]};
+}
+
+// 各要素を最も近い色に割り当て、割り当てられた要素の平均を新しい色にする。色が変わらなくなった場合は打ち切る
+void Refine(const vector<Sample>& samples, u32 refineCount, vector<BGRA>& rtPalette)
+{
+    u32 paletteSize = static_cast<u32>(rtPalette.size());
+    u32 taskCount = static_cast<u32>((samples.size() + SAMPLES_PER_TASK - 1) / SAMPLES_PER_TASK);
+
+    for (u32 pass = 0; pass < refineCount; ++pass)
+    {
+        PaletteTree tree(rtPalette);
+
+        // タスクごとに合計してからまとめる。要素はパレットの色ごとにチャンネルの合計とピクセル数
+        vector<vector<double>> taskSums(taskCount, vector<double>(paletteSize * (CHANNEL_COUNT + 1), 0.0));
+        Parallel::For(taskCount, [&](u32 task)
+        {
+            vector<double>& sums = taskSums[task];
+            size_t end = min(samples.size(), static_cast<size_t>(task + 1) * SAMPLES_PER_TASK);
+            for (size_t i = static_cast<size_t>(task) * SAMPLES_PER_TASK; i < end; ++i)
+            {
+                const Sample& sample = samples[i];
+                s32 color[CHANNEL_COUNT];
+                for (u32 c = 0; c < CHANNEL_COUNT; ++c) color[c] = static_cast<s32>(sample.color[c] + 0.5f);
+
+                double* sum = &sums[tree.findNearest(color) * (CHANNEL_COUNT + 1)];
+                for (u32 c = 0; c < CHANNEL_COUNT; ++c) sum[c] += static_cast<double>(sample.color[c]) * sample.count;
+                sum[CHANNEL_COUNT] += sample.count;
+            }
+        });
+
+        bool isChanged = false;
+        for (u32 i = 0; i < paletteSize; ++i)
+        {
+            double sum[CHANNEL_COUNT + 1] = {};
+            for (const vector<double>& sums : taskSums)
+            {
+                for (u32 c = 0; c <= CHANNEL_COUNT; ++c) sum[c] += sums[i * (CHANNEL_COUNT + 1) + c];
+            }
+
+            // 割り当てられなかった色はそのまま残す
+            if (sum[CHANNEL_COUNT] == 0) continue;
+
+            BGRA color = ToBGRA(sum, static_cast<u64>(sum[CHANNEL_COUNT]));
+            if (memcmp(&color, &rtPalette[i], sizeof(BGRA)) != 0) isChanged = true;
+            rtPalette[i] = color;
+        }
+
+        if (!isChanged) break;
+    }
+}
+
+void LoadChannels(const u8* pixel, s32* rtColor)
+{
+    for (u32 c = 0; c < CHANNEL_COUNT; ++c) rtColor[c] = pixel[c];
+}
+
+// 誤差を右、左下、下、右下へ7:3:5:1で拡散する。アルファは拡散せず、透明な部分の形を保つ
+void MapDiffused(const FileData& fileData, const PaletteTree& tree, const vector<BGRA>& palette, vector<u8>& rtIndices)
+{
+    // 誤差は16倍した値で持ち、左右の端の外側に1ピクセルずつ余白を置く
+    s32 width = fileData.width;
+    vector<s32> current(static_cast<size_t>(width + 2) * 3, 0);
+    vector<s32> next(current.size(), 0);
+
+    for (s32 y = 0; y < fileData.height; ++y)
+    {
+        // 行ごとに向きを反転し、誤差が一方向に偏らないようにする
+        bool isReverse = (y % 2) == 1;
+        s32 direction = (isReverse) ? -1 : 1;
+        fill(next.begin(), next.end(), 0);
+
+        const u8* row = fileData.pixels.get() + static_cast<size_t>(y) * width * 4;
+        for (s32 i = 0; i < width; ++i)
+        {
+            s32 x = (isReverse) ? width - 1 - i : i;
+            s32 color[CHANNEL_COUNT];
+            LoadChannels(row + x * 4, color);
+
+            s32* error = &current[static_cast<size_t>(x + 1) * 3];
+            for (u32 c = 0; c < 3; ++c) color[c] = clamp(color[c] + error[c] / 16, 0, 255);
+
+            u8 index = tree.findNearest(color);
+            rtIndices[static_cast<size_t>(y) * width + x] = index;
+
+            const u8* chosen = reinterpret_cast<const u8*>(&palette[index]);
+            for (u32 c = 0; c < 3; ++c)
+            {
+                s32 diff = color[c] - chosen[c];
+                current[static_cast<size_t>(x + 1 + direction) * 3 + c] += diff * 7;
+                next[static_cast<size_t>(x + 1 - direction) * 3 + c] += diff * 3;
+                next[static_cast<size_t>(x + 1) * 3 + c] += diff * 5;
+                next[static_cast<size_t>(x + 1 + direction) * 3 + c] += diff;
+            }
+        }
+
+        swap(current, next);
+    }
+}
+
+}
+
+PaletteTree::PaletteTree(const vector<BGRA>& palette)
+{
+    vector<u8> indices(palette.size());
+    iota(indices.begin(), indices.end(), 0);
+
+    nodes_.reserve(palette.size());
+    root_ = build(indices, 0, static_cast<u32>(indices.size()), palette);
+}
+
+s16 PaletteTree::build(vector<u8>& indices, u32 begin, u32 end, const vector<BGRA>& palette)
+{
+    if (begin >= end) return -1;
+
+    // 広がりの最も大きいチャンネルの中央値で左右に分ける
+    u8 minColor[CHANNEL_COUNT] = {255, 255, 255, 255};
+    u8 maxColor[CHANNEL_COUNT] = {0, 0, 0, 0};
+    for (u32 i = begin; i < end; ++i)
+    {
+        const u8* color = reinterpret_cast<const u8*>(&palette[indices[i]]);
+        for (u32 c = 0; c < CHANNEL_COUNT; ++c)
+        {
+            minColor[c] = min(minColor[c], color[c]);
+            maxColor[c] = max(maxColor[c], color[c]);
+        }
+    }
+
+    u8 axis = 0;
+    for (u8 c = 1; c < CHANNEL_COUNT; ++c)
+    {
+        if (maxColor[c] - minColor[c] > maxColor[axis] - minColor[axis]) axis = c;
+    }
+
+    u32 middle = (begin + end) / 2;
+    nth_element(indices.begin() + begin, indices.begin() + middle, indices.begin() + end, [&](u8 a, u8 b)
+    {
+        return reinterpret_cast<const u8*>(&palette[a])[axis] < reinterpret_cast<const u8*>(&palette[b])[axis];
+    });
+
+    Node node;
+    const u8* color = reinterpret_cast<const u8*>(&palette[indices[middle]]);
+    for (u32 c = 0; c < CHANNEL_COUNT; ++c) node.color[c] = color[c];
+    node.index = indices[middle];
+    node.axis = axis;
+
+    s16 nodeIndex = static_cast<s16>(nodes_.size());
+    nodes_.push_back(node);
+
+    s16 left = build(indices, begin, middle, palette);
+    s16 right = build(indices, middle + 1, end, palette);
+    nodes_[nodeIndex].left = left;
+    nodes_[nodeIndex].right = right;
+
+    return nodeIndex;
+}
+
+void PaletteTree::search(s16 nodeIndex, const s32* color, u8& rtIndex, s32& rtDistance) const
+{
+    if (nodeIndex < 0) return;
+
+    const Node& node = nodes_[nodeIndex];
+    s32 distance = 0;
+    for (u32 c = 0; c < CHANNEL_COUNT; ++c)
+    {
+        s32 diff = color[c] - node.color[c];
+        distance += diff * diff;
+    }
+
+    if (distance < rtDistance)
+    {
+        rtDistance = distance;
+        rtIndex = node.index;
+    }
+
+    // 近い側から探し、分割面までの距離が最短距離より近い場合のみ反対側も探す
+    s32 diff = color[node.axis] - node.color[node.axis];
+    search((diff < 0) ? node.left : node.right, color, rtIndex, rtDistance);
+    if (diff * diff < rtDistance) search((diff < 0) ? node.right : node.left, color, rtIndex, rtDistance);
+}
+
+u8 PaletteTree::findNearest(const s32* color) const
+{
+    u8 index = 0;
+    s32 distance = INT32_MAX;
+    search(root_, color, index, distance);
+    return index;
+}
+
+vector<BGRA> Quantizer::CreatePalette(const FileData& fileData, u32 colorCount, u32 refineCount)
+{
+    colorCount = clamp(colorCount, 1u, MAX_PALETTE_SIZE);
+
+    vector<Sample> samples = CreateHistogram(fileData);
+    if (samples.empty()) return {};
+
+    vector<Box> boxes = MedianCut(samples, colorCount);
+
+    vector<BGRA> palette;
+    for (const Box& box : boxes)
+    {
+        double sums[CHANNEL_COUNT] = {};
+        for (u32 i = box.begin; i < box.end; ++i)
+        {
+            for (u32 c = 0; c < CHANNEL_COUNT; ++c) sums[c] += static_cast<double>(samples[i].color[c]) * samples[i].count;
+        }
+        palette.push_back(ToBGRA(sums, box.count));
+    }
+
+    Refine(samples, refineCount, palette);
+    return palette;
+}
+
+vector<u8> Quantizer::Map(const FileData& fileData, const vector<BGRA>& palette, DitherType dither)
+{
+    PaletteTree tree(palette);
+    vector<u8> indices(static_cast<size_t>(fileData.width) * fileData.height);
+
+    if (dither == DitherType::floydSteinberg)
+    {
+        MapDiffused(fileData, tree, palette, indices);
+        return indices;
+    }
+
+    // 組織的ディザの振れ幅は、パレットの色の間隔の半分にする
+    s32 ditherStrength = static_cast<s32>(128.0 / cbrt(static_cast<double>(palette.size())));
+
+    u32 taskCount = (fileData.height + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+    Parallel::For(taskCount, [&](u32 task)
+    {
+        u32 beginRow = task * ROWS_PER_TASK;
+        u32 endRow = min(beginRow + ROWS_PER_TASK, static_cast<u32>(fileData.height));
+        for (u32 y = beginRow; y < endRow; ++y)
+        {
+            const u8* row = fileData.pixels.get() + static_cast<size_t>(y) * fileData.width * 4;
+            u8* rowIndices = &indices[static_cast<size_t>(y) * fileData.width];
+
+            // 同じ色が続く場合は前のピクセルの結果を使う
+            u32 previousColor = 0;
+            u8 previousIndex = 0;
+            bool hasPrevious = false;
+            for (s32 x = 0; x < fileData.width; ++x)
+            {
+                s32 color[CHANNEL_COUNT];
+                LoadChannels(row + x * 4, color);
+
+                if (dither == DitherType::ordered)
+                {
+                    s32 offset = (BAYER_MATRIX[y & 3][x & 3] * 2 + 1 - 16) * ditherStrength / 32;
+                    for (u32 c = 0; c < 3; ++c) color[c] = clamp(color[c] + offset, 0, 255);
+
+                    rowIndices[x] = tree.findNearest(color);
+                    continue;
+                }
+
+                u32 packed = LoadColor(row + x * 4);
+                if (!hasPrevious || packed != previousColor)
+                {
+                    previousColor = packed;
+                    previousIndex = tree.findNearest(color);
+                    hasPrevious = true;
+                }
+                rowIndices[x] = previousIndex;
+            }
+        }
+    });
+
+    return indices;
+}
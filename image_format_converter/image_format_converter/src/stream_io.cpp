@@ -0,0 +1,358 @@
+﻿#include "pch.h"
+
+#include "stream_io.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "format_bmp.h"
+#include "format_dds.h"
+#include "format_png.h"
+#include "format_tga.h"
+#include "pixel_layout.h"
+
+using namespace std;
+
+namespace
+{
+
+constexpr size_t READ_CHUNK_SIZE = 1 << 16;
+
+static_assert(sizeof(TgaFileHeader) == StreamIO::PREFIX_SIZE, "TGAのヘッダーを先頭のバイト列から読み込む");
+
+// 下から数えてy行目
+u8* GetRow(FileData& fileData, s32 y)
+{
+    return fileData.pixels.get() + static_cast<size_t>(y) * fileData.width * 4;
+}
+
+unique_ptr<FileData> CreateFileData(s32 width, s32 height)
+{
+    unique_ptr<FileData> fileData = make_unique<FileData>();
+    fileData->width = width;
+    fileData->height = height;
+    fileData->pixels = make_unique<u8[]>(static_cast<size_t>(width) * height * 4);
+    return fileData;
+}
+
+// 1行のピクセルをBGRAに展開する。pixelBytesが1の場合はパレットのインデックスとして扱う
+bool ExpandRow(const u8* src, s32 width, u32 pixelBytes, const vector<BGRA>& palette, u8* rtRow)
+{
+    switch (pixelBytes)
+    {
+    case 1:
+        return Layout::UnpackIndices(src, width, palette, rtRow);
+
+    case 3:
+        for (s32 x = 0; x < width; ++x)
+        {
+            rtRow[x * 4] = src[x * 3];
+            rtRow[x * 4 + 1] = src[x * 3 + 1];
+            rtRow[x * 4 + 2] = src[x * 3 + 2];
+            rtRow[x * 4 + 3] = 0xff;
+        }
+        return true;
+
+    default:
+        memcpy(rtRow, src, static_cast<size_t>(width) * 4);
+        return true;
+    }
+}
+
+// 先頭からoffsetバイト目まで読み捨てる。既に過ぎている場合はfalseを返す
+bool SkipTo(StreamReader& reader, u64 offset)
+{
+    if (offset < reader.getPosition()) return false;
+    return reader.skip(offset - reader.getPosition());
+}
+
+unique_ptr<FileData> DecodeBmp(StreamReader& reader, const u8* prefix)
+{
+    u8 headers[sizeof(BmpFileHeader) + sizeof(BmpInfoHeader)];
+    memcpy(headers, prefix, StreamIO::PREFIX_SIZE);
+    if (!reader.read(headers + StreamIO::PREFIX_SIZE, sizeof(headers) - StreamIO::PREFIX_SIZE)) return nullptr;
+
+    BmpFileHeader fileHeader;
+    BmpInfoHeader infoHeader;
+    if (!BMP::ReadHeader(headers, sizeof(headers), fileHeader, infoHeader)) return nullptr;
+    if (!IsValidImageSize(infoHeader.width, abs(static_cast<s64>(infoHeader.height)))) return nullptr;
+
+    vector<BGRA> palette;
+    if (infoHeader.pixelDepth == 8)
+    {
+        u32 paletteSize = (infoHeader.clrUsed == 0) ? MAX_PALETTE_SIZE : infoHeader.clrUsed;
+        if (!SkipTo(reader, sizeof(BmpFileHeader) + static_cast<u64>(infoHeader.size))) return nullptr;
+
+        palette.resize(paletteSize);
+        if (!reader.read(reinterpret_cast<u8*>(palette.data()), paletteSize * 4)) return nullptr;
+        for (BGRA& color : palette) color.a = 0xff;
+    }
+
+    if (!SkipTo(reader, fileHeader.fileOffBits)) return nullptr;
+
+    // 下から並ぶ場合は読み込んだ順に、上から並ぶ場合は上の行から埋める
+    unique_ptr<FileData> fileData = CreateFileData(infoHeader.width, abs(infoHeader.height));
+    vector<u8> row((static_cast<size_t>(infoHeader.width) * infoHeader.pixelDepth / 8 + 3) & ~static_cast<size_t>(3));
+    for (s32 i = 0; i < fileData->height; ++i)
+    {
+        if (!reader.read(row.data(), row.size())) return nullptr;
+
+        s32 y = (infoHeader.height > 0) ? i : fileData->height - 1 - i;
+        if (!ExpandRow(row.data(), fileData->width, infoHeader.pixelDepth / 8, palette, GetRow(*fileData, y))) return nullptr;
+    }
+
+    return fileData;
+}
+
+// 行をまたいだRLEのパケットの続き
+struct RlePacket
+{
+    u32 remaining = 0;
+    bool isRepeat = false;
+    u8 pixel[4] = {};
+};
+
+bool ReadRleRow(StreamReader& reader, RlePacket& packet, s32 width, u32 pixelBytes, u8* rtRow)
+{
+    u32 x = 0;
+    while (x < static_cast<u32>(width))
+    {
+        if (packet.remaining == 0)
+        {
+            u8 header = 0;
+            if (!reader.read(&header, 1)) return false;
+
+            packet.isRepeat = (header & 0x80) != 0;
+            packet.remaining = (header & 0x7F) + 1;
+            if (packet.isRepeat && !reader.read(packet.pixel, pixelBytes)) return false;
+        }
+
+        u32 count = min(packet.remaining, width - x);
+        u8* dst = rtRow + x * pixelBytes;
+        if (packet.isRepeat)
+        {
+            for (u32 i = 0; i < count; ++i) memcpy(dst + i * pixelBytes, packet.pixel, pixelBytes);
+        }
+        else if (!reader.read(dst, count * pixelBytes)) return false;
+
+        x += count;
+        packet.remaining -= count;
+    }
+
+    return true;
+}
+
+unique_ptr<FileData> DecodeTga(StreamReader& reader, const u8* prefix)
+{
+    TgaFileHeader header;
+    if (!TGA::ReadHeader(prefix, StreamIO::PREFIX_SIZE, header)) return nullptr;
+
+    u8 imageType = header.imageType;
+    bool isColorMapped = imageType == 1 || imageType == 9;
+    bool isGray = imageType == 3 || imageType == 11;
+
+    if (!reader.skip(header.idLength)) return nullptr;
+
+    vector<BGRA> palette;
+    if (isColorMapped)
+    {
+        u32 entryBytes = header.colorMapDepth / 8;
+
+        vector<u8> entries(header.colorMapLength * entryBytes);
+        if (!reader.read(entries.data(), entries.size())) return nullptr;
+
+        palette.resize(header.colorMapIndex + header.colorMapLength);
+        for (u32 i = 0; i < header.colorMapLength; ++i)
+        {
+            const u8* entry = &entries[i * entryBytes];
+            palette[header.colorMapIndex + i] = {entry[0], entry[1], entry[2], (entryBytes == 4) ? entry[3] : u8(0xff)};
+        }
+    }
+    else if (header.colorMapType == 1)
+    {
+        if (!reader.skip(header.colorMapLength * ((header.colorMapDepth + 7) / 8))) return nullptr;
+    }
+
+    if (isGray) palette = Layout::GetGrayPalette();
+
+    // TGA::analysisと同じく、ビット4が立っている場合は上の行から、ビット5が立っている場合は右から並ぶものとして扱う
+    bool isTopFirst = ((header.imageDescriptor >> 4) & 1) != 0;
+    bool isRightFirst = ((header.imageDescriptor >> 5) & 1) != 0;
+
+    unique_ptr<FileData> fileData = CreateFileData(header.width, header.height);
+    u32 pixelBytes = header.pixelDepth / 8;
+    vector<u8> row(static_cast<size_t>(fileData->width) * pixelBytes);
+    RlePacket packet;
+    for (s32 i = 0; i < fileData->height; ++i)
+    {
+        if (imageType >= 9)
+        {
+            if (!ReadRleRow(reader, packet, fileData->width, pixelBytes, row.data())) return nullptr;
+        }
+        else if (!reader.read(row.data(), row.size())) return nullptr;
+
+        u8* dst = GetRow(*fileData, (isTopFirst) ? fileData->height - 1 - i : i);
+        if (!ExpandRow(row.data(), fileData->width, pixelBytes, palette, dst)) return nullptr;
+
+        if (isRightFirst)
+        {
+            u32* pixels = reinterpret_cast<u32*>(dst);
+            reverse(pixels, pixels + fileData->width);
+        }
+    }
+
+    return fileData;
+}
+
+unique_ptr<FileData> DecodeDds(StreamReader& reader, const u8* prefix)
+{
+    u8 headers[sizeof(u32) + sizeof(DdsHeader) + sizeof(DdsHeaderDx10)];
+    memcpy(headers, prefix, StreamIO::PREFIX_SIZE);
+    if (!reader.read(headers + StreamIO::PREFIX_SIZE, sizeof(headers) - StreamIO::PREFIX_SIZE)) return nullptr;
+
+    DdsHeader header;
+    DdsHeaderDx10 headerDx10;
+    memcpy(&header, headers + sizeof(u32), sizeof(DdsHeader));
+    memcpy(&headerDx10, headers + sizeof(u32) + sizeof(DdsHeader), sizeof(DdsHeaderDx10));
+
+    // DDS::analysisと同じく、DX10ヘッダーを持つR8G8B8A8_UNORM_SRGBの2Dテクスチャに対応
+    if (header.ddspf.fourCC != DDS_FOURCC_DX10) return nullptr;
+    if (headerDx10.dxgiFormat != DDS_DXGI_FORMAT_R8G8B8A8_UNORM_SRGB) return nullptr;
+    if (headerDx10.resourceDimension != DDS_RESOURCE_DIMENSION_TEXTURE2D) return nullptr;
+    if (!IsValidImageSize(header.width, header.height)) return nullptr;
+
+    // 先頭のスライスの最も大きいミップマップだけを読み込む。上の行からRGBAの順に並ぶ
+    unique_ptr<FileData> fileData = CreateFileData(header.width, header.height);
+    size_t rowSize = static_cast<size_t>(fileData->width) * 4;
+    for (s32 i = 0; i < fileData->height; ++i)
+    {
+        u8* dst = GetRow(*fileData, fileData->height - 1 - i);
+        if (!reader.read(dst, rowSize)) return nullptr;
+
+        for (size_t x = 0; x < rowSize; x += 4) swap(dst[x], dst[x + 2]);
+    }
+
+    return fileData;
+}
+
+}
+
+bool StreamReader::read(u8* rtData, size_t size)
+{
+    // freadは要求したサイズに達するか、終端に達するまで読み込む
+    size_t readSize = fread(rtData, 1, size, stream_);
+    position_ += readSize;
+    return readSize == size;
+}
+
+bool StreamReader::skip(u64 size)
+{
+    u8 buffer[4096];
+    while (size > 0)
+    {
+        size_t chunkSize = static_cast<size_t>(min<u64>(size, sizeof(buffer)));
+        if (!read(buffer, chunkSize)) return false;
+
+        size -= chunkSize;
+    }
+
+    return true;
+}
+
+void StreamReader::skipToEnd()
+{
+    u8 buffer[4096];
+    while (read(buffer, sizeof(buffer))) {}
+}
+
+bool StreamReader::readToEnd(vector<u8>& rtData)
+{
+    size_t size = rtData.size();
+    while (true)
+    {
+        rtData.resize(size + READ_CHUNK_SIZE);
+        size_t readSize = fread(rtData.data() + size, 1, READ_CHUNK_SIZE, stream_);
+        size += readSize;
+        position_ += readSize;
+
+        if (readSize < READ_CHUNK_SIZE) break;
+    }
+
+    rtData.resize(size);
+    return ferror(stream_) == 0;
+}
+
+void StreamIO::SetBinaryMode([[maybe_unused]] FILE* stream)
+{
+#ifdef _WIN32
+    _setmode(_fileno(stream), _O_BINARY);
+#endif
+}
+
+string StreamIO::DetectFormat(const u8* prefix, u32 prefixSize)
+{
+    if (prefixSize >= sizeof(PNG_SIGNATURE) && memcmp(prefix, PNG_SIGNATURE, sizeof(PNG_SIGNATURE)) == 0) return "png";
+
+    u32 magic = 0;
+    if (prefixSize >= sizeof(u32)) memcpy(&magic, prefix, sizeof(u32));
+    if (magic == DDS_MAGIC) return "dds";
+
+    if (prefixSize >= 2 && prefix[0] == 'B' && prefix[1] == 'M') return "bmp";
+
+    // TGAには識別子がないため、ヘッダーの値が対応している組み合わせか確認する
+    TgaFileHeader header;
+    if (TGA::ReadHeader(prefix, prefixSize, header)) return "tga";
+
+    return "";
+}
+
+unique_ptr<FileData> StreamIO::Decode
+(
+    const Converter& converter, StreamReader& reader, string& rtExt, u32& rtResult
+){
+    u8 prefix[PREFIX_SIZE] = {};
+    if (!reader.read(prefix, PREFIX_SIZE))
+    {
+        rtResult = ERROR_FILE_LOAD_FAILED;
+        return nullptr;
+    }
+
+    rtExt = DetectFormat(prefix, PREFIX_SIZE);
+    if (rtExt.empty() || !converter.isSupported(rtExt))
+    {
+        reader.skipToEnd();
+        rtResult = ERROR_UNSUPPORTED_FORMAT;
+        return nullptr;
+    }
+
+    unique_ptr<FileData> fileData;
+    if (rtExt == "bmp") fileData = DecodeBmp(reader, prefix);
+    else if (rtExt == "tga") fileData = DecodeTga(reader, prefix);
+    else if (rtExt == "dds") fileData = DecodeDds(reader, prefix);
+    else
+    {
+        // 1行ずつ読み込めない形式は、終端まで読み込んでから解析する
+        vector<u8> importData(prefix, prefix + PREFIX_SIZE);
+        if (!reader.readToEnd(importData) || importData.size() > UINT32_MAX)
+        {
+            rtResult = ERROR_FILE_LOAD_FAILED;
+            return nullptr;
+        }
+
+        return converter.dataAnalysis(rtExt, importData.data(), static_cast<u32>(importData.size()), rtResult);
+    }
+
+    reader.skipToEnd();
+    rtResult = (fileData != nullptr) ? SUCCESS : ERROR_ANALYSIS_FAILED;
+    return fileData;
+}
+
+u32 StreamIO::Write(FILE* stream, const u8* data, size_t dataSize)
+{
+    if (fwrite(data, 1, dataSize, stream) != dataSize) return ERROR_FILE_OPERATION;
+    return (fflush(stream) == 0) ? SUCCESS : ERROR_FILE_OPERATION;
+}
@@ -0,0 +1,458 @@
+﻿#include "pch.h"
+
+#include "tile_pyramid.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <tuple>
+
+#include "file_io.h"
+#include "format_bmp.h"
+#include "parallel.h"
+#include "pixel_layout.h"
+
+using namespace std;
+
+namespace
+{
+
+// レベル、y、xの順に並べるためのキー。パックされた構造体のメンバーは参照を取れないため値で返す
+tuple<u32, u32, u32> GetEntryKey(const TilePackEntry& entry)
+{
+    return {entry.level, entry.y, entry.x};
+}
+
+// タイルの書き出し先
+class ITileSink
+{
+public:
+    virtual ~ITileSink() = default;
+
+    virtual u32 write(u32 level, u32 x, u32 y, const u8* data, u32 dataSize) = 0;
+    virtual u32 finish() = 0;
+};
+
+// 「レベル/x_y.拡張子」のファイルとして書き出す
+class DirectoryTileSink : public ITileSink
+{
+private:
+    filesystem::path root_;
+    string ext_;
+    vector<bool> hasLevelDirectory_;
+
+public:
+    DirectoryTileSink(string_view root, string ext, u32 levelCount)
+    : root_(root), ext_(move(ext)), hasLevelDirectory_(levelCount, false) {}
+
+    u32 write(u32 level, u32 x, u32 y, const u8* data, u32 dataSize) override
+    {
+        filesystem::path directory = root_ / to_string(level);
+        if (!hasLevelDirectory_[level])
+        {
+            error_code error;
+            filesystem::create_directories(directory, error);
+            if (error) return ERROR_FILE_OPERATION;
+
+            hasLevelDirectory_[level] = true;
+        }
+
+        string name = to_string(x) + "_" + to_string(y) + "." + ext_;
+        return FileIO::Write((directory / name).string(), data, dataSize);
+    }
+
+    u32 finish() override { return SUCCESS; }
+};
+
+// タイルを順に追記し、最後にインデックスを書き込んでヘッダーのオフセットを更新する
+class PackTileSink : public ITileSink
+{
+private:
+    ofstream file_;
+    TilePackHeader header_;
+    vector<TilePackEntry> entries_;
+    u64 offset_ = 0;
+
+public:
+    PackTileSink(const TilePackHeader& header) : header_(header) {}
+
+    u32 open(string_view path)
+    {
+        file_.open(string(path), ios::binary | ios::trunc);
+        if (!file_) return ERROR_FILE_OPERATION;
+
+        file_.write(reinterpret_cast<const char*>(&header_), sizeof(TilePackHeader));
+        offset_ = sizeof(TilePackHeader);
+        return (file_) ? SUCCESS : ERROR_FILE_OPERATION;
+    }
+
+    u32 write(u32 level, u32 x, u32 y, const u8* data, u32 dataSize) override
+    {
+        file_.write(reinterpret_cast<const char*>(data), dataSize);
+        if (!file_) return ERROR_FILE_OPERATION;
+
+        entries_.push_back({level, x, y, dataSize, offset_});
+        offset_ += dataSize;
+        return SUCCESS;
+    }
+
+    u32 finish() override
+    {
+        sort(entries_.begin(), entries_.end(), [](const TilePackEntry& a, const TilePackEntry& b)
+        {
+            return GetEntryKey(a) < GetEntryKey(b);
+        });
+
+        header_.tileCount = static_cast<u32>(entries_.size());
+        header_.indexOffset = offset_;
+        file_.write(reinterpret_cast<const char*>(entries_.data()), entries_.size() * sizeof(TilePackEntry));
+
+        file_.seekp(0);
+        file_.write(reinterpret_cast<const char*>(&header_), sizeof(TilePackHeader));
+        file_.close();
+
+        return (file_) ? SUCCESS : ERROR_FILE_OPERATION;
+    }
+};
+
+// 2x2ピクセルの平均で1行に縮小する。幅が奇数の場合は右端のピクセルを繰り返す
+void ReduceRow(const u8* top, const u8* bottom, s32 srcWidth, u8* dst, s32 dstWidth)
+{
+    for (s32 x = 0; x < dstWidth; ++x)
+    {
+        s32 x0 = x * 2 * 4;
+        s32 x1 = min(x * 2 + 1, srcWidth - 1) * 4;
+        for (s32 c = 0; c < 4; ++c)
+        {
+            dst[x * 4 + c] = static_cast<u8>((top[x0 + c] + top[x1 + c] + bottom[x0 + c] + bottom[x1 + c] + 2) >> 2);
+        }
+    }
+}
+
+struct Level
+{
+    s32 width = 0;
+    s32 height = 0;
+    u32 receivedRows = 0; // 受け取った行数
+    u32 bandRows = 0; // バンドに溜まっている行数
+    u32 bandIndex = 0; // 上から数えたバンドの位置
+    vector<u8> band;
+};
+
+// 最も大きいレベルから行を受け取り、バンドが埋まるたびにタイルを書き出して1つ小さいレベルに縮小した行を渡す
+class PyramidBuilder
+{
+private:
+    const Converter& converter_;
+    const TileOption& option_;
+    ITileSink& sink_;
+    vector<Level> levels_;
+
+    u32 flushBand(u32 level)
+    {
+        Level& current = levels_[level];
+        u32 tileSize = option_.tileSize;
+        u32 tileCountX = (current.width + tileSize - 1) / tileSize;
+        u32 rowSize = current.width * 4;
+
+        // バンド内のタイルを並列に変換し、書き出しは順に行う
+        vector<vector<u8>> encodedTiles(tileCountX);
+        atomic<u32> result = SUCCESS;
+        Parallel::For(tileCountX, [&](u32 tileX)
+        {
+            FileData tile;
+            tile.width = min<s32>(tileSize, current.width - tileX * tileSize);
+            tile.height = current.bandRows;
+            tile.pixels = make_unique<u8[]>(static_cast<size_t>(tile.width) * tile.height * 4);
+
+            // バンドは上から、FileDataは下から並ぶ
+            for (s32 y = 0; y < tile.height; ++y)
+            {
+                const u8* src = &current.band[static_cast<size_t>(y) * rowSize + tileX * tileSize * 4];
+                memcpy(&tile.pixels[static_cast<size_t>(tile.height - 1 - y) * tile.width * 4], src, tile.width * 4);
+            }
+
+            u32 tileResult = converter_.dataConvert(option_.exportExt, tile, encodedTiles[tileX]);
+            if (tileResult != SUCCESS) result = tileResult;
+        });
+        if (result != SUCCESS) return result;
+
+        for (u32 tileX = 0; tileX < tileCountX; ++tileX)
+        {
+            const vector<u8>& data = encodedTiles[tileX];
+            u32 writeResult = sink_.write(level, tileX, current.bandIndex, data.data(), static_cast<u32>(data.size()));
+            if (writeResult != SUCCESS) return writeResult;
+        }
+
+        vector<u8> reduced;
+        u32 reducedRows = 0;
+        if (level > 0)
+        {
+            // 最後のバンドの行数が奇数の場合は最後の行を繰り返す
+            const Level& next = levels_[level - 1];
+            reducedRows = (current.bandRows + 1) / 2;
+            reduced.resize(static_cast<size_t>(reducedRows) * next.width * 4);
+            Parallel::For(reducedRows, [&](u32 y)
+            {
+                const u8* top = &current.band[static_cast<size_t>(y * 2) * rowSize];
+                const u8* bottom = &current.band[static_cast<size_t>(min(y * 2 + 1, current.bandRows - 1)) * rowSize];
+                ReduceRow(top, bottom, current.width, &reduced[static_cast<size_t>(y) * next.width * 4], next.width);
+            });
+        }
+
+        current.bandRows = 0;
+        current.bandIndex++;
+
+        if (level > 0) return pushRows(level - 1, reduced.data(), reducedRows);
+        return SUCCESS;
+    }
+
+public:
+    PyramidBuilder(const Converter& converter, const TileOption& option, ITileSink& sink, s32 width, s32 height, u32 levelCount)
+    : converter_(converter), option_(option), sink_(sink), levels_(levelCount)
+    {
+        for (u32 i = levelCount; i-- > 0;)
+        {
+            Level& level = levels_[i];
+            level.width = (i + 1 == levelCount) ? width : (levels_[i + 1].width + 1) / 2;
+            level.height = (i + 1 == levelCount) ? height : (levels_[i + 1].height + 1) / 2;
+            level.band.resize(static_cast<size_t>(level.width) * option.tileSize * 4);
+        }
+    }
+
+    // 上から順に行を渡す
+    u32 pushRows(u32 level, const u8* rows, u32 count)
+    {
+        Level& current = levels_[level];
+        u32 rowSize = current.width * 4;
+        while (count > 0)
+        {
+            u32 copyRows = min(count, option_.tileSize - current.bandRows);
+            memcpy(&current.band[static_cast<size_t>(current.bandRows) * rowSize], rows, static_cast<size_t>(copyRows) * rowSize);
+            current.bandRows += copyRows;
+            current.receivedRows += copyRows;
+            rows += static_cast<size_t>(copyRows) * rowSize;
+            count -= copyRows;
+
+            if (current.bandRows == option_.tileSize || current.receivedRows == static_cast<u32>(current.height))
+            {
+                u32 result = flushBand(level);
+                if (result != SUCCESS) return result;
+            }
+        }
+
+        return SUCCESS;
+    }
+};
+
+}
+
+bool FileDataRowSource::read(u32 y, u32 count, u8* rtPixels)
+{
+    if (y + count > static_cast<u32>(fileData_->height)) return false;
+
+    // FileDataは左下から並ぶため、上から数えた行を下から数え直す
+    size_t rowSize = static_cast<size_t>(fileData_->width) * 4;
+    for (u32 i = 0; i < count; ++i)
+    {
+        memcpy(rtPixels + i * rowSize, &fileData_->pixels[(fileData_->height - 1 - y - i) * rowSize], rowSize);
+    }
+
+    return true;
+}
+
+bool BmpRowSource::open(string_view path)
+{
+    file_.open(string(path), ios::binary);
+    if (!file_) return false;
+
+    // 全体を展開しないため、画像の大きさはメモリに収まらなくてもよい
+    u8 headers[sizeof(BmpFileHeader) + sizeof(BmpInfoHeader)];
+    file_.read(reinterpret_cast<char*>(headers), sizeof(headers));
+    if (!file_) return false;
+
+    BmpFileHeader fileHeader;
+    BmpInfoHeader infoHeader;
+    if (!BMP::ReadHeader(headers, sizeof(headers), fileHeader, infoHeader)) return false;
+
+    if (infoHeader.pixelDepth == 8)
+    {
+        u32 paletteSize = (infoHeader.clrUsed == 0) ? MAX_PALETTE_SIZE : infoHeader.clrUsed;
+
+        palette_.resize(paletteSize);
+        file_.seekg(sizeof(BmpFileHeader) + infoHeader.size);
+        file_.read(reinterpret_cast<char*>(palette_.data()), paletteSize * 4);
+        if (!file_) return false;
+
+        for (BGRA& color : palette_) color.a = 0xff;
+    }
+
+    width_ = infoHeader.width;
+    height_ = abs(infoHeader.height);
+    pixelDepth_ = infoHeader.pixelDepth;
+    isBottomUp_ = infoHeader.height > 0;
+    dataOffset_ = fileHeader.fileOffBits;
+    rowSize_ = (static_cast<u64>(width_) * pixelDepth_ / 8 + 3) & ~3ull;
+
+    // ピクセルデータがファイル内に収まっているか確認
+    file_.seekg(0, ios::end);
+    u64 fileSize = static_cast<u64>(file_.tellg());
+    return dataOffset_ + rowSize_ * height_ <= fileSize;
+}
+
+bool BmpRowSource::read(u32 y, u32 count, u8* rtPixels)
+{
+    if (y + count > static_cast<u32>(height_)) return false;
+
+    // 下から並ぶ場合は、読み込む範囲の最も下の行がファイルの先頭側になる
+    u64 firstRow = (isBottomUp_) ? height_ - y - count : y;
+    rowBuffer_.resize(rowSize_ * count);
+    file_.seekg(dataOffset_ + rowSize_ * firstRow);
+    file_.read(reinterpret_cast<char*>(rowBuffer_.data()), rowBuffer_.size());
+    if (!file_) return false;
+
+    size_t dstRowSize = static_cast<size_t>(width_) * 4;
+    for (u32 i = 0; i < count; ++i)
+    {
+        const u8* src = &rowBuffer_[rowSize_ * ((isBottomUp_) ? count - 1 - i : i)];
+        u8* dst = rtPixels + i * dstRowSize;
+        switch (pixelDepth_)
+        {
+        case 8:
+            if (!Layout::UnpackIndices(src, width_, palette_, dst)) return false;
+            break;
+
+        case 24:
+            for (s32 x = 0; x < width_; ++x)
+            {
+                dst[x * 4] = src[x * 3];
+                dst[x * 4 + 1] = src[x * 3 + 1];
+                dst[x * 4 + 2] = src[x * 3 + 2];
+                dst[x * 4 + 3] = 0xff;
+            }
+            break;
+
+        case 32:
+            memcpy(dst, src, dstRowSize);
+            break;
+        }
+    }
+
+    return true;
+}
+
+u32 TilePyramid::GetLevelCount(s32 width, s32 height, u32 tileSize)
+{
+    u32 levelCount = 1;
+    while (static_cast<u32>(width) > tileSize || static_cast<u32>(height) > tileSize)
+    {
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        levelCount++;
+    }
+
+    return levelCount;
+}
+
+unique_ptr<IRowSource> TilePyramid::OpenSource(const Converter& converter, string_view path)
+{
+    string_view ext = path.substr(path.find_last_of('.') + 1);
+    if (ext == "bmp")
+    {
+        unique_ptr<BmpRowSource> source = make_unique<BmpRowSource>();
+        if (source->open(path)) return source;
+    }
+
+    unique_ptr<FileData> fileData = converter.fileAnalysis(path);
+    if (fileData == nullptr) return nullptr;
+
+    return make_unique<FileDataRowSource>(move(fileData));
+}
+
+u32 TilePyramid::Build(const Converter& converter, IRowSource& source, const TileOption& option, string_view exportPath)
+{
+    if (option.tileSize == 0 || option.tileSize % 2 != 0) return ERROR_INVALID_ARGUMENTS;
+    if (!converter.isSupported(option.exportExt)) return ERROR_UNSUPPORTED_FORMAT;
+
+    s32 width = source.getWidth();
+    s32 height = source.getHeight();
+    u32 levelCount = GetLevelCount(width, height, option.tileSize);
+
+    unique_ptr<ITileSink> sink;
+    if (option.isPacked)
+    {
+        TilePackHeader header = {};
+        header.signature = TILE_PACK_SIGNATURE;
+        header.version = TILE_PACK_VERSION;
+        header.width = width;
+        header.height = height;
+        header.tileSize = option.tileSize;
+        header.levelCount = levelCount;
+        if (option.exportExt.size() >= sizeof(header.ext)) return ERROR_INVALID_ARGUMENTS;
+        memcpy(header.ext, option.exportExt.data(), option.exportExt.size());
+
+        unique_ptr<PackTileSink> packSink = make_unique<PackTileSink>(header);
+        u32 result = packSink->open(exportPath);
+        if (result != SUCCESS) return result;
+
+        sink = move(packSink);
+    }
+    else sink = make_unique<DirectoryTileSink>(exportPath, option.exportExt, levelCount);
+
+    // 最も大きいレベルのバンドの行数ずつ読み込む
+    PyramidBuilder builder(converter, option, *sink, width, height, levelCount);
+    vector<u8> rows(static_cast<size_t>(width) * option.tileSize * 4);
+    for (u32 y = 0; y < static_cast<u32>(height); y += option.tileSize)
+    {
+        u32 count = min(option.tileSize, height - y);
+        if (!source.read(y, count, rows.data())) return ERROR_FILE_OPERATION;
+
+        u32 result = builder.pushRows(levelCount - 1, rows.data(), count);
+        if (result != SUCCESS) return result;
+    }
+
+    return sink->finish();
+}
+
+u32 TilePackReader::open(string_view path)
+{
+    ifstream file(string(path), ios::binary);
+    if (!file) return ERROR_FILE_OPERATION;
+
+    file.read(reinterpret_cast<char*>(&header_), sizeof(TilePackHeader));
+    if (!file) return ERROR_ANALYSIS_FAILED;
+    if (header_.signature != TILE_PACK_SIGNATURE || header_.version != TILE_PACK_VERSION) return ERROR_ANALYSIS_FAILED;
+
+    // 確保する前に、インデックスがファイルに収まるか確認する
+    file.seekg(0, ios::end);
+    u64 fileSize = static_cast<u64>(file.tellg());
+    if (header_.indexOffset > fileSize) return ERROR_ANALYSIS_FAILED;
+    if (header_.tileCount > (fileSize - header_.indexOffset) / sizeof(TilePackEntry)) return ERROR_ANALYSIS_FAILED;
+
+    entries_.resize(header_.tileCount);
+    file.seekg(header_.indexOffset);
+    file.read(reinterpret_cast<char*>(entries_.data()), entries_.size() * sizeof(TilePackEntry));
+    if (!file) return ERROR_ANALYSIS_FAILED;
+
+    path_ = path;
+    return SUCCESS;
+}
+
+u32 TilePackReader::load(u32 level, u32 x, u32 y, vector<u8>& rtData) const
+{
+    tuple<u32, u32, u32> key = {level, y, x};
+    auto found = lower_bound(entries_.begin(), entries_.end(), key, [](const TilePackEntry& entry, const tuple<u32, u32, u32>& key)
+    {
+        return GetEntryKey(entry) < key;
+    });
+    if (found == entries_.end() || GetEntryKey(*found) != key) return ERROR_INVALID_ARGUMENTS;
+
+    ifstream file(path_, ios::binary);
+    if (!file) return ERROR_FILE_OPERATION;
+
+    rtData.resize(found->size);
+    file.seekg(found->offset);
+    file.read(reinterpret_cast<char*>(rtData.data()), found->size);
+
+    return (file) ? SUCCESS : ERROR_FILE_OPERATION;
+}
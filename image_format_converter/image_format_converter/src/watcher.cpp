@@ -0,0 +1,285 @@
+﻿#include "pch.h"
+
+#include "watcher.h"
+
+#include <filesystem>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "file_io.h"
+
+using namespace std;
+
+namespace
+{
+
+constexpr u32 WATCH_MASK = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE;
+constexpr u32 RUNNING_RETRY_MILLISECONDS = 5; // 変換中のファイルが再度保存された場合に、終了を確認する間隔
+
+bool IsInDir(const string& path, const string& dir)
+{
+    return path.size() > dir.size() && path.compare(0, dir.size(), dir) == 0 && path[dir.size()] == '/';
+}
+
+}
+
+Watcher::Watcher(const Converter& converter, WatchOption option, function<void(const ChangeEvent&)> onChange)
+: converter_(converter), option_(move(option)), onChange_(move(onChange))
+{
+    // 監視するフォルダと出力先は、イベントのパスと比べられるよう正規化しておく
+    option_.sourceDir = filesystem::weakly_canonical(option_.sourceDir).string();
+    option_.exportDir = filesystem::weakly_canonical(option_.exportDir).string();
+}
+
+Watcher::~Watcher()
+{
+    workerPool_.reset(); // 変換中のファイルを全て書き出してから閉じる
+    if (inotifyFd_ >= 0) close(inotifyFd_);
+}
+
+u32 Watcher::start()
+{
+    if (!filesystem::is_directory(option_.sourceDir)) return ERROR_FILE_OPERATION;
+
+    inotifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd_ < 0) return ERROR_FILE_OPERATION;
+
+    addWatch(option_.sourceDir);
+    if (watchDirs_.empty()) return ERROR_FILE_OPERATION;
+
+    workerPool_ = make_unique<WorkerPool>(option_.threadCount);
+    return SUCCESS;
+}
+
+void Watcher::addWatch(const string& dir)
+{
+    // 出力先が監視するフォルダの中にある場合、書き出したファイルを再度変換しないよう除外する
+    if (dir == option_.exportDir || IsInDir(dir, option_.exportDir)) return;
+
+    int wd = inotify_add_watch(inotifyFd_, dir.c_str(), WATCH_MASK);
+    if (wd < 0) return;
+    watchDirs_[wd] = dir;
+
+    error_code error;
+    for (const filesystem::directory_entry& entry : filesystem::directory_iterator(dir, error))
+    {
+        if (entry.is_directory(error)) addWatch(entry.path().string());
+    }
+}
+
+void Watcher::poll(u32 timeoutMilliseconds)
+{
+    // 変換待ちのファイルがある場合は、最も早く変換を始める時刻まで待つ
+    Clock::time_point now = Clock::now();
+    Clock::time_point wakeTime = now + chrono::milliseconds(timeoutMilliseconds);
+    {
+        lock_guard<mutex> lock(mutex_);
+        for (const auto& [path, pending] : pendingFiles_)
+        {
+            Clock::time_point startTime = pending.startTime;
+            if (runningFiles_.count(path) != 0) startTime = now + chrono::milliseconds(RUNNING_RETRY_MILLISECONDS);
+            wakeTime = min(wakeTime, startTime);
+        }
+    }
+
+    auto waitTime = chrono::duration_cast<chrono::milliseconds>(wakeTime - now).count();
+    pollfd fd = {inotifyFd_, POLLIN, 0};
+    if (::poll(&fd, 1, static_cast<int>(max<s64>(0, waitTime))) > 0) readEvents();
+
+    startDueFiles();
+}
+
+void Watcher::run(const atomic<bool>& isStopped)
+{
+    while (!isStopped) poll(100);
+}
+
+bool Watcher::isIdle()
+{
+    lock_guard<mutex> lock(mutex_);
+    return pendingFiles_.empty() && runningFiles_.empty();
+}
+
+string Watcher::getExportPath(const string& sourcePath) const
+{
+    filesystem::path relativePath = filesystem::path(sourcePath).lexically_relative(option_.sourceDir);
+    filesystem::path exportPath = filesystem::path(option_.exportDir) / relativePath;
+    exportPath.replace_extension("." + option_.exportExt);
+
+    return exportPath.string();
+}
+
+void Watcher::readEvents()
+{
+    alignas(inotify_event) char buff[16 * 1024];
+    while (true)
+    {
+        ssize_t readSize = read(inotifyFd_, buff, sizeof(buff));
+        if (readSize <= 0) break;
+
+        Clock::time_point now = Clock::now();
+        for (char* ptr = buff; ptr < buff + readSize;)
+        {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(ptr);
+            ptr += sizeof(inotify_event) + event->len;
+
+            // キューが溢れてイベントが失われた場合は、監視し直して全体を確認する
+            if ((event->mask & IN_Q_OVERFLOW) != 0)
+            {
+                addWatch(option_.sourceDir);
+                scanDir(option_.sourceDir, now);
+                continue;
+            }
+
+            auto dir = watchDirs_.find(event->wd);
+            if (dir == watchDirs_.end()) continue;
+
+            if ((event->mask & IN_IGNORED) != 0)
+            {
+                watchDirs_.erase(dir);
+                continue;
+            }
+            if (event->len == 0) continue;
+
+            string path = dir->second + "/" + event->name;
+
+            // 新しく作られたフォルダも監視する。監視を始める前に書き込まれたファイルは走査して拾う
+            if ((event->mask & IN_ISDIR) != 0)
+            {
+                if ((event->mask & (IN_CREATE | IN_MOVED_TO)) != 0)
+                {
+                    addWatch(path);
+                    scanDir(path, now);
+                }
+                continue;
+            }
+
+            // 書き込みを終えたファイルと、移動してきたファイルだけを対象にする
+            if ((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) == 0) continue;
+            pushPending(path, now);
+        }
+    }
+}
+
+void Watcher::scanDir(const string& dir, Clock::time_point now)
+{
+    error_code error;
+    filesystem::recursive_directory_iterator it(dir, error);
+    for (; !error && it != filesystem::recursive_directory_iterator(); it.increment(error))
+    {
+        string path = it->path().string();
+        if (it->is_directory(error))
+        {
+            if (path == option_.exportDir) it.disable_recursion_pending();
+            continue;
+        }
+        if (!it->is_regular_file(error) || !converter_.isSupported(path)) continue;
+
+        // 出力が入力より新しい場合は変換済みとみなす
+        filesystem::path exportPath = getExportPath(path);
+        if (filesystem::exists(exportPath, error) &&
+            filesystem::last_write_time(exportPath, error) >= it->last_write_time(error)) continue;
+
+        pushPending(path, now);
+    }
+}
+
+void Watcher::pushPending(const string& path, Clock::time_point now)
+{
+    // 変換できる形式のものだけを対象にする
+    if (!converter_.isSupported(path) || IsInDir(path, option_.exportDir)) return;
+
+    // 保存が続く間は変換を始める時刻を遅らせ、1回の変換にまとめる
+    lock_guard<mutex> lock(mutex_);
+    auto [pending, isInserted] = pendingFiles_.try_emplace(path, PendingFile{now, now});
+    pending->second.startTime = now + chrono::milliseconds(option_.debounceMilliseconds);
+}
+
+void Watcher::startDueFiles()
+{
+    Clock::time_point now = Clock::now();
+
+    lock_guard<mutex> lock(mutex_);
+    for (auto it = pendingFiles_.begin(); it != pendingFiles_.end();)
+    {
+        // 変換中のファイルは、変換を終えるまで待ってから変換し直す
+        if (it->second.startTime > now || runningFiles_.count(it->first) != 0)
+        {
+            ++it;
+            continue;
+        }
+
+        string path = it->first;
+        Clock::time_point detectedTime = it->second.detectedTime;
+        runningFiles_.insert(path);
+        it = pendingFiles_.erase(it);
+
+        workerPool_->push([this, path, detectedTime]() { convertFile(path, detectedTime); });
+    }
+}
+
+void Watcher::convertFile(const string& sourcePath, Clock::time_point detectedTime)
+{
+    ChangeEvent event;
+    event.sourcePath = sourcePath;
+    event.exportPath = getExportPath(sourcePath);
+
+    vector<u8> importData = acquireBuffer();
+    vector<u8> exportData = acquireBuffer();
+
+    event.result = FileIO::Load(sourcePath, importData);
+
+    unique_ptr<FileData> fileData = nullptr;
+    if (event.result == SUCCESS)
+    {
+        fileData = converter_.dataAnalysis(sourcePath, importData.data(), static_cast<u32>(importData.size()), event.result);
+    }
+
+    // 変換結果の大きさに合わせて書き込む。広げた領域は次回以降も使い回す
+    if (fileData != nullptr) event.result = converter_.dataConvert(option_.exportExt, *fileData, exportData);
+
+    // 読み込む側が書き込み途中のファイルを開かないよう、一時ファイルに書き出してから置き換える。
+    // 拡張子だけが違う入力は同じ出力先になるため、一時ファイルの名前は入力のパス全体から決める
+    if (event.result == SUCCESS)
+    {
+        error_code error;
+        filesystem::create_directories(filesystem::path(event.exportPath).parent_path(), error);
+
+        char hashText[17];
+        snprintf(hashText, sizeof(hashText), "%016llx", static_cast<unsigned long long>(hash<string>{}(sourcePath)));
+        string tempPath = event.exportPath + "." + hashText + ".tmp";
+        event.result = FileIO::Write(tempPath, exportData.data(), static_cast<u32>(exportData.size()));
+        if (event.result == SUCCESS)
+        {
+            filesystem::rename(tempPath, event.exportPath, error);
+            if (error) event.result = ERROR_FILE_OPERATION;
+        }
+    }
+
+    releaseBuffer(move(importData));
+    releaseBuffer(move(exportData));
+
+    event.milliseconds = chrono::duration<f64, milli>(Clock::now() - detectedTime).count();
+    if (onChange_) onChange_(event);
+
+    lock_guard<mutex> lock(mutex_);
+    runningFiles_.erase(sourcePath);
+}
+
+vector<u8> Watcher::acquireBuffer()
+{
+    lock_guard<mutex> lock(bufferMutex_);
+    if (buffers_.empty()) return {};
+
+    vector<u8> buffer = move(buffers_.back());
+    buffers_.pop_back();
+    return buffer;
+}
+
+void Watcher::releaseBuffer(vector<u8> buffer)
+{
+    lock_guard<mutex> lock(bufferMutex_);
+    buffers_.push_back(move(buffer));
+}
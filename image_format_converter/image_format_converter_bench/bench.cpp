@@ -0,0 +1,103 @@
+﻿#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+
+#include "pch.h"
+
+#include "converter.h"
+#include "file_io.h"
+#include "format_bmp.h"
+#include "format_tga.h"
+#include "format_dds.h"
+#include "format_png.h"
+
+using namespace std;
+
+namespace
+{
+
+// 処理をiterations回実行し、1回あたりの秒数を返す
+double Measure(u32 iterations, const function<void()>& func)
+{
+    auto start = chrono::steady_clock::now();
+    for (u32 i = 0; i < iterations; ++i) func();
+    auto end = chrono::steady_clock::now();
+
+    return chrono::duration<double>(end - start).count() / iterations;
+}
+
+void PrintResult(const string& name, const string& label, double seconds, u64 pixelBytes, u32 outputSize)
+{
+    double mbps = static_cast<double>(pixelBytes) / (1024.0 * 1024.0) / seconds;
+    cout << left << setw(14) << name << setw(18) << label
+         << right << setw(10) << fixed << setprecision(3) << seconds * 1000.0 << " ms"
+         << setw(10) << setprecision(1) << mbps << " MB/s";
+    if (outputSize != 0)
+    {
+        // 圧縮率は元のBGRAピクセルのサイズに対する倍率
+        cout << setw(12) << outputSize << " bytes"
+             << setw(8) << setprecision(2) << static_cast<double>(pixelBytes) / outputSize << " x";
+    }
+    cout << endl;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    u32 iterations = (argc > 1) ? static_cast<u32>(atoi(argv[1])) : 20;
+    if (iterations == 0) iterations = 1;
+
+    vector<pair<string, unique_ptr<IConverter>>> codecs;
+    codecs.emplace_back("bmp", make_unique<BMP>());
+    codecs.emplace_back("bmp(256)", make_unique<BMP>(QuantizeOption{256}));
+    codecs.emplace_back("tga", make_unique<TGA>(false));
+    codecs.emplace_back("tga(rle)", make_unique<TGA>(true));
+    codecs.emplace_back("tga(rle,256)", make_unique<TGA>(true, QuantizeOption{256}));
+    codecs.emplace_back("dds", make_unique<DDS>());
+    codecs.emplace_back("png(fast)", make_unique<PNG>(DeflateLevel::fast));
+    codecs.emplace_back("png(best)", make_unique<PNG>(DeflateLevel::best));
+
+    cout << "iterations : " << iterations << endl;
+
+    for (const char* name : {"mini.bmp", "windows.bmp", "sample2.bmp", "Lenna.tga", "hari.tga", "sidaba.dds"})
+    {
+        string path = string(RESOURCE_DIR) + "/" + name;
+        string ext = path.substr(path.find_last_of('.') + 1);
+
+        u32 fileSize = 0;
+        unique_ptr<u8[]> fileBuff = FileIO::Load(path, fileSize);
+        if (fileBuff == nullptr)
+        {
+            cout << name << " : ファイルの読み込みに失敗しました。" << endl;
+            continue;
+        }
+
+        IConverter* decoder = nullptr;
+        for (auto& codec : codecs) if (codec.first == ext) decoder = codec.second.get();
+        if (decoder == nullptr) continue;
+
+        unique_ptr<FileData> fileData = decoder->analysis(fileBuff.get(), fileSize);
+        if (fileData == nullptr) continue;
+
+        u64 pixelBytes = static_cast<u64>(fileData->width) * abs(fileData->height) * 4;
+
+        double decodeSec = Measure(iterations, [&]() { decoder->analysis(fileBuff.get(), fileSize); });
+        PrintResult(name, "decode", decodeSec, pixelBytes, fileSize);
+
+        for (auto& codec : codecs)
+        {
+            u32 outputSize = 0;
+            double encodeSec = Measure(iterations, [&]() { codec.second->convert(*fileData, outputSize); });
+            PrintResult(name, "encode " + codec.first, encodeSec, pixelBytes, outputSize);
+
+            // 自身の出力のデコード速度も測る
+            unique_ptr<u8[]> encoded = codec.second->convert(*fileData, outputSize);
+            double redecodeSec = Measure(iterations, [&]() { codec.second->analysis(encoded.get(), outputSize); });
+            PrintResult(name, "decode " + codec.first, redecodeSec, pixelBytes, 0);
+        }
+    }
+
+    return SUCCESS;
+}
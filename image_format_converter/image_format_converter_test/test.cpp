@@ -0,0 +1,1546 @@
+﻿#include "pch.h"
+
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+#include <vector>
+
+#include "image_format_converter/include/pch.h"
+#include "image_format_converter/include/converter.h"
+#include "image_format_converter/include/converter_api.h"
+#include "image_format_converter/include/file_io.h"
+#include "image_format_converter/include/format_bmp.h"
+#include "image_format_converter/include/format_tga.h"
+#include "image_format_converter/include/format_dds.h"
+#include "image_format_converter/include/format_png.h"
+#include "image_format_converter/include/deflate.h"
+#include "image_format_converter/include/parallel.h"
+#include "image_format_converter/include/image_compare.h"
+#include "image_format_converter/include/pixel_kernel.h"
+#include "image_format_converter/include/pixel_layout.h"
+#include "image_format_converter/include/quantizer.h"
+#include "image_format_converter/include/tile_pyramid.h"
+#include "image_format_converter/include/change_feed.h"
+#include "image_format_converter/include/image_hash.h"
+#include "image_format_converter/include/batch.h"
+#include "image_format_converter/include/stream_io.h"
+
+#ifdef __linux__
+#include <chrono>
+#include <mutex>
+
+#include "image_format_converter/include/watcher.h"
+#endif
+
+namespace
+{
+
+std::string ResourcePath(const std::string& name)
+{
+    return std::string(RESOURCE_DIR) + "/" + name;
+}
+
+void AddObservers(Converter& converter)
+{
+    converter.addObserver("bmp", std::make_unique<BMP>());
+    converter.addObserver("tga", std::make_unique<TGA>(true));
+    converter.addObserver("dds", std::make_unique<DDS>());
+    converter.addObserver("png", std::make_unique<PNG>());
+}
+
+// 書き出したデータを再度解析する
+std::unique_ptr<FileData> RoundTrip(const IConverter& codec, const std::unique_ptr<FileData>& fileData)
+{
+    u32 dataSize = 0;
+    std::unique_ptr<u8[]> data = codec.convert(*fileData, dataSize);
+    if (data == nullptr) return nullptr;
+
+    return codec.analysis(data.get(), dataSize);
+}
+
+std::vector<u8> LoadResource(const std::string& name)
+{
+    u32 size = 0;
+    std::unique_ptr<u8[]> data = FileIO::Load(ResourcePath(name), size);
+    if (data == nullptr) return {};
+
+    return std::vector<u8>(data.get(), data.get() + size);
+}
+
+bool IsSamePixels(const std::unique_ptr<FileData>& a, const std::unique_ptr<FileData>& b)
+{
+    if (a->width != b->width || a->height != b->height) return false;
+    return std::memcmp(a->pixels.get(), b->pixels.get(), a->width * a->height * 4) == 0;
+}
+
+}
+
+TEST(ConverterTest, DdsHeaderLayout)
+{
+    // d3d11.hの列挙型と同じサイズ、値であること
+    EXPECT_EQ(20u, sizeof(DdsHeaderDx10));
+    EXPECT_EQ(124u, sizeof(DdsHeader));
+    EXPECT_EQ(29u, static_cast<u32>(DDS_DXGI_FORMAT_R8G8B8A8_UNORM_SRGB));
+    EXPECT_EQ(3u, static_cast<u32>(DDS_RESOURCE_DIMENSION_TEXTURE2D));
+}
+
+TEST(ConverterTest, FileIO)
+{
+    const u8 data[] = {0x00, 0x01, 0x7f, 0x80, 0xff};
+    std::string path = "file_io_test.bin";
+
+    EXPECT_EQ(SUCCESS, FileIO::Write(path, data, sizeof(data)));
+
+    u32 size = 0;
+    std::unique_ptr<u8[]> loaded = FileIO::Load(path, size);
+    ASSERT_TRUE(loaded);
+    EXPECT_EQ(sizeof(data), size);
+    EXPECT_EQ(0, std::memcmp(data, loaded.get(), sizeof(data)));
+
+    std::remove(path.c_str());
+}
+
+TEST(ConverterTest, LoadMissingFile)
+{
+    u32 size = 0;
+    EXPECT_FALSE(FileIO::Load(ResourcePath("not_found.bmp"), size));
+}
+
+TEST(ConverterTest, AnalysisResources)
+{
+    Converter converter;
+    AddObservers(converter);
+
+    std::unique_ptr<FileData> bmp = converter.fileAnalysis(ResourcePath("mini.bmp"));
+    ASSERT_TRUE(bmp);
+    EXPECT_EQ(10, bmp->width);
+    EXPECT_EQ(10, bmp->height);
+
+    std::unique_ptr<FileData> tga = converter.fileAnalysis(ResourcePath("Lenna.tga"));
+    ASSERT_TRUE(tga);
+    EXPECT_EQ(150, tga->width);
+    EXPECT_EQ(150, tga->height);
+
+    std::unique_ptr<FileData> dds = converter.fileAnalysis(ResourcePath("sidaba.dds"));
+    ASSERT_TRUE(dds);
+    EXPECT_EQ(256, dds->width);
+    EXPECT_EQ(256, dds->height);
+}
+
+TEST(ConverterTest, RoundTrip)
+{
+    Converter converter;
+    AddObservers(converter);
+
+    BMP bmp;
+    TGA tga(false);
+    TGA tgaRle(true);
+    DDS dds;
+    PNG pngFast(DeflateLevel::fast);
+    PNG pngBest(DeflateLevel::best);
+    IConverter* codecs[] = {&bmp, &tga, &tgaRle, &dds, &pngFast, &pngBest};
+
+    // 各形式で書き出し、再度読み込んだピクセルが一致すること
+    for (const char* name : {"mini.bmp", "windows.bmp", "Lenna.tga", "hari.tga", "sidaba.dds"})
+    {
+        std::unique_ptr<FileData> src = converter.fileAnalysis(ResourcePath(name));
+        ASSERT_TRUE(src) << name;
+
+        for (IConverter* codec : codecs)
+        {
+            std::unique_ptr<FileData> dst = RoundTrip(*codec, src);
+            ASSERT_TRUE(dst) << name;
+            EXPECT_TRUE(IsSamePixels(src, dst)) << name;
+        }
+    }
+}
+
+TEST(ConverterTest, RleLongRun)
+{
+    // 128ピクセルを超える同色の並びと、行末のLiteralを含む画像
+    std::unique_ptr<FileData> src = std::make_unique<FileData>();
+    src->width = 300;
+    src->height = 3;
+    src->pixels = std::make_unique<u8[]>(src->width * src->height * 4);
+    for (s32 i = 0; i < src->width * src->height; ++i)
+    {
+        u8 value = (i % src->width < 200) ? 0x40 : static_cast<u8>(i);
+        src->pixels[i * 4] = value;
+        src->pixels[i * 4 + 1] = value;
+        src->pixels[i * 4 + 2] = value;
+        src->pixels[i * 4 + 3] = 0xff;
+    }
+
+    TGA tga(true);
+    std::unique_ptr<FileData> dst = RoundTrip(tga, src);
+    ASSERT_TRUE(dst);
+    EXPECT_TRUE(IsSamePixels(src, dst));
+}
+
+TEST(ConverterTest, DeflateRoundTrip)
+{
+    // 繰り返しの多いデータ、乱数のデータ、空のデータ
+    std::vector<u8> repeated(200000);
+    for (size_t i = 0; i < repeated.size(); ++i) repeated[i] = static_cast<u8>((i / 7) % 13);
+
+    std::vector<u8> random(100000);
+    u32 seed = 12345;
+    for (u8& value : random)
+    {
+        seed = seed * 1103515245 + 12345;
+        value = static_cast<u8>(seed >> 16);
+    }
+
+    std::vector<u8> empty;
+
+    for (const std::vector<u8>* data : {&repeated, &random, &empty})
+    {
+        const u8* src = data->data();
+        u32 srcSize = static_cast<u32>(data->size());
+
+        for (DeflateLevel level : {DeflateLevel::fast, DeflateLevel::best})
+        {
+            std::vector<u8> compressed = Deflate::Compress(src, srcSize, level, true);
+
+            std::vector<u8> uncompressed(srcSize);
+            u32 readSize = 0;
+            ASSERT_TRUE(Deflate::Uncompress
+            (
+                compressed.data(), static_cast<u32>(compressed.size()), uncompressed.data(), srcSize, readSize
+            ));
+            EXPECT_EQ(compressed.size(), readSize);
+            if (srcSize != 0)
+            {
+                EXPECT_EQ(0, std::memcmp(src, uncompressed.data(), srcSize));
+            }
+        }
+    }
+
+    // 非圧縮ブロックに切り替わり、サイズがほとんど増えないこと
+    std::vector<u8> compressed = Deflate::Compress(random.data(), static_cast<u32>(random.size()), DeflateLevel::best, true);
+    EXPECT_LT(compressed.size(), random.size() + random.size() / 100);
+    EXPECT_LT(Deflate::Compress(repeated.data(), static_cast<u32>(repeated.size()), DeflateLevel::fast, true).size(), repeated.size() / 20);
+}
+
+TEST(ConverterTest, DeflateConcatenate)
+{
+    std::vector<u8> data(50000);
+    for (size_t i = 0; i < data.size(); ++i) data[i] = static_cast<u8>(i * i >> 5);
+
+    // 独立に圧縮した二つの出力を連結しても一つのストリームとして展開できること
+    u32 half = static_cast<u32>(data.size() / 2);
+    std::vector<u8> stream = Deflate::Compress(data.data(), half, DeflateLevel::fast, false);
+    std::vector<u8> second = Deflate::Compress(data.data() + half, static_cast<u32>(data.size()) - half, DeflateLevel::fast, true);
+    stream.insert(stream.end(), second.begin(), second.end());
+
+    std::vector<u8> uncompressed(data.size());
+    u32 readSize = 0;
+    ASSERT_TRUE(Deflate::Uncompress(stream.data(), static_cast<u32>(stream.size()), uncompressed.data(), static_cast<u32>(data.size()), readSize));
+    EXPECT_EQ(data, uncompressed);
+
+    u32 adler1 = Deflate::Adler32(data.data(), half);
+    u32 adler2 = Deflate::Adler32(data.data() + half, static_cast<u32>(data.size()) - half);
+    EXPECT_EQ(Deflate::Adler32(data.data(), static_cast<u32>(data.size())), Deflate::Adler32Combine(adler1, adler2, static_cast<u32>(data.size()) - half));
+
+    // 途中で途切れたストリームは展開に失敗すること
+    EXPECT_FALSE(Deflate::Uncompress(stream.data(), static_cast<u32>(stream.size()) / 2, uncompressed.data(), static_cast<u32>(data.size()), readSize));
+}
+
+TEST(ConverterTest, PngCompression)
+{
+    Converter converter;
+    AddObservers(converter);
+
+    std::unique_ptr<FileData> src = converter.fileAnalysis(ResourcePath("Lenna.tga"));
+    ASSERT_TRUE(src);
+
+    // 写真のような画像でもTGAのRLE圧縮より小さくなること
+    TGA tgaRle(true);
+    PNG pngFast(DeflateLevel::fast);
+    PNG pngBest(DeflateLevel::best);
+
+    u32 tgaSize = 0;
+    u32 fastSize = 0;
+    u32 bestSize = 0;
+    tgaRle.convert(*src, tgaSize);
+    std::unique_ptr<u8[]> fast = pngFast.convert(*src, fastSize);
+    pngBest.convert(*src, bestSize);
+
+    EXPECT_LT(fastSize, tgaSize);
+    EXPECT_LE(bestSize, fastSize);
+
+    // 署名やCRCが壊れたデータは解析に失敗すること
+    EXPECT_FALSE(pngFast.analysis(fast.get(), fastSize / 2));
+    fast[20] ^= 0xff;
+    EXPECT_FALSE(pngFast.analysis(fast.get(), fastSize));
+    fast[20] ^= 0xff;
+    fast[0] = 0;
+    EXPECT_FALSE(pngFast.analysis(fast.get(), fastSize));
+}
+
+TEST(ConverterTest, CompareEqual)
+{
+    Converter converter;
+    AddObservers(converter);
+
+    // 同じ画像を異なる形式で読み込んでも一致すること
+    std::unique_ptr<FileData> src = converter.fileAnalysis(ResourcePath("hari.tga"));
+    ASSERT_TRUE(src);
+    PNG png;
+    std::unique_ptr<FileData> dst = RoundTrip(png, src);
+    ASSERT_TRUE(dst);
+
+    EXPECT_TRUE(ImageCompare::IsEqual(*src, *dst));
+
+    CompareResult result = ImageCompare::Compare(*src, *dst);
+    EXPECT_TRUE(result.isSameSize);
+    EXPECT_TRUE(result.isEqual);
+    EXPECT_EQ(0u, result.maxAbsError);
+    EXPECT_EQ(0.0, result.mse);
+    EXPECT_TRUE(std::isinf(result.psnr));
+    EXPECT_DOUBLE_EQ(1.0, result.ssim);
+}
+
+TEST(ConverterTest, CompareMetrics)
+{
+    // SIMDの端数処理を含むよう、幅を16の倍数にしない
+    FileData a;
+    a.width = 37;
+    a.height = 70;
+    a.pixels = std::make_unique<u8[]>(a.width * a.height * 4);
+    for (s32 i = 0; i < a.width * a.height * 4; ++i) a.pixels[i] = static_cast<u8>(i * 31 >> 3);
+
+    FileData b;
+    b.width = a.width;
+    b.height = a.height;
+    b.pixels = std::make_unique<u8[]>(a.width * a.height * 4);
+    std::memcpy(b.pixels.get(), a.pixels.get(), a.width * a.height * 4);
+
+    // 最後の行の末尾と、先頭のピクセルを変更する
+    u32 last = a.width * a.height * 4 - 2;
+    b.pixels[last] = static_cast<u8>(a.pixels[last] + 40);
+    b.pixels[0] = static_cast<u8>(a.pixels[0] + 3);
+
+    EXPECT_FALSE(ImageCompare::IsEqual(a, b));
+
+    CompareResult result = ImageCompare::Compare(a, b);
+    EXPECT_FALSE(result.isEqual);
+    EXPECT_EQ(40u, result.maxAbsError);
+    EXPECT_DOUBLE_EQ((40.0 * 40.0 + 3.0 * 3.0) / (a.width * a.height * 4), result.mse);
+    EXPECT_NEAR(10.0 * std::log10(255.0 * 255.0 / result.mse), result.psnr, 1e-9);
+    EXPECT_LT(result.ssim, 1.0);
+    EXPECT_GT(result.ssim, 0.9);
+
+    std::unique_ptr<FileData> heatMap = ImageCompare::CreateHeatMap(a, b);
+    ASSERT_TRUE(heatMap);
+    EXPECT_EQ(255, heatMap->pixels[2]);
+    EXPECT_EQ(255, heatMap->pixels[last - 2 + 2]);
+    EXPECT_GT(255, heatMap->pixels[6]);
+
+    // サイズが異なる場合
+    b.height = a.height - 1;
+    EXPECT_FALSE(ImageCompare::IsEqual(a, b));
+    EXPECT_FALSE(ImageCompare::Compare(a, b).isSameSize);
+    EXPECT_FALSE(ImageCompare::CreateHeatMap(a, b));
+}
+
+namespace
+{
+
+// 全てのピクセルがvalueの画像
+std::unique_ptr<FileData> CreateFilledImage(s32 width, s32 height, u8 value)
+{
+    std::unique_ptr<FileData> fileData = std::make_unique<FileData>();
+    fileData->width = width;
+    fileData->height = height;
+    fileData->pixels = std::make_unique<u8[]>(width * height * 4);
+    std::memset(fileData->pixels.get(), value, width * height * 4);
+    return fileData;
+}
+
+}
+
+TEST(ConverterTest, DdsTextureArray)
+{
+    Converter converter;
+    AddObservers(converter);
+
+    DdsTexture texture;
+    texture.type = DdsTextureType::textureArray;
+    texture.slices.push_back(converter.fileAnalysis(ResourcePath("hari.tga")));
+    texture.slices.push_back(CreateFilledImage(400, 400, 0x20));
+    texture.slices.push_back(CreateFilledImage(400, 400, 0x80));
+    ASSERT_TRUE(texture.slices[0]);
+
+    DDS dds;
+    u32 dataSize = 0;
+    std::unique_ptr<u8[]> data = dds.convertTexture(texture, dataSize);
+    ASSERT_TRUE(data);
+
+    const DdsHeaderDx10* headerDx10 = reinterpret_cast<const DdsHeaderDx10*>(&data[sizeof(u32) + sizeof(DdsHeader)]);
+    EXPECT_EQ(3u, headerDx10->arraySize);
+    EXPECT_EQ(0u, headerDx10->miscFlag);
+
+    std::unique_ptr<DdsTexture> loaded = dds.analysisTexture(data.get(), dataSize);
+    ASSERT_TRUE(loaded);
+    EXPECT_EQ(DdsTextureType::textureArray, loaded->type);
+    ASSERT_EQ(3u, loaded->slices.size());
+    for (size_t i = 0; i < loaded->slices.size(); ++i) EXPECT_TRUE(IsSamePixels(texture.slices[i], loaded->slices[i])) << i;
+
+    // analysisは先頭のスライスを返す
+    std::unique_ptr<FileData> first = dds.analysis(data.get(), dataSize);
+    ASSERT_TRUE(first);
+    EXPECT_TRUE(IsSamePixels(texture.slices[0], first));
+
+    // サイズが揃っていない場合は変換できない
+    texture.slices.push_back(CreateFilledImage(10, 10, 0));
+    EXPECT_FALSE(dds.convertTexture(texture, dataSize));
+
+    // 途中で途切れたデータは解析に失敗する
+    EXPECT_FALSE(dds.analysisTexture(data.get(), dataSize - 1));
+}
+
+TEST(ConverterTest, DdsCubeMap)
+{
+    DDS dds;
+
+    // 面ごとに異なる値で塗った横、縦の展開図。各面の左下のピクセルだけ値を変える
+    for (bool isHorizontal : {true, false})
+    {
+        const s32 faceSize = 5;
+        s32 columns = (isHorizontal) ? 4 : 3;
+        s32 rows = (isHorizontal) ? 3 : 4;
+        std::unique_ptr<FileData> cross = CreateFilledImage(faceSize * columns, faceSize * rows, 0);
+
+        // +X、-X、+Y、-Y、+Z、-Zの位置（列、上から数えた行）
+        const s32 positions[6][2] = {{2, 1}, {0, 1}, {1, 0}, {1, 2}, {1, 1}, {(isHorizontal) ? 3 : 1, (isHorizontal) ? 1 : 3}};
+        for (s32 face = 0; face < 6; ++face)
+        {
+            s32 startX = positions[face][0] * faceSize;
+            s32 startY = (rows - 1 - positions[face][1]) * faceSize;
+            for (s32 y = 0; y < faceSize; ++y)
+            {
+                for (s32 x = 0; x < faceSize; ++x)
+                {
+                    u8* pixel = &cross->pixels[((startY + y) * cross->width + startX + x) * 4];
+                    std::memset(pixel, (x == 0 && y == 0) ? 0xff : 0x10 * (face + 1), 4);
+                }
+            }
+        }
+
+        std::unique_ptr<DdsTexture> texture = dds.splitCross(*cross);
+        ASSERT_TRUE(texture);
+        ASSERT_EQ(6u, texture->slices.size());
+        for (s32 face = 0; face < 6; ++face)
+        {
+            const FileData& slice = *texture->slices[face];
+            EXPECT_EQ(faceSize, slice.width);
+            EXPECT_EQ(0x10 * (face + 1), slice.pixels[4 * 2]);
+
+            // 縦の展開図の-Z面は180度回転している
+            bool isRotated = !isHorizontal && face == 5;
+            u32 cornerIndex = (isRotated) ? (faceSize * faceSize - 1) * 4 : 0;
+            EXPECT_EQ(0xff, slice.pixels[cornerIndex]) << face;
+        }
+
+        u32 dataSize = 0;
+        std::unique_ptr<u8[]> data = dds.convertTexture(*texture, dataSize);
+        ASSERT_TRUE(data);
+
+        const DdsHeaderDx10* headerDx10 = reinterpret_cast<const DdsHeaderDx10*>(&data[sizeof(u32) + sizeof(DdsHeader)]);
+        EXPECT_EQ(1u, headerDx10->arraySize);
+        EXPECT_EQ(DDS_MISC_TEXTURECUBE, headerDx10->miscFlag);
+
+        std::unique_ptr<DdsTexture> loaded = dds.analysisTexture(data.get(), dataSize);
+        ASSERT_TRUE(loaded);
+        EXPECT_EQ(DdsTextureType::cubeMap, loaded->type);
+        ASSERT_EQ(6u, loaded->slices.size());
+        for (s32 face = 0; face < 6; ++face) EXPECT_TRUE(IsSamePixels(texture->slices[face], loaded->slices[face]));
+    }
+
+    // 展開図の形でない場合
+    EXPECT_FALSE(dds.splitCross(*CreateFilledImage(10, 10, 0)));
+}
+
+TEST(ConverterTest, DdsSkipMipMaps)
+{
+    DDS dds;
+    DdsTexture texture;
+    texture.type = DdsTextureType::textureArray;
+    texture.slices.push_back(CreateFilledImage(4, 4, 0x30));
+    texture.slices.push_back(CreateFilledImage(4, 4, 0x60));
+
+    u32 dataSize = 0;
+    std::unique_ptr<u8[]> data = dds.convertTexture(texture, dataSize);
+    ASSERT_TRUE(data);
+
+    // 各スライスの後ろに2x2、1x1のミップマップを挿入したデータを作る
+    const u32 headerSize = sizeof(u32) + sizeof(DdsHeader) + sizeof(DdsHeaderDx10);
+    const u32 imageSize = 4 * 4 * 4;
+    const u32 mipSize = (2 * 2 + 1) * 4;
+    std::vector<u8> mipData(data.get(), data.get() + headerSize);
+    for (u32 i = 0; i < 2; ++i)
+    {
+        const u8* slice = &data[headerSize + imageSize * i];
+        mipData.insert(mipData.end(), slice, slice + imageSize);
+        mipData.insert(mipData.end(), mipSize, 0xee);
+    }
+
+    DdsHeader* header = reinterpret_cast<DdsHeader*>(&mipData[sizeof(u32)]);
+    header->mipMapCount = 3;
+
+    std::unique_ptr<DdsTexture> loaded = dds.analysisTexture(mipData.data(), static_cast<u32>(mipData.size()));
+    ASSERT_TRUE(loaded);
+    ASSERT_EQ(2u, loaded->slices.size());
+    EXPECT_TRUE(IsSamePixels(texture.slices[0], loaded->slices[0]));
+    EXPECT_TRUE(IsSamePixels(texture.slices[1], loaded->slices[1]));
+
+    // ミップマップとスライスのバイト数の合計が桁あふれするヘッダーは解析に失敗すること
+    header->width = 0x8000;
+    header->height = 0x7fff;
+    header->mipMapCount = 32;
+    DdsHeaderDx10* headerDx10 = reinterpret_cast<DdsHeaderDx10*>(&mipData[sizeof(u32) + sizeof(DdsHeader)]);
+    headerDx10->arraySize = UINT32_MAX;
+    headerDx10->miscFlag = DDS_MISC_TEXTURECUBE;
+    EXPECT_FALSE(dds.analysisTexture(mipData.data(), static_cast<u32>(mipData.size())));
+    EXPECT_FALSE(dds.analysis(mipData.data(), static_cast<u32>(mipData.size())));
+}
+
+namespace
+{
+
+// 特殊化する前のPixelFlipperと同じ、ピクセルごとに分岐するスカラー実装
+void ConvertPixelsReference
+(
+    const u8* src, u32 srcBytes, FlippedType type, ChannelOrder order, bool hasPadding,
+    u8* dst, s32 width, s32 height
+){
+    u32 srcIndex = 0;
+    u32 imageSize = width * height * 4;
+    for (u32 i = 0; i < imageSize; i += 4)
+    {
+        u32 x = (i / 4) % width;
+        u32 y = (i / 4) / width;
+
+        u32 flippedIndex;
+        switch (type)
+        {
+        case FlippedType::x:
+            flippedIndex = y * width * 4 + (width - x - 1) * 4;
+            break;
+        case FlippedType::y:
+            flippedIndex = (height - y - 1) * width * 4 + x * 4;
+            break;
+        case FlippedType::xy:
+            flippedIndex = (height - y - 1) * width * 4 + (width - x - 1) * 4;
+            break;
+        default:
+            flippedIndex = i;
+            break;
+        }
+
+        const u8* pixel = &src[srcIndex];
+        dst[flippedIndex] = (order == ChannelOrder::bgra) ? pixel[0] : pixel[2];
+        dst[flippedIndex + 1] = pixel[1];
+        dst[flippedIndex + 2] = (order == ChannelOrder::bgra) ? pixel[2] : pixel[0];
+        dst[flippedIndex + 3] = (srcBytes == 4) ? pixel[3] : 0xff;
+
+        srcIndex += srcBytes;
+        if (hasPadding && x == static_cast<u32>(width) - 1) srcIndex += (4 - (width * srcBytes) % 4) % 4;
+    }
+}
+
+}
+
+TEST(ConverterTest, PixelKernels)
+{
+    std::vector<u8> src(64 * 64 * 4 + 64 * 4);
+    for (size_t i = 0; i < src.size(); ++i) src[i] = static_cast<u8>(i * 7 + (i >> 8));
+
+    // 全ての組み合わせが、パディングの有無が変わる幅を含めてスカラー実装と一致すること
+    u32 checkedCount = 0;
+    for (u32 srcBytes : {3u, 4u})
+    {
+        for (FlippedType type : {FlippedType::none, FlippedType::x, FlippedType::y, FlippedType::xy})
+        {
+            for (ChannelOrder order : {ChannelOrder::bgra, ChannelOrder::rgba})
+            {
+                for (bool hasPadding : {false, true})
+                {
+                    PixelKernel::Kernel kernel = PixelKernel::Find(srcBytes, type, order, hasPadding);
+                    ASSERT_NE(nullptr, kernel);
+                    checkedCount++;
+
+                    for (auto [width, height] : {std::pair{1, 1}, std::pair{3, 2}, std::pair{7, 5}, std::pair{64, 64}})
+                    {
+                        std::vector<u8> expected(width * height * 4);
+                        std::vector<u8> actual(width * height * 4);
+                        ConvertPixelsReference(src.data(), srcBytes, type, order, hasPadding, expected.data(), width, height);
+                        kernel(src.data(), actual.data(), width, height);
+
+                        EXPECT_EQ(expected, actual) 
+                            << srcBytes << " " << type << " " << static_cast<u32>(order) << " " << hasPadding 
+                            << " " << width << "x" << height;
+                    }
+                }
+            }
+        }
+    }
+    EXPECT_EQ(PixelKernel::KERNEL_COUNT, checkedCount);
+    EXPECT_EQ(nullptr, PixelKernel::Find(2, FlippedType::none, ChannelOrder::bgra, false));
+}
+
+TEST(ConverterTest, PixelLayout)
+{
+    // SIMDの端数を含むよう、幅を4の倍数にしない
+    auto createImage = [](u32 colorCount, bool isGray, u8 alpha)
+    {
+        std::unique_ptr<FileData> fileData = std::make_unique<FileData>();
+        fileData->width = 37;
+        fileData->height = 70;
+        fileData->pixels = std::make_unique<u8[]>(fileData->width * fileData->height * 4);
+        for (s32 i = 0; i < fileData->width * fileData->height; ++i)
+        {
+            u32 color = (static_cast<u32>(i) * 2654435761u >> 8) % colorCount;
+            fileData->pixels[i * 4] = static_cast<u8>(color);
+            fileData->pixels[i * 4 + 1] = static_cast<u8>((isGray) ? color : color >> 8);
+            fileData->pixels[i * 4 + 2] = static_cast<u8>((isGray) ? color : color * 7);
+            fileData->pixels[i * 4 + 3] = (i % 3 == 0) ? alpha : 0xff;
+        }
+        return fileData;
+    };
+
+    std::unique_ptr<FileData> gray = createImage(256, true, 0xff);
+    std::unique_ptr<FileData> fewColors = createImage(20, false, 0);
+    std::unique_ptr<FileData> manyColors = createImage(1 << 16, false, 0xff);
+    std::unique_ptr<FileData> translucent = createImage(1 << 16, true, 0x80);
+
+    PixelLayout grayLayout = Layout::Analysis(*gray);
+    EXPECT_EQ(AlphaType::opaque, grayLayout.alphaType);
+    EXPECT_TRUE(grayLayout.isGray);
+    EXPECT_EQ(256u, grayLayout.palette.size());
+
+    PixelLayout fewLayout = Layout::Analysis(*fewColors);
+    EXPECT_EQ(AlphaType::binary, fewLayout.alphaType);
+    EXPECT_FALSE(fewLayout.isGray);
+    ASSERT_EQ(40u, fewLayout.palette.size());
+    EXPECT_EQ(0, fewLayout.palette.front().a); // 透明な色が先頭に並ぶ
+    EXPECT_EQ(0xff, fewLayout.palette.back().a);
+
+    PixelLayout manyLayout = Layout::Analysis(*manyColors);
+    EXPECT_EQ(AlphaType::opaque, manyLayout.alphaType);
+    EXPECT_TRUE(manyLayout.palette.empty());
+
+    PixelLayout translucentLayout = Layout::Analysis(*translucent);
+    EXPECT_EQ(AlphaType::translucent, translucentLayout.alphaType);
+    EXPECT_TRUE(translucentLayout.isGray);
+
+    // 各形式で最小のレイアウトを選び、ピクセルが一致したまま読み込めること
+    struct Expected
+    {
+        const std::unique_ptr<FileData>* image;
+        u8 bmpDepth;
+        u8 tgaType;
+        u8 pngColorType;
+    };
+    const Expected expecteds[] =
+    {
+        {&gray, 8, 3, 0},
+        {&fewColors, 32, 1, 3},
+        {&manyColors, 24, 2, 2},
+        {&translucent, 32, 2, 4},
+    };
+
+    BMP bmp;
+    TGA tga(false);
+    TGA tgaRle(true);
+    PNG png;
+    for (const Expected& expected : expecteds)
+    {
+        const std::unique_ptr<FileData>& image = *expected.image;
+        u32 dataSize = 0;
+
+        std::unique_ptr<u8[]> bmpData = bmp.convert(*image, dataSize);
+        EXPECT_EQ(expected.bmpDepth, bmpData[sizeof(BmpFileHeader) + offsetof(BmpInfoHeader, pixelDepth)]);
+        std::unique_ptr<FileData> bmpImage = bmp.analysis(bmpData.get(), dataSize);
+        ASSERT_TRUE(bmpImage);
+        EXPECT_TRUE(IsSamePixels(image, bmpImage));
+
+        std::unique_ptr<u8[]> tgaData = tga.convert(*image, dataSize);
+        EXPECT_EQ(expected.tgaType, tgaData[offsetof(TgaFileHeader, imageType)]);
+        std::unique_ptr<FileData> tgaImage = tga.analysis(tgaData.get(), dataSize);
+        ASSERT_TRUE(tgaImage);
+        EXPECT_TRUE(IsSamePixels(image, tgaImage));
+
+        std::unique_ptr<u8[]> tgaRleData = tgaRle.convert(*image, dataSize);
+        EXPECT_EQ(expected.tgaType + 8, tgaRleData[offsetof(TgaFileHeader, imageType)]);
+        std::unique_ptr<FileData> tgaRleImage = tgaRle.analysis(tgaRleData.get(), dataSize);
+        ASSERT_TRUE(tgaRleImage);
+        EXPECT_TRUE(IsSamePixels(image, tgaRleImage));
+
+        // IHDRのカラータイプ。署名、チャンクのサイズと種類、幅、高さ、ビット深度の後に置かれる
+        std::unique_ptr<u8[]> pngData = png.convert(*image, dataSize);
+        EXPECT_EQ(expected.pngColorType, pngData[8 + 8 + 9]);
+        std::unique_ptr<FileData> pngImage = png.analysis(pngData.get(), dataSize);
+        ASSERT_TRUE(pngImage);
+        EXPECT_TRUE(IsSamePixels(image, pngImage));
+    }
+}
+
+TEST(ConverterTest, Quantizer)
+{
+    // 256色を超えるグラデーション。幅を4の倍数にしない
+    auto createImage = [](bool isOpaque)
+    {
+        std::unique_ptr<FileData> fileData = std::make_unique<FileData>();
+        fileData->width = 61;
+        fileData->height = 45;
+        fileData->pixels = std::make_unique<u8[]>(61 * 45 * 4);
+        for (s32 y = 0; y < 45; ++y)
+        {
+            for (s32 x = 0; x < 61; ++x)
+            {
+                u8* pixel = &fileData->pixels[(y * 61 + x) * 4];
+                pixel[0] = static_cast<u8>(x * 4);
+                pixel[1] = static_cast<u8>(y * 5);
+                pixel[2] = static_cast<u8>((x + y) * 2);
+                pixel[3] = (isOpaque || x >= 8) ? 0xff : 0;
+            }
+        }
+        return fileData;
+    };
+
+    // k-d木は全ての色と比べた場合と同じ距離の色を返すこと
+    std::vector<BGRA> palette;
+    for (u32 i = 0; i < 100; ++i)
+    {
+        u32 hash = i * 2654435761u;
+        palette.push_back({static_cast<u8>(hash), static_cast<u8>(hash >> 8), static_cast<u8>(hash >> 16), static_cast<u8>(hash >> 24)});
+    }
+    PaletteTree tree(palette);
+    auto getDistance = [](const s32* color, const BGRA& entry)
+    {
+        s32 diff[4] = {color[0] - entry.b, color[1] - entry.g, color[2] - entry.r, color[3] - entry.a};
+        return diff[0] * diff[0] + diff[1] * diff[1] + diff[2] * diff[2] + diff[3] * diff[3];
+    };
+    for (u32 i = 0; i < 1000; ++i)
+    {
+        u32 hash = i * 0x85ebca6bu + 12345;
+        s32 color[4] = {static_cast<s32>(hash & 0xff), static_cast<s32>((hash >> 8) & 0xff), static_cast<s32>((hash >> 16) & 0xff), static_cast<s32>(hash >> 24)};
+
+        s32 nearest = INT32_MAX;
+        for (const BGRA& entry : palette) nearest = std::min(nearest, getDistance(color, entry));
+        ASSERT_EQ(nearest, getDistance(color, palette[tree.findNearest(color)])) << i;
+    }
+
+    std::unique_ptr<FileData> image = createImage(true);
+    std::vector<BGRA> quantized = Quantizer::CreatePalette(*image, 16, 4);
+    ASSERT_FALSE(quantized.empty());
+    EXPECT_LE(quantized.size(), 16u);
+
+    for (DitherType dither : {DitherType::none, DitherType::ordered, DitherType::floydSteinberg})
+    {
+        std::vector<u8> indices = Quantizer::Map(*image, quantized, dither);
+        ASSERT_EQ(61u * 45u, indices.size());
+        for (u8 index : indices) ASSERT_LT(index, quantized.size());
+    }
+
+    // BMPは8ビット、TGAはアルファを持つカラーマップで書き出され、元の画像に近い色で読み込めること
+    QuantizeOption option;
+    option.colorCount = 64;
+    BMP bmp(option);
+    TGA tga(true, option);
+    std::unique_ptr<FileData> translucent = createImage(false);
+    u32 dataSize = 0;
+
+    std::unique_ptr<u8[]> bmpData = bmp.convert(*image, dataSize);
+    EXPECT_EQ(8, bmpData[sizeof(BmpFileHeader) + offsetof(BmpInfoHeader, pixelDepth)]);
+    std::unique_ptr<FileData> bmpImage = bmp.analysis(bmpData.get(), dataSize);
+    ASSERT_TRUE(bmpImage);
+    CompareResult bmpResult = ImageCompare::Compare(*image, *bmpImage);
+    EXPECT_TRUE(bmpResult.isSameSize);
+    EXPECT_GT(bmpResult.psnr, 30.0);
+
+    std::unique_ptr<u8[]> tgaData = tga.convert(*translucent, dataSize);
+    EXPECT_EQ(9, tgaData[offsetof(TgaFileHeader, imageType)]);
+    EXPECT_EQ(32, tgaData[offsetof(TgaFileHeader, colorMapDepth)]);
+    std::unique_ptr<FileData> tgaImage = tga.analysis(tgaData.get(), dataSize);
+    ASSERT_TRUE(tgaImage);
+    CompareResult tgaResult = ImageCompare::Compare(*translucent, *tgaImage);
+    EXPECT_GT(tgaResult.psnr, 30.0);
+
+    // 透明な部分は透明なまま残る
+    for (s32 y = 0; y < 45; ++y) EXPECT_EQ(0, tgaImage->pixels[(y * 61) * 4 + 3]);
+
+    // 色数以下の画像は減色せず、そのまま書き出す
+    std::unique_ptr<FileData> fewColors = createImage(true);
+    for (s32 i = 0; i < 61 * 45; ++i) fewColors->pixels[i * 4 + 2] = fewColors->pixels[i * 4 + 1] = fewColors->pixels[i * 4] & 0xc0;
+    std::unique_ptr<u8[]> fewData = tga.convert(*fewColors, dataSize);
+    std::unique_ptr<FileData> fewImage = tga.analysis(fewData.get(), dataSize);
+    ASSERT_TRUE(fewImage);
+    EXPECT_TRUE(IsSamePixels(fewColors, fewImage));
+}
+
+TEST(ConverterTest, TilePyramid)
+{
+    Converter converter;
+    AddObservers(converter);
+
+    // タイルのサイズで割り切れず、縮小で奇数になる大きさの画像
+    std::unique_ptr<FileData> src = std::make_unique<FileData>();
+    src->width = 300;
+    src->height = 150;
+    src->pixels = std::make_unique<u8[]>(src->width * src->height * 4);
+    for (s32 i = 0; i < src->width * src->height; ++i)
+    {
+        src->pixels[i * 4] = static_cast<u8>(i * 7);
+        src->pixels[i * 4 + 1] = static_cast<u8>(i / src->width * 5);
+        src->pixels[i * 4 + 2] = static_cast<u8>(i % src->width);
+        src->pixels[i * 4 + 3] = static_cast<u8>(0xff - i % 3);
+    }
+    ASSERT_EQ(SUCCESS, converter.fileConvert("tile_source.bmp", src));
+
+    constexpr u32 TILE_SIZE = 64;
+    ASSERT_EQ(4u, TilePyramid::GetLevelCount(src->width, src->height, TILE_SIZE)); // 300、150、75、38
+
+    // BMPは行ごとに読み込み、結果は画像全体を解析した場合と一致すること
+    TileOption option;
+    option.tileSize = TILE_SIZE;
+    option.exportExt = "tga";
+    option.isPacked = true;
+
+    std::unique_ptr<IRowSource> bmpSource = TilePyramid::OpenSource(converter, "tile_source.bmp");
+    ASSERT_NE(nullptr, dynamic_cast<BmpRowSource*>(bmpSource.get()));
+    ASSERT_EQ(SUCCESS, TilePyramid::Build(converter, *bmpSource, option, "tile_bmp.tpk"));
+
+    FileDataRowSource fileDataSource(converter.fileAnalysis("tile_source.bmp"));
+    ASSERT_EQ(SUCCESS, TilePyramid::Build(converter, fileDataSource, option, "tile_data.tpk"));
+
+    std::vector<u8> bmpPack;
+    std::vector<u8> dataPack;
+    ASSERT_EQ(SUCCESS, FileIO::Load("tile_bmp.tpk", bmpPack));
+    ASSERT_EQ(SUCCESS, FileIO::Load("tile_data.tpk", dataPack));
+    EXPECT_EQ(bmpPack, dataPack);
+
+    TilePackReader reader;
+    ASSERT_EQ(SUCCESS, reader.open("tile_bmp.tpk"));
+    EXPECT_EQ(4u, reader.getHeader().levelCount);
+    EXPECT_EQ(15u + 6u + 2u + 1u, reader.getHeader().tileCount);
+
+    TGA tga;
+    auto loadTile = [&](u32 level, u32 x, u32 y)
+    {
+        std::vector<u8> data;
+        if (reader.load(level, x, y, data) != SUCCESS) return std::unique_ptr<FileData>();
+        return tga.analysis(data.data(), static_cast<u32>(data.size()));
+    };
+
+    // 上から数えた座標のピクセル
+    auto getPixel = [](const FileData& fileData, s32 x, s32 y, s32 c)
+    {
+        return fileData.pixels[((fileData.height - 1 - y) * fileData.width + x) * 4 + c];
+    };
+
+    // 右下の端のタイルは元の画像を切り出したものになる
+    std::unique_ptr<FileData> edgeTile = loadTile(3, 4, 2);
+    ASSERT_TRUE(edgeTile);
+    ASSERT_EQ(300 - 256, edgeTile->width);
+    ASSERT_EQ(150 - 128, edgeTile->height);
+    for (s32 y = 0; y < edgeTile->height; ++y)
+    {
+        for (s32 x = 0; x < edgeTile->width; ++x)
+        {
+            for (s32 c = 0; c < 4; ++c)
+            {
+                ASSERT_EQ(getPixel(*src, 256 + x, 128 + y, c), getPixel(*edgeTile, x, y, c));
+            }
+        }
+    }
+
+    // 1つ小さいレベルは2x2ピクセルの平均になる
+    std::unique_ptr<FileData> reducedTile = loadTile(2, 1, 0);
+    ASSERT_TRUE(reducedTile);
+    ASSERT_EQ(TILE_SIZE, static_cast<u32>(reducedTile->width));
+    for (s32 y = 0; y < reducedTile->height; ++y)
+    {
+        for (s32 x = 0; x < reducedTile->width; ++x)
+        {
+            s32 srcX = (TILE_SIZE + x) * 2;
+            for (s32 c = 0; c < 4; ++c)
+            {
+                u32 sum = getPixel(*src, srcX, y * 2, c) + getPixel(*src, srcX + 1, y * 2, c) + 
+                    getPixel(*src, srcX, y * 2 + 1, c) + getPixel(*src, srcX + 1, y * 2 + 1, c);
+                ASSERT_EQ((sum + 2) / 4, getPixel(*reducedTile, x, y, c));
+            }
+        }
+    }
+
+    std::unique_ptr<FileData> topTile = loadTile(0, 0, 0);
+    ASSERT_TRUE(topTile);
+    EXPECT_EQ(38, topTile->width);
+    EXPECT_EQ(19, topTile->height);
+    EXPECT_FALSE(loadTile(0, 1, 0));
+
+    // フォルダに書き出す場合は「レベル/x_y.拡張子」になる
+    option.isPacked = false;
+    option.exportExt = "png";
+    ASSERT_EQ(SUCCESS, TilePyramid::Build(converter, fileDataSource, option, "tile_dir"));
+    std::unique_ptr<FileData> fileTile = converter.fileAnalysis("tile_dir/3/4_2.png");
+    ASSERT_TRUE(fileTile);
+    EXPECT_TRUE(IsSamePixels(edgeTile, fileTile));
+
+    option.tileSize = 3;
+    EXPECT_EQ(ERROR_INVALID_ARGUMENTS, TilePyramid::Build(converter, fileDataSource, option, "tile_dir"));
+
+    // ファイルに収まらないタイル数は確保する前に失敗すること
+    std::vector<u8> badPack = bmpPack;
+    u32 badTileCount = UINT32_MAX;
+    std::memcpy(&badPack[offsetof(TilePackHeader, tileCount)], &badTileCount, sizeof(u32));
+    ASSERT_EQ(SUCCESS, FileIO::Write("tile_bad.tpk", badPack.data(), static_cast<u32>(badPack.size())));
+    TilePackReader badReader;
+    EXPECT_EQ(ERROR_ANALYSIS_FAILED, badReader.open("tile_bad.tpk"));
+
+    std::filesystem::remove_all("tile_dir");
+    std::remove("tile_source.bmp");
+    std::remove("tile_bmp.tpk");
+    std::remove("tile_data.tpk");
+    std::remove("tile_bad.tpk");
+}
+
+TEST(ConverterTest, ParallelNested)
+{
+    // 入れ子のParallel::Forはスレッドを増やさず、外側の処理を行うスレッドで順に処理すること
+    const u32 outerCount = 8;
+    std::vector<bool> isSameThread(outerCount, false);
+    std::vector<bool> isInParallel(outerCount, false);
+    Parallel::For(outerCount, [&](u32 index)
+    {
+        std::thread::id outerId = std::this_thread::get_id();
+        bool same = true;
+        Parallel::For(16, [&](u32) { same = same && std::this_thread::get_id() == outerId; });
+        isSameThread[index] = same;
+        isInParallel[index] = Parallel::IsInParallel() || Parallel::GetThreadCount() == 1;
+    });
+
+    for (u32 i = 0; i < outerCount; ++i)
+    {
+        EXPECT_TRUE(isSameThread[i]) << i;
+        EXPECT_TRUE(isInParallel[i]) << i;
+    }
+    EXPECT_FALSE(Parallel::IsInParallel());
+}
+
+TEST(ConverterTest, ParallelException)
+{
+    // ワーカースレッドで投げられた例外は、終了させずに呼び出したスレッドへ伝えること
+    std::atomic<u32> calledCount = 0;
+    EXPECT_THROW
+    (
+        Parallel::For(1000, [&](u32 index)
+        {
+            calledCount++;
+            if (index == 37) throw std::bad_alloc();
+        }),
+        std::bad_alloc
+    );
+    EXPECT_GE(calledCount.load(), 1u);
+    EXPECT_FALSE(Parallel::IsInParallel());
+
+    // 例外の後も続けて使えること
+    std::atomic<u32> sum = 0;
+    Parallel::For(100, [&](u32 index) { sum += index; });
+    EXPECT_EQ(4950u, sum.load());
+}
+
+TEST(ConverterTest, ImageHash)
+{
+    // ストライプの端数と撹拌の境目を含む長さで、SIMD版とスカラー版が一致すること
+    std::vector<u8> data(5000);
+    for (size_t i = 0; i < data.size(); ++i) data[i] = static_cast<u8>(i * 31 + (i >> 7));
+
+    for (u64 size : {0ull, 1ull, 63ull, 64ull, 65ull, 1024ull, 1025ull, 5000ull})
+    {
+        Hash128 hash = ImageHash::Hash(data.data(), size, 7);
+        EXPECT_EQ(hash, ImageHash::HashScalar(data.data(), size, 7)) << size;
+    }
+
+    // 1バイトの違い、末尾の0、シードで値が変わること
+    Hash128 hash = ImageHash::Hash(data.data(), data.size());
+    std::vector<u8> changed = data;
+    changed[4321] ^= 1;
+    EXPECT_NE(hash, ImageHash::Hash(changed.data(), changed.size()));
+    changed = data;
+    changed.push_back(0);
+    EXPECT_NE(hash, ImageHash::Hash(changed.data(), changed.size()));
+    EXPECT_NE(hash, ImageHash::Hash(data.data(), data.size(), 1));
+
+    // ピクセルの並びが同じでも、幅と高さが違えば別の画像になる
+    FileData wide;
+    wide.width = 20;
+    wide.height = 10;
+    wide.pixels = std::make_unique<u8[]>(20 * 10 * 4);
+    memcpy(wide.pixels.get(), data.data(), 20 * 10 * 4);
+    FileData tall;
+    tall.width = 10;
+    tall.height = 20;
+    tall.pixels = std::make_unique<u8[]>(20 * 10 * 4);
+    memcpy(tall.pixels.get(), data.data(), 20 * 10 * 4);
+    EXPECT_NE(ImageHash::HashImage(wide), ImageHash::HashImage(tall));
+}
+
+TEST(ConverterTest, Batch)
+{
+    namespace fs = std::filesystem;
+    fs::remove_all("batch_src");
+    fs::create_directories("batch_src/sub");
+
+    Converter converter;
+    AddObservers(converter);
+
+    auto createImage = [](u8 seed)
+    {
+        std::unique_ptr<FileData> fileData = std::make_unique<FileData>();
+        fileData->width = 40;
+        fileData->height = 30;
+        fileData->pixels = std::make_unique<u8[]>(40 * 30 * 4);
+        for (s32 i = 0; i < 40 * 30 * 4; ++i) fileData->pixels[i] = static_cast<u8>(i * seed + i / 160);
+        return fileData;
+    };
+
+    // 同じファイルを別名で、同じピクセルを別の形式で保存する
+    std::unique_ptr<FileData> image = createImage(3);
+    std::unique_ptr<FileData> other = createImage(5);
+    ASSERT_EQ(SUCCESS, converter.fileConvert("batch_src/a.bmp", image));
+    image = createImage(3);
+    ASSERT_EQ(SUCCESS, converter.fileConvert("batch_src/c.tga", image));
+    ASSERT_EQ(SUCCESS, converter.fileConvert("batch_src/b.bmp", other));
+    fs::copy_file("batch_src/a.bmp", "batch_src/sub/a_copy.bmp");
+
+    // 出力フォルダが入力フォルダの中にあっても、2回目の実行で出力を入力として扱わないこと
+    BatchOption option;
+    option.sourceDir = "batch_src";
+    option.exportDir = "batch_src/out";
+    option.exportExt = "png";
+    for (bool useVerify : {false, true})
+    {
+        option.useVerify = useVerify;
+        std::vector<BatchEntry> entries = Batch::Run(converter, option);
+        ASSERT_EQ(4u, entries.size());
+
+        EXPECT_EQ("batch_src/a.bmp", entries[0].sourcePath);
+        EXPECT_EQ("batch_src/out/a.png", entries[0].exportPath);
+        EXPECT_EQ("batch_src/sub/a_copy.bmp", entries[3].sourcePath);
+        EXPECT_EQ("batch_src/out/sub/a_copy.png", entries[3].exportPath);
+
+        const DuplicateType types[] = {DuplicateType::none, DuplicateType::none, DuplicateType::pixels, DuplicateType::bytes};
+        const u32 groups[] = {1, 2, 1, 1};
+        for (u32 i = 0; i < 4; ++i)
+        {
+            EXPECT_EQ(SUCCESS, entries[i].result);
+            EXPECT_EQ(types[i], entries[i].duplicateType) << i;
+            EXPECT_EQ(groups[i], entries[i].group) << i;
+            EXPECT_EQ(entries[i].exportSize, fs::file_size(entries[i].exportPath));
+        }
+        EXPECT_EQ(entries[0].pixelHash, entries[2].pixelHash);
+        EXPECT_NE(entries[0].fileHash, entries[2].fileHash);
+        EXPECT_EQ(entries[0].fileHash, entries[3].fileHash);
+
+        std::string report = Batch::FormatReport(entries);
+        EXPECT_EQ
+        (
+            "1\tsource\tbatch_src/a.bmp\tbatch_src/out/a.png\n"
+            "1\tpixels\tbatch_src/c.tga\tbatch_src/out/c.png\n"
+            "1\tbytes\tbatch_src/sub/a_copy.bmp\tbatch_src/out/sub/a_copy.png\n",
+            report
+        );
+    }
+
+    // 重複した画像の出力は代表と同じ内容になる
+    std::vector<u8> representative;
+    std::vector<u8> duplicate;
+    ASSERT_EQ(SUCCESS, FileIO::Load("batch_src/out/a.png", representative));
+    ASSERT_EQ(SUCCESS, FileIO::Load("batch_src/out/sub/a_copy.png", duplicate));
+    EXPECT_EQ(representative, duplicate);
+    std::unique_ptr<FileData> exported = converter.fileAnalysis("batch_src/out/c.png");
+    ASSERT_TRUE(exported);
+    EXPECT_TRUE(IsSamePixels(image, exported));
+
+    // 重複を探さない場合は全て変換する
+    option.useDedup = false;
+    std::vector<BatchEntry> entries = Batch::Run(converter, option);
+    ASSERT_EQ(4u, entries.size());
+    for (const BatchEntry& entry : entries) EXPECT_EQ(DuplicateType::none, entry.duplicateType);
+    EXPECT_TRUE(Batch::FormatReport(entries).empty());
+
+    fs::remove_all("batch_src");
+}
+
+TEST(ConverterTest, BatchSameStem)
+{
+    namespace fs = std::filesystem;
+    fs::remove_all("batch_stem");
+    fs::create_directories("batch_stem/src");
+
+    Converter converter;
+    AddObservers(converter);
+
+    // 拡張子だけが違う入力は、入力の拡張子を残した別の出力になること
+    std::unique_ptr<FileData> image = CreateFilledImage(20, 10, 0x40);
+    ASSERT_EQ(SUCCESS, converter.fileConvert("batch_stem/src/img.bmp", image));
+    ASSERT_EQ(SUCCESS, converter.fileConvert("batch_stem/src/img.tga", image));
+    ASSERT_EQ(SUCCESS, converter.fileConvert("batch_stem/src/other.bmp", image));
+
+    BatchOption option;
+    option.sourceDir = "batch_stem/src";
+    option.exportDir = "batch_stem/out";
+    option.exportExt = "png";
+    for (bool useDedup : {true, false})
+    {
+        for (bool useVerify : {false, true})
+        {
+            fs::remove_all("batch_stem/out");
+            option.useDedup = useDedup;
+            option.useVerify = useVerify;
+
+            std::vector<BatchEntry> entries = Batch::Run(converter, option);
+            ASSERT_EQ(3u, entries.size());
+            EXPECT_EQ("batch_stem/out/img.bmp.png", entries[0].exportPath);
+            EXPECT_EQ("batch_stem/out/img.tga.png", entries[1].exportPath);
+            EXPECT_EQ("batch_stem/out/other.png", entries[2].exportPath);
+
+            for (const BatchEntry& entry : entries)
+            {
+                EXPECT_EQ(SUCCESS, entry.result) << entry.sourcePath;
+                std::unique_ptr<FileData> exported = converter.fileAnalysis(entry.exportPath);
+                ASSERT_TRUE(exported) << entry.exportPath;
+                EXPECT_TRUE(IsSamePixels(image, exported));
+            }
+        }
+    }
+
+    fs::remove_all("batch_stem");
+}
+
+TEST(ConverterTest, StreamDecode)
+{
+    Converter converter;
+    AddObservers(converter);
+
+    // 標準入力と同じく、シークせずに先頭から読み込む。末尾の余分なデータは読み捨てられること
+    auto decode = [&](const std::vector<u8>& data, std::string& rtExt, u32& rtResult)
+    {
+        std::vector<u8> padded = data;
+        padded.resize(data.size() + 100, 0xcd);
+        FileIO::Write("stream_test.bin", padded.data(), static_cast<u32>(padded.size()));
+
+        FILE* fp = fopen("stream_test.bin", "rb");
+        StreamReader reader(fp);
+        std::unique_ptr<FileData> fileData = StreamIO::Decode(converter, reader, rtExt, rtResult);
+        EXPECT_EQ(padded.size(), reader.getPosition()) << rtExt;
+        fclose(fp);
+        return fileData;
+    };
+
+    // ファイル全体を解析した場合と同じピクセルになること
+    auto expectSame = [&](const std::vector<u8>& data, const std::string& ext)
+    {
+        u32 result = SUCCESS;
+        std::unique_ptr<FileData> expected = converter.dataAnalysis(ext, data.data(), static_cast<u32>(data.size()), result);
+        ASSERT_TRUE(expected) << ext;
+
+        std::string detectedExt;
+        std::unique_ptr<FileData> actual = decode(data, detectedExt, result);
+        EXPECT_EQ(ext, detectedExt);
+        ASSERT_EQ(SUCCESS, result) << ext;
+        EXPECT_TRUE(IsSamePixels(expected, actual)) << ext;
+    };
+
+    for (const char* name : {"mini.bmp", "sample2.bmp", "windows.bmp", "Lenna.tga", "hari.tga", "sidaba.dds"})
+    {
+        std::string path = name;
+        expectSame(LoadResource(name), path.substr(path.find_last_of('.') + 1));
+    }
+
+    // 各形式のレイアウト。幅を4の倍数にせず、BMPの行のパディングを含める
+    std::unique_ptr<FileData> image = std::make_unique<FileData>();
+    image->width = 37;
+    image->height = 21;
+    image->pixels = std::make_unique<u8[]>(37 * 21 * 4);
+    auto fill = [&](u32 colorCount, bool isGray, bool isOpaque)
+    {
+        for (s32 i = 0; i < 37 * 21; ++i)
+        {
+            u32 color = (static_cast<u32>(i) * 2654435761u >> 8) % colorCount;
+            image->pixels[i * 4] = static_cast<u8>(color);
+            image->pixels[i * 4 + 1] = static_cast<u8>((isGray) ? color : color >> 8);
+            image->pixels[i * 4 + 2] = static_cast<u8>((isGray) ? color : color * 7);
+            image->pixels[i * 4 + 3] = (isOpaque || i % 3 != 0) ? 0xff : static_cast<u8>(i);
+        }
+    };
+
+    BMP bmp;
+    TGA tga(false);
+    TGA tgaRle(true);
+    DDS dds;
+    PNG png;
+    auto encode = [&](const IConverter& codec)
+    {
+        u32 dataSize = 0;
+        std::unique_ptr<u8[]> data = codec.convert(*image, dataSize);
+        return std::vector<u8>(data.get(), data.get() + dataSize);
+    };
+
+    const bool layouts[][3] = {{false, true, true}, {false, false, true}, {true, false, true}, {true, false, false}};
+    for (const bool* layout : layouts)
+    {
+        fill((layout[0]) ? 1 << 16 : 200, layout[1], layout[2]);
+        expectSame(encode(bmp), "bmp");
+        expectSame(encode(dds), "dds");
+        expectSame(encode(png), "png");
+
+        // 上から並ぶBMPは高さが負になる
+        std::vector<u8> bmpData = encode(bmp);
+        s32* height = reinterpret_cast<s32*>(&bmpData[sizeof(BmpFileHeader) + offsetof(BmpInfoHeader, height)]);
+        *height = -*height;
+        expectSame(bmpData, "bmp");
+
+        // TGAは格納順の全ての組み合わせで確かめる
+        for (const IConverter* codec : {&tga, &tgaRle})
+        {
+            std::vector<u8> tgaData = encode(*codec);
+            for (u8 order = 0; order < 4; ++order)
+            {
+                tgaData[offsetof(TgaFileHeader, imageDescriptor)] = static_cast<u8>((tgaData[17] & 0x0f) | (order << 4));
+                expectSame(tgaData, "tga");
+            }
+        }
+    }
+
+    // 判別できない形式と、途中で途切れたデータ
+    std::string ext;
+    u32 result = SUCCESS;
+    EXPECT_FALSE(decode(std::vector<u8>(32, 0xff), ext, result));
+    EXPECT_EQ(ERROR_UNSUPPORTED_FORMAT, result);
+
+    std::vector<u8> truncated = LoadResource("mini.bmp");
+    truncated.resize(truncated.size() / 2);
+    FileIO::Write("stream_test.bin", truncated.data(), static_cast<u32>(truncated.size()));
+    FILE* fp = fopen("stream_test.bin", "rb");
+    StreamReader reader(fp);
+    EXPECT_FALSE(StreamIO::Decode(converter, reader, ext, result));
+    EXPECT_EQ(ERROR_ANALYSIS_FAILED, result);
+    fclose(fp);
+
+    std::remove("stream_test.bin");
+}
+
+TEST(ConverterTest, ChangeFeed)
+{
+    std::string path = "change_feed_test.txt";
+    std::remove(path.c_str());
+
+    ChangeFeedReader reader(path);
+    EXPECT_TRUE(reader.poll().empty());
+
+    ChangeEvent event;
+    event.result = SUCCESS;
+    event.milliseconds = 1.5;
+    event.sourcePath = "src/a b.bmp";
+    event.exportPath = "out/a b.tga";
+    std::string line = ChangeFeed::Format(event);
+
+    // 改行まで書き込まれていない行は次回に読み込む
+    FileIO::Write(path, reinterpret_cast<const u8*>(line.data()), static_cast<u32>(line.size() - 5));
+    EXPECT_TRUE(reader.poll().empty());
+
+    std::string lines = line + line;
+    FileIO::Write(path, reinterpret_cast<const u8*>(lines.data()), static_cast<u32>(lines.size()));
+    std::vector<ChangeEvent> events = reader.poll();
+    ASSERT_EQ(2u, events.size());
+    EXPECT_EQ(SUCCESS, events[0].result);
+    EXPECT_DOUBLE_EQ(1.5, events[0].milliseconds);
+    EXPECT_EQ("src/a b.bmp", events[0].sourcePath);
+    EXPECT_EQ("out/a b.tga", events[1].exportPath);
+    EXPECT_TRUE(reader.poll().empty());
+
+    ChangeEvent invalid;
+    EXPECT_FALSE(ChangeFeed::Parse("x\t1\ta\tb", invalid));
+    EXPECT_FALSE(ChangeFeed::Parse("0\t1\ta", invalid));
+
+    std::remove(path.c_str());
+}
+
+#ifdef __linux__
+TEST(ConverterTest, Watcher)
+{
+    namespace fs = std::filesystem;
+    fs::path root = fs::temp_directory_path() / ("image_format_converter_watch_" + std::to_string(::getpid()));
+    fs::remove_all(root);
+    fs::create_directories(root / "src" / "sub");
+
+    Converter converter;
+    AddObservers(converter);
+
+    WatchOption option;
+    option.sourceDir = (root / "src").string();
+    option.exportDir = (root / "src" / "out").string(); // 監視するフォルダの中に出力しても再変換しない
+    option.exportExt = "tga";
+    option.debounceMilliseconds = 100;
+
+    std::mutex eventMutex;
+    std::vector<ChangeEvent> events;
+    Watcher watcher(converter, option, [&](const ChangeEvent& event)
+    {
+        std::lock_guard<std::mutex> lock(eventMutex);
+        events.push_back(event);
+    });
+    ASSERT_EQ(SUCCESS, watcher.start());
+
+    auto waitEvents = [&](size_t count)
+    {
+        auto limit = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (std::chrono::steady_clock::now() < limit)
+        {
+            watcher.poll(10);
+
+            std::lock_guard<std::mutex> lock(eventMutex);
+            if (events.size() >= count && watcher.isIdle()) return;
+        }
+    };
+
+    // 短い間隔で何度も保存されたファイルは1回だけ変換する
+    std::vector<u8> bmp = LoadResource("windows.bmp");
+    std::string sourcePath = (root / "src" / "sub" / "image.bmp").string();
+    for (u32 i = 0; i < 3; ++i) FileIO::Write(sourcePath, bmp.data(), static_cast<u32>(bmp.size()));
+    FileIO::Write((root / "src" / "ignored.txt").string(), bmp.data(), 4);
+
+    waitEvents(1);
+    {
+        std::lock_guard<std::mutex> lock(eventMutex);
+        ASSERT_EQ(1u, events.size());
+        EXPECT_EQ(SUCCESS, events[0].result);
+        EXPECT_EQ(fs::weakly_canonical(sourcePath).string(), events[0].sourcePath);
+        EXPECT_EQ((fs::weakly_canonical(root) / "src" / "out" / "sub" / "image.tga").string(), events[0].exportPath);
+    }
+
+    std::unique_ptr<FileData> expected = converter.fileAnalysis(ResourcePath("windows.bmp"));
+    std::unique_ptr<FileData> actual = converter.fileAnalysis(events[0].exportPath);
+    ASSERT_TRUE(actual);
+    EXPECT_TRUE(IsSamePixels(expected, actual));
+
+    // 再度保存すると変換し直す。出力先への書き込みは監視しない
+    FileIO::Write(sourcePath, bmp.data(), static_cast<u32>(bmp.size()));
+    waitEvents(2);
+    for (u32 i = 0; i < 10; ++i) watcher.poll(10);
+    {
+        std::lock_guard<std::mutex> lock(eventMutex);
+        EXPECT_EQ(2u, events.size());
+    }
+
+    // 壊れたファイルは失敗として通知する
+    FileIO::Write(sourcePath, bmp.data(), 10);
+    waitEvents(3);
+    {
+        std::lock_guard<std::mutex> lock(eventMutex);
+        ASSERT_EQ(3u, events.size());
+        EXPECT_NE(SUCCESS, events[2].result);
+    }
+
+    // 書き込み済みのファイルを含むフォルダを移動してきた場合も変換する
+    fs::create_directories(root / "staging");
+    FileIO::Write((root / "staging" / "moved.bmp").string(), bmp.data(), static_cast<u32>(bmp.size()));
+    fs::rename(root / "staging", root / "src" / "moved");
+    waitEvents(4);
+    {
+        std::lock_guard<std::mutex> lock(eventMutex);
+        ASSERT_EQ(4u, events.size());
+        EXPECT_EQ(SUCCESS, events[3].result);
+        EXPECT_EQ((fs::weakly_canonical(root) / "src" / "out" / "moved" / "moved.tga").string(), events[3].exportPath);
+    }
+
+    // 一時ファイルは残さない
+    for (const fs::directory_entry& entry : fs::recursive_directory_iterator(root / "src" / "out"))
+    {
+        EXPECT_NE(".tmp", entry.path().extension().string());
+    }
+
+    fs::remove_all(root);
+}
+#endif
+
+TEST(ConverterTest, TruncatedData)
+{
+    BMP bmp;
+    TGA tga;
+    DDS dds;
+
+    // 途中で途切れたデータは解析に失敗すること
+    for (const char* name : {"mini.bmp", "Lenna.tga", "hari.tga", "sidaba.dds"})
+    {
+        std::vector<u8> data = LoadResource(name);
+        ASSERT_FALSE(data.empty()) << name;
+
+        std::string ext = std::string(name).substr(std::string(name).find_last_of('.') + 1);
+        const IConverter* codec = (ext == "bmp") ? static_cast<IConverter*>(&bmp) : (ext == "tga") ? static_cast<IConverter*>(&tga) : &dds;
+
+        EXPECT_TRUE(codec->analysis(data.data(), static_cast<u32>(data.size()))) << name;
+        EXPECT_FALSE(codec->analysis(data.data(), static_cast<u32>(data.size()) / 2)) << name;
+        EXPECT_FALSE(codec->analysis(data.data(), 8)) << name;
+    }
+}
+
+TEST(ConverterTest, DataConvert)
+{
+    Converter converter;
+    AddObservers(converter);
+
+    std::vector<u8> src = LoadResource("Lenna.tga");
+    ASSERT_FALSE(src.empty());
+
+    u32 result = SUCCESS;
+    std::unique_ptr<FileData> expect = converter.dataAnalysis("tga", src.data(), static_cast<u32>(src.size()), result);
+    ASSERT_EQ(SUCCESS, result);
+
+    // 容量が足りない場合は必要なサイズが返ること
+    u32 dataSize = 0;
+    EXPECT_EQ
+    (
+        ERROR_BUFFER_TOO_SMALL, 
+        converter.dataConvert("tga", src.data(), static_cast<u32>(src.size()), "dds", nullptr, 0, dataSize)
+    );
+    ASSERT_EQ(sizeof(u32) + sizeof(DdsHeader) + sizeof(DdsHeaderDx10) + 150 * 150 * 4, dataSize);
+
+    std::vector<u8> dst(dataSize);
+    EXPECT_EQ
+    (
+        SUCCESS, 
+        converter.dataConvert("tga", src.data(), static_cast<u32>(src.size()), "dds", dst.data(), dataSize, dataSize)
+    );
+
+    std::unique_ptr<FileData> actual = converter.dataAnalysis("dds", dst.data(), dataSize, result);
+    ASSERT_EQ(SUCCESS, result);
+    EXPECT_TRUE(IsSamePixels(expect, actual));
+
+    EXPECT_FALSE(converter.dataAnalysis("jpg", src.data(), static_cast<u32>(src.size()), result));
+    EXPECT_EQ(ERROR_UNSUPPORTED_FORMAT, result);
+}
+
+TEST(ConverterTest, ConcurrentDataConvert)
+{
+    Converter converter;
+    AddObservers(converter);
+
+    std::vector<u8> src = LoadResource("hari.tga");
+    ASSERT_FALSE(src.empty());
+
+    u32 expectSize = 0;
+    converter.dataConvert("tga", src.data(), static_cast<u32>(src.size()), "bmp", nullptr, 0, expectSize);
+    std::vector<u8> expect(expectSize);
+    ASSERT_EQ
+    (
+        SUCCESS, 
+        converter.dataConvert("tga", src.data(), static_cast<u32>(src.size()), "bmp", expect.data(), expectSize, expectSize)
+    );
+
+    // 一つのConverterを複数のスレッドから同時に使用しても結果が変わらないこと
+    const u32 threadCount = 8;
+    std::vector<bool> isSame(threadCount, false);
+    std::vector<std::thread> threads;
+    for (u32 i = 0; i < threadCount; ++i)
+    {
+        threads.emplace_back([&, i]()
+        {
+            std::vector<u8> dst(expectSize);
+            bool same = true;
+            for (u32 j = 0; j < 8; ++j)
+            {
+                u32 dataSize = 0;
+                u32 result = converter.dataConvert
+                (
+                    "tga", src.data(), static_cast<u32>(src.size()), "bmp", dst.data(), expectSize, dataSize
+                );
+                same = same && result == SUCCESS && dst == expect;
+            }
+            isSame[i] = same;
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+
+    for (u32 i = 0; i < threadCount; ++i) EXPECT_TRUE(isSame[i]);
+}
+
+TEST(ConverterTest, CApi)
+{
+    IfcConverter* converter = IfcCreateConverter(1);
+    ASSERT_NE(nullptr, converter);
+
+    std::vector<u8> src = LoadResource("mini.bmp");
+    ASSERT_FALSE(src.empty());
+
+    unsigned int dataSize = 0;
+    EXPECT_EQ
+    (
+        IFC_ERROR_BUFFER_TOO_SMALL, 
+        IfcConvert(converter, "bmp", src.data(), static_cast<unsigned int>(src.size()), "tga", nullptr, 0, &dataSize)
+    );
+
+    std::vector<u8> dst(dataSize);
+    EXPECT_EQ
+    (
+        IFC_SUCCESS, 
+        IfcConvert(converter, "bmp", src.data(), static_cast<unsigned int>(src.size()), "tga", dst.data(), dataSize, &dataSize)
+    );
+    EXPECT_NE(0, dst[2] & 8); // RLE圧縮されたTGA
+
+    // 大きさに合わせて確保する場合は1度の変換で同じ結果を受け取る
+    IfcEncodedData* encodedData = nullptr;
+    EXPECT_EQ
+    (
+        IFC_SUCCESS, 
+        IfcConvertAlloc(converter, "bmp", src.data(), static_cast<unsigned int>(src.size()), "tga", &encodedData)
+    );
+    ASSERT_NE(nullptr, encodedData);
+    unsigned int encodedSize = 0;
+    const unsigned char* encoded = IfcGetEncodedData(encodedData, &encodedSize);
+    EXPECT_EQ(dataSize, encodedSize);
+    EXPECT_TRUE(std::equal(dst.begin(), dst.end(), encoded, encoded + encodedSize));
+    IfcDestroyEncodedData(encodedData);
+
+    EXPECT_EQ
+    (
+        IFC_ERROR_ANALYSIS_FAILED, 
+        IfcConvertAlloc(converter, "dds", src.data(), static_cast<unsigned int>(src.size()), "tga", &encodedData)
+    );
+    EXPECT_EQ(nullptr, encodedData);
+
+    EXPECT_EQ
+    (
+        IFC_ERROR_ANALYSIS_FAILED, 
+        IfcConvert(converter, "dds", src.data(), static_cast<unsigned int>(src.size()), "tga", dst.data(), dataSize, &dataSize)
+    );
+
+    // 幅、高さを掛けると桁あふれするDDSは解析に失敗すること
+    EXPECT_FALSE(IsValidImageSize(0x80000000LL, 0x80000000LL));
+    EXPECT_FALSE(IsValidImageSize(UINT32_MAX, 2));
+    EXPECT_TRUE(IsValidImageSize(0x4000, 0x3FFF));
+
+    std::vector<u8> dds = LoadResource("sidaba.dds");
+    ASSERT_FALSE(dds.empty());
+    u32 hugeSize = 0x80000000;
+    std::memcpy(&dds[sizeof(u32) + offsetof(DdsHeader, height)], &hugeSize, sizeof(u32));
+    std::memcpy(&dds[sizeof(u32) + offsetof(DdsHeader, width)], &hugeSize, sizeof(u32));
+    EXPECT_EQ
+    (
+        IFC_ERROR_ANALYSIS_FAILED, 
+        IfcConvert(converter, "dds", dds.data(), static_cast<unsigned int>(dds.size()), "tga", dst.data(), dataSize, &dataSize)
+    );
+
+    IfcDestroyConverter(converter);
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
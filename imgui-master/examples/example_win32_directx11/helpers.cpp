@@ -11,6 +11,7 @@ using Microsoft::WRL::ComPtr;
 #include "format_bmp.h"
 #include "format_tga.h"
 #include "format_dds.h"
+#include "file_io.h"
 
 #include "texture.h"
 #include "visual_object.h"
@@ -1286,6 +1287,126 @@ HRESULT CreateTextureBuffer
     // シェーダーリソースビュー作成
     hr = D3DDevice()->CreateShaderResourceView(texture.Get(), &srvDesc, &view);
     if (FAILED(hr)) return hr;
+
+    return S_OK;
+}
+
+HRESULT CreateTextureArrayBuffer
+(
+    ComPtr<ID3D11Texture2D> &texture, 
+    ComPtr<ID3D11ShaderResourceView> &view, 
+    DirectX::XMUINT2 clientSize, u32 arraySize, bool isCubeMap, std::unique_ptr<u8[]> &pixels
+){
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = clientSize.x;
+    desc.Height = clientSize.y;
+    desc.MipLevels = 1;
+    desc.ArraySize = arraySize;
+    desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    desc.SampleDesc.Count = 1;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    desc.CPUAccessFlags = 0;
+    desc.MiscFlags = (isCubeMap) ? D3D11_RESOURCE_MISC_TEXTURECUBE : 0;
+
+    // スライスごとのサブリソースデータ。ピクセルはスライス順に連続して並んでいる
+    u32 sliceSize = clientSize.x * clientSize.y * 4;
+    std::vector<D3D11_SUBRESOURCE_DATA> initData(arraySize);
+    for (u32 i = 0; i < arraySize; ++i)
+    {
+        initData[i].pSysMem = pixels.get() + sliceSize * i;
+        initData[i].SysMemPitch = clientSize.x * 4;
+        initData[i].SysMemSlicePitch = sliceSize;
+    }
+
+    // テクスチャ作成
+    HRESULT hr = D3DDevice()->CreateTexture2D(&desc, initData.data(), &texture);
+    if (FAILED(hr)) return hr;
+
+    // シェーダーリソースビューの説明
+    D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+    srvDesc.Format = desc.Format;
+    if (isCubeMap && arraySize == 6)
+    {
+        srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURECUBE;
+        srvDesc.TextureCube.MostDetailedMip = 0;
+        srvDesc.TextureCube.MipLevels = 1;
+    }
+    else if (isCubeMap)
+    {
+        srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURECUBEARRAY;
+        srvDesc.TextureCubeArray.MostDetailedMip = 0;
+        srvDesc.TextureCubeArray.MipLevels = 1;
+        srvDesc.TextureCubeArray.First2DArrayFace = 0;
+        srvDesc.TextureCubeArray.NumCubes = arraySize / 6;
+    }
+    else
+    {
+        srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+        srvDesc.Texture2DArray.MostDetailedMip = 0;
+        srvDesc.Texture2DArray.MipLevels = 1;
+        srvDesc.Texture2DArray.FirstArraySlice = 0;
+        srvDesc.Texture2DArray.ArraySize = arraySize;
+    }
+
+    // シェーダーリソースビュー作成
+    return D3DDevice()->CreateShaderResourceView(texture.Get(), &srvDesc, &view);
+}
+
+namespace
+{
+
+// 配列テクスチャ、キューブマップのDDSを1つのリソースとして作成する。スライスが1枚の場合はS_FALSEを返す
+HRESULT CreateDdsTextureArray(TextureData& texture)
+{
+    u32 dataSize = 0;
+    std::unique_ptr<u8[]> data = FileIO::Load(texture.path, dataSize);
+    if (data == nullptr) return E_FAIL;
+
+    DDS dds;
+    std::unique_ptr<DdsTexture> ddsTexture = dds.analysisTexture(data.get(), dataSize);
+    if (ddsTexture == nullptr) return E_FAIL;
+    if (ddsTexture->slices.size() <= 1) return S_FALSE;
+
+    const FileData& first = *ddsTexture->slices[0];
+    u32 sliceSize = first.width * first.height * 4;
+    u32 arraySize = static_cast<u32>(ddsTexture->slices.size());
+
+    // 各スライスをFileDataのBLTRからTLBRに変換して連続して並べる
+    std::unique_ptr<u8[]> srcPixels = std::make_unique<u8[]>(sliceSize * arraySize);
+    for (u32 i = 0; i < arraySize; ++i)
+    {
+        PixelFlipper flipper;
+        flipper.getFlipTypeToTLBR(PixelStorageOrder::bottomLeftToTopRight);
+        flipper.insertPixelsFlippedRGBA(srcPixels, sliceSize * i, ddsTexture->slices[i]->pixels, first.width, first.height);
+    }
+
+    bool isCubeMap = ddsTexture->type == DdsTextureType::cubeMap;
+    ComPtr<ID3D11Texture2D> newArrayTexture;
+    ComPtr<ID3D11ShaderResourceView> newArrayView;
+    HRESULT hr = CreateTextureArrayBuffer
+    (
+        newArrayTexture, newArrayView, 
+        DirectX::XMUINT2(first.width, first.height), arraySize, isCubeMap, srcPixels
+    );
+    if (FAILED(hr)) return hr;
+
+    // 既存のシェーダーはTexture2Dとして読むため、先頭のスライスは通常のテクスチャとしても作成する
+    ComPtr<ID3D11Texture2D> newTexture;
+    ComPtr<ID3D11ShaderResourceView> newView;
+    hr = CreateTextureBuffer(newTexture, newView, DirectX::XMUINT2(first.width, first.height), srcPixels);
+    if (FAILED(hr)) return hr;
+
+    texture.texture = newTexture;
+    texture.view = newView;
+    texture.arrayTexture = newArrayTexture;
+    texture.arrayView = newArrayView;
+    texture.arraySize = arraySize;
+    texture.isCubeMap = isCubeMap;
+
+    return S_OK;
+}
+
 }
 
 HRESULT CreateTextures(Converter &converter, TextureContainer &container)
@@ -1318,22 +1439,50 @@ HRESULT CreateTextures(Converter &converter, TextureContainer &container)
         TextureData* texture = container.getTexture(i);
         if (texture == nullptr) return 1;
 
-        std::unique_ptr<FileData> fileData = converter.fileAnalysis(texture->path);
-        if (fileData == nullptr) return 1;
+        hr = CreateTexture(converter, *texture);
+        if (FAILED(hr)) return hr;
+    }
 
-        PixelFlipper flipper;
-        flipper.getFlipTypeToTLBR(PixelStorageOrder::bottomLeftToTopRight); // FileDataはBLTRなのでTLBRに変換
-        std::unique_ptr<u8[]> srcPixels = std::make_unique<u8[]>(fileData->width * fileData->height * 4);
-        flipper.insertPixelsFlippedRGBA(srcPixels, 0, fileData->pixels, fileData->width, fileData->height);
+    return hr;
+}
 
-        hr = CreateTextureBuffer
-        (
-            texture->texture, texture->view, 
-            DirectX::XMUINT2(fileData->width, fileData->height), srcPixels
-        );
+HRESULT CreateTexture(Converter &converter, TextureData &texture)
+{
+    HRESULT hr = S_OK;
+
+    // DDSの配列テクスチャ、キューブマップは全てのスライスを1つのリソースにする
+    if (texture.path.size() > 4 && texture.path.substr(texture.path.size() - 4) == ".dds")
+    {
+        hr = CreateDdsTextureArray(texture);
         if (FAILED(hr)) return hr;
+        if (hr == S_OK) return hr;
     }
 
+    std::unique_ptr<FileData> fileData = converter.fileAnalysis(texture.path);
+    if (fileData == nullptr) return 1;
+
+    PixelFlipper flipper;
+    flipper.getFlipTypeToTLBR(PixelStorageOrder::bottomLeftToTopRight); // FileDataはBLTRなのでTLBRに変換
+    std::unique_ptr<u8[]> srcPixels = std::make_unique<u8[]>(fileData->width * fileData->height * 4);
+    flipper.insertPixelsFlippedRGBA(srcPixels, 0, fileData->pixels, fileData->width, fileData->height);
+
+    // 再読み込み時は作成に成功してから差し替える
+    ComPtr<ID3D11Texture2D> newTexture;
+    ComPtr<ID3D11ShaderResourceView> newView;
+    hr = CreateTextureBuffer
+    (
+        newTexture, newView, 
+        DirectX::XMUINT2(fileData->width, fileData->height), srcPixels
+    );
+    if (FAILED(hr)) return hr;
+
+    texture.texture = newTexture;
+    texture.view = newView;
+    texture.arrayTexture = nullptr;
+    texture.arrayView = nullptr;
+    texture.arraySize = 1;
+    texture.isCubeMap = false;
+
     return hr;
 }
 
@@ -13,6 +13,7 @@
 #include "type.h"
 
 class Converter;
+struct TextureData;
 class TextureContainer;
 
 class VisualObject;
@@ -126,6 +127,9 @@ Microsoft::WRL::ComPtr<ID3D11Buffer> CreateVertexBuffer(Vertex* vertices, u32 ve
 Microsoft::WRL::ComPtr<ID3D11Buffer> CreateIndexBuffer(u32* indices, u32 indexSize);
 
 HRESULT CreateTextures(Converter& converter, TextureContainer& container);
+
+// 画像ファイルを読み込み、textureのリソースを作成する。既にある場合は作り直す
+HRESULT CreateTexture(Converter& converter, TextureData& texture);
 HRESULT CreateTextureBuffer
 (
     Microsoft::WRL::ComPtr<ID3D11Texture2D>& texture,
@@ -133,6 +137,14 @@ HRESULT CreateTextureBuffer
     DirectX::XMUINT2 clientSize, std::unique_ptr<u8[]>& pixels
 );
 
+// 左上から右下に並んだRGBAのスライスらを、1つの配列テクスチャまたはキューブマップとして作成する
+HRESULT CreateTextureArrayBuffer
+(
+    Microsoft::WRL::ComPtr<ID3D11Texture2D>& texture,
+    Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>& view,
+    DirectX::XMUINT2 clientSize, u32 arraySize, bool isCubeMap, std::unique_ptr<u8[]>& pixels
+);
+
 HRESULT CreateObjects(ObjectContainer& container);
 std::unique_ptr<VisualObject> CreateFullScreenTriangle();
 
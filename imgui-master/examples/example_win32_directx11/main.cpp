@@ -27,6 +27,7 @@
 #include "format_bmp.h"
 #include "format_tga.h"
 #include "format_dds.h"
+#include "change_feed.h"
 
 #include <wrl/client.h>
 using Microsoft::WRL::ComPtr;
@@ -233,6 +234,9 @@ int main(int argc, char* argv[])
     hr = CreateTextures(converter, textureContainer);
     if (FAILED(hr)) return 1;
 
+    // image_format_converterの/watch /feedで書き出される変更通知を読み、変換された画像を再読み込みする
+    ChangeFeedReader changeFeed("images/change_feed.txt");
+
     /*************************************************************************************************************** */
     // Create Object
     /*************************************************************************************************************** */
@@ -324,6 +328,18 @@ int main(int argc, char* argv[])
         }
         gSwapChainOccluded = false;
 
+        // Reload textures converted by the watcher
+        for (const ChangeEvent& event : changeFeed.poll())
+        {
+            if (event.result != SUCCESS) continue;
+
+            TextureData* texture = textureContainer.findTexture(event.exportPath);
+            if (texture == nullptr) continue;
+
+            hr = CreateTexture(converter, *texture);
+            if (FAILED(hr)) std::cout << "テクスチャを再読み込みできませんでした。" << texture->path << std::endl;
+        }
+
         // Handle window resize (we don't resize directly in the WM_SIZE handler)
         if (gResizeWidth != 0 && gResizeHeight != 0)
         {
@@ -1,5 +1,7 @@
 ﻿#include "texture.h"
 
+#include <filesystem>
+
 using Microsoft::WRL::ComPtr;
 
 u32 TextureContainer::addTexture(std::string path)
@@ -20,4 +22,16 @@ TextureData* TextureContainer::getTexture(u32 id)
 {
     if (id >= textures_.size()) return nullptr;
     return textures_[id].get();
+}
+
+TextureData* TextureContainer::findTexture(std::string_view path)
+{
+    std::error_code error;
+    for (const std::unique_ptr<TextureData>& texture : textures_)
+    {
+        if (texture->path == path) return texture.get();
+        if (std::filesystem::equivalent(texture->path, path, error)) return texture.get();
+    }
+
+    return nullptr;
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <memory>
 
 #include "type.h"
@@ -13,7 +14,14 @@ struct TextureData
 {
     std::string path = "";
     Microsoft::WRL::ComPtr<ID3D11Texture2D> texture = nullptr;
-    Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> view = nullptr;
+    Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> view = nullptr; // Texture2Dとして読むビュー。配列テクスチャの場合は先頭のスライス
+
+    // 配列テクスチャ、キューブマップの全てのスライスを持つリソースと、Texture2DArray、TextureCubeとして読むビュー。
+    // スライスが1枚の場合はnullptr
+    Microsoft::WRL::ComPtr<ID3D11Texture2D> arrayTexture = nullptr;
+    Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> arrayView = nullptr;
+    u32 arraySize = 1; // 配列テクスチャの要素数。キューブマップは面の数
+    bool isCubeMap = false;
 };
 
 class TextureContainer
@@ -31,5 +39,8 @@ public:
     u32 addTexture(std::string path);
     TextureData* getTexture(u32 id);
 
+    // pathと同じファイルを指すテクスチャを探す。見つからない場合はnullptrを返す
+    TextureData* findTexture(std::string_view path);
+
     u32 getContainerSize() { return textures_.size(); }
 };
\ No newline at end of file